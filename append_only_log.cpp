@@ -0,0 +1,794 @@
+#include "append_only_log.h"
+#include "atomic_file.h"
+#include "command_parser.h"
+#include "datastore.h"
+#include "input_buffer.h"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace {
+
+/**
+ * Sequence number of the last record queued by this thread
+ */
+thread_local uint64_t lastThreadSequence = 0;
+
+/**
+ * Stop collecting a batch once it reaches this size, so one write() never
+ * grows without bound while producers keep queueing
+ */
+constexpr size_t MAX_BATCH_BYTES = 4 * 1024 * 1024;
+
+/**
+ * How long the writer waits before retrying a failed write or fsync
+ */
+constexpr auto RETRY_INTERVAL = std::chrono::milliseconds(100);
+
+/**
+ * Apply one logged command to the store
+ * @return true if the command was a known mutation, false otherwise
+ */
+bool applyCommand(DataStore& store, const Command& command) {
+    CommandArgs args(command);
+    std::string_view key;
+    std::string_view value;
+    std::string_view option;
+    std::string_view amount;
+    switch (command.type) {
+        case CommandType::Set: {
+            if (!args.next(key) || !args.next(value)) return false;
+            // Expiry times are logged as PXAT, absolute, so a key whose time
+            // passed while the server was down is deleted again here
+            int64_t expiresAt = 0;
+            while (args.next(option)) {
+                if (!args.next(amount) ||
+                    !protocol::parseExpiry(option, amount, DataStore::unixTimeMillis(), expiresAt)) {
+                    return false;
+                }
+            }
+            store.set(key, value, expiresAt);
+            return true;
+        }
+        case CommandType::PExpireAt: {
+            long long expiresAt = 0;
+            if (!args.next(key) || !args.next(amount) || !protocol::parseInteger(amount, expiresAt)) return false;
+            store.expireAt(key, expiresAt);
+            return true;
+        }
+        case CommandType::Persist:
+            if (!args.next(key)) return false;
+            store.persist(key);
+            return true;
+        case CommandType::Delete:
+        case CommandType::MDel: {
+            std::vector<std::string_view> keys;
+            while (args.next(key)) {
+                keys.push_back(key);
+            }
+            store.mdel(keys);
+            return true;
+        }
+        case CommandType::MSet: {
+            std::vector<std::pair<std::string_view, std::string_view>> entries;
+            while (args.next(key) && args.next(value)) {
+                entries.emplace_back(key, value);
+            }
+            store.mset(entries);
+            return true;
+        }
+        case CommandType::HSet: {
+            std::vector<std::pair<std::string_view, std::string_view>> fields;
+            if (!args.next(key)) return false;
+            while (args.next(option) && args.next(value)) {
+                fields.emplace_back(option, value);
+            }
+            size_t added = 0;
+            return store.hset(key, fields, added) != TypedStatus::Failed;
+        }
+        case CommandType::HDel:
+        case CommandType::LPush:
+        case CommandType::RPush:
+        case CommandType::ZRem: {
+            std::vector<std::string_view> items;
+            if (!args.next(key)) return false;
+            while (args.next(value)) {
+                items.push_back(value);
+            }
+            size_t count = 0;
+            TypedStatus status;
+            if (command.type == CommandType::HDel) {
+                status = store.hdel(key, items, count);
+            } else if (command.type == CommandType::ZRem) {
+                status = store.zrem(key, items, count);
+            } else {
+                status = store.push(key, command.type == CommandType::LPush, items, count);
+            }
+            return status != TypedStatus::Failed;
+        }
+        case CommandType::LPop:
+        case CommandType::RPop: {
+            long long count = 0;
+            if (!args.next(key) || !args.next(amount) || !protocol::parseInteger(amount, count) || count < 0) {
+                return false;
+            }
+            std::vector<Value> popped;
+            return store.pop(key, command.type == CommandType::LPop, static_cast<size_t>(count), popped) !=
+                   TypedStatus::Failed;
+        }
+        case CommandType::ZAdd: {
+            std::vector<std::pair<double, std::string_view>> members;
+            if (!args.next(key)) return false;
+            while (args.next(amount) && args.next(value)) {
+                double score = 0;
+                if (!protocol::parseDouble(amount, score)) return false;
+                members.emplace_back(score, value);
+            }
+            size_t added = 0;
+            return store.zadd(key, members, added) != TypedStatus::Failed;
+        }
+        case CommandType::Append: {
+            // Only in logs written before APPEND was logged as a SET
+            if (!args.next(key) || !args.next(value)) return false;
+            size_t length = 0;
+            return store.append(key, value, length) != TypedStatus::Failed;
+        }
+        default:
+            return false;
+    }
+}
+
+// Name of the record a snapshot leaves in the log, see checkpointRecord()
+const char* const CHECKPOINT = "CHECKPOINT";
+
+bool isCheckpoint(const Command& command) {
+    return command.type == CommandType::Unknown && protocol::equalsIgnoreCase(command.name, CHECKPOINT);
+}
+
+/**
+ * Parse the records of a log file from its current position, calling
+ * visit(command, end) for each with the file offset just past it
+ * @param offset The file offset reading starts at
+ * @return The offset past the last complete, well-formed record
+ */
+template <typename Visit>
+uint64_t readRecords(std::ifstream& file, uint64_t offset, Visit visit) {
+    InputBuffer input;
+    CommandParser parser;
+    Command command;
+    bool corrupt = false;
+    while (!corrupt) {
+        char* space = input.prepare();
+        file.read(space, static_cast<std::streamsize>(input.writable()));
+        size_t received = static_cast<size_t>(file.gcount());
+        input.commit(received);
+
+        while (!input.empty()) {
+            // Only RESP arrays are ever written; anything else is damage
+            if (input.view().front() != '*') {
+                corrupt = true;
+                break;
+            }
+            size_t before = input.size();
+            CommandParser::Status status = parser.next(input, command);
+            if (status == CommandParser::Status::Incomplete) break;
+            if (status == CommandParser::Status::Error) {
+                corrupt = true;
+                break;
+            }
+            offset += before - input.size();
+            visit(command, offset);
+        }
+        if (received == 0) break;
+    }
+    return offset;
+}
+
+} // namespace
+
+AppendOnlyLog::AppendOnlyLog(const std::string& filename, FsyncPolicy policy)
+    : filename_(filename), policy_(policy), fd_(-1), running_(false), head_(&stub_),
+      tail_(&stub_), nextSequence_(0), writerSleeping_(false), durableSequence_(0), syncedSequence_(0),
+      syncRequested_(0), failing_(false), records_(0),
+      bytes_(0), writes_(0), fsyncs_(0), fsyncMicros_(0), fsyncMaxMicros_(0),
+      maxBatchRecords_(0), writtenSequence_(0), pendingCheckpoint_(0),
+      fileSize_(0), checkpointSequence_(0), checkpointOffset_(0) {
+}
+
+AppendOnlyLog::~AppendOnlyLog() {
+    close();
+    // Records queued after the writer stopped were never written
+    while (Record* record = pop()) {
+        delete record;
+    }
+}
+
+void AppendOnlyLog::push(Record* record) {
+    record->next.store(nullptr, std::memory_order_relaxed);
+    Record* previous = head_.exchange(record, std::memory_order_acq_rel);
+    previous->next.store(record, std::memory_order_release);
+}
+
+AppendOnlyLog::Record* AppendOnlyLog::pop() {
+    Record* tail = tail_;
+    Record* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+        if (next == nullptr) return nullptr;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    // tail is the last record unless a producer is halfway through push()
+    if (tail != head_.load(std::memory_order_acquire)) return nullptr;
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void AppendOnlyLog::append(std::string&& bytes) {
+    if (!running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    Record* record = new Record();
+    record->bytes = std::move(bytes);
+    record->sequence = nextSequence_.fetch_add(1) + 1;
+    lastThreadSequence = record->sequence;
+    push(record);
+
+    // The writer only sleeps when it has caught up; under load this branch
+    // is never taken and appending stays lock-free
+    if (writerSleeping_.load()) {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        wakeCondition_.notify_one();
+    }
+}
+
+void AppendOnlyLog::appendCheckpoint(uint64_t sequence) {
+    if (!running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    Record* record = new Record();
+    record->bytes = checkpointRecord(sequence);
+    record->checkpoint = sequence;
+    record->sequence = nextSequence_.fetch_add(1) + 1;
+    lastThreadSequence = record->sequence;
+    push(record);
+    if (writerSleeping_.load()) {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        wakeCondition_.notify_one();
+    }
+}
+
+bool AppendOnlyLog::waitForThreadRecords() {
+    uint64_t target = std::min(lastThreadSequence, nextSequence_.load());
+    if (target == 0 || durableSequence_.load(std::memory_order_acquire) >= target) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(durableMutex_);
+    durableCondition_.wait(lock, [this, target]() {
+        return durableSequence_.load(std::memory_order_acquire) >= target || failing_.load() || !running_;
+    });
+    return durableSequence_.load(std::memory_order_acquire) >= target;
+}
+
+bool AppendOnlyLog::syncThreadRecords() {
+    uint64_t target = std::min(lastThreadSequence, nextSequence_.load());
+    if (target == 0 || syncedSequence_.load(std::memory_order_acquire) >= target) {
+        return true;
+    }
+    if (failing_.load()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        if (syncRequested_.load() < target) {
+            syncRequested_.store(target);
+        }
+    }
+    wakeCondition_.notify_one();
+    std::unique_lock<std::mutex> lock(durableMutex_);
+    durableCondition_.wait(lock, [this, target]() {
+        return syncedSequence_.load(std::memory_order_acquire) >= target || failing_.load() || !running_;
+    });
+    return syncedSequence_.load(std::memory_order_acquire) >= target;
+}
+
+bool AppendOnlyLog::openFile() {
+#ifdef _WIN32
+    fd_ = _open(filename_.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd_ = ::open(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    if (fd_ < 0) {
+        std::cerr << "Failed to open append-only log: " << filename_ << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool AppendOnlyLog::open() {
+    if (running_) {
+        return true;
+    }
+    if (!openFile()) {
+        return false;
+    }
+    std::error_code error;
+    fileSize_ = std::filesystem::file_size(filename_, error);
+    if (error) {
+        std::cerr << "Failed to open append-only log: " << filename_ << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    running_ = true;
+    writerThread_ = std::thread(&AppendOnlyLog::writerLoop, this);
+    std::cout << "Append-only log " << filename_ << " opened (fsync " << policyName(policy_) << ")"
+              << std::endl;
+    if (pendingCheckpoint_ != 0) {
+        // A new log next to an existing snapshot: mark where it starts
+        appendCheckpoint(pendingCheckpoint_);
+        pendingCheckpoint_ = 0;
+        return syncThreadRecords();
+    }
+    return true;
+}
+
+void AppendOnlyLog::close() {
+    if (!writerThread_.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        running_ = false;
+    }
+    wakeCondition_.notify_one();
+    writerThread_.join();
+
+    bool synced = sync();
+    if (!synced) {
+        std::cerr << "Failed to fsync append-only log: " << filename_ << std::endl;
+    }
+#ifdef _WIN32
+    _close(fd_);
+#else
+    ::close(fd_);
+#endif
+    fd_ = -1;
+
+    // Release anyone still waiting for a commit
+    {
+        std::lock_guard<std::mutex> lock(durableMutex_);
+        if (synced || policy_ == FsyncPolicy::Never) {
+            durableSequence_.store(writtenSequence_.load());
+        }
+        if (synced) {
+            syncedSequence_.store(writtenSequence_.load());
+        }
+    }
+    durableCondition_.notify_all();
+}
+
+void AppendOnlyLog::writerLoop() {
+    using Clock = std::chrono::steady_clock;
+    std::string batch;
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> outOfOrder;
+    uint64_t taken = 0;  // Every sequence up to this one is in the batch or written
+    uint64_t popped = 0;
+    uint64_t count = 0;
+    uint64_t checkpoint = 0;
+    size_t checkpointAt = 0;   // Offset of the CHECKPOINT record in the batch
+    bool dirty = false;        // Written but not fsynced
+    bool writeFailed = false;  // The batch still has to be written
+    bool syncFailed = false;
+    Clock::time_point lastSync = Clock::now();
+
+    while (true) {
+        // A batch that failed is retried as it is, ahead of anything newer
+        if (!writeFailed) {
+            batch.clear();
+            count = 0;
+            checkpoint = 0;
+            while (batch.size() < MAX_BATCH_BYTES) {
+                Record* record = pop();
+                if (record == nullptr) break;
+                if (record->checkpoint != 0) {
+                    checkpoint = record->checkpoint;
+                    checkpointAt = batch.size();
+                }
+                batch += record->bytes;
+                // Producers can be preempted between taking a sequence number
+                // and queueing, so sequences may arrive slightly out of order
+                if (record->sequence == taken + 1 && outOfOrder.empty()) {
+                    taken = record->sequence;
+                } else {
+                    outOfOrder.push(record->sequence);
+                    while (!outOfOrder.empty() && outOfOrder.top() == taken + 1) {
+                        taken = outOfOrder.top();
+                        outOfOrder.pop();
+                    }
+                }
+                delete record;
+                ++count;
+            }
+            popped += count;
+        }
+
+        std::unique_lock<std::mutex> fileLock(fileMutex_);
+        bool wrote = false;
+        if (count > 0) {
+            // A failed write may have left part of the batch in the file; it
+            // is cut off so no record ever follows a torn one
+            if (!writeFailed || ((fd_ >= 0 || openFile()) && truncateFile())) {
+                wrote = writeAll(batch);
+            }
+            if (wrote) {
+                if (checkpoint != 0) {
+                    checkpointSequence_ = checkpoint;
+                    checkpointOffset_ = fileSize_ + checkpointAt;
+                }
+                fileSize_ += batch.size();
+                records_.fetch_add(count, std::memory_order_relaxed);
+                bytes_.fetch_add(batch.size(), std::memory_order_relaxed);
+                writes_.fetch_add(1, std::memory_order_relaxed);
+                if (count > maxBatchRecords_.load(std::memory_order_relaxed)) {
+                    maxBatchRecords_.store(count, std::memory_order_relaxed);
+                }
+                writtenSequence_.store(taken, std::memory_order_release);
+                dirty = true;
+            } else if (!writeFailed) {
+                std::cerr << "Failed to write append-only log: " << filename_ << "; retrying" << std::endl;
+            }
+            writeFailed = !wrote;
+        }
+        uint64_t written = writtenSequence_.load(std::memory_order_relaxed);
+
+        // syncThreadRecords() asks for an fsync under any policy
+        bool requested = syncRequested_.load(std::memory_order_acquire) >
+                         syncedSequence_.load(std::memory_order_relaxed);
+        bool syncNow = dirty && (policy_ == FsyncPolicy::Always || requested || syncFailed ||
+                                 (policy_ == FsyncPolicy::EverySecond &&
+                                  Clock::now() - lastSync >= std::chrono::seconds(1)));
+        bool synced = false;
+        if (syncNow) {
+            synced = sync();
+            if (!synced && !syncFailed) {
+                std::cerr << "Failed to fsync append-only log: " << filename_ << "; retrying" << std::endl;
+            }
+            lastSync = Clock::now();
+            dirty = !synced;
+            syncFailed = !synced;
+        }
+
+        // Only what was written (and fsynced, where the policy asks for it)
+        // is published; waiters give up while a failure is being retried
+        bool publish = synced || (wrote && policy_ == FsyncPolicy::Never);
+        bool failing = writeFailed || syncFailed;
+        if ((publish && (durableSequence_.load(std::memory_order_relaxed) != written || synced)) ||
+            failing != failing_.load(std::memory_order_relaxed)) {
+            if (!failing && failing_.load(std::memory_order_relaxed)) {
+                std::cerr << "Append-only log " << filename_ << " is being written again" << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(durableMutex_);
+                if (publish) {
+                    durableSequence_.store(written, std::memory_order_release);
+                }
+                if (synced) {
+                    syncedSequence_.store(written, std::memory_order_release);
+                }
+                failing_.store(failing);
+            }
+            durableCondition_.notify_all();
+        }
+        fileLock.unlock();
+
+        if (failing) {
+            if (!running_) {
+                std::cerr << "Append-only log " << filename_ << " is missing the last "
+                          << (nextSequence_.load() - written) << " records, which could not be written"
+                          << std::endl;
+                break;
+            }
+            std::this_thread::sleep_for(RETRY_INTERVAL);
+            continue;
+        }
+        if (count > 0) {
+            continue;
+        }
+        if (popped < nextSequence_.load()) {
+            // A producer is in the middle of queueing; it will be done shortly
+            std::this_thread::yield();
+            continue;
+        }
+        if (!running_) {
+            break;
+        }
+
+        // Caught up: sleep until a producer queues a record, or until the
+        // next once-per-second fsync is due
+        auto timeout = std::chrono::milliseconds(100);
+        if (dirty && policy_ == FsyncPolicy::EverySecond) {
+            auto due = std::chrono::duration_cast<std::chrono::milliseconds>(
+                lastSync + std::chrono::seconds(1) - Clock::now());
+            timeout = std::max(std::chrono::milliseconds(1), std::min(timeout, due));
+        }
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        writerSleeping_.store(true);
+        if (running_ && popped == nextSequence_.load() &&
+            !(dirty && syncRequested_.load() > syncedSequence_.load())) {
+            wakeCondition_.wait_for(lock, timeout);
+        }
+        writerSleeping_.store(false);
+    }
+}
+
+bool AppendOnlyLog::writeAll(const std::string& bytes) {
+    size_t done = 0;
+    while (done < bytes.size()) {
+#ifdef _WIN32
+        int result = _write(fd_, bytes.data() + done, static_cast<unsigned>(bytes.size() - done));
+#else
+        ssize_t result = ::write(fd_, bytes.data() + done, bytes.size() - done);
+#endif
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+bool AppendOnlyLog::truncateFile() {
+#ifdef _WIN32
+    return _chsize_s(fd_, static_cast<__int64>(fileSize_)) == 0;
+#else
+    return ftruncate(fd_, static_cast<off_t>(fileSize_)) == 0;
+#endif
+}
+
+bool AppendOnlyLog::sync() {
+    if (fd_ < 0) {
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+#ifdef _WIN32
+    int result = _commit(fd_);
+#elif defined(__linux__)
+    int result = fdatasync(fd_);
+#else
+    int result = fsync(fd_);
+#endif
+    uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    fsyncs_.fetch_add(1, std::memory_order_relaxed);
+    fsyncMicros_.fetch_add(micros, std::memory_order_relaxed);
+    if (micros > fsyncMaxMicros_.load(std::memory_order_relaxed)) {
+        fsyncMaxMicros_.store(micros, std::memory_order_relaxed);
+    }
+    if (result != 0) {
+        return false;
+    }
+    return true;
+}
+
+bool AppendOnlyLog::compact(uint64_t sequence) {
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    if (fd_ < 0 || checkpointSequence_ != sequence) {
+        return false;
+    }
+    if (checkpointOffset_ == 0) {
+        return true;
+    }
+
+    // Copy the checkpoint and the records after it; nothing is appended
+    // while the lock is held, so fileSize_ is where the last whole record ends
+    std::ifstream input(filename_, std::ios::binary);
+    AtomicFileWriter output(filename_);
+    if (!input.is_open() || !output.open()) {
+        std::cerr << "Failed to rewrite append-only log: " << filename_ << std::endl;
+        return false;
+    }
+    input.seekg(static_cast<std::streamoff>(checkpointOffset_));
+    uint64_t remaining = fileSize_ - checkpointOffset_;
+    std::string buffer(std::min<uint64_t>(remaining, AtomicFileWriter::BUFFER_SIZE), '\0');
+    while (remaining > 0 && input) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+        input.read(buffer.data(), static_cast<std::streamsize>(chunk));
+        size_t received = static_cast<size_t>(input.gcount());
+        output.write(std::string_view(buffer.data(), received));
+        remaining -= received;
+    }
+    input.close();
+    if (remaining > 0) {
+        std::cerr << "Failed to read append-only log: " << filename_ << std::endl;
+        return false;
+    }
+
+    // Windows can't rename over an open file, so close it first either way
+#ifdef _WIN32
+    _close(fd_);
+#else
+    ::close(fd_);
+#endif
+    fd_ = -1;
+    bool committed = output.commit();
+    if (committed) {
+        fileSize_ -= checkpointOffset_;
+        checkpointOffset_ = 0;
+    } else {
+        std::cerr << "Failed to rewrite append-only log: " << filename_ << std::endl;
+    }
+    // If this fails the writer thread retries, as for any failed write
+    return openFile() && committed;
+}
+
+bool AppendOnlyLog::replay(DataStore& store, uint64_t checkpoint, size_t& applied) {
+    applied = 0;
+    std::ifstream file(filename_, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "No existing append-only log found: " << filename_ << std::endl;
+        pendingCheckpoint_ = checkpoint;
+        return true;
+    }
+
+    uint64_t start = 0;
+    uint64_t validBytes = 0;
+    size_t skipped = 0;
+    try {
+        if (checkpoint != 0) {
+            // A save that failed or found nothing to write may have left
+            // an earlier record with the same sequence; the last one counts
+            std::string sequence = std::to_string(checkpoint);
+            uint64_t valid = readRecords(file, 0, [&](const Command& command, uint64_t end) {
+                if (isCheckpoint(command) && command.argc == 1 && command.argv[0] == sequence) {
+                    start = end;
+                }
+            });
+            if (start == 0 && valid > 0) {
+                std::cerr << "Append-only log " << filename_ << " has no checkpoint " << checkpoint
+                          << " for the loaded snapshot; refusing to replay it from the start. Move the log"
+                          << " aside to start from the snapshot alone" << std::endl;
+                return false;
+            }
+            if (valid == 0) {
+                pendingCheckpoint_ = checkpoint;
+            }
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(start));
+            if (start != 0) {
+                std::cout << "Replaying " << filename_ << " from checkpoint " << checkpoint << " at byte " << start
+                          << std::endl;
+            }
+        }
+        validBytes = readRecords(file, start, [&](const Command& command, uint64_t) {
+            if (isCheckpoint(command)) {
+                return;
+            }
+            if (applyCommand(store, command)) {
+                ++applied;
+            } else {
+                ++skipped;
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "Error replaying append-only log: " << e.what() << std::endl;
+        return false;
+    }
+    file.close();
+
+    if (skipped > 0) {
+        std::cerr << "Skipped " << skipped << " unknown commands in " << filename_ << std::endl;
+    }
+    std::error_code error;
+    uint64_t fileSize = std::filesystem::file_size(filename_, error);
+    if (!error && fileSize > validBytes) {
+        // A torn write at the end: keep everything up to the last whole record
+        std::cerr << "Append-only log " << filename_ << " ends with " << (fileSize - validBytes)
+                  << " bytes of incomplete or damaged data; truncating" << std::endl;
+        std::filesystem::resize_file(filename_, validBytes, error);
+        if (error) {
+            std::cerr << "Failed to truncate " << filename_ << ": " << error.message() << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << "Replayed " << applied << " commands from " << filename_ << std::endl;
+    return true;
+}
+
+std::string AppendOnlyLog::checkpointRecord(uint64_t sequence) {
+    return encode({CHECKPOINT, std::to_string(sequence)});
+}
+
+void AppendOnlyLog::beginCommand(std::string& out, size_t argc) {
+    char digits[24];
+    char* end = std::to_chars(digits, digits + sizeof(digits), argc).ptr;
+    out += '*';
+    out.append(digits, static_cast<size_t>(end - digits));
+    out += "\r\n";
+}
+
+void AppendOnlyLog::addArgument(std::string& out, std::string_view argument) {
+    char digits[24];
+    char* end = std::to_chars(digits, digits + sizeof(digits), argument.size()).ptr;
+    out += '$';
+    out.append(digits, static_cast<size_t>(end - digits));
+    out += "\r\n";
+    out.append(argument.data(), argument.size());
+    out += "\r\n";
+}
+
+std::string AppendOnlyLog::encode(std::initializer_list<std::string_view> arguments) {
+    size_t size = 16;
+    for (std::string_view argument : arguments) {
+        size += argument.size() + 16;
+    }
+    std::string out;
+    out.reserve(size);
+    beginCommand(out, arguments.size());
+    for (std::string_view argument : arguments) {
+        addArgument(out, argument);
+    }
+    return out;
+}
+
+bool AppendOnlyLog::parsePolicy(const std::string& name, FsyncPolicy& policy) {
+    if (name == "always") {
+        policy = FsyncPolicy::Always;
+    } else if (name == "everysec") {
+        policy = FsyncPolicy::EverySecond;
+    } else if (name == "no") {
+        policy = FsyncPolicy::Never;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* AppendOnlyLog::policyName(FsyncPolicy policy) {
+    switch (policy) {
+        case FsyncPolicy::Always: return "always";
+        case FsyncPolicy::EverySecond: return "everysec";
+        case FsyncPolicy::Never: return "no";
+    }
+    return "unknown";
+}
+
+AppendLogStats AppendOnlyLog::stats() const {
+    AppendLogStats stats;
+    stats.records = records_.load(std::memory_order_relaxed);
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    stats.writes = writes_.load(std::memory_order_relaxed);
+    stats.fsyncs = fsyncs_.load(std::memory_order_relaxed);
+    stats.fsyncMicros = fsyncMicros_.load(std::memory_order_relaxed);
+    stats.fsyncMaxMicros = fsyncMaxMicros_.load(std::memory_order_relaxed);
+    stats.maxBatchRecords = maxBatchRecords_.load(std::memory_order_relaxed);
+    uint64_t queued = nextSequence_.load(std::memory_order_relaxed);
+    stats.pendingRecords = queued > stats.records ? queued - stats.records : 0;
+    return stats;
+}
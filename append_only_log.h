@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class DataStore;
+
+/**
+ * When the append-only log forces its writes to stable storage
+ */
+enum class FsyncPolicy {
+    Always,       // fsync every group commit; writers wait for it before replying
+    EverySecond,  // fsync at most once per second in the background
+    Never         // leave flushing to the operating system
+};
+
+/**
+ * Counters describing the log's group commits
+ */
+struct AppendLogStats {
+    uint64_t records = 0;          // Records written to the file
+    uint64_t bytes = 0;            // Bytes written to the file
+    uint64_t writes = 0;           // write() batches (group commits)
+    uint64_t fsyncs = 0;           // fsync calls
+    uint64_t fsyncMicros = 0;      // Total time spent in fsync
+    uint64_t fsyncMaxMicros = 0;   // Slowest fsync
+    uint64_t maxBatchRecords = 0;  // Largest number of records in one batch
+    uint64_t pendingRecords = 0;   // Records queued but not yet written
+};
+
+/**
+ * Write-ahead log of every mutation applied to the data store
+ * Mutations are recorded as RESP2 commands (SET, DEL, MSET, and
+ * PEXPIREAT or PERSIST for expiry times, which are always absolute, and the
+ * hash, list and sorted set commands), the encoding clients use, so the log
+ * is replayed with the server's own command parser. Each snapshot also
+ * leaves a CHECKPOINT record at the point it was taken, see
+ * checkpointRecord(). Writers only push an encoded record onto a lock-free
+ * multi-producer queue; a background thread drains the queue, writes each
+ * batch with one write() and fsyncs according to the policy, so records
+ * from many connections share one group commit
+ */
+class AppendOnlyLog {
+private:
+    struct Record {
+        std::atomic<Record*> next{nullptr};
+        uint64_t sequence = 0;
+        uint64_t checkpoint = 0;  // Sequence of a CHECKPOINT record, 0 for others
+        std::string bytes;
+    };
+
+    std::string filename_;
+    FsyncPolicy policy_;
+    int fd_;
+    std::atomic<bool> running_;
+    std::thread writerThread_;
+
+    // Intrusive MPSC queue (Vyukov): producers swap themselves into head_,
+    // the writer thread consumes from tail_
+    std::atomic<Record*> head_;
+    Record* tail_;
+    Record stub_;
+    std::atomic<uint64_t> nextSequence_;
+
+    // Writer sleep/wake; producers only touch the mutex when the writer sleeps
+    std::mutex wakeMutex_;
+    std::condition_variable wakeCondition_;
+    std::atomic<bool> writerSleeping_;
+
+    // Highest sequence such that it and every earlier record are durable
+    std::mutex durableMutex_;
+    std::condition_variable durableCondition_;
+    std::atomic<uint64_t> durableSequence_;
+    std::atomic<uint64_t> syncedSequence_;  // The same, but fsynced whatever the policy
+    std::atomic<uint64_t> syncRequested_;   // Sequence syncThreadRecords() wants fsynced
+    std::atomic<bool> failing_;             // A write or fsync failed and is being retried
+
+    // Written by the writer thread only, read by stats()
+    std::atomic<uint64_t> records_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> writes_;
+    std::atomic<uint64_t> fsyncs_;
+    std::atomic<uint64_t> fsyncMicros_;
+    std::atomic<uint64_t> fsyncMaxMicros_;
+    std::atomic<uint64_t> maxBatchRecords_;
+    std::atomic<uint64_t> writtenSequence_;
+
+    // Checkpoint replay() found no log for; open() starts the log with it
+    uint64_t pendingCheckpoint_;
+
+    // Held by the writer thread around writes and fsyncs, and by compact()
+    // while it replaces the file
+    std::mutex fileMutex_;
+    uint64_t fileSize_;
+    uint64_t checkpointSequence_;  // Last CHECKPOINT record written
+    uint64_t checkpointOffset_;    // File offset it starts at
+
+    void push(Record* record);
+    Record* pop();
+
+    /**
+     * Background thread: drain the queue, write batches and fsync
+     */
+    void writerLoop();
+
+    /**
+     * Write a whole buffer to the file, retrying short writes
+     * @return true if successful, false otherwise
+     */
+    bool writeAll(const std::string& bytes);
+
+    /**
+     * Cut the file back to fileSize_, dropping what a failed write left
+     * @return true if successful, false otherwise
+     */
+    bool truncateFile();
+
+    /**
+     * Flush the file to stable storage and account for the time taken
+     * @return true if successful, false otherwise
+     */
+    bool sync();
+
+    /**
+     * Open fd_ for appending
+     * @return true if successful, false otherwise
+     */
+    bool openFile();
+
+public:
+    /**
+     * Constructor
+     * @param filename Path of the log file
+     * @param policy When to fsync
+     */
+    AppendOnlyLog(const std::string& filename, FsyncPolicy policy);
+
+    /**
+     * Destructor - drains and closes the log
+     */
+    ~AppendOnlyLog();
+
+    AppendOnlyLog(const AppendOnlyLog&) = delete;
+    AppendOnlyLog& operator=(const AppendOnlyLog&) = delete;
+
+    /**
+     * Apply the complete commands in the log file to a data store: those
+     * after the last CHECKPOINT record of the loaded snapshot, or all of
+     * them if there is none
+     * A torn record at the end of the file (a crash in the middle of a
+     * write) is reported and cut off so new records follow valid ones.
+     * A log with records but without the checkpoint does not belong to the
+     * snapshot; replaying all of it would apply commands twice, so it is
+     * refused. An empty log gets the checkpoint as its first record
+     * @param store The store to load into; must not have this log attached
+     * @param checkpoint Sequence of the snapshot or delta the store was
+     *        loaded up to, 0 if it is unknown
+     * @param applied Receives the number of commands applied
+     * @return true if successful (including when the file does not exist),
+     *         false on a read error or a log without the checkpoint
+     */
+    bool replay(DataStore& store, uint64_t checkpoint, size_t& applied);
+
+    /**
+     * Open the file for appending and start the writer thread
+     * @return true if successful, false otherwise
+     */
+    bool open();
+
+    /**
+     * Write and fsync everything queued, then stop the writer thread
+     */
+    void close();
+
+    /**
+     * Queue an encoded record; never blocks and never touches the disk
+     * @param bytes A complete RESP2 command, see encode()
+     */
+    void append(std::string&& bytes);
+
+    /**
+     * Queue a CHECKPOINT record, see checkpointRecord()
+     * The writer remembers where the last one lands in the file, for compact()
+     * @param sequence The snapshot's or delta's checkpoint sequence
+     */
+    void appendCheckpoint(uint64_t sequence);
+
+    /**
+     * Drop everything before a checkpoint from the file
+     * Called once a full snapshot with that checkpoint is committed and its
+     * record is durable: the records before it are all in the snapshot, so
+     * the file is rewritten to start at the record, and only holds what was
+     * logged since the last full snapshot. The writer thread waits while
+     * the remaining records are copied; producers do not
+     * @param sequence The committed snapshot's checkpoint sequence
+     * @return true if the file now starts at the checkpoint
+     */
+    bool compact(uint64_t sequence);
+
+    /**
+     * Wait until every record queued by the calling thread is durable
+     * Only meaningful with FsyncPolicy::Always, where replies must not be
+     * sent before the mutations they acknowledge are on disk
+     * @return false if the records are not durable because writing or
+     *         fsyncing the log is failing, or the log was closed
+     */
+    bool waitForThreadRecords();
+
+    /**
+     * Write and fsync every record queued by the calling thread, whatever
+     * the policy. A snapshot calls this for its CHECKPOINT record before
+     * it is committed, so that no snapshot on disk names a checkpoint the
+     * log could have lost in a crash. Returns at once while the log is
+     * failing
+     * @return true if the records are on stable storage
+     */
+    bool syncThreadRecords();
+
+    /**
+     * Start a RESP2 command with argc elements
+     */
+    static void beginCommand(std::string& out, size_t argc);
+
+    /**
+     * Add one bulk string element to a command
+     */
+    static void addArgument(std::string& out, std::string_view argument);
+
+    /**
+     * Encode a whole command, e.g. encode({"SET", key, value})
+     */
+    static std::string encode(std::initializer_list<std::string_view> arguments);
+
+    /**
+     * Encode the record a snapshot leaves in the log while it holds every
+     * shard lock: every record before it is in the snapshot and none after
+     * it, so replay() can start there. Lists need this, as pushes and pops
+     * replayed on a snapshot that already has them would apply twice
+     * @param sequence The snapshot's or delta's checkpoint sequence
+     */
+    static std::string checkpointRecord(uint64_t sequence);
+
+    /**
+     * Parse a policy name: "always", "everysec" or "no"
+     * @return true if the name was valid, false otherwise
+     */
+    static bool parsePolicy(const std::string& name, FsyncPolicy& policy);
+
+    /**
+     * Get the name of a policy as accepted by parsePolicy()
+     */
+    static const char* policyName(FsyncPolicy policy);
+
+    FsyncPolicy policy() const { return policy_; }
+
+    const std::string& filename() const { return filename_; }
+
+    /**
+     * Get a snapshot of the group commit counters
+     */
+    AppendLogStats stats() const;
+};
@@ -0,0 +1,179 @@
+#include "atomic_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace {
+
+uint64_t microsSince(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+} // namespace
+
+AtomicFileWriter::AtomicFileWriter(const std::string& filename)
+    : filename_(filename), tempFilename_(filename + ".tmp"), fd_(-1),
+      bytesWritten_(0), syncMicros_(0), failed_(false) {
+}
+
+AtomicFileWriter::~AtomicFileWriter() {
+    discard();
+}
+
+bool AtomicFileWriter::open() {
+    discard();
+#ifdef _WIN32
+    fd_ = _open(tempFilename_.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd_ = ::open(tempFilename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    if (fd_ < 0) {
+        std::cerr << "Failed to open file for writing: " << tempFilename_ << std::endl;
+        return false;
+    }
+    buffer_.clear();
+    buffer_.reserve(BUFFER_SIZE);
+    bytesWritten_ = 0;
+    syncMicros_ = 0;
+    failed_ = false;
+    return true;
+}
+
+bool AtomicFileWriter::writeAll(const char* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+#ifdef _WIN32
+        int result = _write(fd_, data + done, static_cast<unsigned>(std::min<size_t>(size - done, 1u << 30)));
+#else
+        ssize_t result = ::write(fd_, data + done, size - done);
+#endif
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += static_cast<size_t>(result);
+    }
+    bytesWritten_ += size;
+    return true;
+}
+
+bool AtomicFileWriter::flush() {
+    if (buffer_.empty()) {
+        return true;
+    }
+    bool ok = writeAll(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    return ok;
+}
+
+void AtomicFileWriter::write(std::string_view data) {
+    if (failed_ || fd_ < 0) {
+        failed_ = true;
+        return;
+    }
+    if (buffer_.size() + data.size() > BUFFER_SIZE && !flush()) {
+        failed_ = true;
+        return;
+    }
+    if (data.size() >= BUFFER_SIZE) {
+        failed_ = !writeAll(data.data(), data.size());
+    } else {
+        buffer_.append(data.data(), data.size());
+    }
+}
+
+bool AtomicFileWriter::commit() {
+    if (fd_ < 0) {
+        return false;
+    }
+    if (failed_ || !flush()) {
+        std::cerr << "Failed to write " << tempFilename_ << std::endl;
+        discard();
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+#ifdef _WIN32
+    int result = _commit(fd_);
+#else
+    int result = fsync(fd_);
+#endif
+    syncMicros_ += microsSince(start);
+    closeFile();
+    if (result != 0) {
+        std::cerr << "Failed to fsync " << tempFilename_ << std::endl;
+        std::remove(tempFilename_.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    bool renamed = MoveFileExA(tempFilename_.c_str(), filename_.c_str(),
+                               MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool renamed = std::rename(tempFilename_.c_str(), filename_.c_str()) == 0;
+#endif
+    if (!renamed) {
+        std::cerr << "Failed to replace " << filename_ << " with " << tempFilename_ << std::endl;
+        std::remove(tempFilename_.c_str());
+        return false;
+    }
+
+    // Without this the rename may still be lost on power failure, leaving
+    // the old file in place even though the new one was reported saved
+    start = std::chrono::steady_clock::now();
+    bool synced = syncParentDirectory(filename_);
+    syncMicros_ += microsSince(start);
+    if (!synced) {
+        std::cerr << "Failed to fsync the directory of " << filename_ << std::endl;
+    }
+    return synced;
+}
+
+void AtomicFileWriter::closeFile() {
+    if (fd_ >= 0) {
+#ifdef _WIN32
+        _close(fd_);
+#else
+        ::close(fd_);
+#endif
+        fd_ = -1;
+    }
+}
+
+void AtomicFileWriter::discard() {
+    if (fd_ >= 0) {
+        closeFile();
+        std::remove(tempFilename_.c_str());
+    }
+    buffer_.clear();
+}
+
+bool AtomicFileWriter::syncParentDirectory(const std::string& path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    std::string directory = parent.empty() ? "." : parent.string();
+    int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    int result = fsync(fd);
+    ::close(fd);
+    return result == 0;
+#endif
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Writes a file so that it is either fully replaced or left untouched
+ * Data goes to "<filename>.tmp" through a large user-space buffer, so the
+ * kernel sees a few multi-megabyte write() calls instead of one per record.
+ * commit() then fsyncs the temporary file, renames it over the target and
+ * fsyncs the directory, so after a crash or power loss the target holds
+ * either the old contents or the complete new ones. A writer destroyed
+ * without commit() removes its temporary file
+ */
+class AtomicFileWriter {
+private:
+    std::string filename_;
+    std::string tempFilename_;
+    int fd_;
+    std::string buffer_;
+    uint64_t bytesWritten_;
+    uint64_t syncMicros_;
+    bool failed_;
+
+    /**
+     * Write a range to the file, retrying short writes
+     * @return true if successful, false otherwise
+     */
+    bool writeAll(const char* data, size_t size);
+
+    /**
+     * Write out the buffer
+     * @return true if successful, false otherwise
+     */
+    bool flush();
+
+    void closeFile();
+
+public:
+    /**
+     * Size of the write buffer; writes at least this large bypass it
+     */
+    static constexpr size_t BUFFER_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * Constructor
+     * @param filename Path of the file to replace
+     */
+    explicit AtomicFileWriter(const std::string& filename);
+
+    /**
+     * Destructor - discards the temporary file unless committed
+     */
+    ~AtomicFileWriter();
+
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    /**
+     * Create (or truncate) the temporary file
+     * @return true if successful, false otherwise
+     */
+    bool open();
+
+    /**
+     * Append bytes; errors are reported by commit()
+     * @param data The bytes to write
+     */
+    void write(std::string_view data);
+
+    /**
+     * Flush, fsync and close the temporary file, rename it over the
+     * target and fsync the directory
+     * @return true if the target now holds the new contents
+     */
+    bool commit();
+
+    /**
+     * Close and remove the temporary file without touching the target
+     */
+    void discard();
+
+    /**
+     * Get the number of bytes written so far, buffered ones included
+     */
+    uint64_t size() const { return bytesWritten_ + buffer_.size(); }
+
+    /**
+     * Get the time commit() spent in fsync, file and directory together
+     */
+    uint64_t syncMicros() const { return syncMicros_; }
+
+    const std::string& tempFilename() const { return tempFilename_; }
+
+    /**
+     * Flush a directory entry change (create, rename) to stable storage
+     * A no-op on Windows, where MoveFileEx() writes through instead
+     * @param path Path of a file in the directory
+     * @return true if successful, false otherwise
+     */
+    static bool syncParentDirectory(const std::string& path);
+};
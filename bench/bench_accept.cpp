@@ -0,0 +1,125 @@
+/**
+ * Connection storm benchmark
+ *
+ * Many client threads open short-lived connections as fast as they can. Each
+ * connection is timed from connect() until the reply to its first command
+ * arrives, which includes waiting in the accept queue and being picked up by
+ * the server. Reports accept latency percentiles for the original
+ * configuration (thread per connection, backlog 10), a reactor with a single
+ * accept thread, and reactors with their own SO_REUSEPORT listeners. Usage:
+ *   bench_accept [--clients 16] [--connections 200] [--io-threads 4]
+ *                [--backlog 511] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+struct StormResult {
+    std::vector<double> latenciesMs;
+    long failures = 0;
+    double seconds = 0;
+};
+
+StormResult runStorm(const ServerConfig& config, int port, int clients, int connectionsPerClient) {
+    StormResult result;
+    bench::EmbeddedServer server(port, config);
+    if (!server.start()) {
+        result.failures = static_cast<long>(clients) * connectionsPerClient;
+        return result;
+    }
+    server.store().set("k", "v");
+
+    std::mutex resultMutex;
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < clients; ++t) {
+        threads.emplace_back([&]() {
+            std::vector<double> local;
+            long failures = 0;
+            std::string reply;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < connectionsPerClient; ++i) {
+                double start = bench::nowSeconds();
+                bench::Client client;
+                if (!client.connect("127.0.0.1", port) || !client.command("GET k", reply)) {
+                    ++failures;
+                    continue;
+                }
+                local.push_back((bench::nowSeconds() - start) * 1e3);
+            }
+            std::lock_guard<std::mutex> lock(resultMutex);
+            result.latenciesMs.insert(result.latenciesMs.end(), local.begin(), local.end());
+            result.failures += failures;
+        });
+    }
+
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result.seconds = bench::nowSeconds() - start;
+    server.stop();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_accept [--clients 16] [--connections 200] [--io-threads 4]"
+            << " [--backlog 511] [--port P]" << std::endl;
+        return 0;
+    }
+
+    int clients = static_cast<int>(args.getInt("clients", 16));
+    int connections = static_cast<int>(args.getInt("connections", 200));
+    int ioThreads = static_cast<int>(args.getInt("io-threads", 4));
+    int backlog = static_cast<int>(args.getInt("backlog", 511));
+    int port = static_cast<int>(args.getInt("port", 7482));
+
+    ServerConfig original;
+    original.ioModel = IoModel::Threads;
+    original.backlog = 10;
+
+    ServerConfig singleAcceptor;
+    singleAcceptor.ioModel = IoModel::Reactor;
+    singleAcceptor.ioThreads = ioThreads;
+    singleAcceptor.backlog = backlog;
+
+    ServerConfig reusePort = singleAcceptor;
+    reusePort.reusePort = true;
+
+    const std::pair<const char*, ServerConfig> scenarios[] = {
+        {"threads/backlog=10", original},
+        {"reactor/1 acceptor", singleAcceptor},
+        {"reactor/reuseport", reusePort},
+    };
+
+    out << "Connection storm: " << clients << " clients x " << connections
+        << " connections, connect-to-first-reply latency in ms" << std::endl;
+    out << std::left << std::setw(22) << "scenario" << std::setw(10) << "conn/s" << std::setw(9)
+        << "p50" << std::setw(9) << "p90" << std::setw(9) << "p99" << std::setw(9) << "p99.9"
+        << std::setw(10) << "max" << "failed" << std::endl;
+
+    int run = 0;
+    for (const auto& scenario : scenarios) {
+        StormResult result = runStorm(scenario.second, port + run++, clients, connections);
+        auto& samples = result.latenciesMs;
+        out << std::left << std::setw(22) << scenario.first << std::fixed << std::setprecision(0)
+            << std::setw(10) << (result.seconds > 0 ? samples.size() / result.seconds : 0)
+            << std::setprecision(2) << std::setw(9) << bench::percentile(samples, 50) << std::setw(9)
+            << bench::percentile(samples, 90) << std::setw(9) << bench::percentile(samples, 99)
+            << std::setw(9) << bench::percentile(samples, 99.9) << std::setw(10)
+            << bench::percentile(samples, 100) << result.failures << std::endl;
+    }
+    return 0;
+}
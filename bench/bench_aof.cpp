@@ -0,0 +1,155 @@
+/**
+ * Append-only log benchmark
+ *
+ * Runs an embedded server once without a log and once per fsync policy.
+ * C clients each send SET round trips for a while; every reply is timed,
+ * so with the "always" policy the latency includes waiting for the group
+ * commit that made the write durable. Reports throughput, write latency
+ * percentiles and how many records each write()/fsync covered.
+ * Usage:
+ *   bench_aof [--clients 1,16] [--seconds 2] [--value-size 64]
+ *             [--policies none,no,everysec,always] [--io-model reactor|threads]
+ *             [--file bench_aof.aof] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "append_only_log.h"
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct RunResult {
+    double opsPerSecond = 0;
+    std::vector<double> latenciesUs;
+    AppendLogStats stats;
+    bool ok = true;
+};
+
+RunResult runClients(int port, int clients, double seconds, const std::string& value) {
+    RunResult result;
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::mutex samplesMutex;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c]() {
+            bench::Client client;
+            if (!client.connect("127.0.0.1", port)) {
+                failed = true;
+                return;
+            }
+            std::vector<double> samples;
+            std::string reply;
+            long i = 0;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::string command = "SET c" + std::to_string(c) + ":" + std::to_string(i++ % 10000) + " " + value;
+                double start = bench::nowSeconds();
+                if (!client.command(command, reply) || reply != "+OK") {
+                    failed = true;
+                    break;
+                }
+                samples.push_back((bench::nowSeconds() - start) * 1e6);
+            }
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            result.latenciesUs.insert(result.latenciesUs.end(), samples.begin(), samples.end());
+        });
+    }
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result.opsPerSecond = result.latenciesUs.size() / (bench::nowSeconds() - start);
+    result.ok = !failed;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_aof [--clients 1,16] [--seconds 2] [--value-size 64]"
+            << " [--policies none,no,everysec,always] [--io-model reactor|threads]"
+            << " [--file bench_aof.aof] [--port P]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> clientCounts = args.getIntList("clients", {1, 16});
+    double seconds = static_cast<double>(args.getInt("seconds", 2));
+    std::string value(static_cast<size_t>(args.getInt("value-size", 64)), 'v');
+    std::string policyList = args.getString("policies", "none,no,everysec,always");
+    std::string file = args.getString("file", "bench_aof.aof");
+    int port = static_cast<int>(args.getInt("port", 7485));
+    ServerConfig config;
+    config.ioModel = args.getString("io-model", "reactor") == "threads" ? IoModel::Threads : IoModel::Reactor;
+
+    std::vector<std::string> policies;
+    for (size_t start = 0; start <= policyList.size();) {
+        size_t end = policyList.find(',', start);
+        if (end == std::string::npos) end = policyList.size();
+        if (end > start) policies.push_back(policyList.substr(start, end - start));
+        start = end + 1;
+    }
+
+    out << "SET round trips with " << value.size() << "-byte values, log file " << file << std::endl;
+    out << std::left << std::setw(10) << "policy" << std::setw(9) << "clients" << std::setw(11) << "ops/s"
+        << std::setw(9) << "p50 us" << std::setw(9) << "p99 us" << std::setw(10) << "p99.9 us"
+        << std::setw(10) << "max us" << std::setw(9) << "fsyncs" << std::setw(12) << "recs/write"
+        << std::setw(12) << "recs/fsync" << "fsync us" << std::endl;
+
+    for (const std::string& name : policies) {
+        FsyncPolicy policy = FsyncPolicy::Never;
+        bool logged = name != "none";
+        if (logged && !AppendOnlyLog::parsePolicy(name, policy)) {
+            std::cerr << "Unknown policy: " << name << std::endl;
+            return 1;
+        }
+        for (long clients : clientCounts) {
+            std::remove(file.c_str());
+            bench::EmbeddedServer server(port, config);
+            if (logged) {
+                server.persistence().enableAppendOnly(file, policy);
+                server.persistence().initialize();
+            }
+            if (!server.start()) {
+                std::cerr << "Failed to start the embedded server" << std::endl;
+                return 1;
+            }
+            RunResult result = runClients(port, static_cast<int>(clients), seconds, value);
+            server.stop();
+            if (logged) {
+                server.persistence().stopPersistence();
+                result.stats = server.persistence().appendLog()->stats();
+            }
+            if (!result.ok) {
+                std::cerr << "Client error with policy " << name << std::endl;
+                return 1;
+            }
+
+            const AppendLogStats& stats = result.stats;
+            out << std::left << std::setw(10) << name << std::setw(9) << clients << std::fixed
+                << std::setprecision(0) << std::setw(11) << result.opsPerSecond << std::setprecision(1)
+                << std::setw(9) << bench::percentile(result.latenciesUs, 50) << std::setw(9)
+                << bench::percentile(result.latenciesUs, 99) << std::setw(10)
+                << bench::percentile(result.latenciesUs, 99.9) << std::setw(10)
+                << bench::percentile(result.latenciesUs, 100) << std::setw(9) << stats.fsyncs
+                << std::setw(12) << (stats.writes ? static_cast<double>(stats.records) / stats.writes : 0.0)
+                << std::setw(12) << (stats.fsyncs ? static_cast<double>(stats.records) / stats.fsyncs : 0.0)
+                << (stats.fsyncs ? static_cast<double>(stats.fsyncMicros) / stats.fsyncs : 0.0) << std::endl;
+        }
+    }
+    std::remove(file.c_str());
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * Multi-key batch benchmark
+ *
+ * Loads feature-vector style batches of B random keys and compares the
+ * batch APIs against the equivalent single-key loops:
+ *   - DataStore: mget/mset/mdel vs. get/set/del loops, with T threads
+ *   - TCP: one MGET/MSET vs. B GET/SET round trips vs. B pipelined commands
+ * Usage:
+ *   bench_batch [--batch 500] [--keys 100000] [--threads 1,4] [--seconds 1]
+ *               [--value-size 16] [--shards N] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "datastore.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <thread>
+
+namespace {
+
+// Keeps the compiler from discarding lookups whose results are unused
+std::atomic<size_t> hitSink(0);
+
+struct Workload {
+    std::vector<std::string> keys;
+    std::string value;
+    size_t batch;
+};
+
+/**
+ * Pick batch random keys with a per-thread xorshift generator
+ */
+void pickBatch(const Workload& workload, uint64_t& state, std::vector<std::string_view>& out) {
+    out.clear();
+    for (size_t i = 0; i < workload.batch; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        out.push_back(workload.keys[state % workload.keys.size()]);
+    }
+}
+
+using BatchOp = std::function<void(DataStore&, const std::vector<std::string_view>&, const std::string&)>;
+
+/**
+ * Run one operation on random batches from several threads for a while
+ * @return Batches completed per second
+ */
+double runBatches(DataStore& store, const Workload& workload, int threadCount, double seconds,
+                  const BatchOp& op) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<long> batches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+            std::vector<std::string_view> keys;
+            long done = 0;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                pickBatch(workload, state, keys);
+                op(store, keys, workload.value);
+                ++done;
+            }
+            batches.fetch_add(done);
+        });
+    }
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return batches.load() / (bench::nowSeconds() - start);
+}
+
+void reportDataStore(std::ostream& out, const Workload& workload, const std::vector<long>& threadCounts,
+                     double seconds, size_t shards) {
+    const std::pair<const char*, BatchOp> ops[] = {
+        {"get loop", [](DataStore& store, const std::vector<std::string_view>& keys, const std::string&) {
+             size_t hits = 0;
+             for (std::string_view key : keys) hits += store.get(key) ? 1 : 0;
+             hitSink.fetch_add(hits, std::memory_order_relaxed);
+         }},
+        {"mget", [](DataStore& store, const std::vector<std::string_view>& keys, const std::string&) {
+             size_t hits = 0;
+             for (const Value& value : store.mget(keys)) hits += value ? 1 : 0;
+             hitSink.fetch_add(hits, std::memory_order_relaxed);
+         }},
+        {"set loop", [](DataStore& store, const std::vector<std::string_view>& keys, const std::string& value) {
+             for (std::string_view key : keys) store.set(key, value);
+         }},
+        {"mset", [](DataStore& store, const std::vector<std::string_view>& keys, const std::string& value) {
+             std::vector<std::pair<std::string_view, std::string_view>> entries;
+             entries.reserve(keys.size());
+             for (std::string_view key : keys) entries.emplace_back(key, value);
+             store.mset(entries);
+         }},
+        {"del loop", [](DataStore& store, const std::vector<std::string_view>& keys, const std::string&) {
+             for (std::string_view key : keys) store.del(key);
+         }},
+        {"mdel", [](DataStore& store, const std::vector<std::string_view>& keys, const std::string&) {
+             store.mdel(keys);
+         }},
+    };
+
+    out << "DataStore API: batches of " << workload.batch << " random keys out of "
+        << workload.keys.size() << ", " << shards << " shards" << std::endl;
+    out << std::left << std::setw(10) << "threads" << std::setw(12) << "operation" << std::setw(14)
+        << "batches/s" << std::setw(14) << "keys/s" << "us/batch" << std::endl;
+    for (long threads : threadCounts) {
+        for (const auto& op : ops) {
+            DataStore store(shards);
+            for (const auto& key : workload.keys) {
+                store.set(key, workload.value);
+            }
+            double rate = runBatches(store, workload, static_cast<int>(threads), seconds, op.second);
+            out << std::left << std::setw(10) << threads << std::setw(12) << op.first << std::fixed
+                << std::setprecision(0) << std::setw(14) << rate << std::setw(14)
+                << rate * workload.batch << std::setprecision(1)
+                << (rate > 0 ? threads * 1e6 / rate : 0) << std::endl;
+        }
+    }
+}
+
+/**
+ * Time a client-side batch strategy over TCP
+ * @return Mean microseconds per batch, or -1 on error
+ */
+double timeTcp(bench::Client& client, const Workload& workload, double seconds,
+               const std::function<bool(bench::Client&, const std::vector<std::string_view>&)>& run) {
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    std::vector<std::string_view> keys;
+    long batches = 0;
+    double start = bench::nowSeconds();
+    double elapsed = 0;
+    while (elapsed < seconds) {
+        pickBatch(workload, state, keys);
+        if (!run(client, keys)) return -1;
+        ++batches;
+        elapsed = bench::nowSeconds() - start;
+    }
+    return elapsed * 1e6 / batches;
+}
+
+void reportTcp(std::ostream& out, const Workload& workload, double seconds, size_t shards, int port) {
+    ServerConfig config;
+    config.ioModel = IoModel::Reactor;
+    bench::EmbeddedServer server(port, config, shards);
+    bench::Client client;
+    if (!server.start() || !client.connect("127.0.0.1", port)) {
+        out << "TCP: failed to start the embedded server" << std::endl;
+        return;
+    }
+    for (const auto& key : workload.keys) {
+        server.store().set(key, workload.value);
+    }
+
+    using Strategy = std::function<bool(bench::Client&, const std::vector<std::string_view>&)>;
+    const std::string& value = workload.value;
+    const std::pair<const char*, Strategy> strategies[] = {
+        {"GET round trips", [](bench::Client& c, const std::vector<std::string_view>& keys) {
+             std::string reply;
+             for (std::string_view key : keys) {
+                 if (!c.command("GET " + std::string(key), reply)) return false;
+             }
+             return true;
+         }},
+        {"GET pipelined", [](bench::Client& c, const std::vector<std::string_view>& keys) {
+             std::string batch;
+             for (std::string_view key : keys) batch.append("GET ").append(key).append("\n");
+             std::string reply;
+             if (!c.sendAll(batch)) return false;
+             for (size_t i = 0; i < keys.size(); ++i) {
+                 if (!c.readReply(reply)) return false;
+             }
+             return true;
+         }},
+        {"MGET", [](bench::Client& c, const std::vector<std::string_view>& keys) {
+             std::string command = "MGET";
+             for (std::string_view key : keys) command.append(" ").append(key);
+             std::string header;
+             std::string reply;
+             if (!c.sendAll(command + "\n") || !c.readLine(header)) return false;
+             for (size_t i = 0; i < keys.size(); ++i) {
+                 if (!c.readReply(reply)) return false;
+             }
+             return true;
+         }},
+        {"SET pipelined", [&value](bench::Client& c, const std::vector<std::string_view>& keys) {
+             std::string batch;
+             for (std::string_view key : keys) batch.append("SET ").append(key).append(" ").append(value).append("\n");
+             std::string reply;
+             if (!c.sendAll(batch)) return false;
+             for (size_t i = 0; i < keys.size(); ++i) {
+                 if (!c.readReply(reply)) return false;
+             }
+             return true;
+         }},
+        {"MSET", [&value](bench::Client& c, const std::vector<std::string_view>& keys) {
+             std::string command = "MSET";
+             for (std::string_view key : keys) command.append(" ").append(key).append(" ").append(value);
+             std::string reply;
+             return c.command(command, reply) && reply == "+OK";
+         }},
+    };
+
+    out << std::endl << "TCP (reactor, one client): batches of " << workload.batch << " keys" << std::endl;
+    out << std::left << std::setw(18) << "strategy" << std::setw(12) << "us/batch" << "keys/s" << std::endl;
+    for (const auto& strategy : strategies) {
+        double us = timeTcp(client, workload, seconds, strategy.second);
+        out << std::left << std::setw(18) << strategy.first << std::fixed << std::setprecision(1)
+            << std::setw(12) << us << std::setprecision(0)
+            << (us > 0 ? workload.batch * 1e6 / us : 0) << std::endl;
+    }
+    server.stop();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_batch [--batch 500] [--keys 100000] [--threads 1,4] [--seconds 1]"
+            << " [--value-size 16] [--shards N] [--port P]" << std::endl;
+        return 0;
+    }
+
+    Workload workload;
+    workload.batch = static_cast<size_t>(std::max(1L, args.getInt("batch", 500)));
+    long keyCount = std::max(1L, args.getInt("keys", 100000));
+    workload.value.assign(static_cast<size_t>(args.getInt("value-size", 16)), 'v');
+    std::vector<long> threadCounts = args.getIntList("threads", {1, 4});
+    double seconds = static_cast<double>(args.getInt("seconds", 1));
+    size_t shards = static_cast<size_t>(args.getInt("shards", DataStore::DEFAULT_SHARD_COUNT));
+    int port = static_cast<int>(args.getInt("port", 7484));
+
+    for (long i = 0; i < keyCount; ++i) {
+        workload.keys.push_back("feature:" + std::to_string(i));
+    }
+
+    reportDataStore(out, workload, threadCounts, seconds, shards);
+    reportTcp(out, workload, seconds, shards, port);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * Hash, list and sorted set benchmark
+ *
+ * For each size N in --sizes, fills --keys keys with N fields (or elements,
+ * or members) each and reports:
+ *   - field update ns: mean time to change one random field of a key,
+ *     with HSET (hset()) and the way a client without hashes does it:
+ *     GET the whole value, serialized as "field=value;..." text, replace
+ *     the field and SET it back
+ *   - zadd ns: mean time to change one random member's score
+ *   - push+pop ns: mean time of one push() at the tail and one pop() at
+ *     the head, keeping the list's length
+ *   - bytes/entry: usedMemory() after filling, divided by the fields (or
+ *     elements, members) stored, for the hash, the serialized string, the
+ *     list and the sorted set
+ * Sizes up to Collection::COMPACT_MAX_ENTRIES stay in the compact listpack
+ * encoding, larger ones switch to hash tables, deques and trees, so the
+ * table shows both encodings. Usage:
+ *   bench_collections [--sizes 8,64,128,1024,10000] [--entries N] [--updates N] [--value-size N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include <algorithm>
+#include <iomanip>
+#include <random>
+
+namespace {
+
+struct Result {
+    double hsetNs;
+    double rewriteNs;
+    double zaddNs;
+    double pushPopNs;
+    double hashBytes;
+    double stringBytes;
+    double listBytes;
+    double zsetBytes;
+};
+
+std::string fieldName(size_t i) {
+    return "field:" + std::to_string(i);
+}
+
+/**
+ * Replace one field's value in a "field=value;..." string
+ */
+std::string replaceField(std::string_view blob, const std::string& field, std::string_view value) {
+    std::string result(blob);
+    std::string needle = field + "=";
+    size_t start = 0;
+    while ((start = result.find(needle, start)) != std::string::npos) {
+        if (start == 0 || result[start - 1] == ';') break;
+        ++start;
+    }
+    if (start == std::string::npos) {
+        return result + field + "=" + std::string(value) + ";";
+    }
+    start += needle.size();
+    size_t end = result.find(';', start);
+    result.replace(start, end - start, value);
+    return result;
+}
+
+Result run(size_t size, size_t keyCount, size_t updates, const std::string& value) {
+    Result result{};
+    std::mt19937_64 random(size);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < keyCount; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    double entries = static_cast<double>(keyCount * size);
+
+    DataStore hashes;
+    DataStore strings;
+    DataStore lists;
+    DataStore sets;
+    size_t added = 0;
+    for (const std::string& key : keys) {
+        std::string blob;
+        std::vector<std::string> fields;
+        std::vector<std::pair<std::string_view, std::string_view>> pairs;
+        std::vector<std::string_view> elements;
+        std::vector<std::pair<double, std::string_view>> members;
+        for (size_t i = 0; i < size; ++i) {
+            fields.push_back(fieldName(i));
+        }
+        for (size_t i = 0; i < size; ++i) {
+            pairs.emplace_back(fields[i], value);
+            elements.push_back(value);
+            members.emplace_back(static_cast<double>(random() % 1000000), fields[i]);
+            blob += fields[i] + "=" + value + ";";
+        }
+        hashes.hset(key, pairs, added);
+        lists.push(key, false, elements, added);
+        sets.zadd(key, members, added);
+        strings.set(key, blob);
+    }
+    result.hashBytes = static_cast<double>(hashes.usedMemory()) / entries;
+    result.stringBytes = static_cast<double>(strings.usedMemory()) / entries;
+    result.listBytes = static_cast<double>(lists.usedMemory()) / entries;
+    result.zsetBytes = static_cast<double>(sets.usedMemory()) / entries;
+
+    std::vector<std::pair<size_t, size_t>> targets(updates);
+    for (auto& target : targets) {
+        target = {static_cast<size_t>(random() % keyCount), static_cast<size_t>(random() % size)};
+    }
+    std::string updated = value;
+    updated.back() = 'u';
+
+    double start = bench::nowSeconds();
+    for (const auto& target : targets) {
+        std::string field = fieldName(target.second);
+        std::vector<std::pair<std::string_view, std::string_view>> pair{{field, updated}};
+        hashes.hset(keys[target.first], pair, added);
+    }
+    result.hsetNs = (bench::nowSeconds() - start) * 1e9 / static_cast<double>(updates);
+
+    start = bench::nowSeconds();
+    for (const auto& target : targets) {
+        const std::string& key = keys[target.first];
+        Value blob = strings.get(key);
+        strings.set(key, replaceField(blob.view(), fieldName(target.second), updated));
+    }
+    result.rewriteNs = (bench::nowSeconds() - start) * 1e9 / static_cast<double>(updates);
+
+    start = bench::nowSeconds();
+    for (const auto& target : targets) {
+        std::string member = fieldName(target.second);
+        std::vector<std::pair<double, std::string_view>> score{{static_cast<double>(random() % 1000000), member}};
+        sets.zadd(keys[target.first], score, added);
+    }
+    result.zaddNs = (bench::nowSeconds() - start) * 1e9 / static_cast<double>(updates);
+
+    std::vector<std::string_view> element{value};
+    std::vector<Value> popped;
+    start = bench::nowSeconds();
+    for (const auto& target : targets) {
+        const std::string& key = keys[target.first];
+        lists.push(key, false, element, added);
+        lists.pop(key, true, 1, popped);
+    }
+    result.pushPopNs = (bench::nowSeconds() - start) * 1e9 / static_cast<double>(updates);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_collections [--sizes 8,64,128,1024,10000] [--entries N] [--updates N]"
+                  << " [--value-size N]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> sizes = args.getIntList("sizes", {8, 64, 128, 1024, 10000});
+    size_t totalEntries = static_cast<size_t>(args.getInt("entries", 1000000));
+    size_t updates = static_cast<size_t>(std::max(1L, args.getInt("updates", 100000)));
+    std::string value(static_cast<size_t>(std::max(1L, args.getInt("value-size", 16))), 'v');
+
+    std::cout << "Collections: about " << totalEntries << " entries per type, " << value.size()
+              << "-byte values, " << updates << " updates" << std::endl;
+    std::cout << std::left << std::setw(8) << "size" << std::setw(9) << "keys" << std::setw(11) << "hset ns"
+              << std::setw(13) << "get+set ns" << std::setw(10) << "zadd ns" << std::setw(13) << "push+pop ns"
+              << "bytes/entry hash, string, list, zset" << std::endl;
+    for (long entrySize : sizes) {
+        size_t size = static_cast<size_t>(std::max(1L, entrySize));
+        size_t keyCount = std::max<size_t>(1, totalEntries / size);
+        Result result = run(size, keyCount, updates, value);
+        std::cout << std::setw(8) << size << std::setw(9) << keyCount << std::fixed << std::setprecision(0)
+                  << std::setw(11) << result.hsetNs << std::setw(13) << result.rewriteNs << std::setw(10)
+                  << result.zaddNs << std::setw(13) << result.pushPopNs << std::setprecision(1)
+                  << result.hashBytes << ", " << result.stringBytes << ", " << result.listBytes << ", "
+                  << result.zsetBytes << std::endl;
+    }
+    return 0;
+}
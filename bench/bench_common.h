@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Small helpers shared by the benchmark programs
+ */
+namespace bench {
+
+/**
+ * Command line options of the form --name value
+ */
+class Args {
+private:
+    std::map<std::string, std::string> values_;
+
+public:
+    Args(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) continue;
+            if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0) {
+                values_[arg.substr(2)] = argv[++i];
+            } else {
+                values_[arg.substr(2)] = "1";
+            }
+        }
+    }
+
+    bool has(const std::string& name) const {
+        return values_.count(name) > 0;
+    }
+
+    long getInt(const std::string& name, long defaultValue) const {
+        auto it = values_.find(name);
+        return it == values_.end() ? defaultValue : std::strtol(it->second.c_str(), nullptr, 10);
+    }
+
+    std::string getString(const std::string& name, const std::string& defaultValue) const {
+        auto it = values_.find(name);
+        return it == values_.end() ? defaultValue : it->second;
+    }
+
+    /**
+     * Parse a comma separated list of integers, e.g. --threads 1,2,4,8
+     */
+    std::vector<long> getIntList(const std::string& name, const std::vector<long>& defaultValue) const {
+        auto it = values_.find(name);
+        if (it == values_.end()) return defaultValue;
+        std::vector<long> result;
+        size_t start = 0;
+        const std::string& text = it->second;
+        while (start <= text.size()) {
+            size_t end = text.find(',', start);
+            if (end == std::string::npos) end = text.size();
+            if (end > start) result.push_back(std::strtol(text.substr(start, end - start).c_str(), nullptr, 10));
+            start = end + 1;
+        }
+        return result;
+    }
+};
+
+/**
+ * Monotonic wall clock in seconds
+ */
+inline double nowSeconds() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Percentile of a sample set (sorts the samples in place)
+ * @param samples The samples
+ * @param p Percentile in the range [0, 100]
+ */
+template <typename T>
+T percentile(std::vector<T>& samples, double p) {
+    if (samples.empty()) return T{};
+    std::sort(samples.begin(), samples.end());
+    size_t index = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(index, samples.size() - 1)];
+}
+
+} // namespace bench
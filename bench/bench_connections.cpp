@@ -0,0 +1,158 @@
+/**
+ * Connection scaling benchmark
+ *
+ * Holds N idle connections open against an embedded server while a few
+ * active clients run GET round trips, and reports server threads, resident
+ * memory, throughput and latency for the thread-per-connection and reactor
+ * I/O models. Usage:
+ *   bench_connections [--idle 100,1000,4000] [--active 8] [--seconds 2]
+ *                     [--io-threads 4] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "metrics.h"
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+/**
+ * Read a numeric field such as "Threads" or "VmRSS" from /proc/self/status
+ * @return The value, or 0 where /proc is not available
+ */
+long procStatus(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind(field + ":", 0) == 0) {
+            return std::strtol(line.c_str() + field.size() + 1, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Wait (bounded) until the server reports the given number of connected clients
+ */
+void waitForClients(long count) {
+    for (int attempt = 0; attempt < 5000 && metrics::connectedClients.load() < count; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+struct RunResult {
+    long threads;
+    long rssKb;
+    double opsPerSecond;
+    double p50Us;
+    double p99Us;
+};
+
+bool runScenario(IoModel model, int ioThreads, int port, long idle, int active, double seconds,
+                 RunResult& result) {
+    ServerConfig config;
+    config.ioModel = model;
+    config.ioThreads = ioThreads;
+    bench::EmbeddedServer server(port, config);
+    if (!server.start()) return false;
+    server.store().set("ping", "pong");
+
+    long baseRss = procStatus("VmRSS");
+    std::vector<bench::Client> idleClients;
+    idleClients.reserve(static_cast<size_t>(idle));
+    for (long i = 0; i < idle; ++i) {
+        bench::Client client;
+        if (!client.connect("127.0.0.1", port)) return false;
+        idleClients.push_back(std::move(client));
+        // Connect in small batches and let the server catch up, so this
+        // measures steady-state cost rather than accept backlog overflow
+        if (i % 8 == 7) {
+            waitForClients(i + 1);
+        }
+    }
+    waitForClients(idle);
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> operations(0);
+    std::mutex samplesMutex;
+    std::vector<double> latencies;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < active; ++t) {
+        workers.emplace_back([&]() {
+            bench::Client client;
+            if (!client.connect("127.0.0.1", port)) return;
+            std::vector<double> local;
+            std::string reply;
+            while (!stop.load(std::memory_order_relaxed)) {
+                double start = bench::nowSeconds();
+                if (!client.command("GET ping", reply)) break;
+                local.push_back((bench::nowSeconds() - start) * 1e6);
+            }
+            operations.fetch_add(static_cast<long>(local.size()));
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            latencies.insert(latencies.end(), local.begin(), local.end());
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    result.threads = procStatus("Threads");
+    result.rssKb = procStatus("VmRSS") - baseRss;
+    stop = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    result.opsPerSecond = operations.load() / seconds;
+    result.p50Us = bench::percentile(latencies, 50);
+    result.p99Us = bench::percentile(latencies, 99);
+
+    idleClients.clear();
+    for (int attempt = 0; attempt < 1000 && metrics::connectedClients.load() > 0; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    server.stop();
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_connections [--idle 100,1000,4000] [--active 8] [--seconds 2]"
+            << " [--io-threads 4] [--port P]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> idleCounts = args.getIntList("idle", {100, 1000, 4000});
+    int active = static_cast<int>(args.getInt("active", 8));
+    double seconds = static_cast<double>(args.getInt("seconds", 2));
+    int ioThreads = static_cast<int>(args.getInt("io-threads", 4));
+    int port = static_cast<int>(args.getInt("port", 7481));
+
+    out << "Connection scaling: " << active << " active clients doing GET round trips for "
+        << seconds << "s next to N idle connections" << std::endl;
+    out << std::left << std::setw(10) << "model" << std::setw(8) << "idle" << std::setw(10)
+        << "threads" << std::setw(12) << "rss +KB" << std::setw(12) << "ops/s" << std::setw(10)
+        << "p50 us" << "p99 us" << std::endl;
+
+    const std::pair<IoModel, const char*> models[] = {
+        {IoModel::Threads, "threads"}, {IoModel::Reactor, "reactor"}};
+    int run = 0;
+    for (long idle : idleCounts) {
+        for (const auto& model : models) {
+            RunResult result{};
+            if (!runScenario(model.first, ioThreads, port + run++, idle, active, seconds, result)) {
+                out << model.second << ": failed with " << idle << " idle connections" << std::endl;
+                continue;
+            }
+            out << std::left << std::setw(10) << model.second << std::setw(8) << idle
+                << std::setw(10) << result.threads << std::setw(12) << result.rssKb << std::fixed
+                << std::setprecision(0) << std::setw(12) << result.opsPerSecond
+                << std::setprecision(1) << std::setw(10) << result.p50Us << result.p99Us << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * Hot counter benchmark
+ *
+ * T threads (or T TCP clients) bump counters spread over K keys, few keys
+ * meaning heavy contention, in two ways:
+ *   - incr: one atomic increment executed in the store (increment(), or
+ *     INCR over TCP)
+ *   - get+set: what a client without INCR does, reading the counter,
+ *     parsing it, adding one and writing the text back (get() and set(),
+ *     or GET and SET round trips)
+ * For each it reports increments per second and lost updates: increments
+ * done minus the sum of the counters afterwards, which get+set loses when
+ * two threads read the same count before either writes it back. Usage:
+ *   bench_counters [--threads 1,4,8] [--keys 1,16,1024] [--seconds 1]
+ *                  [--clients 1,4] [--shards N] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "datastore.h"
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <iomanip>
+#include <thread>
+
+namespace {
+
+struct Result {
+    double rate;  // Increments per second
+    long lost;    // Increments the counters don't show
+};
+
+std::vector<std::string> counterKeys(size_t count) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back("counter:" + std::to_string(i));
+    }
+    return keys;
+}
+
+int64_t parseCount(std::string_view text) {
+    int64_t count = 0;
+    std::from_chars(text.data(), text.data() + text.size(), count);
+    return count;
+}
+
+/**
+ * Run op(thread, key) from several threads for a while, each thread going
+ * round the keys from its own offset
+ * @return Calls per second; the number of calls goes to total
+ */
+template <typename Op>
+double runThreads(int threadCount, size_t keyCount, double seconds, Op op, long& total) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<long> done(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            size_t next = static_cast<size_t>(t) % keyCount;
+            long count = 0;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (!op(t, next)) break;
+                next = next + 1 == keyCount ? 0 : next + 1;
+                ++count;
+            }
+            done.fetch_add(count);
+        });
+    }
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    total = done.load();
+    return total / (bench::nowSeconds() - start);
+}
+
+Result runStore(bool atomic, int threadCount, const std::vector<std::string>& keys, double seconds, size_t shards) {
+    DataStore store(shards);
+    long total = 0;
+    double rate = runThreads(threadCount, keys.size(), seconds, [&](int, size_t index) {
+        const std::string& key = keys[index];
+        if (atomic) {
+            int64_t value = 0;
+            return store.increment(key, 1, value) == TypedStatus::Ok;
+        }
+        Value current = store.get(key);
+        std::string next = std::to_string(parseCount(current.view()) + 1);
+        return store.set(key, next);
+    }, total);
+    long counted = 0;
+    for (const std::string& key : keys) {
+        counted += static_cast<long>(parseCount(store.get(key).view()));
+    }
+    return {rate, total - counted};
+}
+
+Result runTcp(bool atomic, int clientCount, const std::vector<std::string>& keys, double seconds,
+              bench::EmbeddedServer& server, int port) {
+    for (const std::string& key : keys) {
+        server.store().del(key);
+    }
+    std::vector<bench::Client> clients(static_cast<size_t>(clientCount));
+    for (auto& client : clients) {
+        if (!client.connect("127.0.0.1", port)) {
+            return {-1, 0};
+        }
+    }
+    long total = 0;
+    double rate = runThreads(clientCount, keys.size(), seconds, [&](int t, size_t index) {
+        bench::Client& client = clients[static_cast<size_t>(t)];
+        const std::string& key = keys[index];
+        std::string reply;
+        if (atomic) {
+            return client.command("INCR " + key, reply) && reply[0] == ':';
+        }
+        if (!client.command("GET " + key, reply)) return false;
+        int64_t count = reply == "$-1" ? 0 : parseCount(reply);
+        return client.command("SET " + key + " " + std::to_string(count + 1), reply) && reply == "+OK";
+    }, total);
+    long counted = 0;
+    for (const std::string& key : keys) {
+        counted += static_cast<long>(parseCount(server.store().get(key).view()));
+    }
+    return {rate, total - counted};
+}
+
+void printRow(std::ostream& out, long threads, size_t keys, const Result& atomic, const Result& split) {
+    out << std::left << std::setw(9) << threads << std::setw(8) << keys << std::fixed << std::setprecision(0)
+        << std::setw(14) << atomic.rate << std::setw(14) << split.rate << std::setw(10) << atomic.lost
+        << split.lost << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_counters [--threads 1,4,8] [--keys 1,16,1024] [--seconds 1]\n"
+            << "                      [--clients 1,4] [--shards N] [--port P]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> threadCounts = args.getIntList("threads", {1, 4, 8});
+    std::vector<long> keyCounts = args.getIntList("keys", {1, 16, 1024});
+    std::vector<long> clientCounts = args.getIntList("clients", {1, 4});
+    double seconds = static_cast<double>(args.getInt("seconds", 1));
+    size_t shards = static_cast<size_t>(args.getInt("shards", DataStore::DEFAULT_SHARD_COUNT));
+    int port = static_cast<int>(args.getInt("port", 7486));
+
+    out << "DataStore API: " << shards << " shards" << std::endl;
+    out << std::left << std::setw(9) << "threads" << std::setw(8) << "keys" << std::setw(14) << "incr/s"
+        << std::setw(14) << "get+set/s" << "lost: incr, get+set" << std::endl;
+    for (long threads : threadCounts) {
+        for (long keyCount : keyCounts) {
+            std::vector<std::string> keys = counterKeys(static_cast<size_t>(std::max(1L, keyCount)));
+            int count = static_cast<int>(std::max(1L, threads));
+            Result atomic = runStore(true, count, keys, seconds, shards);
+            Result split = runStore(false, count, keys, seconds, shards);
+            printRow(out, threads, keys.size(), atomic, split);
+        }
+    }
+
+    ServerConfig config;
+    config.ioModel = IoModel::Reactor;
+    bench::EmbeddedServer server(port, config, shards);
+    if (!server.start()) {
+        out << "TCP: failed to start the embedded server" << std::endl;
+        return 1;
+    }
+    out << std::endl << "TCP (reactor): INCR vs GET and SET round trips" << std::endl;
+    out << std::left << std::setw(9) << "clients" << std::setw(8) << "keys" << std::setw(14) << "incr/s"
+        << std::setw(14) << "get+set/s" << "lost: incr, get+set" << std::endl;
+    for (long clients : clientCounts) {
+        for (long keyCount : keyCounts) {
+            std::vector<std::string> keys = counterKeys(static_cast<size_t>(std::max(1L, keyCount)));
+            int count = static_cast<int>(std::max(1L, clients));
+            Result atomic = runTcp(true, count, keys, seconds, server, port);
+            Result split = runTcp(false, count, keys, seconds, server, port);
+            printRow(out, clients, keys.size(), atomic, split);
+        }
+    }
+    server.stop();
+    return 0;
+}
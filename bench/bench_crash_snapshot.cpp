@@ -0,0 +1,225 @@
+/**
+ * Snapshot crash-injection harness
+ *
+ * A child process fills a store with K keys whose values all carry a
+ * generation number and saves it over and over, bumping the generation
+ * before every save. The parent SIGKILLs the child at a random moment,
+ * then loads the snapshot file into a fresh store and checks that
+ *   - it loads, and holds exactly K keys,
+ *   - every value comes from the same generation (no torn save),
+ *   - that generation is the last one the child finished saving, or the
+ *     one it was saving if the kill landed after the rename.
+ * This covers process crashes at every point of a save; power loss (page
+ * cache contents lost) needs a fault-injecting block device instead.
+ * Also reports save throughput. POSIX only. Usage:
+ *   bench_crash_snapshot [--iterations 50] [--keys 200000] [--value-size 100]
+ *                        [--format binary|csv] [--file bench_crash.bdb]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "datastore.h"
+#include "metrics.h"
+#include "persistence.h"
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <new>
+#include <random>
+#include <thread>
+
+#ifndef _WIN32
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+
+/**
+ * Progress the child shares with the parent through an anonymous mapping
+ */
+struct Progress {
+    std::atomic<uint64_t> saving{0};  // Generation being saved, 0 before the first save
+    std::atomic<uint64_t> saved{0};   // Last generation whose save returned
+    std::atomic<uint64_t> savedBytes{0};
+    std::atomic<uint64_t> savedMicros{0};
+};
+
+std::string keyName(long i) {
+    return "crash:key:" + std::to_string(i);
+}
+
+std::string valueFor(uint64_t generation, long i, size_t valueSize) {
+    std::string value = "gen:" + std::to_string(generation) + ":" + std::to_string(i) + ":";
+    value.resize(std::max(value.size(), valueSize), 'v');
+    return value;
+}
+
+/**
+ * Parse the generation out of a value written by valueFor()
+ */
+uint64_t generationOf(std::string_view value) {
+    if (value.substr(0, 4) != "gen:") return 0;
+    return std::strtoull(std::string(value.substr(4, 20)).c_str(), nullptr, 10);
+}
+
+#ifndef _WIN32
+[[noreturn]] void runChild(Progress& progress, const std::string& filename, SnapshotFormat format,
+                           long keyCount, size_t valueSize, uint64_t firstGeneration) {
+    DataStore store;
+    PersistenceManager saver(store, filename);
+    saver.setSnapshotFormat(format);
+    for (uint64_t generation = firstGeneration;; ++generation) {
+        for (long i = 0; i < keyCount; ++i) {
+            store.set(keyName(i), valueFor(generation, i, valueSize));
+        }
+        progress.saving = generation;
+        if (!saver.forceSave()) {
+            _exit(2);
+        }
+        progress.savedBytes = metrics::snapshotLastBytes.load();
+        progress.savedMicros = metrics::snapshotLastMicros.load();
+        progress.saved = generation;
+    }
+}
+
+/**
+ * Load the file and check it against what the child reported
+ * @param saved Generation of the last save known to be complete, 0 if none
+ * @param saving Generation the child was saving when it was killed
+ * @param loaded Receives the generation found in the file
+ * @return An empty string if the file is valid, otherwise what is wrong
+ */
+std::string verify(const std::string& filename, long keyCount, uint64_t saved, uint64_t saving,
+                   uint64_t& loaded) {
+    DataStore store;
+    PersistenceManager loader(store, filename);
+    loaded = 0;
+    if (!loader.initialize()) {
+        return "snapshot failed to load";
+    }
+    if (store.size() == 0 && saved == 0) {
+        return "";  // Killed before the first save finished
+    }
+    if (store.size() != static_cast<size_t>(keyCount)) {
+        return "loaded " + std::to_string(store.size()) + " of " + std::to_string(keyCount) + " keys";
+    }
+    uint64_t generation = generationOf(store.get(keyName(0)).view());
+    loaded = generation;
+    for (long i = 1; i < keyCount; ++i) {
+        Value value = store.get(keyName(i));
+        if (!value || generationOf(value.view()) != generation) {
+            return "values from more than one generation";
+        }
+    }
+    // The rename may have happened just before the kill, before the child
+    // recorded the save as done
+    if (generation != saved && generation != saving) {
+        return "generation " + std::to_string(generation) + " but the last completed save was " +
+               std::to_string(saved);
+    }
+    return "";
+}
+#endif
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_crash_snapshot [--iterations 50] [--keys 200000] [--value-size 100]"
+            << " [--format binary|csv] [--file bench_crash.bdb]" << std::endl;
+        return 0;
+    }
+#ifdef _WIN32
+    out << "bench_crash_snapshot needs fork() and is not available on Windows" << std::endl;
+    return 0;
+#else
+    long iterations = std::max(1L, args.getInt("iterations", 50));
+    long keyCount = std::max(1L, args.getInt("keys", 200000));
+    size_t valueSize = static_cast<size_t>(args.getInt("value-size", 100));
+    SnapshotFormat format = args.getString("format", "binary") == "csv" ? SnapshotFormat::Csv
+                                                                       : SnapshotFormat::Binary;
+    std::string filename = args.getString("file", "bench_crash.bdb");
+    std::remove(filename.c_str());
+
+    void* shared = mmap(nullptr, sizeof(Progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        std::cerr << "mmap failed" << std::endl;
+        return 1;
+    }
+    Progress* progress = new (shared) Progress();
+
+    // Measure one save first so kills can be spread across a whole save
+    std::mt19937_64 random(12345);
+    uint64_t generation = 1;
+    double saveSeconds = 0;
+    {
+        pid_t child = fork();
+        if (child == 0) {
+            runChild(*progress, filename, format, keyCount, valueSize, generation);
+        }
+        while (progress->saved.load() < 2) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+        saveSeconds = progress->savedMicros.load() / 1e6;
+        generation = progress->saving.load() + 1;
+    }
+    uint64_t onDisk = 0;
+    std::string error = verify(filename, keyCount, progress->saved.load(), generation - 1, onDisk);
+    if (!error.empty()) {
+        out << "calibration run: " << error << std::endl;
+        return 1;
+    }
+
+    out << keyCount << " keys, " << valueSize << "-byte values, "
+        << (format == SnapshotFormat::Csv ? "csv" : "binary") << " format" << std::endl;
+    out << "save: " << std::fixed << std::setprecision(3) << saveSeconds << " s, "
+        << std::setprecision(1) << progress->savedBytes.load() / (1024.0 * 1024.0) << " MB, "
+        << progress->savedBytes.load() / (1024.0 * 1024.0) / saveSeconds << " MB/s including fsync"
+        << std::endl;
+
+    long midSave = 0;
+    long failures = 0;
+    std::uniform_real_distribution<double> delay(0.0, 3.0 * saveSeconds);
+    for (long iteration = 0; iteration < iterations; ++iteration) {
+        progress->saving = 0;
+        progress->saved = 0;
+        pid_t child = fork();
+        if (child == 0) {
+            runChild(*progress, filename, format, keyCount, valueSize, generation);
+        }
+        // Wait until the child is saving, then kill it somewhere in the save
+        while (progress->saving.load() == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(delay(random)));
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+
+        uint64_t saving = progress->saving.load();
+        uint64_t saved = progress->saved.load();
+        if (saving != saved) {
+            ++midSave;
+        }
+        // A kill before the child's first save completes leaves the
+        // previous iteration's file
+        error = verify(filename, keyCount, saved ? saved : onDisk, saving, onDisk);
+        if (!error.empty()) {
+            ++failures;
+            out << "iteration " << iteration << ": " << error << std::endl;
+        }
+        generation = saving + 1;
+    }
+
+    out << iterations << " kills, " << midSave << " during a save, " << failures << " bad snapshots"
+        << std::endl;
+    std::remove(filename.c_str());
+    std::remove((filename + ".tmp").c_str());
+    return failures == 0 ? 0 : 1;
+#endif
+}
@@ -0,0 +1,132 @@
+/**
+ * Multi-threaded DataStore throughput benchmark
+ *
+ * Compares the sharded DataStore against the original single-mutex store
+ * under a mixed SET/GET workload. Usage:
+ *   bench_datastore [--threads 1,2,4,8] [--ops N] [--keys N]
+ *                   [--write-percent P] [--shards N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+/**
+ * The pre-sharding store: one unordered_map behind one mutex
+ */
+class SingleMutexStore {
+private:
+    std::unordered_map<std::string, std::string> data_;
+    mutable std::mutex mutex_;
+
+public:
+    bool set(const std::string& key, const std::string& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        data_[key] = value;
+        return true;
+    }
+
+    std::optional<std::string> get(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = data_.find(key);
+        if (it != data_.end()) return it->second;
+        return std::nullopt;
+    }
+};
+
+// Keeps the compiler from discarding lookups whose results are unused
+std::atomic<size_t> hitSink(0);
+
+struct Workload {
+    std::vector<std::string> keys;
+    std::string value;
+    long opsPerThread;
+    int writePercent;
+};
+
+template <typename Store>
+double runThroughput(Store& store, const Workload& workload, int threadCount) {
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+            size_t hits = 0;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (long i = 0; i < workload.opsPerThread; ++i) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                const std::string& key = workload.keys[state % workload.keys.size()];
+                if (static_cast<int>((state >> 32) % 100) < workload.writePercent) {
+                    store.set(key, workload.value);
+                } else if (store.get(key)) {
+                    ++hits;
+                }
+            }
+            hitSink.fetch_add(hits, std::memory_order_relaxed);
+        });
+    }
+
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = bench::nowSeconds() - start;
+    return static_cast<double>(workload.opsPerThread) * threadCount / elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_datastore [--threads 1,2,4,8] [--ops N] [--keys N]"
+                  << " [--write-percent P] [--shards N]" << std::endl;
+        return 0;
+    }
+
+    Workload workload;
+    workload.opsPerThread = args.getInt("ops", 500000);
+    workload.writePercent = static_cast<int>(args.getInt("write-percent", 50));
+    workload.value = std::string(static_cast<size_t>(args.getInt("value-size", 32)), 'v');
+    long keyCount = args.getInt("keys", 100000);
+    for (long i = 0; i < keyCount; ++i) {
+        workload.keys.push_back("key:" + std::to_string(i));
+    }
+    size_t shards = static_cast<size_t>(args.getInt("shards", DataStore::DEFAULT_SHARD_COUNT));
+    std::vector<long> threadCounts = args.getIntList("threads", {1, 2, 4, 8, 16});
+
+    std::cout << "DataStore throughput: " << keyCount << " keys, " << workload.writePercent
+              << "% writes, " << workload.opsPerThread << " ops/thread, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    std::cout << std::left << std::setw(10) << "threads" << std::setw(20) << "single-mutex ops/s"
+              << std::setw(20) << ("sharded(" + std::to_string(shards) + ") ops/s")
+              << "speedup" << std::endl;
+
+    for (long threadCount : threadCounts) {
+        SingleMutexStore single;
+        DataStore sharded(shards);
+        for (const auto& key : workload.keys) {
+            single.set(key, workload.value);
+            sharded.set(key, workload.value);
+        }
+
+        double singleOps = runThroughput(single, workload, static_cast<int>(threadCount));
+        double shardedOps = runThroughput(sharded, workload, static_cast<int>(threadCount));
+        std::cout << std::left << std::setw(10) << threadCount << std::fixed << std::setprecision(0)
+                  << std::setw(20) << singleOps << std::setw(20) << shardedOps
+                  << std::setprecision(2) << shardedOps / singleOps << "x" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+/**
+ * Eviction policy benchmark
+ *
+ * Runs a cache workload over a Zipfian key distribution against a store
+ * whose memory limit holds only a fraction of the key space: each thread
+ * GETs a key and, on a miss, SETs it as a cache would after fetching it
+ * from the backing store. Reports the hit rate and throughput of every
+ * eviction policy. For the volatile-* policies all keys but every 20th carry
+ * an expiry time (far enough away that none expires during the run); the
+ * others can never be evicted, so writes are refused once they fill the
+ * limit. Usage:
+ *   bench_eviction [--keys N] [--ops N] [--threads N] [--zipf S] [--cache-ratio R]
+ *                  [--value-size N] [--samples N] [--shards N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include "metrics.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <thread>
+
+namespace {
+
+/**
+ * Zipfian ranks in [0, n): rank r is drawn with probability proportional
+ * to 1 / (r + 1)^s, sampled by binary search over the cumulative weights
+ */
+class ZipfDistribution {
+private:
+    std::vector<double> cumulative_;
+
+public:
+    ZipfDistribution(size_t n, double s) : cumulative_(n) {
+        double total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            total += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            cumulative_[i] = total;
+        }
+        for (double& weight : cumulative_) {
+            weight /= total;
+        }
+    }
+
+    /**
+     * @param uniform A uniform number in [0, 1)
+     */
+    size_t operator()(double uniform) const {
+        auto it = std::lower_bound(cumulative_.begin(), cumulative_.end(), uniform);
+        return it == cumulative_.end() ? cumulative_.size() - 1 : static_cast<size_t>(it - cumulative_.begin());
+    }
+};
+
+struct RunResult {
+    double opsPerSecond;
+    double hitRate;
+    uint64_t refused;
+};
+
+struct Workload {
+    const std::vector<std::string>* keys;
+    const ZipfDistribution* zipf;
+    std::string value;
+    int64_t expiryBase;  // 0 if no key expires
+    long ops;
+    int threads;
+};
+
+/**
+ * Expiry time of key i: all but every 20th key, spread over an hour from the base
+ */
+int64_t expiryOf(const Workload& workload, size_t i) {
+    if (workload.expiryBase == 0 || i % 20 == 0) return 0;
+    return workload.expiryBase + static_cast<int64_t>((i * 7919) % 3600000);
+}
+
+/**
+ * Run ops GET-or-SET operations per thread; only the second half counts
+ */
+RunResult runCache(DataStore& store, const Workload& workload) {
+    std::atomic<uint64_t> hits(0);
+    std::atomic<uint64_t> lookups(0);
+    std::atomic<uint64_t> refused(0);
+    std::atomic<int> warm(0);
+    std::atomic<bool> measuring(false);
+    double measureStart = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < workload.threads; ++t) {
+        threads.emplace_back([&, t]() {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+            uint64_t localHits = 0;
+            uint64_t localLookups = 0;
+            uint64_t localRefused = 0;
+            for (long i = 0; i < workload.ops; ++i) {
+                if (i == workload.ops / 2) {
+                    // Wait for every thread to warm up before measuring
+                    if (warm.fetch_add(1) + 1 == workload.threads) {
+                        measureStart = bench::nowSeconds();
+                        measuring.store(true, std::memory_order_release);
+                    }
+                    while (!measuring.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
+                    localHits = localLookups = localRefused = 0;
+                }
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                size_t index = (*workload.zipf)(static_cast<double>(state >> 11) * 0x1.0p-53);
+                const std::string& key = (*workload.keys)[index];
+                ++localLookups;
+                if (store.get(key)) {
+                    ++localHits;
+                } else if (store.freeMemoryIfNeeded()) {
+                    store.set(key, workload.value, expiryOf(workload, index));
+                } else {
+                    ++localRefused;
+                }
+            }
+            hits.fetch_add(localHits);
+            lookups.fetch_add(localLookups);
+            refused.fetch_add(localRefused);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = bench::nowSeconds() - measureStart;
+    RunResult result;
+    result.opsPerSecond = static_cast<double>(lookups.load()) / elapsed;
+    result.hitRate = lookups.load() ? static_cast<double>(hits.load()) / lookups.load() : 0.0;
+    result.refused = refused.load();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_eviction [--keys N] [--ops N] [--threads N] [--zipf S] [--cache-ratio R]\n"
+                  << "                      [--value-size N] [--samples N] [--shards N]" << std::endl;
+        return 0;
+    }
+
+    size_t keyCount = static_cast<size_t>(args.getInt("keys", 200000));
+    long ops = args.getInt("ops", 2000000);
+    int threadCount = static_cast<int>(args.getInt("threads", 4));
+    double skew = std::stod(args.getString("zipf", "0.99"));
+    double cacheRatio = std::stod(args.getString("cache-ratio", "0.1"));
+    size_t samples = static_cast<size_t>(args.getInt("samples", static_cast<long>(DataStore::DEFAULT_EVICTION_SAMPLES)));
+    size_t shards = static_cast<size_t>(args.getInt("shards", static_cast<long>(DataStore::DEFAULT_SHARD_COUNT)));
+    std::string value(static_cast<size_t>(args.getInt("value-size", 100)), 'v');
+
+    std::vector<std::string> keys;
+    keys.reserve(keyCount);
+    for (size_t i = 0; i < keyCount; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    ZipfDistribution zipf(keyCount, skew);
+
+    // Size the limit from the memory the whole key space takes
+    size_t fullBytes = 0;
+    {
+        DataStore full(shards);
+        for (const auto& key : keys) {
+            full.set(key, value);
+        }
+        fullBytes = full.usedMemory();
+    }
+    size_t limit = static_cast<size_t>(static_cast<double>(fullBytes) * cacheRatio);
+
+    std::cout << "Eviction: " << keyCount << " keys, Zipf s=" << skew << ", " << value.size()
+              << "-byte values, limit " << limit / 1024 << " KiB (" << cacheRatio * 100
+              << "% of " << fullBytes / 1024 << " KiB), " << threadCount << " threads x " << ops
+              << " ops, " << samples << " samples" << std::endl;
+    std::cout << std::left << std::setw(18) << "policy" << std::setw(12) << "hit rate" << std::setw(14)
+              << "ops/s" << std::setw(12) << "evicted" << std::setw(14) << "used KiB" << "refused" << std::endl;
+
+    struct Row {
+        const char* name;
+        EvictionPolicy policy;
+        size_t limit;
+        bool expiring;
+    };
+    const Row rows[] = {
+        {"unlimited", EvictionPolicy::NoEviction, 0, false},
+        {"allkeys-lru", EvictionPolicy::AllKeysLru, limit, false},
+        {"allkeys-lfu", EvictionPolicy::AllKeysLfu, limit, false},
+        {"allkeys-random", EvictionPolicy::AllKeysRandom, limit, false},
+        {"volatile-lru", EvictionPolicy::VolatileLru, limit, true},
+        {"volatile-lfu", EvictionPolicy::VolatileLfu, limit, true},
+        {"volatile-random", EvictionPolicy::VolatileRandom, limit, true},
+        {"volatile-ttl", EvictionPolicy::VolatileTtl, limit, true},
+    };
+
+    for (const Row& row : rows) {
+        DataStore store(shards);
+        store.setMemoryLimit(row.limit, row.policy, samples);
+        Workload workload{&keys, &zipf, value, row.expiring ? DataStore::unixTimeMillis() + 3600000 : 0,
+                          ops, threadCount};
+        uint64_t evictedBefore = metrics::evictedKeys.load();
+        RunResult result = runCache(store, workload);
+        std::cout << std::left << std::setw(18) << row.name << std::fixed << std::setprecision(2)
+                  << std::setw(12) << (std::to_string(result.hitRate * 100).substr(0, 5) + "%")
+                  << std::setprecision(0) << std::setw(14) << result.opsPerSecond << std::setw(12)
+                  << (metrics::evictedKeys.load() - evictedBefore) << std::setw(14) << store.usedMemory() / 1024
+                  << result.refused << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * Shard map benchmark
+ *
+ * Fills a std::unordered_map<std::string, StoredValue>, the map DataStore
+ * used to keep a shard in, and the FlatHashMap it uses now with the same
+ * keys and values, then reports for each:
+ *   - bytes per key: everything the map and its entries allocate (the
+ *     growth of the heap in use as glibc's mallinfo2() reports it, 0
+ *     elsewhere), divided by the key count
+ *   - lookup ns: mean time of a find() for keys present (hit) and absent
+ *     (miss), in random order
+ * The flat table doubles at 7/8 full, so its bytes per key depend on where
+ * the key count falls between two sizes; the load column shows the fill.
+ * Values are Values in both maps, so short ones are kept inline either way.
+ * Usage:
+ *   bench_flat_map [--keys 400000,1000000] [--key-sizes 8,16,32] [--value-size N] [--lookups N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <unordered_map>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+/**
+ * Bytes of heap in use, chunk overhead and mapped chunks included
+ */
+size_t heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+struct Result {
+    double load;  // Entries per slot or bucket
+    double bytesPerKey;
+    double hitNs;
+    double missNs;
+};
+
+/**
+ * Key i padded with a fixed prefix to the given length (at least its digits)
+ */
+std::string makeKey(const char* prefix, size_t i, size_t length) {
+    std::string digits = std::to_string(i);
+    std::string key(prefix);
+    if (key.size() + digits.size() < length) {
+        key.append(length - key.size() - digits.size(), 'x');
+    }
+    return key + digits;
+}
+
+size_t slotsOf(const std::unordered_map<std::string, StoredValue>& map) { return map.bucket_count(); }
+size_t slotsOf(const KeyValueMap& map) { return map.capacity(); }
+
+/**
+ * Finish moving entries out of an old table, so it isn't counted
+ */
+void settle(std::unordered_map<std::string, StoredValue>&) {}
+void settle(KeyValueMap& map) { map.rehashStep(std::numeric_limits<size_t>::max()); }
+
+template <typename Map, typename Find>
+Result measure(const std::vector<std::string>& keys, const std::vector<std::string>& missing,
+               const std::vector<size_t>& order, const std::string& value, Find find) {
+    Result result;
+    size_t before = heapInUse();
+    Map map;
+    for (const std::string& key : keys) {
+        map.emplace(key, StoredValue(Value::copyOf(value), 0));
+    }
+    settle(map);
+    result.bytesPerKey = static_cast<double>(heapInUse() - before) / static_cast<double>(keys.size());
+    result.load = static_cast<double>(map.size()) / static_cast<double>(slotsOf(map));
+
+    size_t found = 0;
+    double start = bench::nowSeconds();
+    for (size_t index : order) {
+        found += find(map, keys[index]);
+    }
+    result.hitNs = (bench::nowSeconds() - start) * 1e9 / static_cast<double>(order.size());
+    start = bench::nowSeconds();
+    for (size_t index : order) {
+        found += find(map, missing[index]);
+    }
+    result.missNs = (bench::nowSeconds() - start) * 1e9 / static_cast<double>(order.size());
+    if (found != order.size()) {
+        std::cerr << "Lookup mismatch: found " << found << " of " << order.size() << std::endl;
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_flat_map [--keys 400000,1000000] [--key-sizes 8,16,32] [--value-size N]\n"
+                  << "                      [--lookups N]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> keyCounts = args.getIntList("keys", {400000, 1000000});
+    size_t lookups = static_cast<size_t>(args.getInt("lookups", 2000000));
+    std::vector<long> keySizes = args.getIntList("key-sizes", {8, 16, 32});
+    std::string value(static_cast<size_t>(args.getInt("value-size", 8)), 'v');
+
+    std::cout << "Shard map: " << value.size() << "-byte values, " << lookups << " lookups" << std::endl;
+    std::cout << std::left << std::setw(10) << "keys" << std::setw(10) << "key size" << std::setw(16) << "map"
+              << std::setw(8) << "load" << std::setw(12) << "bytes/key" << std::setw(10) << "hit ns"
+              << "miss ns" << std::endl;
+
+    for (long count : keyCounts) {
+        size_t keyCount = static_cast<size_t>(count);
+        std::vector<size_t> order(lookups);
+        std::mt19937_64 random(42);
+        for (size_t& index : order) {
+            index = static_cast<size_t>(random() % keyCount);
+        }
+        for (long keySize : keySizes) {
+            std::vector<std::string> keys;
+            std::vector<std::string> missing;
+            keys.reserve(keyCount);
+            missing.reserve(keyCount);
+            for (size_t i = 0; i < keyCount; ++i) {
+                keys.push_back(makeKey("key:", i, static_cast<size_t>(keySize)));
+                missing.push_back(makeKey("nokey:", i, static_cast<size_t>(keySize)));
+            }
+
+            Result chained = measure<std::unordered_map<std::string, StoredValue>>(
+                keys, missing, order, value,
+                [](const std::unordered_map<std::string, StoredValue>& map, const std::string& key) {
+                    return map.count(key);
+                });
+            Result flat = measure<KeyValueMap>(keys, missing, order, value,
+                [](const KeyValueMap& map, const std::string& key) { return map.count(key); });
+
+            const std::pair<const char*, Result> rows[] = {{"unordered_map", chained}, {"flat", flat}};
+            for (const auto& row : rows) {
+                std::cout << std::left << std::setw(10) << keyCount << std::setw(10) << keys.front().size()
+                          << std::setw(16) << row.first << std::fixed << std::setprecision(2) << std::setw(8)
+                          << row.second.load << std::setprecision(1) << std::setw(12) << row.second.bytesPerKey
+                          << std::setw(10) << row.second.hitNs << row.second.missNs << std::endl;
+            }
+        }
+    }
+    return 0;
+}
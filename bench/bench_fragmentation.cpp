@@ -0,0 +1,188 @@
+/**
+ * Allocator fragmentation benchmark
+ *
+ * Runs the same churn against two stores, each in a child process of its
+ * own so one's heap doesn't hide the other's:
+ *   - malloc: a KeyValueMap whose keys and values come from the heap, as
+ *     DataStore allocated them before it had slab arenas
+ *   - slab: a DataStore, allocating from its shards' slab arenas
+ * The churn fills --keys keys with values of random size, rewrites every
+ * key --rounds times with values a little larger each round, then deletes
+ * all but --keep percent of the keys at random. After each phase it prints
+ * the bytes of the keys and values left (live), how much the process's
+ * resident set grew since the start (rss) and their ratio; for the slab
+ * store also the arenas' active / allocated ratio. The slab store then runs
+ * active defragmentation cycles until nothing moves, and reports again
+ * with the time that took. POSIX only: elsewhere both stores run in one
+ * process, one after the other. Usage:
+ *   bench_fragmentation [--keys N] [--rounds N] [--keep PERCENT] [--key-size N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include "metrics.h"
+#include <cstdint>
+#include <iomanip>
+#include <random>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct Workload {
+    size_t keys;
+    size_t rounds;
+    size_t keep;
+    size_t keySize;
+};
+
+std::string makeKey(size_t i, size_t length) {
+    std::string key = "key:" + std::to_string(i) + ":";
+    if (key.size() < length) {
+        key.append(length - key.size(), 'k');
+    }
+    return key;
+}
+
+/**
+ * Value size for a rewrite round: uniform, shifting up each round
+ */
+size_t valueSize(std::mt19937_64& random, size_t round) {
+    return 16 + round * 96 + static_cast<size_t>(random() % 384);
+}
+
+void printRow(const char* store, const char* phase, size_t live, size_t baseRss, const SlabArena::Stats* slabs,
+              double seconds = -1) {
+    uint64_t rss = metrics::residentBytes();
+    double grown = rss > baseRss ? static_cast<double>(rss - baseRss) : 0.0;
+    std::cout << std::left << std::setw(8) << store << std::setw(11) << phase << std::fixed << std::setprecision(1)
+              << std::setw(10) << live / 1048576.0 << std::setw(10) << grown / 1048576.0 << std::setprecision(2)
+              << std::setw(10) << (live ? grown / live : 0.0);
+    if (slabs) {
+        std::cout << std::setw(12)
+                  << (slabs->allocated ? static_cast<double>(slabs->active) / slabs->allocated : 0.0);
+    } else {
+        std::cout << std::setw(12) << "-";
+    }
+    if (seconds >= 0) {
+        std::cout << std::setprecision(2) << seconds;
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Run the churn, calling set(key, size) and erase(key) on the store and
+ * report(phase, live bytes) after each phase
+ */
+template <typename Set, typename Erase, typename Report>
+void churn(const Workload& workload, Set set, Erase erase, Report report) {
+    std::mt19937_64 random(7);
+    std::vector<size_t> sizes(workload.keys);
+    size_t live = 0;
+    for (size_t i = 0; i < workload.keys; ++i) {
+        std::string key = makeKey(i, workload.keySize);
+        sizes[i] = valueSize(random, 0);
+        set(key, sizes[i]);
+        live += key.size() + sizes[i];
+    }
+    report("filled", live);
+    for (size_t round = 1; round <= workload.rounds; ++round) {
+        for (size_t i = 0; i < workload.keys; ++i) {
+            size_t index = static_cast<size_t>(random() % workload.keys);
+            size_t size = valueSize(random, round);
+            set(makeKey(index, workload.keySize), size);
+            live += size - sizes[index];
+            sizes[index] = size;
+        }
+    }
+    report("churned", live);
+    for (size_t i = 0; i < workload.keys; ++i) {
+        if (static_cast<size_t>(random() % 100) >= workload.keep) {
+            std::string key = makeKey(i, workload.keySize);
+            erase(key);
+            live -= key.size() + sizes[i];
+        }
+    }
+    report("trimmed", live);
+}
+
+void runMalloc(const Workload& workload) {
+    size_t baseRss = metrics::residentBytes();
+    std::string bytes(4096, 'v');
+    KeyValueMap map;
+    churn(workload,
+          [&](const std::string& key, size_t size) {
+              map.insert_or_assign(key, StoredValue(Value::copyOf(std::string_view(bytes.data(), size)), 0));
+          },
+          [&](const std::string& key) { map.erase(key); },
+          [&](const char* phase, size_t live) { printRow("malloc", phase, live, baseRss, nullptr); });
+}
+
+void runSlab(const Workload& workload) {
+    size_t baseRss = metrics::residentBytes();
+    std::string bytes(4096, 'v');
+    DataStore store;
+    size_t live = 0;
+    churn(workload,
+          [&](const std::string& key, size_t size) { store.set(key, std::string_view(bytes.data(), size)); },
+          [&](const std::string& key) { store.del(key); },
+          [&](const char* phase, size_t bytesLive) {
+              live = bytesLive;
+              SlabArena::Stats stats = store.allocatorStats();
+              printRow("slab", phase, live, baseRss, &stats);
+          });
+
+    store.setActiveDefrag(true, 0, 0);
+    double start = bench::nowSeconds();
+    while (store.defragCycle(DataStore::DEFRAG_CYCLE_BUDGET) != 0) {
+    }
+    double seconds = bench::nowSeconds() - start;
+    SlabArena::Stats stats = store.allocatorStats();
+    printRow("slab", "defragged", live, baseRss, &stats, seconds);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_fragmentation [--keys N] [--rounds N] [--keep PERCENT] [--key-size N]"
+                  << std::endl;
+        return 0;
+    }
+
+    Workload workload;
+    workload.keys = static_cast<size_t>(args.getInt("keys", 1000000));
+    workload.rounds = static_cast<size_t>(args.getInt("rounds", 4));
+    workload.keep = static_cast<size_t>(std::min(100L, args.getInt("keep", 25)));
+    workload.keySize = static_cast<size_t>(args.getInt("key-size", 32));
+
+    std::cout << "Churn: " << workload.keys << " keys of " << workload.keySize << " bytes, " << workload.rounds
+              << " rewrite rounds, " << workload.keep << "% kept" << std::endl;
+    std::cout << std::left << std::setw(8) << "store" << std::setw(11) << "phase" << std::setw(10) << "live MB"
+              << std::setw(10) << "rss MB" << std::setw(10) << "rss/live" << std::setw(12) << "slab ratio"
+              << "defrag s" << std::endl;
+
+    void (*runs[])(const Workload&) = {runMalloc, runSlab};
+    for (auto run : runs) {
+#ifndef _WIN32
+        pid_t child = fork();
+        if (child < 0) {
+            std::cerr << "fork failed" << std::endl;
+            return 1;
+        }
+        if (child == 0) {
+            run(workload);
+            std::cout.flush();
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+#else
+        run(workload);
+#endif
+    }
+    return 0;
+}
@@ -0,0 +1,374 @@
+/**
+ * HTTP API benchmark
+ *
+ * C client threads send GET /api/get requests for a while, against:
+ *   - legacy: a replica of the original HttpServer, which starts a detached
+ *     thread per connection, reads one recv() of at most 4 KB, answers and
+ *     closes, so every request pays a TCP handshake and a thread start
+ *   - close: the current server with one connection per request
+ *     ("Connection: close"), for the cost of the handshake alone
+ *   - keep-alive: the current server, each client reusing its connection
+ *   - pipelined: the same with D requests in flight per connection
+ * and reports requests per second. It then POSTs a value of --body-kb KB
+ * to both servers and reports how much of it was stored, which the
+ * legacy server truncates to whatever arrived in its first read. Last, it
+ * reads keys in batches of B, one keep-alive GET per key vs. one POST
+ * /api/mget per batch, and streams every key with /api/scan, reporting
+ * keys per second. Usage:
+ *   bench_http [--clients 1,8,32] [--seconds 1] [--depth 16]
+ *              [--workers N] [--body-kb 64] [--batch 10,100,1000] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "http_server.h"
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+/**
+ * The original HttpServer's request handling, reduced to the two API
+ * routes used here
+ */
+class LegacyHttpServer {
+private:
+    DataStore& store_;
+    std::atomic<bool> running_{false};
+    std::atomic<int> active_{0};
+    socket_t listener_ = INVALID_SOCKET_VALUE;
+    std::thread acceptThread_;
+
+    static void closeSocket(socket_t s) {
+#ifdef _WIN32
+        closesocket(s);
+#else
+        ::close(s);
+#endif
+    }
+
+    static void sendAll(socket_t s, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            int n = send(s, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+            if (n <= 0) return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    void acceptLoop() {
+        while (running_) {
+            socket_t cs = accept(listener_, nullptr, nullptr);
+            if (cs == INVALID_SOCKET_VALUE) continue;
+            ++active_;
+            std::thread([this, cs]() {
+                handleClient(cs);
+                --active_;
+            }).detach();
+        }
+    }
+
+    void handleClient(socket_t cs) {
+        char buf[4096];
+        int n = recv(cs, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) {
+            closeSocket(cs);
+            return;
+        }
+        std::string req(buf, static_cast<size_t>(n));
+        std::istringstream iss(req);
+        std::string method, path;
+        iss >> method >> path;
+        std::string body;
+        if (method == "GET" && path.rfind("/api/get?key=", 0) == 0) {
+            Value value = store_.get(path.substr(13));
+            body = value ? "{\"key\":\"" + path.substr(13) + "\",\"value\":\"" + value.str() + "\"}"
+                         : "{\"error\":\"not_found\"}";
+        } else if (method == "POST" && path == "/api/set") {
+            std::string form = req.substr(req.find("\r\n\r\n") + 4);
+            size_t vpos = form.find("&value=");
+            if (form.rfind("key=", 0) == 0 && vpos != std::string::npos) {
+                body = store_.set(form.substr(4, vpos - 4), form.substr(vpos + 7)) ? "{\"ok\":true}"
+                                                                                   : "{\"ok\":false}";
+            }
+        }
+        std::ostringstream res;
+        res << "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " << body.size()
+            << "\r\n\r\n" << body;
+        sendAll(cs, res.str());
+        closeSocket(cs);
+    }
+
+public:
+    explicit LegacyHttpServer(DataStore& store) : store_(store) {}
+    ~LegacyHttpServer() { stop(); }
+
+    bool start(int port) {
+        listener_ = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&opt), sizeof(opt));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listener_, 128) < 0) {
+            closeSocket(listener_);
+            return false;
+        }
+        running_ = true;
+        acceptThread_ = std::thread(&LegacyHttpServer::acceptLoop, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running_) return;
+        running_ = false;
+#ifdef _WIN32
+        shutdown(listener_, SD_BOTH);
+#else
+        shutdown(listener_, SHUT_RDWR);
+#endif
+        closeSocket(listener_);
+        acceptThread_.join();
+        while (active_ > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+};
+
+/**
+ * Read one response, returning its body, sized by Content-Length or chunked
+ */
+bool readResponse(bench::Client& client, std::string& body) {
+    std::string line;
+    size_t length = 0;
+    bool chunked = false;
+    if (!client.readLine(line) || line.rfind("HTTP/1.", 0) != 0) return false;
+    while (client.readLine(line) && !line.empty()) {
+        if (line.rfind("Content-Length:", 0) == 0) {
+            length = std::stoul(line.substr(15));
+        } else if (line == "Transfer-Encoding: chunked") {
+            chunked = true;
+        }
+    }
+    if (!chunked) {
+        return client.readExact(length, body);
+    }
+    body.clear();
+    std::string chunk;
+    while (client.readLine(line)) {
+        size_t size = std::stoul(line, nullptr, 16);
+        if (size == 0) {
+            return client.readLine(line);
+        }
+        if (!client.readExact(size, chunk) || !client.readLine(line)) return false;
+        body += chunk;
+    }
+    return false;
+}
+
+enum class Mode { PerRequest, KeepAlive, Pipelined };
+
+/**
+ * Run client threads against a server for a while
+ * @return Requests answered per second, -1 if a client failed
+ */
+double runClients(Mode mode, int port, int clientCount, int depth, double seconds, size_t keyCount) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<long> done(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < clientCount; ++t) {
+        threads.emplace_back([&, t]() {
+            size_t next = static_cast<size_t>(t) * 7919 % keyCount;
+            int inFlight = mode == Mode::Pipelined ? depth : 1;
+            const char* connection = mode == Mode::PerRequest ? "close" : "keep-alive";
+            bench::Client client;
+            if (mode != Mode::PerRequest && !client.connect("127.0.0.1", port)) {
+                failed = true;
+                return;
+            }
+            long count = 0;
+            std::string batch;
+            std::string body;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (mode == Mode::PerRequest && !client.connect("127.0.0.1", port)) {
+                    failed = true;
+                    break;
+                }
+                batch.clear();
+                for (int i = 0; i < inFlight; ++i) {
+                    batch += "GET /api/get?key=key:" + std::to_string(next) + " HTTP/1.1\r\nHost: bench\r\n" +
+                             "Connection: " + connection + "\r\n\r\n";
+                    next = next + 1 == keyCount ? 0 : next + 1;
+                }
+                if (!client.sendAll(batch)) {
+                    failed = true;
+                    break;
+                }
+                for (int i = 0; i < inFlight; ++i) {
+                    if (!readResponse(client, body)) {
+                        failed = true;
+                        break;
+                    }
+                }
+                if (failed) break;
+                count += inFlight;
+                if (mode == Mode::PerRequest) {
+                    client.close();
+                }
+            }
+            done.fetch_add(count);
+        });
+    }
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return failed ? -1 : done.load() / (bench::nowSeconds() - start);
+}
+
+/**
+ * POST a large value to /api/set
+ * @return The bytes of it the store holds afterwards
+ */
+size_t postLargeValue(DataStore& store, int port, size_t bytes) {
+    store.del("large");
+    std::string form = "key=large&value=" + std::string(bytes, 'x');
+    bench::Client client;
+    std::string body;
+    if (!client.connect("127.0.0.1", port) ||
+        !client.sendAll("POST /api/set HTTP/1.1\r\nHost: bench\r\nContent-Length: " + std::to_string(form.size()) +
+                        "\r\n\r\n" + form) ||
+        !readResponse(client, body)) {
+        return 0;
+    }
+    return store.get("large").size();
+}
+
+/**
+ * Read batches of keys for a while from one keep-alive connection
+ * @param mget true for one /api/mget per batch, false for a GET per key
+ * @return Keys read per second, -1 on failure
+ */
+double runBatches(bool mget, int port, size_t batch, double seconds, size_t keyCount) {
+    bench::Client client;
+    if (!client.connect("127.0.0.1", port)) return -1;
+    std::string request;
+    std::string body;
+    size_t next = 0;
+    long keys = 0;
+    double start = bench::nowSeconds();
+    double elapsed = 0;
+    while ((elapsed = bench::nowSeconds() - start) < seconds) {
+        request.clear();
+        if (mget) {
+            std::string array = "[";
+            for (size_t i = 0; i < batch; ++i) {
+                array += (i == 0 ? "\"key:" : ",\"key:") + std::to_string((next + i) % keyCount) + "\"";
+            }
+            array += "]";
+            request = "POST /api/mget HTTP/1.1\r\nHost: bench\r\nContent-Length: " + std::to_string(array.size()) +
+                      "\r\n\r\n" + array;
+            if (!client.sendAll(request) || !readResponse(client, body)) return -1;
+        } else {
+            for (size_t i = 0; i < batch; ++i) {
+                request = "GET /api/get?key=key:" + std::to_string((next + i) % keyCount) +
+                          " HTTP/1.1\r\nHost: bench\r\n\r\n";
+                if (!client.sendAll(request) || !readResponse(client, body)) return -1;
+            }
+        }
+        next = (next + batch) % keyCount;
+        keys += static_cast<long>(batch);
+    }
+    return keys / elapsed;
+}
+
+/**
+ * Stream every key and value with /api/scan
+ * @return Keys per second, -1 on failure
+ */
+double runScan(int port, size_t keyCount) {
+    bench::Client client;
+    std::string body;
+    double start = bench::nowSeconds();
+    if (!client.connect("127.0.0.1", port) || !client.sendAll("GET /api/scan HTTP/1.1\r\nHost: bench\r\n\r\n") ||
+        !readResponse(client, body)) {
+        return -1;
+    }
+    return keyCount / (bench::nowSeconds() - start);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_http [--clients 1,8,32] [--seconds 1] [--depth 16]\n"
+            << "                  [--workers N] [--body-kb 64] [--batch 10,100,1000] [--port P]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> clientCounts = args.getIntList("clients", {1, 8, 32});
+    double seconds = static_cast<double>(args.getInt("seconds", 1));
+    int depth = static_cast<int>(std::max(1L, args.getInt("depth", 16)));
+    size_t workers = static_cast<size_t>(args.getInt("workers", 0));
+    size_t bodyBytes = static_cast<size_t>(args.getInt("body-kb", 64)) * 1024;
+    std::vector<long> batchSizes = args.getIntList("batch", {10, 100, 1000});
+    int port = static_cast<int>(args.getInt("port", 7491));
+    const size_t keyCount = 10000;
+
+    DataStore store;
+    store.setOrderedIndex(true);
+    for (size_t i = 0; i < keyCount; ++i) {
+        store.set("key:" + std::to_string(i), std::string(32, 'v'));
+    }
+    LegacyHttpServer legacy(store);
+    HttpServer server(store);
+    if (!legacy.start(port + 1) || !server.start(port, "web", workers)) {
+        out << "Failed to start the HTTP servers on ports " << port << " and " << port + 1 << std::endl;
+        return 1;
+    }
+
+    out << "GET /api/get requests/s, pipeline depth " << depth << std::endl;
+    out << std::left << std::setw(9) << "clients" << std::setw(12) << "legacy" << std::setw(12) << "close"
+        << std::setw(12) << "keep-alive" << "pipelined" << std::endl;
+    for (long clients : clientCounts) {
+        int count = static_cast<int>(std::max(1L, clients));
+        double legacyRate = runClients(Mode::PerRequest, port + 1, count, depth, seconds, keyCount);
+        double closeRate = runClients(Mode::PerRequest, port, count, depth, seconds, keyCount);
+        double keepAliveRate = runClients(Mode::KeepAlive, port, count, depth, seconds, keyCount);
+        double pipelinedRate = runClients(Mode::Pipelined, port, count, depth, seconds, keyCount);
+        out << std::left << std::setw(9) << clients << std::fixed << std::setprecision(0) << std::setw(12)
+            << legacyRate << std::setw(12) << closeRate << std::setw(12) << keepAliveRate << pipelinedRate
+            << std::endl;
+    }
+
+    out << std::endl << "POST /api/set with a " << bodyBytes / 1024 << " KB value, bytes stored" << std::endl;
+    out << "legacy: " << postLargeValue(store, port + 1, bodyBytes) << std::endl;
+    out << "current: " << postLargeValue(store, port, bodyBytes) << std::endl;
+    store.del("large");
+
+    out << std::endl << "Keys read/s over one keep-alive connection" << std::endl;
+    out << std::left << std::setw(9) << "batch" << std::setw(12) << "get" << "mget" << std::endl;
+    for (long batch : batchSizes) {
+        size_t size = static_cast<size_t>(std::max(1L, batch));
+        double single = runBatches(false, port, size, seconds, keyCount);
+        double multi = runBatches(true, port, size, seconds, keyCount);
+        out << std::left << std::setw(9) << size << std::fixed << std::setprecision(0) << std::setw(12) << single
+            << multi << std::endl;
+    }
+    out << "scan: " << std::fixed << std::setprecision(0) << runScan(port, keyCount) << " keys/s streamed" << std::endl;
+
+    server.stop();
+    legacy.stop();
+    return 0;
+}
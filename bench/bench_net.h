@@ -0,0 +1,200 @@
+#pragma once
+
+#include "datastore.h"
+#include "net.h"
+#include "persistence.h"
+#include "server.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+/**
+ * Networking helpers for benchmarks that talk to a BoltDB server
+ */
+namespace bench {
+
+/**
+ * Minimal blocking client for the text protocol
+ */
+class Client {
+private:
+    socket_t socket_ = INVALID_SOCKET_VALUE;
+    std::string buffer_;
+    size_t offset_ = 0;
+
+    bool fill() {
+        if (offset_ > 0 && offset_ == buffer_.size()) {
+            buffer_.clear();
+            offset_ = 0;
+        }
+        char chunk[16384];
+        int n = recv(socket_, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer_.append(chunk, static_cast<size_t>(n));
+        return true;
+    }
+
+public:
+    Client() = default;
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+    Client(Client&& other) noexcept
+        : socket_(other.socket_), buffer_(std::move(other.buffer_)), offset_(other.offset_) {
+        other.socket_ = INVALID_SOCKET_VALUE;
+    }
+
+    ~Client() { close(); }
+
+    bool connect(const std::string& host, int port) {
+        socket_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (socket_ == INVALID_SOCKET_VALUE) return false;
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET, host.c_str(), &address.sin_addr);
+        if (::connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (socket_ != INVALID_SOCKET_VALUE) {
+#ifdef _WIN32
+            closesocket(socket_);
+#else
+            ::close(socket_);
+#endif
+            socket_ = INVALID_SOCKET_VALUE;
+        }
+    }
+
+    bool sendAll(const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            int n = send(socket_, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+            if (n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    /**
+     * Read one reply line, without its terminator
+     */
+    bool readLine(std::string& line) {
+        while (true) {
+            size_t pos = buffer_.find('\n', offset_);
+            if (pos != std::string::npos) {
+                size_t end = (pos > offset_ && buffer_[pos - 1] == '\r') ? pos - 1 : pos;
+                line.assign(buffer_, offset_, end - offset_);
+                offset_ = pos + 1;
+                return true;
+            }
+            if (!fill()) return false;
+        }
+    }
+
+    /**
+     * Read exactly count bytes
+     */
+    bool readExact(size_t count, std::string& out) {
+        while (buffer_.size() - offset_ < count) {
+            if (!fill()) return false;
+        }
+        out.assign(buffer_, offset_, count);
+        offset_ += count;
+        return true;
+    }
+
+    /**
+     * Read one complete reply: a status line, or a bulk string with its payload
+     * @param payload Receives the bulk payload (or the status line)
+     */
+    bool readReply(std::string& payload) {
+        std::string line;
+        if (!readLine(line)) return false;
+        if (!line.empty() && line[0] == '$' && line != "$-1") {
+            size_t length = std::stoul(line.substr(1));
+            if (!readExact(length, payload)) return false;
+            return readLine(line);
+        }
+        payload = line;
+        return true;
+    }
+
+    /**
+     * Send one command and wait for its reply
+     */
+    bool command(const std::string& text, std::string& reply) {
+        return sendAll(text + "\n") && readReply(reply);
+    }
+};
+
+/**
+ * A BoltDB server running inside the benchmark process
+ * Server log lines go to std::cout, so benchmarks report through their own
+ * stream (see results()) while the server's chatter is discarded
+ */
+class EmbeddedServer {
+private:
+    std::unique_ptr<DataStore> store_;
+    std::unique_ptr<PersistenceManager> persistence_;
+    std::unique_ptr<Server> server_;
+    std::thread thread_;
+    int port_;
+
+public:
+    explicit EmbeddedServer(int port, const ServerConfig& config = ServerConfig(),
+                            size_t shards = DataStore::DEFAULT_SHARD_COUNT)
+        : store_(std::make_unique<DataStore>(shards)),
+          persistence_(std::make_unique<PersistenceManager>(*store_, "bench_embedded.bdb")),
+          server_(std::make_unique<Server>(*store_, *persistence_, config)),
+          port_(port) {}
+
+    ~EmbeddedServer() { stop(); }
+
+    DataStore& store() { return *store_; }
+    PersistenceManager& persistence() { return *persistence_; }
+    Server& server() { return *server_; }
+
+    /**
+     * Start serving and wait until the port accepts connections
+     */
+    bool start() {
+        thread_ = std::thread([this]() { server_->start(port_); });
+        for (int attempt = 0; attempt < 200; ++attempt) {
+            Client probe;
+            if (server_->isRunning() && probe.connect("127.0.0.1", port_)) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    void stop() {
+        if (thread_.joinable()) {
+            server_->stop();
+            thread_.join();
+        }
+    }
+};
+
+/**
+ * Stream for benchmark results; silences std::cout so embedded server logs
+ * don't interleave with the report
+ */
+inline std::ostream& results() {
+    static std::ostream out(std::cout.rdbuf());
+    static bool silenced = false;
+    if (!silenced) {
+        std::cout.rdbuf(nullptr);
+        silenced = true;
+    }
+    return out;
+}
+
+} // namespace bench
@@ -0,0 +1,182 @@
+/**
+ * Ordered index benchmark
+ *
+ * Keys look like "user:<id>:item:<n>", --items-per-user of them per user,
+ * written in random order. Two stores take the same writes, one without
+ * the ordered index and one with it, and for each the benchmark reports:
+ *   - insert / overwrite / delete ns: mean time of a set() of a new key,
+ *     a set() of an existing one (which leaves the index alone) and a del()
+ *   - bytes/key: usedMemory() after the inserts, divided by the key count
+ * Then, on the indexed store:
+ *   - full walk: range() over every key in batches of COUNT, each batch
+ *     resuming after the last key of the one before, as RANGE clients do;
+ *     keys per second, with and without values
+ *   - prefix scan: range() over the keys of one random user, as SCAN with
+ *     MATCH user:<id>:* does; scans and keys per second
+ * Usage:
+ *   bench_ordered_index [--keys N] [--items-per-user N] [--value-size N] [--counts 10,100,1000]
+ *                       [--prefix-scans N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <random>
+
+namespace {
+
+struct WriteResult {
+    double insertNs;
+    double overwriteNs;
+    double deleteNs;
+    double bytesPerKey;
+};
+
+std::string makeKey(size_t user, size_t item) {
+    char key[48];
+    std::snprintf(key, sizeof(key), "user:%07zu:item:%04zu", user, item);
+    return key;
+}
+
+std::string userPrefix(size_t user) {
+    char prefix[32];
+    std::snprintf(prefix, sizeof(prefix), "user:%07zu:", user);
+    return prefix;
+}
+
+/**
+ * The first string after every key starting with prefix
+ */
+std::string prefixEnd(std::string prefix) {
+    prefix.back() = static_cast<char>(prefix.back() + 1);
+    return prefix;
+}
+
+WriteResult measureWrites(DataStore& store, const std::vector<std::string>& keys, const std::string& value) {
+    WriteResult result;
+    double count = static_cast<double>(keys.size());
+    size_t before = store.usedMemory();
+    double start = bench::nowSeconds();
+    for (const std::string& key : keys) {
+        store.set(key, value);
+    }
+    result.insertNs = (bench::nowSeconds() - start) * 1e9 / count;
+    result.bytesPerKey = static_cast<double>(store.usedMemory() - before) / count;
+
+    start = bench::nowSeconds();
+    for (const std::string& key : keys) {
+        store.set(key, value);
+    }
+    result.overwriteNs = (bench::nowSeconds() - start) * 1e9 / count;
+    return result;
+}
+
+double measureDeletes(DataStore& store, const std::vector<std::string>& keys) {
+    double start = bench::nowSeconds();
+    for (const std::string& key : keys) {
+        store.del(key);
+    }
+    return (bench::nowSeconds() - start) * 1e9 / static_cast<double>(keys.size());
+}
+
+/**
+ * Walk every key COUNT at a time
+ * @return Keys returned; the time taken in seconds goes to seconds
+ */
+size_t walkAll(const DataStore& store, size_t count, bool withValues, double& seconds) {
+    size_t total = 0;
+    std::string last;
+    KeyRange range;
+    double start = bench::nowSeconds();
+    while (true) {
+        auto entries = store.range(range, count, withValues);
+        total += entries.size();
+        if (entries.size() < count) {
+            break;
+        }
+        last = std::move(entries.back().first);
+        range.min = last;
+        range.minExclusive = true;
+    }
+    seconds = bench::nowSeconds() - start;
+    return total;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_ordered_index [--keys N] [--items-per-user N] [--value-size N]\n"
+                  << "                           [--counts 10,100,1000] [--prefix-scans N]" << std::endl;
+        return 0;
+    }
+
+    size_t keyCount = static_cast<size_t>(args.getInt("keys", 1000000));
+    size_t itemsPerUser = static_cast<size_t>(std::max(1L, args.getInt("items-per-user", 100)));
+    std::string value(static_cast<size_t>(args.getInt("value-size", 16)), 'v');
+    std::vector<long> counts = args.getIntList("counts", {10, 100, 1000});
+    size_t prefixScans = static_cast<size_t>(args.getInt("prefix-scans", 100000));
+    size_t users = (keyCount + itemsPerUser - 1) / itemsPerUser;
+
+    std::vector<std::string> keys;
+    keys.reserve(keyCount);
+    for (size_t i = 0; i < keyCount; ++i) {
+        keys.push_back(makeKey(i / itemsPerUser, i % itemsPerUser));
+    }
+    std::mt19937_64 random(42);
+    std::shuffle(keys.begin(), keys.end(), random);
+
+    std::cout << "Ordered index: " << keyCount << " keys of " << keys.front().size() << " bytes, " << users
+              << " users, " << value.size() << "-byte values" << std::endl;
+
+    DataStore plain;
+    DataStore indexed;
+    indexed.setOrderedIndex(true);
+    WriteResult plainWrites = measureWrites(plain, keys, value);
+    WriteResult indexedWrites = measureWrites(indexed, keys, value);
+
+    // Scan the indexed store while it is full, then time deletes on both
+    std::cout << std::left << std::setw(10) << "walk" << std::setw(8) << "count" << std::setw(14)
+              << "keys/s" << std::setw(12) << "seconds" << "keys" << std::endl;
+    for (bool withValues : {false, true}) {
+        for (long count : counts) {
+            double seconds = 0;
+            size_t total = walkAll(indexed, static_cast<size_t>(std::max(1L, count)), withValues, seconds);
+            std::cout << std::setw(10) << (withValues ? "values" : "keys") << std::setw(8) << count << std::fixed
+                      << std::setprecision(0) << std::setw(14) << total / seconds << std::setprecision(3)
+                      << std::setw(12) << seconds << total << std::endl;
+        }
+    }
+
+    size_t scanned = 0;
+    double start = bench::nowSeconds();
+    for (size_t i = 0; i < prefixScans; ++i) {
+        std::string prefix = userPrefix(static_cast<size_t>(random() % users));
+        std::string end = prefixEnd(prefix);
+        KeyRange range;
+        range.min = prefix;
+        range.max = end;
+        range.maxExclusive = true;
+        range.maxUnbounded = false;
+        scanned += indexed.range(range, itemsPerUser, false).size();
+    }
+    double seconds = bench::nowSeconds() - start;
+    std::cout << std::endl << "prefix scan: " << std::setprecision(0) << prefixScans / seconds << " scans/s, "
+              << scanned / seconds << " keys/s (" << std::setprecision(1)
+              << static_cast<double>(scanned) / static_cast<double>(prefixScans) << " keys per scan)" << std::endl
+              << std::endl;
+
+    plainWrites.deleteNs = measureDeletes(plain, keys);
+    indexedWrites.deleteNs = measureDeletes(indexed, keys);
+    const std::pair<const char*, WriteResult> rows[] = {{"none", plainWrites}, {"ordered", indexedWrites}};
+    std::cout << std::left << std::setw(10) << "index" << std::setw(12) << "insert ns" << std::setw(14)
+              << "overwrite ns" << std::setw(11) << "delete ns" << "bytes/key" << std::endl;
+    for (const auto& row : rows) {
+        std::cout << std::setw(10) << row.first << std::fixed << std::setprecision(1) << std::setw(12)
+                  << row.second.insertNs << std::setw(14) << row.second.overwriteNs << std::setw(11)
+                  << row.second.deleteNs << row.second.bytesPerKey << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+/**
+ * Command parser microbenchmark
+ *
+ * Parses a pipelined buffer of GET/SET/DELETE commands the way the original
+ * server did (substr + erase per line, an istringstream and an upper-cased
+ * copy of the name per command) and with the zero-copy parser
+ * (InputBuffer::readLine + protocol::parseCommand). No data store is
+ * involved; each parsed key and value is only folded into a checksum.
+ * Reports nanoseconds and heap allocations per command for each batch
+ * size. Usage:
+ *   bench_parser [--batch 100,10000,100000] [--rounds N] [--value-size 32]
+ */
+#include "bench_common.h"
+#include "command_parser.h"
+#include "input_buffer.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+} // namespace
+
+// Count every heap allocation made by the process
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+std::string buildBatch(long commands, size_t valueSize) {
+    std::string value(valueSize, 'v');
+    std::string batch;
+    for (long i = 0; i < commands; ++i) {
+        std::string key = "key:" + std::to_string(i % 1000);
+        switch (i % 4) {
+            case 0: batch += "SET " + key + " " + value + "\r\n"; break;
+            case 3: batch += "delete " + key + "\n"; break;
+            default: batch += "GET " + key + "\n"; break;
+        }
+    }
+    return batch;
+}
+
+/**
+ * The parser as it was: copy the line out, erase it from the front of the
+ * buffer, trim, tokenize with an istringstream and upper-case a copy
+ */
+size_t parseLegacy(const std::string& batch) {
+    std::string commandBuffer = batch;
+    size_t checksum = 0;
+    size_t pos;
+    while ((pos = commandBuffer.find('\n')) != std::string::npos) {
+        std::string command = commandBuffer.substr(0, pos);
+        commandBuffer.erase(0, pos + 1);
+        command.erase(command.find_last_not_of(" \t\r\n") + 1);
+        command.erase(0, command.find_first_not_of(" \t\r\n"));
+        if (command.empty()) continue;
+
+        std::istringstream iss(command);
+        std::string cmd;
+        iss >> cmd;
+        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+        std::string key;
+        iss >> key;
+        checksum += key.size();
+        if (cmd == "SET") {
+            std::string remaining;
+            std::getline(iss, remaining);
+            checksum += remaining.size();
+        } else if (cmd == "GET") {
+            checksum += 1;
+        } else if (cmd == "DELETE") {
+            checksum += 2;
+        }
+    }
+    return checksum;
+}
+
+size_t parseZeroCopy(const std::string& batch, InputBuffer& input) {
+    input.append(batch);
+    size_t checksum = 0;
+    std::string_view line;
+    while (input.readLine(line)) {
+        Command command = protocol::parseCommand(line);
+        std::string_view args = command.args;
+        checksum += protocol::nextToken(args).size();
+        switch (command.type) {
+            case CommandType::Set: checksum += args.size(); break;
+            case CommandType::Get: checksum += 1; break;
+            case CommandType::Delete: checksum += 2; break;
+            default: break;
+        }
+    }
+    return checksum;
+}
+
+struct ParseResult {
+    double nsPerCommand;
+    double allocationsPerCommand;
+    size_t checksum;
+};
+
+template <typename Parse>
+ParseResult measure(long commands, int rounds, Parse parse) {
+    parse();  // Warm up buffers and caches
+    uint64_t allocationsBefore = allocations.load();
+    double start = bench::nowSeconds();
+    size_t checksum = 0;
+    for (int round = 0; round < rounds; ++round) {
+        checksum += parse();
+    }
+    double seconds = bench::nowSeconds() - start;
+    double total = static_cast<double>(commands) * rounds;
+    return {seconds * 1e9 / total, (allocations.load() - allocationsBefore) / total, checksum};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_parser [--batch 100,10000,100000] [--rounds N]"
+                  << " [--value-size 32]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> batches = args.getIntList("batch", {100, 10000, 100000});
+    long rounds = args.getInt("rounds", 0);
+    size_t valueSize = static_cast<size_t>(args.getInt("value-size", 32));
+
+    std::cout << "Parsing pipelined batches (25% SET with " << valueSize
+              << "-byte values, 50% GET, 25% DELETE)" << std::endl;
+    std::cout << std::left << std::setw(10) << "batch" << std::setw(12) << "parser"
+              << std::setw(14) << "ns/command" << "allocs/command" << std::endl;
+
+    for (long batchSize : batches) {
+        std::string batch = buildBatch(batchSize, valueSize);
+        // Aim for roughly a million commands per measurement
+        int count = static_cast<int>(rounds > 0 ? rounds : std::max(1L, 1000000 / batchSize));
+        // The legacy parser is quadratic; keep its big batches affordable
+        int legacyCount = count;
+        if (rounds <= 0) {
+            legacyCount = std::max(1, std::min(count, static_cast<int>(20000000 / batchSize / batchSize)));
+        }
+
+        InputBuffer input;
+        ParseResult legacy = measure(batchSize, legacyCount, [&]() { return parseLegacy(batch); });
+        ParseResult zeroCopy = measure(batchSize, count, [&]() { return parseZeroCopy(batch, input); });
+        if (legacy.checksum / legacyCount != zeroCopy.checksum / count) {
+            std::cerr << "Parsers disagree on batch " << batchSize << std::endl;
+            return 1;
+        }
+
+        std::cout << std::left << std::setw(10) << batchSize << std::setw(12) << "legacy"
+                  << std::fixed << std::setprecision(1) << std::setw(14) << legacy.nsPerCommand
+                  << std::setprecision(2) << legacy.allocationsPerCommand << std::endl;
+        std::cout << std::left << std::setw(10) << batchSize << std::setw(12) << "zero-copy"
+                  << std::fixed << std::setprecision(1) << std::setw(14) << zeroCopy.nsPerCommand
+                  << std::setprecision(2) << zeroCopy.allocationsPerCommand << std::endl;
+    }
+    return 0;
+}
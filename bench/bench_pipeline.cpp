@@ -0,0 +1,145 @@
+/**
+ * Pipelined load generator
+ *
+ * Each client writes a batch of D GET commands in one send and then reads
+ * the D replies, against an embedded server. Reports throughput and how many
+ * commands the server answered per send system call for each pipeline
+ * depth. Depth 1 is the classic request/response pattern. Commands are sent
+ * as text lines or, with --protocol resp, as RESP2 arrays. Usage:
+ *   bench_pipeline [--depth 1,16,128,1000] [--clients 4] [--requests N]
+ *                  [--io-model threads|reactor|both] [--io-threads 4] [--port P]
+ *                  [--protocol text|resp]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "metrics.h"
+#include <atomic>
+#include <iomanip>
+
+namespace {
+
+struct PipelineResult {
+    double opsPerSecond = 0;
+    double commandsPerWrite = 0;
+    long errors = 0;
+};
+
+/**
+ * Encode GET key:<index> in the chosen protocol
+ */
+void appendGet(std::string& batch, int index, bool resp) {
+    std::string key = "key:" + std::to_string(index);
+    if (resp) {
+        batch += "*2\r\n$3\r\nGET\r\n$" + std::to_string(key.size()) + "\r\n" + key + "\r\n";
+    } else {
+        batch += "GET " + key + "\n";
+    }
+}
+
+PipelineResult runPipeline(const ServerConfig& config, int port, int clients, long requests,
+                           long depth, int keyCount, bool resp) {
+    PipelineResult result;
+    bench::EmbeddedServer server(port, config);
+    if (!server.start()) {
+        result.errors = 1;
+        return result;
+    }
+    for (int i = 0; i < keyCount; ++i) {
+        server.store().set("key:" + std::to_string(i), "value:" + std::to_string(i));
+    }
+
+    uint64_t commandsBefore = metrics::commandsProcessed.load();
+    uint64_t writesBefore = metrics::socketWrites.load();
+    std::atomic<long> errors(0);
+    std::vector<std::thread> threads;
+    double start = bench::nowSeconds();
+    for (int t = 0; t < clients; ++t) {
+        threads.emplace_back([&, t]() {
+            bench::Client client;
+            if (!client.connect("127.0.0.1", port)) {
+                errors.fetch_add(1);
+                return;
+            }
+            std::string batch;
+            std::string reply;
+            long sent = 0;
+            int next = t;
+            while (sent < requests) {
+                long count = std::min(depth, requests - sent);
+                batch.clear();
+                for (long i = 0; i < count; ++i) {
+                    appendGet(batch, next++ % keyCount, resp);
+                }
+                if (!client.sendAll(batch)) {
+                    errors.fetch_add(1);
+                    return;
+                }
+                for (long i = 0; i < count; ++i) {
+                    if (!client.readReply(reply)) {
+                        errors.fetch_add(1);
+                        return;
+                    }
+                }
+                sent += count;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = bench::nowSeconds() - start;
+
+    uint64_t commands = metrics::commandsProcessed.load() - commandsBefore;
+    uint64_t writes = metrics::socketWrites.load() - writesBefore;
+    result.opsPerSecond = static_cast<double>(clients) * requests / seconds;
+    result.commandsPerWrite = writes ? static_cast<double>(commands) / writes : 0;
+    result.errors = errors.load();
+    server.stop();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_pipeline [--depth 1,16,128,1000] [--clients 4] [--requests N]"
+            << " [--io-model threads|reactor|both] [--io-threads 4] [--port P]"
+            << " [--protocol text|resp]" << std::endl;
+        return 0;
+    }
+
+    std::vector<long> depths = args.getIntList("depth", {1, 16, 128, 1000});
+    int clients = static_cast<int>(args.getInt("clients", 4));
+    long requests = args.getInt("requests", 100000);
+    std::string model = args.getString("io-model", "both");
+    int ioThreads = static_cast<int>(args.getInt("io-threads", 4));
+    int port = static_cast<int>(args.getInt("port", 7483));
+    bool resp = args.getString("protocol", "text") == "resp";
+
+    std::vector<std::pair<IoModel, const char*>> models;
+    if (model == "threads" || model == "both") models.emplace_back(IoModel::Threads, "threads");
+    if (model == "reactor" || model == "both") models.emplace_back(IoModel::Reactor, "reactor");
+
+    out << "Pipelined GET load (" << (resp ? "RESP" : "text") << " protocol): " << clients
+        << " clients x " << requests << " requests" << std::endl;
+    out << std::left << std::setw(10) << "model" << std::setw(8) << "depth" << std::setw(14)
+        << "ops/s" << std::setw(16) << "commands/write" << "errors" << std::endl;
+
+    int run = 0;
+    for (const auto& entry : models) {
+        ServerConfig config;
+        config.ioModel = entry.first;
+        config.ioThreads = ioThreads;
+        for (long depth : depths) {
+            PipelineResult result = runPipeline(config, port + run++, clients, requests,
+                                                std::max(1L, depth), 1000, resp);
+            out << std::left << std::setw(10) << entry.second << std::setw(8) << depth
+                << std::fixed << std::setprecision(0) << std::setw(14) << result.opsPerSecond
+                << std::setprecision(1) << std::setw(16) << result.commandsPerWrite
+                << result.errors << std::endl;
+        }
+    }
+    return 0;
+}
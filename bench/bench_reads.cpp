@@ -0,0 +1,145 @@
+/**
+ * Read-path scaling benchmark
+ *
+ * Runs a read-only GET workload over a small hot key set and reports how
+ * throughput scales with the number of reader threads. The DataStore read
+ * path (shared shard locks) is compared with an exclusive-lock read path of
+ * the same shape. Usage:
+ *   bench_reads [--threads 1,2,4,8] [--ops N] [--keys N] [--shards N]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+/**
+ * Sharded store whose readers take the shard lock exclusively
+ */
+class ExclusiveReadStore {
+private:
+    struct alignas(64) Shard {
+        std::unordered_map<std::string, std::string> data;
+        mutable std::mutex mutex;
+    };
+    size_t shardCount_;
+    std::unique_ptr<Shard[]> shards_;
+
+    Shard& shardFor(const std::string& key) const {
+        return shards_[std::hash<std::string>{}(key) % shardCount_];
+    }
+
+public:
+    explicit ExclusiveReadStore(size_t shardCount)
+        : shardCount_(shardCount), shards_(std::make_unique<Shard[]>(shardCount)) {}
+
+    bool set(const std::string& key, const std::string& value) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.data[key] = value;
+        return true;
+    }
+
+    std::optional<std::string> get(const std::string& key) const {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.data.find(key);
+        if (it != shard.data.end()) return it->second;
+        return std::nullopt;
+    }
+};
+
+// Keeps the compiler from discarding lookups whose results are unused
+std::atomic<size_t> hitSink(0);
+
+template <typename Store>
+double runReaders(const Store& store, const std::vector<std::string>& keys, long opsPerThread,
+                  int threadCount) {
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+            size_t hits = 0;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (long i = 0; i < opsPerThread; ++i) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                if (store.get(keys[state % keys.size()])) ++hits;
+            }
+            hitSink.fetch_add(hits, std::memory_order_relaxed);
+        });
+    }
+
+    double start = bench::nowSeconds();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return static_cast<double>(opsPerThread) * threadCount / (bench::nowSeconds() - start);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_reads [--threads 1,2,4,8] [--ops N] [--keys N] [--shards N]"
+                  << std::endl;
+        return 0;
+    }
+
+    long opsPerThread = args.getInt("ops", 1000000);
+    long keyCount = args.getInt("keys", 64);
+    size_t shards = static_cast<size_t>(args.getInt("shards", 4));
+    std::vector<long> threadCounts = args.getIntList("threads", {1, 2, 4, 8, 16});
+    std::string value(static_cast<size_t>(args.getInt("value-size", 32)), 'v');
+
+    std::vector<std::string> keys;
+    for (long i = 0; i < keyCount; ++i) {
+        keys.push_back("hot:" + std::to_string(i));
+    }
+
+    ExclusiveReadStore exclusive(shards);
+    DataStore shared(shards);
+    for (const auto& key : keys) {
+        exclusive.set(key, value);
+        shared.set(key, value);
+    }
+
+    std::cout << "Read scaling: " << keyCount << " hot keys over " << shards << " shards, "
+              << opsPerThread << " GETs/thread, " << std::thread::hardware_concurrency()
+              << " hardware threads" << std::endl;
+    std::cout << std::left << std::setw(10) << "threads" << std::setw(18) << "exclusive ops/s"
+              << std::setw(12) << "scaling" << std::setw(18) << "shared ops/s" << "scaling" << std::endl;
+
+    double exclusiveBase = 0;
+    double sharedBase = 0;
+    for (long threadCount : threadCounts) {
+        double exclusiveOps = runReaders(exclusive, keys, opsPerThread, static_cast<int>(threadCount));
+        double sharedOps = runReaders(shared, keys, opsPerThread, static_cast<int>(threadCount));
+        if (exclusiveBase == 0) {
+            exclusiveBase = exclusiveOps / threadCount;
+            sharedBase = sharedOps / threadCount;
+        }
+        // Scaling efficiency: 100% means perfectly linear in the thread count
+        std::cout << std::left << std::setw(10) << threadCount << std::fixed << std::setprecision(0)
+                  << std::setw(18) << exclusiveOps << std::setw(12)
+                  << (std::to_string(static_cast<int>(100 * exclusiveOps / (exclusiveBase * threadCount))) + "%")
+                  << std::setw(18) << sharedOps
+                  << (std::to_string(static_cast<int>(100 * sharedOps / (sharedBase * threadCount))) + "%")
+                  << std::endl;
+    }
+    return 0;
+}
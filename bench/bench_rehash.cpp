@@ -0,0 +1,159 @@
+/**
+ * Resize latency benchmark
+ *
+ * Bulk-loads N keys one insertion at a time and times every insertion,
+ * for:
+ *   - unordered_map: std::unordered_map<std::string, StoredValue>, which
+ *     rehashes all entries at once whenever it crosses its load factor
+ *   - flat-at-once: KeyValueMap, finishing every resize within the
+ *     insertion that started it (as it did before resizing was incremental)
+ *   - flat: KeyValueMap, moving one old group per insertion
+ *   - datastore: DataStore::set() with --shards shards, each resizing
+ *     incrementally; this includes the store's locking and bookkeeping
+ * The run is split into --windows windows of equal insertion counts; for
+ * each the p99.9 and worst insertion latency are printed, so a resize shows
+ * as a spike in the window it happened in. --csv writes the same series to
+ * a file for plotting. Usage:
+ *   bench_rehash [--keys N] [--windows N] [--shards N] [--csv FILE]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+struct Window {
+    double p999Us;
+    double maxUs;
+};
+
+struct Series {
+    const char* name;
+    std::vector<Window> windows;
+    double totalSeconds;
+    double p999Us;
+    double maxUs;
+};
+
+/**
+ * Time insert(i) for every key index, collecting per-window percentiles
+ */
+Series run(const char* name, size_t keyCount, size_t windowCount, const std::function<void(size_t)>& insert) {
+    using Clock = std::chrono::steady_clock;
+    Series series{name, {}, 0, 0, 0};
+    size_t windowSize = (keyCount + windowCount - 1) / windowCount;
+    std::vector<double> window;
+    std::vector<double> p999s;
+    window.reserve(windowSize);
+    double start = bench::nowSeconds();
+    for (size_t i = 0; i < keyCount; ++i) {
+        auto before = Clock::now();
+        insert(i);
+        auto after = Clock::now();
+        window.push_back(std::chrono::duration<double, std::micro>(after - before).count());
+        if (window.size() == windowSize || i + 1 == keyCount) {
+            double worst = *std::max_element(window.begin(), window.end());
+            series.windows.push_back(Window{bench::percentile(window, 99.9), worst});
+            series.maxUs = std::max(series.maxUs, worst);
+            p999s.push_back(series.windows.back().p999Us);
+            window.clear();
+        }
+    }
+    series.totalSeconds = bench::nowSeconds() - start;
+    series.p999Us = *std::max_element(p999s.begin(), p999s.end());
+    return series;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_rehash [--keys N] [--windows N] [--shards N] [--csv FILE]" << std::endl;
+        return 0;
+    }
+
+    size_t keyCount = static_cast<size_t>(args.getInt("keys", 4000000));
+    size_t windowCount = static_cast<size_t>(std::max(1L, args.getInt("windows", 20)));
+    size_t shards = static_cast<size_t>(args.getInt("shards", static_cast<long>(DataStore::DEFAULT_SHARD_COUNT)));
+    std::string csv = args.getString("csv", "");
+
+    std::vector<std::string> keys;
+    keys.reserve(keyCount);
+    for (size_t i = 0; i < keyCount; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    std::string value(16, 'v');
+
+    std::vector<Series> results;
+    {
+        std::unordered_map<std::string, StoredValue> map;
+        results.push_back(run("unordered_map", keyCount, windowCount, [&](size_t i) {
+            map.emplace(keys[i], StoredValue(Value::copyOf(value), 0));
+        }));
+    }
+    {
+        KeyValueMap map;
+        results.push_back(run("flat-at-once", keyCount, windowCount, [&](size_t i) {
+            map.emplace(keys[i], StoredValue(Value::copyOf(value), 0));
+            map.rehashStep(std::numeric_limits<size_t>::max());
+        }));
+    }
+    {
+        KeyValueMap map;
+        results.push_back(run("flat", keyCount, windowCount, [&](size_t i) {
+            map.emplace(keys[i], StoredValue(Value::copyOf(value), 0));
+        }));
+    }
+    {
+        DataStore store(shards);
+        results.push_back(run("datastore", keyCount, windowCount, [&](size_t i) {
+            store.set(keys[i], value);
+        }));
+    }
+
+    std::cout << "Bulk load: " << keyCount << " keys, " << windowCount << " windows, worst latency per window (us)"
+              << std::endl;
+    std::cout << std::left << std::setw(10) << "keys";
+    for (const Series& series : results) {
+        std::cout << std::setw(16) << series.name;
+    }
+    std::cout << std::endl;
+    size_t windowSize = (keyCount + windowCount - 1) / windowCount;
+    for (size_t w = 0; w < results.front().windows.size(); ++w) {
+        std::cout << std::left << std::setw(10) << std::min(keyCount, (w + 1) * windowSize);
+        for (const Series& series : results) {
+            std::cout << std::fixed << std::setprecision(1) << std::setw(16) << series.windows[w].maxUs;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::endl << std::left << std::setw(16) << "map" << std::setw(12) << "load s" << std::setw(14)
+              << "p99.9 us" << "max us" << std::endl;
+    for (const Series& series : results) {
+        std::cout << std::left << std::setw(16) << series.name << std::fixed << std::setprecision(2)
+                  << std::setw(12) << series.totalSeconds << std::setprecision(1) << std::setw(14)
+                  << series.p999Us << series.maxUs << std::endl;
+    }
+
+    if (!csv.empty()) {
+        std::ofstream file(csv);
+        file << "keys";
+        for (const Series& series : results) {
+            file << ',' << series.name << "_p999_us," << series.name << "_max_us";
+        }
+        file << '\n';
+        for (size_t w = 0; w < results.front().windows.size(); ++w) {
+            file << std::min(keyCount, (w + 1) * windowSize);
+            for (const Series& series : results) {
+                file << ',' << series.windows[w].p999Us << ',' << series.windows[w].maxUs;
+            }
+            file << '\n';
+        }
+    }
+    return 0;
+}
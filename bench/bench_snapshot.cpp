@@ -0,0 +1,210 @@
+/**
+ * Snapshot benchmark
+ *
+ * Loads K keys, keeps W writer threads issuing random SETs and saves a
+ * snapshot to a file while they run, two ways:
+ *   - copy: the original approach, copying the whole map under the store's
+ *     lock (a single-mutex store, as before sharding) and writing the copy
+ *   - cow: DataStore::snapshot(), which only takes shard references under
+ *     the locks; writers copy a shard they touch before it has been saved
+ * Reports the save duration, how long writers were blocked while the
+ * snapshot was captured, the writers' worst latency during the save and the
+ * extra memory the snapshot cost. Usage:
+ *   bench_snapshot [--keys 1000000] [--value-size 32] [--writers 2]
+ *                  [--shards N] [--file bench_snapshot.bdb]
+ */
+#include "bench_common.h"
+#include "datastore.h"
+#include "metrics.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+/**
+ * The pre-sharding store: one map behind one mutex, copied whole to save
+ */
+class SingleMutexStore {
+private:
+    std::unordered_map<std::string, Value> data_;
+    mutable std::mutex mutex_;
+
+public:
+    void set(const std::string& key, std::string_view value) {
+        Value stored = Value::copyOf(value);
+        std::lock_guard<std::mutex> lock(mutex_);
+        data_[key] = std::move(stored);
+    }
+
+    std::unordered_map<std::string, Value> getAllData() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return data_;
+    }
+};
+
+/**
+ * Same estimate DataStore uses for its shard copies: nodes, out-of-line
+ * key bytes and buckets; values are shared in both approaches
+ */
+size_t estimateMapBytes(const std::unordered_map<std::string, Value>& map) {
+    size_t bytes = map.bucket_count() * sizeof(void*);
+    for (const auto& entry : map) {
+        bytes += sizeof(entry) + 2 * sizeof(void*);
+        if (entry.first.capacity() >= sizeof(std::string)) {
+            bytes += entry.first.capacity() + 1;
+        }
+    }
+    return bytes;
+}
+
+std::string_view valueOf(const Value& value) {
+    return value.view();
+}
+
+std::string_view valueOf(const StoredValue& entry) {
+    return entry.value.view();
+}
+
+template <typename Map>
+void writeEntries(std::ofstream& file, const Map& map) {
+    for (const auto& entry : map) {
+        file << std::string_view(entry.first) << ',' << valueOf(entry.second) << '\n';
+    }
+}
+
+struct SaveResult {
+    double saveMs = 0;
+    double pauseUs = 0;
+    double writerMaxUs = 0;
+    double writerP999Us = 0;
+    long writesDuringSave = 0;
+    size_t extraBytes = 0;
+};
+
+/**
+ * Run writers against a store, perform one save while they run, and
+ * collect the writers' latencies during the save
+ */
+SaveResult measureSave(const std::vector<std::string>& keys, int writers,
+                       const std::function<void(const std::string&)>& set,
+                       const std::function<void(SaveResult&)>& save) {
+    std::atomic<bool> stop(false);
+    std::atomic<bool> saving(false);
+    std::mutex samplesMutex;
+    std::vector<double> samples;
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w]() {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (w + 1);
+            std::vector<double> local;
+            while (!stop.load(std::memory_order_relaxed)) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                bool during = saving.load(std::memory_order_relaxed);
+                double start = bench::nowSeconds();
+                set(keys[state % keys.size()]);
+                if (during) local.push_back((bench::nowSeconds() - start) * 1e6);
+            }
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            samples.insert(samples.end(), local.begin(), local.end());
+        });
+    }
+
+    SaveResult result;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    saving = true;
+    double start = bench::nowSeconds();
+    save(result);
+    result.saveMs = (bench::nowSeconds() - start) * 1e3;
+    saving = false;
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result.writesDuringSave = static_cast<long>(samples.size());
+    result.writerP999Us = bench::percentile(samples, 99.9);
+    result.writerMaxUs = bench::percentile(samples, 100);
+    return result;
+}
+
+void report(std::ostream& out, const char* name, const SaveResult& result) {
+    out << std::left << std::setw(7) << name << std::fixed << std::setprecision(1) << std::setw(10)
+        << result.saveMs << std::setw(11) << result.pauseUs << std::setw(13) << result.writerP999Us
+        << std::setw(12) << result.writerMaxUs << std::setw(14) << result.writesDuringSave
+        << std::setprecision(1) << result.extraBytes / (1024.0 * 1024.0) << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    if (args.has("help")) {
+        std::cout << "Usage: bench_snapshot [--keys 1000000] [--value-size 32] [--writers 2]"
+                  << " [--shards N] [--file bench_snapshot.bdb]" << std::endl;
+        return 0;
+    }
+
+    long keyCount = std::max(1L, args.getInt("keys", 1000000));
+    std::string value(static_cast<size_t>(args.getInt("value-size", 32)), 'v');
+    int writers = static_cast<int>(args.getInt("writers", 2));
+    size_t shards = static_cast<size_t>(args.getInt("shards", DataStore::DEFAULT_SHARD_COUNT));
+    std::string filename = args.getString("file", "bench_snapshot.bdb");
+
+    std::vector<std::string> keys;
+    keys.reserve(static_cast<size_t>(keyCount));
+    for (long i = 0; i < keyCount; ++i) {
+        keys.push_back("snapshot:key:" + std::to_string(i));
+    }
+
+    std::cout << keyCount << " keys, " << value.size() << "-byte values, " << writers
+              << " writer threads, " << shards << " shards" << std::endl;
+    std::cout << std::left << std::setw(7) << "mode" << std::setw(10) << "save ms" << std::setw(11)
+              << "pause us" << std::setw(13) << "write p99.9" << std::setw(12) << "write max"
+              << std::setw(14) << "writes/save" << "extra MB" << std::endl;
+
+    {
+        SingleMutexStore store;
+        for (const auto& key : keys) store.set(key, value);
+        SaveResult result = measureSave(
+            keys, writers, [&](const std::string& key) { store.set(key, value); },
+            [&](SaveResult& r) {
+                double start = bench::nowSeconds();
+                auto copy = store.getAllData();
+                r.pauseUs = (bench::nowSeconds() - start) * 1e6;
+                r.extraBytes = estimateMapBytes(copy);
+                std::ofstream file(filename);
+                writeEntries(file, copy);
+            });
+        report(std::cout, "copy", result);
+    }
+
+    {
+        DataStore store(shards);
+        for (const auto& key : keys) store.set(key, value);
+        SaveResult result = measureSave(
+            keys, writers, [&](const std::string& key) { store.set(key, value); },
+            [&](SaveResult& r) {
+                uint64_t copiedBefore = metrics::snapshotBytesCopied.load();
+                StoreSnapshot snapshot = store.snapshot();
+                r.pauseUs = static_cast<double>(metrics::snapshotLastPauseMicros.load());
+                std::ofstream file(filename);
+                for (size_t i = 0; i < snapshot.shardCount(); ++i) {
+                    writeEntries(file, *snapshot.shard(i));
+                    snapshot.release(i);
+                }
+                r.extraBytes = metrics::snapshotBytesCopied.load() - copiedBefore;
+            });
+        report(std::cout, "cow", result);
+    }
+
+    std::remove(filename.c_str());
+    return 0;
+}
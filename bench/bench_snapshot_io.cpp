@@ -0,0 +1,105 @@
+/**
+ * Snapshot file format benchmark
+ *
+ * Saves K keys through PersistenceManager in the original CSV format and
+ * in the binary block format, then loads each file into a fresh store with
+ * the given loader thread counts (the CSV loader is single-threaded).
+ * Throughput is key plus value bytes per second. Usage:
+ *   bench_snapshot_io [--keys 1000000] [--value-size 100] [--threads 1,4]
+ *                     [--shards N] [--file bench_snapshot_io.bdb]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "crc32c.h"
+#include "datastore.h"
+#include "persistence.h"
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+
+namespace {
+
+void report(std::ostream& out, const char* format, const char* operation, const std::string& threads,
+            double seconds, double bytes, uint64_t fileSize) {
+    out << std::left << std::setw(8) << format << std::setw(7) << operation << std::setw(9) << threads
+        << std::fixed << std::setprecision(3) << std::setw(10) << seconds << std::setw(9)
+        << bytes / seconds / 1e9 << std::setprecision(1) << fileSize / (1024.0 * 1024.0) << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_snapshot_io [--keys 1000000] [--value-size 100] [--threads 1,4]"
+            << " [--shards N] [--file bench_snapshot_io.bdb]" << std::endl;
+        return 0;
+    }
+
+    long keyCount = std::max(1L, args.getInt("keys", 1000000));
+    size_t valueSize = static_cast<size_t>(args.getInt("value-size", 100));
+    std::vector<long> threadCounts = args.getIntList("threads", {1, 4});
+    size_t shards = static_cast<size_t>(args.getInt("shards", DataStore::DEFAULT_SHARD_COUNT));
+    std::string filename = args.getString("file", "bench_snapshot_io.bdb");
+
+    DataStore source(shards);
+    double bytes = 0;
+    std::string value(valueSize, 'v');
+    for (long i = 0; i < keyCount; ++i) {
+        std::string key = "snapshot:key:" + std::to_string(i);
+        // Vary the values a little so every record is not byte-identical
+        value[i % valueSize] = static_cast<char>('a' + i % 26);
+        source.set(key, value);
+        bytes += static_cast<double>(key.size() + valueSize);
+    }
+
+    std::vector<char> block(1 << 20, 'x');
+    double start = bench::nowSeconds();
+    uint32_t crc = 0;
+    for (int i = 0; i < 1024; ++i) {
+        crc = crc32c::extend(crc, block.data(), block.size());
+    }
+    out << "CRC-32C: " << std::fixed << std::setprecision(2)
+        << 1024.0 * block.size() / (bench::nowSeconds() - start) / 1e9 << " GB/s (" << std::hex << crc
+        << std::dec << ")" << std::endl;
+
+    out << keyCount << " keys, " << valueSize << "-byte values, " << std::setprecision(1) << bytes / 1e6
+        << " MB of data" << std::endl;
+    out << std::left << std::setw(8) << "format" << std::setw(7) << "op" << std::setw(9) << "threads"
+        << std::setw(10) << "seconds" << std::setw(9) << "GB/s" << "file MB" << std::endl;
+
+    const std::pair<const char*, SnapshotFormat> formats[] = {
+        {"csv", SnapshotFormat::Csv},
+        {"binary", SnapshotFormat::Binary},
+    };
+    for (const auto& format : formats) {
+        PersistenceManager saver(source, filename);
+        saver.setSnapshotFormat(format.second);
+        start = bench::nowSeconds();
+        if (!saver.forceSave()) {
+            std::cerr << "Save failed" << std::endl;
+            return 1;
+        }
+        double seconds = bench::nowSeconds() - start;
+        uint64_t fileSize = std::filesystem::file_size(filename);
+        report(out, format.first, "save", "1", seconds, bytes, fileSize);
+
+        std::vector<long> loaders = format.second == SnapshotFormat::Csv ? std::vector<long>{1} : threadCounts;
+        for (long threads : loaders) {
+            DataStore target(shards);
+            PersistenceManager loader(target, filename);
+            loader.setLoadThreads(static_cast<size_t>(threads));
+            start = bench::nowSeconds();
+            if (!loader.initialize() || target.size() != static_cast<size_t>(keyCount)) {
+                std::cerr << "Load failed" << std::endl;
+                return 1;
+            }
+            seconds = bench::nowSeconds() - start;
+            report(out, format.first, "load", std::to_string(threads), seconds, bytes, fileSize);
+        }
+    }
+
+    std::remove(filename.c_str());
+    return 0;
+}
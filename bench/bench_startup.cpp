@@ -0,0 +1,94 @@
+/**
+ * Startup time benchmark
+ *
+ * Saves K keys as a binary snapshot, then starts a fresh store from the
+ * file with the eager loader and with lazy loading from the memory mapping.
+ * For each mode it reports the time until initialize() returns, until the
+ * first GET has been answered, and until every shard is in memory (the lazy
+ * mode finishes loading in the background). The file is in the page cache,
+ * so these are best-case disk figures. Usage:
+ *   bench_startup [--keys 1000000] [--value-size 100] [--threads 0]
+ *                 [--shards N] [--file bench_startup.bdb]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "datastore.h"
+#include "persistence.h"
+#include <cstdio>
+#include <iomanip>
+#include <thread>
+
+namespace {
+
+std::string keyName(long i) {
+    return "startup:key:" + std::to_string(i);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_startup [--keys 1000000] [--value-size 100] [--threads 0]"
+            << " [--shards N] [--file bench_startup.bdb]" << std::endl;
+        return 0;
+    }
+
+    long keyCount = std::max(1L, args.getInt("keys", 1000000));
+    size_t valueSize = static_cast<size_t>(std::max(1L, args.getInt("value-size", 100)));
+    size_t threads = static_cast<size_t>(args.getInt("threads", 0));
+    size_t shards = static_cast<size_t>(args.getInt("shards", DataStore::DEFAULT_SHARD_COUNT));
+    std::string filename = args.getString("file", "bench_startup.bdb");
+
+    {
+        DataStore source(shards);
+        std::string value(valueSize, 'v');
+        for (long i = 0; i < keyCount; ++i) {
+            value[i % valueSize] = static_cast<char>('a' + i % 26);
+            source.set(keyName(i), value);
+        }
+        PersistenceManager saver(source, filename);
+        if (!saver.forceSave()) {
+            std::cerr << "Save failed" << std::endl;
+            return 1;
+        }
+    }
+
+    out << keyCount << " keys, " << valueSize << "-byte values, " << shards << " shards" << std::endl;
+    out << std::left << std::setw(8) << "mode" << std::setw(12) << "ready ms" << std::setw(16)
+        << "first GET ms" << std::setw(18) << "all loaded ms" << "GET hit" << std::endl;
+
+    const std::pair<const char*, bool> modes[] = {{"eager", false}, {"lazy", true}};
+    for (const auto& mode : modes) {
+        DataStore store(shards);
+        PersistenceManager loader(store, filename);
+        loader.setLoadThreads(threads);
+        loader.setLazyLoad(mode.second);
+
+        double start = bench::nowSeconds();
+        if (!loader.initialize()) {
+            std::cerr << "Load failed" << std::endl;
+            return 1;
+        }
+        double ready = bench::nowSeconds() - start;
+        Value value = store.get(keyName(keyCount / 2));
+        double firstGet = bench::nowSeconds() - start;
+        while (store.pendingShards() > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        double loaded = bench::nowSeconds() - start;
+
+        out << std::left << std::setw(8) << mode.first << std::fixed << std::setprecision(2) << std::setw(12)
+            << ready * 1e3 << std::setw(16) << firstGet * 1e3 << std::setw(18) << loaded * 1e3
+            << (value && value.size() == valueSize ? "yes" : "no") << std::endl;
+        if (store.size() != static_cast<size_t>(keyCount)) {
+            std::cerr << "Loaded " << store.size() << " of " << keyCount << " keys" << std::endl;
+            return 1;
+        }
+        loader.stopPersistence();
+    }
+
+    std::remove(filename.c_str());
+    return 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * Value copy benchmark for GET
+ *
+ * Stores one large value on an embedded server, fetches it repeatedly and
+ * reports the user-space value bytes copied per GET (from the server's INFO
+ * counters) next to the copies made by the original GET path, which copied
+ * the value into a std::optional and again into the response string. Usage:
+ *   bench_value_copy [--value-size BYTES] [--gets N] [--port P]
+ */
+#include "bench_common.h"
+#include "bench_net.h"
+#include "metrics.h"
+#include "output_buffer.h"
+#include <iomanip>
+#include <optional>
+#include <unordered_map>
+
+namespace {
+
+/**
+ * Read one numeric field from an INFO reply
+ */
+uint64_t infoField(const std::string& info, const std::string& name) {
+    size_t pos = info.find(name + ":");
+    if (pos == std::string::npos) return 0;
+    return std::stoull(info.substr(pos + name.size() + 1));
+}
+
+/**
+ * The original GET response path, instrumented to count the value bytes it copies
+ */
+size_t legacyGetResponse(const std::unordered_map<std::string, std::string>& data,
+                         const std::string& key, std::string& response) {
+    size_t copied = 0;
+    std::optional<std::string> value;
+    auto it = data.find(key);
+    if (it != data.end()) {
+        value = it->second;
+        copied += value->size();
+    }
+    std::string framed = "$" + std::to_string(value->length()) + "\n" + *value;
+    copied += value->size();
+    size_t capacity = framed.capacity();
+    response = std::move(framed) + "\n";
+    if (response.capacity() != capacity) copied += value->size();
+    return copied;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Args args(argc, argv);
+    std::ostream& out = bench::results();
+    if (args.has("help")) {
+        out << "Usage: bench_value_copy [--value-size BYTES] [--gets N] [--port P]" << std::endl;
+        return 0;
+    }
+
+    size_t valueSize = static_cast<size_t>(args.getInt("value-size", 1 << 20));
+    long gets = args.getInt("gets", 200);
+    int port = static_cast<int>(args.getInt("port", 7480));
+    std::string value(valueSize, 'x');
+
+    // Original path, in process
+    std::unordered_map<std::string, std::string> legacy{{"big", value}};
+    std::string response;
+    size_t legacyCopied = 0;
+    double start = bench::nowSeconds();
+    for (long i = 0; i < gets; ++i) {
+        legacyCopied += legacyGetResponse(legacy, "big", response);
+    }
+    double legacySeconds = bench::nowSeconds() - start;
+
+    // Current path, in process: shared value queued into an output buffer
+    DataStore store;
+    store.set("big", value);
+    uint64_t copiedBefore = metrics::valueBytesCopied.load();
+    start = bench::nowSeconds();
+    for (long i = 0; i < gets; ++i) {
+        OutputBuffer buffer;
+        Value stored = store.get("big");
+        buffer.append("$" + std::to_string(stored.size()) + "\n");
+        buffer.appendValue(stored);
+        buffer.append("\n");
+    }
+    double currentSeconds = bench::nowSeconds() - start;
+    uint64_t currentCopied = metrics::valueBytesCopied.load() - copiedBefore;
+
+    out << "GET response assembly, " << valueSize << "-byte value, " << gets << " requests" << std::endl;
+    out << std::left << std::setw(12) << "path" << std::setw(24) << "value bytes copied/GET"
+        << "us/GET" << std::endl;
+    out << std::setw(12) << "original" << std::setw(24) << legacyCopied / gets << std::fixed
+        << std::setprecision(2) << legacySeconds * 1e6 / gets << std::endl;
+    out << std::setw(12) << "shared" << std::setw(24) << currentCopied / gets
+        << currentSeconds * 1e6 / gets << std::endl;
+
+    // End to end over TCP, counted by the server
+    bench::EmbeddedServer server(port);
+    if (!server.start()) {
+        out << "Failed to start embedded server on port " << port << std::endl;
+        return 1;
+    }
+    {
+        bench::Client client;
+        std::string reply;
+        if (!client.connect("127.0.0.1", port) || !client.command("SET big " + value, reply)) {
+            out << "Failed to talk to embedded server" << std::endl;
+            return 1;
+        }
+
+        std::string info;
+        client.command("INFO", info);
+        uint64_t before = infoField(info, "value_bytes_copied");
+        start = bench::nowSeconds();
+        for (long i = 0; i < gets; ++i) {
+            client.command("GET big", reply);
+        }
+        double seconds = bench::nowSeconds() - start;
+        client.command("INFO", info);
+        uint64_t after = infoField(info, "value_bytes_copied");
+
+        out << std::endl << "TCP GET via embedded server" << std::endl;
+        out << "value bytes copied/GET: " << (after - before) / gets << std::endl;
+        out << "throughput: " << std::setprecision(1) << gets / seconds << " GET/s, "
+            << gets * static_cast<double>(valueSize) / seconds / (1 << 20) << " MB/s" << std::endl;
+    }
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,579 @@
+#include "binary_snapshot.h"
+#include "crc32c.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr char HEADER_MAGIC[8] = {'B', 'O', 'L', 'T', 'S', 'N', 'A', 'P'};
+constexpr char DELTA_MAGIC[8] = {'B', 'O', 'L', 'T', 'D', 'L', 'T', 'A'};
+constexpr char FOOTER_MAGIC[8] = {'B', 'O', 'L', 'T', 'E', 'N', 'D', '\0'};
+constexpr size_t HEADER_SIZE_V2 = 24;
+constexpr size_t HEADER_SIZE = 32;
+constexpr size_t INDEX_ENTRY_SIZE_V1 = 24;
+constexpr size_t INDEX_ENTRY_SIZE = 32;
+constexpr size_t FOOTER_SIZE = 24;
+constexpr size_t RECORD_HEADER_SIZE = 8;
+constexpr uint32_t NO_SHARD = 0xFFFFFFFF;
+constexpr uint32_t TOMBSTONE = 0xFFFFFFFF;  // Value length of a deleted key in a delta
+constexpr uint32_t EXPIRES_FLAG = 0x80000000;  // Key length bit: a u64 expiry time follows the lengths
+constexpr uint32_t TYPED_FLAG = 0x80000000;    // Value length bit (version 5): the value is a collection
+constexpr uint32_t FIRST_TYPED_VERSION = 5;
+constexpr size_t EXPIRY_SIZE = 8;
+
+struct BlockInfo {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t records;
+    uint32_t crc;
+    uint32_t shard;  // NO_SHARD in version 1 files
+};
+
+/**
+ * Everything but the blocks themselves
+ */
+struct Layout {
+    bool delta = false;
+    uint32_t version = 0;
+    uint32_t shardCount = 0;
+    uint64_t entryCount = 0;
+    uint64_t sequence = 0;  // 0 before version 3
+    std::vector<BlockInfo> blocks;
+};
+
+void putU32(std::string& out, uint32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; ++i) bytes[i] = static_cast<char>(value >> (8 * i));
+    out.append(bytes, sizeof(bytes));
+}
+
+void putU64(std::string& out, uint64_t value) {
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) bytes[i] = static_cast<char>(value >> (8 * i));
+    out.append(bytes, sizeof(bytes));
+}
+
+uint32_t getU32(const char* p) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+           static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+uint64_t getU64(const char* p) {
+    return static_cast<uint64_t>(getU32(p)) | static_cast<uint64_t>(getU32(p + 4)) << 32;
+}
+
+/**
+ * Validate the header, footer and block index of a mapped snapshot
+ * @return true if the layout is consistent, false (after logging) otherwise
+ */
+bool readLayout(const MappedFile& file, const std::string& filename, Layout& layout) {
+    const char* data = file.data();
+    uint64_t fileSize = file.size();
+    layout.delta = fileSize >= sizeof(DELTA_MAGIC) && std::memcmp(data, DELTA_MAGIC, sizeof(DELTA_MAGIC)) == 0;
+    if (fileSize < HEADER_SIZE_V2 + FOOTER_SIZE ||
+        (!layout.delta && std::memcmp(data, HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0)) {
+        std::cerr << "Snapshot " << filename << " is truncated or has an invalid header" << std::endl;
+        return false;
+    }
+    layout.version = getU32(data + 8);
+    if (layout.version < 1 || layout.version > BinarySnapshot::VERSION || (layout.delta && layout.version < 3)) {
+        std::cerr << "Snapshot " << filename << " has unsupported version " << layout.version << std::endl;
+        return false;
+    }
+    uint64_t headerSize = layout.version < 3 ? HEADER_SIZE_V2 : HEADER_SIZE;
+    if (fileSize < headerSize + FOOTER_SIZE) {
+        std::cerr << "Snapshot " << filename << " is truncated or has an invalid header" << std::endl;
+        return false;
+    }
+    layout.shardCount = layout.version == 1 ? 0 : getU32(data + 12);
+    layout.entryCount = getU64(data + 16);
+    layout.sequence = layout.version < 3 ? 0 : getU64(data + 24);
+    size_t entrySize = layout.version == 1 ? INDEX_ENTRY_SIZE_V1 : INDEX_ENTRY_SIZE;
+
+    const char* footer = data + fileSize - FOOTER_SIZE;
+    uint64_t indexOffset = getU64(footer);
+    uint32_t blockCount = getU32(footer + 8);
+    uint32_t indexCrc = getU32(footer + 12);
+    if (std::memcmp(footer + 16, FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) != 0 || indexOffset < headerSize ||
+        indexOffset + static_cast<uint64_t>(blockCount) * entrySize + FOOTER_SIZE != fileSize) {
+        std::cerr << "Snapshot " << filename << " is truncated or has an invalid footer" << std::endl;
+        return false;
+    }
+
+    const char* index = data + indexOffset;
+    if (crc32c::compute(index, static_cast<size_t>(blockCount) * entrySize) != indexCrc) {
+        std::cerr << "Snapshot " << filename << " has a corrupt block index" << std::endl;
+        return false;
+    }
+
+    layout.blocks.resize(blockCount);
+    uint64_t expectedOffset = headerSize;
+    for (uint32_t i = 0; i < blockCount; ++i) {
+        const char* entry = index + static_cast<size_t>(i) * entrySize;
+        BlockInfo& block = layout.blocks[i];
+        block = {getU64(entry), getU64(entry + 8), getU32(entry + 16), getU32(entry + 20), NO_SHARD};
+        if (layout.version > 1) {
+            block.shard = getU32(entry + 24);
+        }
+        if (block.offset != expectedOffset || block.size > indexOffset - expectedOffset ||
+            (layout.version > 1 && block.shard >= layout.shardCount)) {
+            std::cerr << "Snapshot " << filename << " has an invalid block index" << std::endl;
+            return false;
+        }
+        expectedOffset += block.size;
+    }
+    if (expectedOffset != indexOffset) {
+        std::cerr << "Snapshot " << filename << " has an invalid block index" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Verify a block's checksum and call visit(key, value, expiresAt, typed)
+ * for each record, expiresAt being 0 for keys that never expire and typed
+ * true when the value is a serialized Collection
+ * In a delta a deleted key is visited with a null value (data() == nullptr)
+ * @param version The file's version
+ * @param delta true if the block comes from a delta file
+ * @return false if the checksum, the record bounds or the count don't match
+ */
+template <typename Visit>
+bool parseBlock(const MappedFile& file, const BlockInfo& info, uint32_t version, bool delta, Visit visit) {
+    const char* block = file.data() + info.offset;
+    size_t size = static_cast<size_t>(info.size);
+    if (crc32c::compute(block, size) != info.crc) {
+        return false;
+    }
+    size_t pos = 0;
+    uint32_t records = 0;
+    while (pos < size) {
+        if (size - pos < RECORD_HEADER_SIZE) return false;
+        uint32_t keyField = getU32(block + pos);
+        uint64_t keyLength = keyField & ~EXPIRES_FLAG;
+        uint64_t valueLength = getU32(block + pos + 4);
+        pos += RECORD_HEADER_SIZE;
+        int64_t expiresAt = 0;
+        if (keyField & EXPIRES_FLAG) {
+            if (size - pos < EXPIRY_SIZE) return false;
+            expiresAt = static_cast<int64_t>(getU64(block + pos));
+            pos += EXPIRY_SIZE;
+        }
+        if (delta && valueLength == TOMBSTONE) {
+            if (size - pos < keyLength) return false;
+            visit(std::string_view(block + pos, keyLength), std::string_view(), int64_t(0), false);
+            pos += keyLength;
+            ++records;
+            continue;
+        }
+        bool typed = version >= FIRST_TYPED_VERSION && (valueLength & TYPED_FLAG);
+        if (typed) {
+            valueLength &= ~TYPED_FLAG;
+        }
+        if (size - pos < keyLength + valueLength) return false;
+        visit(std::string_view(block + pos, keyLength), std::string_view(block + pos + keyLength, valueLength),
+              expiresAt, typed);
+        pos += keyLength + valueLength;
+        ++records;
+    }
+    return records == info.records;
+}
+
+/**
+ * Serves the shards of a mapped snapshot to DataStore on first use
+ */
+class MappedShardSource : public ShardSource {
+private:
+    std::shared_ptr<MappedFile> file_;
+    std::string filename_;
+    std::vector<std::vector<BlockInfo>> shardBlocks_;
+    std::vector<size_t> shardEntries_;
+    uint32_t version_;
+
+public:
+    MappedShardSource(std::shared_ptr<MappedFile> file, const std::string& filename, const Layout& layout)
+        : file_(std::move(file)), filename_(filename), shardBlocks_(layout.shardCount),
+          shardEntries_(layout.shardCount, 0), version_(layout.version) {
+        for (const BlockInfo& block : layout.blocks) {
+            shardBlocks_[block.shard].push_back(block);
+            shardEntries_[block.shard] += block.records;
+        }
+    }
+
+    bool load(size_t shard, KeyValueMap& map) override {
+        map.reserve(shardEntries_[shard]);
+        // Values keep the mapping alive, not this source
+        std::shared_ptr<const void> owner = file_;
+        int64_t now = DataStore::unixTimeMillis();
+        bool ok = true;
+        bool decoded = true;
+        for (const BlockInfo& block : shardBlocks_[shard]) {
+            bool valid = parseBlock(*file_, block, version_, false,
+                                    [&](std::string_view key, std::string_view value, int64_t expiresAt, bool typed) {
+                if (expiresAt != 0 && expiresAt <= now) {
+                    return;
+                }
+                Value stored;
+                if (typed) {
+                    // Collections are rebuilt: they are modified in place
+                    std::unique_ptr<Collection> collection = Collection::decode(value);
+                    if (!collection) {
+                        decoded = false;
+                        return;
+                    }
+                    stored = Value::collection(std::move(collection));
+                } else if (value.size() <= Value::INLINE_CAPACITY) {
+                    // A value short enough for the handle is cheaper copied than shared
+                    stored = Value::copyOf(value);
+                } else {
+                    stored = Value::external(value, owner);
+                }
+                map.emplace(key, StoredValue{std::move(stored), expiresAt});
+            });
+            if (!valid) {
+                std::cerr << "Checksum mismatch in a block of shard " << shard << " of " << filename_
+                          << std::endl;
+                ok = false;
+            }
+        }
+        if (!decoded) {
+            std::cerr << "Invalid collection in shard " << shard << " of " << filename_ << std::endl;
+            ok = false;
+        }
+        return ok;
+    }
+
+    size_t size(size_t shard) const override {
+        return shardEntries_[shard];
+    }
+};
+
+/**
+ * Writes the blocks, index and footer of a snapshot or delta file
+ * Blocks are closed at BLOCK_SIZE and at the end of each shard
+ */
+class BlockWriter {
+private:
+    AtomicFileWriter& file_;
+    std::vector<BlockInfo> blocks_;
+    uint64_t offset_;
+    std::string block_;
+    uint32_t records_;
+    uint32_t shard_;
+    std::string encoded_;  // Scratch buffer for serialized collections
+
+    void flushBlock() {
+        if (block_.empty()) return;
+        blocks_.push_back({offset_, block_.size(), records_, crc32c::compute(block_.data(), block_.size()), shard_});
+        file_.write(block_);
+        offset_ += block_.size();
+        block_.clear();
+        records_ = 0;
+    }
+
+    void addRecord(std::string_view key, uint32_t valueLength, std::string_view value, int64_t expiresAt) {
+        putU32(block_, static_cast<uint32_t>(key.size()) | (expiresAt != 0 ? EXPIRES_FLAG : 0));
+        putU32(block_, valueLength);
+        if (expiresAt != 0) {
+            putU64(block_, static_cast<uint64_t>(expiresAt));
+        }
+        block_.append(key.data(), key.size());
+        block_.append(value.data(), value.size());
+        ++records_;
+        if (block_.size() >= BinarySnapshot::BLOCK_SIZE) {
+            flushBlock();
+        }
+    }
+
+public:
+    BlockWriter(AtomicFileWriter& file, const char* magic, size_t shardCount, uint64_t entryCount,
+                uint64_t sequence)
+        : file_(file), offset_(HEADER_SIZE), records_(0), shard_(0) {
+        std::string header(magic, sizeof(HEADER_MAGIC));
+        putU32(header, BinarySnapshot::VERSION);
+        putU32(header, static_cast<uint32_t>(shardCount));
+        putU64(header, entryCount);
+        putU64(header, sequence);
+        file_.write(header);
+        block_.reserve(BinarySnapshot::BLOCK_SIZE + BinarySnapshot::BLOCK_SIZE / 4);
+    }
+
+    void beginShard(size_t shard) {
+        shard_ = static_cast<uint32_t>(shard);
+    }
+
+    void add(std::string_view key, const StoredValue& entry) {
+        if (const Collection* collection = entry.value.collection()) {
+            encoded_.clear();
+            collection->encode(encoded_);
+            addRecord(key, static_cast<uint32_t>(encoded_.size()) | TYPED_FLAG, encoded_, entry.expiresAt);
+            return;
+        }
+        addRecord(key, static_cast<uint32_t>(entry.value.size()), entry.value.view(), entry.expiresAt);
+    }
+
+    void addTombstone(std::string_view key) {
+        addRecord(key, TOMBSTONE, std::string_view(), 0);
+    }
+
+    void endShard() {
+        flushBlock();
+    }
+
+    void finish() {
+        std::string index;
+        index.reserve(blocks_.size() * INDEX_ENTRY_SIZE + FOOTER_SIZE);
+        for (const BlockInfo& info : blocks_) {
+            putU64(index, info.offset);
+            putU64(index, info.size);
+            putU32(index, info.records);
+            putU32(index, info.crc);
+            putU32(index, info.shard);
+            putU32(index, 0);
+        }
+        uint32_t indexCrc = crc32c::compute(index.data(), index.size());
+        putU64(index, offset_);
+        putU32(index, static_cast<uint32_t>(blocks_.size()));
+        putU32(index, indexCrc);
+        index.append(FOOTER_MAGIC, sizeof(FOOTER_MAGIC));
+        file_.write(index);
+    }
+};
+
+} // namespace
+
+bool BinarySnapshot::isBinary(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(HEADER_MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, HEADER_MAGIC, sizeof(magic)) == 0;
+}
+
+bool BinarySnapshot::readSequence(const std::string& filename, uint64_t& sequence) {
+    sequence = 0;
+    std::ifstream file(filename, std::ios::binary);
+    char header[HEADER_SIZE];
+    if (!file.read(header, sizeof(header)) || std::memcmp(header, HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0 ||
+        getU32(header + 8) < 3) {
+        return false;
+    }
+    sequence = getU64(header + 24);
+    return true;
+}
+
+void BinarySnapshot::save(AtomicFileWriter& file, StoreSnapshot& snapshot, uint64_t sequence, size_t& entries) {
+    entries = 0;
+    // Keys that expired but were not removed yet are left out
+    int64_t now = DataStore::unixTimeMillis();
+    BlockWriter writer(file, HEADER_MAGIC, snapshot.shardCount(), snapshot.size(), sequence);
+    for (size_t shard = 0; shard < snapshot.shardCount(); ++shard) {
+        writer.beginShard(shard);
+        for (const auto& entry : *snapshot.shard(shard)) {
+            if (!entry.second.expired(now)) {
+                writer.add(entry.first, entry.second);
+                ++entries;
+            }
+        }
+        writer.endShard();
+        snapshot.release(shard);
+    }
+    writer.finish();
+}
+
+void BinarySnapshot::saveDelta(AtomicFileWriter& file, StoreSnapshot& snapshot,
+                               const std::vector<DirtyKeys>& changed, uint64_t sequence, size_t& entries) {
+    entries = 0;
+    for (const DirtyKeys& keys : changed) {
+        entries += keys.size();
+    }
+    int64_t now = DataStore::unixTimeMillis();
+    BlockWriter writer(file, DELTA_MAGIC, snapshot.shardCount(), entries, sequence);
+    for (size_t shard = 0; shard < snapshot.shardCount(); ++shard) {
+        const KeyValueMap& data = *snapshot.shard(shard);
+        writer.beginShard(shard);
+        for (const std::string& key : changed[shard]) {
+            auto it = data.find(key);
+            if (it != data.end() && !it->second.expired(now)) {
+                writer.add(key, it->second);
+            } else {
+                writer.addTombstone(key);
+            }
+        }
+        writer.endShard();
+        snapshot.release(shard);
+    }
+    writer.finish();
+}
+
+bool BinarySnapshot::applyDelta(const std::string& filename, DataStore& store, uint64_t& sequence,
+                                size_t& entries) {
+    entries = 0;
+    std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+    Layout layout;
+    if (!file || !readLayout(*file, filename, layout)) {
+        return false;
+    }
+    if (!layout.delta) {
+        std::cerr << filename << " is not a snapshot delta" << std::endl;
+        return false;
+    }
+    sequence = layout.sequence;
+
+    // Each key appears once per delta, so sets and deletes of one block can
+    // be applied as two batches. A key set with an expiry time that has
+    // passed since is deleted, as the snapshot may still hold it
+    int64_t now = DataStore::unixTimeMillis();
+    std::vector<std::pair<std::string_view, std::string_view>> sets;
+    std::vector<int64_t> expiries;
+    std::vector<std::string_view> deletes;
+    for (const BlockInfo& block : layout.blocks) {
+        sets.clear();
+        expiries.clear();
+        deletes.clear();
+        bool restored = true;
+        bool valid = parseBlock(*file, block, layout.version, true,
+                                [&](std::string_view key, std::string_view value, int64_t expiresAt, bool typed) {
+            if (value.data() == nullptr || (expiresAt != 0 && expiresAt <= now)) {
+                deletes.push_back(key);
+            } else if (typed) {
+                restored = store.restoreCollection(key, value, expiresAt) && restored;
+            } else {
+                sets.emplace_back(key, value);
+                expiries.push_back(expiresAt);
+            }
+        });
+        if (!valid || !restored || !store.mset(sets, expiries)) {
+            std::cerr << "Checksum mismatch or invalid records in " << filename << std::endl;
+            return false;
+        }
+        store.mdel(deletes);
+        entries += block.records;
+    }
+    return true;
+}
+
+bool BinarySnapshot::load(const std::string& filename, DataStore& store, size_t threads, size_t& entries) {
+    entries = 0;
+    std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+    Layout layout;
+    if (!file) {
+        std::cerr << "Failed to open snapshot: " << filename << std::endl;
+        return false;
+    }
+    if (!readLayout(*file, filename, layout)) {
+        return false;
+    }
+    if (layout.delta) {
+        std::cerr << filename << " is a snapshot delta, not a snapshot" << std::endl;
+        return false;
+    }
+
+    // Pre-size the shards so loading never rehashes
+    store.reset(static_cast<size_t>(layout.entryCount));
+
+    const std::vector<BlockInfo>& blocks = layout.blocks;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max<size_t>(1, std::min<size_t>(threads, blocks.size()));
+
+    std::atomic<size_t> nextBlock(0);
+    std::atomic<size_t> loaded(0);
+    std::atomic<bool> failed(false);
+    int64_t now = DataStore::unixTimeMillis();
+    auto worker = [&]() {
+        std::vector<std::pair<std::string_view, std::string_view>> batch;
+        std::vector<int64_t> expiries;
+        size_t i;
+        while (!failed && (i = nextBlock.fetch_add(1)) < blocks.size()) {
+            batch.clear();
+            expiries.clear();
+            bool expiring = false;
+            size_t restored = 0;
+            bool decoded = true;
+            bool valid = parseBlock(*file, blocks[i], layout.version, false,
+                                    [&](std::string_view key, std::string_view value, int64_t expiresAt, bool typed) {
+                if (expiresAt != 0 && expiresAt <= now) {
+                    return;  // Expired while the server was down
+                }
+                if (typed) {
+                    // Rare enough to take the shard lock once per collection
+                    decoded = store.restoreCollection(key, value, expiresAt) && decoded;
+                    ++restored;
+                    return;
+                }
+                batch.emplace_back(key, value);
+                expiries.push_back(expiresAt);
+                expiring = expiring || expiresAt != 0;
+            });
+            if (!expiring) {
+                expiries.clear();  // mset() skips expiry handling for an empty list
+            }
+            // One lock per shard per block
+            if (!valid || !decoded || !store.mset(batch, expiries)) {
+                std::cerr << "Checksum mismatch or invalid records in block " << i << " of " << filename
+                          << std::endl;
+                failed = true;
+            } else {
+                loaded.fetch_add(batch.size() + restored, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    if (failed) {
+        store.reset(0);
+        return false;
+    }
+    entries = loaded.load();
+    return true;
+}
+
+bool BinarySnapshot::openLazy(const std::string& filename, DataStore& store, size_t& entries) {
+    entries = 0;
+    std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+    Layout layout;
+    if (!file || !readLayout(*file, filename, layout) || layout.delta) {
+        return false;
+    }
+    if (layout.version < 2 || layout.shardCount != store.shardCount()) {
+        std::cerr << "Snapshot " << filename << " was not written with " << store.shardCount()
+                  << " shards; loading it eagerly" << std::endl;
+        return false;
+    }
+
+    // A different standard library may hash keys to other shards; check the
+    // first key of every shard before trusting the file's partitioning
+    for (size_t i = 0; i < layout.blocks.size(); ++i) {
+        const BlockInfo& block = layout.blocks[i];
+        if (i > 0 && layout.blocks[i - 1].shard == block.shard) continue;
+        if (block.size < RECORD_HEADER_SIZE) return false;
+        const char* record = file->data() + block.offset;
+        uint64_t keyLength = getU32(record) & ~EXPIRES_FLAG;
+        uint64_t keyOffset = RECORD_HEADER_SIZE + ((getU32(record) & EXPIRES_FLAG) ? EXPIRY_SIZE : 0);
+        if (keyOffset + keyLength > block.size ||
+            store.shardIndex(std::string_view(record + keyOffset, keyLength)) != block.shard) {
+            std::cerr << "Snapshot " << filename << " partitions keys differently; loading it eagerly"
+                      << std::endl;
+            return false;
+        }
+    }
+
+    entries = static_cast<size_t>(layout.entryCount);
+    store.loadLazily(std::make_shared<MappedShardSource>(std::move(file), filename, layout));
+    return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "atomic_file.h"
+#include "datastore.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Versioned binary snapshot file
+ *
+ * Layout, all integers little-endian:
+ *   header  "BOLTSNAP", u32 version, u32 shard count, u64 entry count,
+ *           u64 checkpoint sequence
+ *   blocks  records of u32 key length, u32 value length, [u64 expiry],
+ *           key, value; the expiry time (Unix milliseconds) is present when
+ *           the key length has its top bit set. A block is closed once it
+ *           reaches BLOCK_SIZE and at the end of each shard, so every block
+ *           belongs to exactly one shard
+ *   index   per block: u64 offset, u64 size, u32 records, u32 CRC-32C,
+ *           u32 shard, u32 reserved (0)
+ *   footer  u64 index offset, u32 block count, u32 CRC-32C of the index,
+ *           "BOLTEND\0"
+ * Every block is checksummed and located through the index, so a loader
+ * can verify and parse blocks independently, in parallel, or one shard at
+ * a time on demand. Keys already expired are left out when saving and
+ * skipped when loading. A value length with its top bit set marks a
+ * hash, list or sorted set, the value being its Collection::encode() form;
+ * version 4 files have only strings. Version 3 files have no expiry times, version 2
+ * files no sequence either (24-byte header), and version 1 files also have
+ * a shard count of 0 and 24-byte index entries without the shard; those
+ * are loaded eagerly.
+ *
+ * A delta has the same layout with the magic "BOLTDLTA" and holds only the
+ * keys changed since the previous checkpoint; a value length of
+ * 0xFFFFFFFF marks a deleted key. A snapshot with sequence N is brought up
+ * to date by applying the deltas N+1, N+2, ... in order
+ */
+class BinarySnapshot {
+public:
+    static constexpr uint32_t VERSION = 5;
+
+    /**
+     * Target uncompressed size of one block
+     */
+    static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+
+    /**
+     * Check whether a file starts with the binary snapshot magic
+     * @param filename Path of the file
+     * @return true if the file exists and is a binary snapshot
+     */
+    static bool isBinary(const std::string& filename);
+
+    /**
+     * Read the checkpoint sequence from a snapshot's header
+     * @param filename Path of the file
+     * @param sequence Receives the sequence, 0 if the file has none
+     * @return true if the file is a snapshot of version 3 or later
+     */
+    static bool readSequence(const std::string& filename, uint64_t& sequence);
+
+    /**
+     * Write a snapshot, releasing each shard once it has been written
+     * Whole blocks are handed to the writer; the caller commits the file
+     * @param file An open writer
+     * @param snapshot The snapshot to save; its shards are released
+     * @param sequence Checkpoint sequence the snapshot represents
+     * @param entries Receives the number of entries written
+     */
+    static void save(AtomicFileWriter& file, StoreSnapshot& snapshot, uint64_t sequence, size_t& entries);
+
+    /**
+     * Write a delta holding the changed keys' state in a snapshot
+     * @param file An open writer
+     * @param snapshot The checkpoint's snapshot; its shards are released
+     * @param changed Keys changed since the previous checkpoint, per shard
+     * @param sequence Checkpoint sequence the delta brings a store up to
+     * @param entries Receives the number of records written
+     */
+    static void saveDelta(AtomicFileWriter& file, StoreSnapshot& snapshot, const std::vector<DirtyKeys>& changed,
+                          uint64_t sequence, size_t& entries);
+
+    /**
+     * Apply a delta's sets and deletes to a store
+     * @param filename Path of the delta
+     * @param store The store, holding the state of the previous checkpoint
+     * @param sequence Receives the delta's checkpoint sequence
+     * @param entries Receives the number of records applied
+     * @return true if successful; on failure some blocks may be applied
+     */
+    static bool applyDelta(const std::string& filename, DataStore& store, uint64_t& sequence, size_t& entries);
+
+    /**
+     * Replace the contents of a store with a snapshot file
+     * The file is memory-mapped, the shards are pre-sized from the header's
+     * entry count and the blocks are verified and inserted by several
+     * threads. On any error the store is left empty
+     * @param filename Path of the file to read
+     * @param store The store to load into
+     * @param threads Loader threads, 0 for one per hardware thread
+     * @param entries Receives the number of entries loaded
+     * @return true if successful, false otherwise
+     */
+    static bool load(const std::string& filename, DataStore& store, size_t threads, size_t& entries);
+
+    /**
+     * Serve a snapshot file without loading it first
+     * Only the header and block index are read. The file stays mapped and
+     * each shard is checksummed and indexed the first time it is used (see
+     * DataStore::loadLazily()); values are not copied but point into the
+     * mapping, which stays alive until the last of them is overwritten or
+     * deleted. Requires a file written with the store's shard count whose
+     * keys map to the same shards in this build
+     * @param filename Path of the file to read
+     * @param store The store to serve it from
+     * @param entries Receives the number of entries in the file
+     * @return true if the store now serves the file, false if the file
+     *         can't be served lazily (the store is then unchanged)
+     */
+    static bool openLazy(const std::string& filename, DataStore& store, size_t& entries);
+};
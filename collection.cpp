@@ -0,0 +1,625 @@
+#include "collection.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+/**
+ * Bytes malloc hands out for a request of the given size, as DataStore
+ * estimates them
+ */
+size_t allocationSize(size_t bytes) {
+    return std::max<size_t>((bytes + 8 + 15) & ~static_cast<size_t>(15), 32);
+}
+
+/**
+ * Heap bytes a Value in a full structure takes beyond its handle
+ */
+size_t valueBytes(const Value& value) {
+    size_t footprint = value.footprint();
+    return footprint != 0 ? allocationSize(footprint) : 0;
+}
+
+/**
+ * Heap bytes a std::string takes beyond the object, 0 while it fits SSO
+ */
+size_t stringBytes(const std::string& text) {
+    return text.capacity() > 15 ? allocationSize(text.capacity() + 1) : 0;
+}
+
+// A std::set node: three pointers and a color next to the element
+constexpr size_t SET_NODE_OVERHEAD = 4 * sizeof(void*);
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/**
+ * Read a varint at pos, advancing pos past it
+ * @return false if the bytes end before it does or it overflows
+ */
+bool getVarint(std::string_view bytes, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64 && pos < bytes.size(); shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(bytes[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string encodeScore(double score) {
+    uint64_t bits;
+    std::memcpy(&bits, &score, sizeof(bits));
+    std::string bytes(sizeof(bits), '\0');
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        bytes[i] = static_cast<char>(bits >> (8 * i));
+    }
+    return bytes;
+}
+
+double decodeScore(std::string_view bytes) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < sizeof(bits) && i < bytes.size(); ++i) {
+        bits |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i])) << (8 * i);
+    }
+    double score;
+    std::memcpy(&score, &bits, sizeof(score));
+    return score;
+}
+
+bool fitsCompact(std::string_view element) {
+    return element.size() <= Collection::COMPACT_MAX_VALUE;
+}
+
+} // namespace
+
+std::string_view Listpack::at(size_t offset) const noexcept {
+    uint64_t length = 0;
+    getVarint(data_, offset, length);
+    return std::string_view(data_.data() + offset, static_cast<size_t>(length));
+}
+
+size_t Listpack::next(size_t offset) const noexcept {
+    uint64_t length = 0;
+    getVarint(data_, offset, length);
+    return offset + static_cast<size_t>(length);
+}
+
+void Listpack::encodeEntry(std::string& out, std::string_view entry) {
+    putVarint(out, entry.size());
+    out.append(entry.data(), entry.size());
+}
+
+void Listpack::insert(size_t offset, std::string_view entry) {
+    std::string encoded;
+    encodeEntry(encoded, entry);
+    data_.insert(offset, encoded);
+    ++count_;
+}
+
+void Listpack::erase(size_t offset, size_t count) {
+    size_t end = offset;
+    for (size_t i = 0; i < count; ++i) {
+        end = next(end);
+    }
+    data_.erase(offset, end - offset);
+    count_ -= count;
+}
+
+void Listpack::replace(size_t offset, std::string_view entry) {
+    std::string encoded;
+    encodeEntry(encoded, entry);
+    data_.replace(offset, next(offset) - offset, encoded);
+}
+
+bool Listpack::assign(std::string_view bytes, size_t count) {
+    size_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t length = 0;
+        if (!getVarint(bytes, pos, length) || length > bytes.size() - pos) {
+            return false;
+        }
+        pos += static_cast<size_t>(length);
+    }
+    if (pos != bytes.size()) {
+        return false;
+    }
+    data_.assign(bytes.data(), bytes.size());
+    count_ = count;
+    return true;
+}
+
+size_t Listpack::memoryUsage() const noexcept {
+    return stringBytes(data_);
+}
+
+std::unique_ptr<Collection> Collection::decode(std::string_view bytes) {
+    size_t pos = 1;
+    uint64_t count = 0;
+    if (bytes.empty() || !getVarint(bytes, pos, count) || count > bytes.size()) {
+        return nullptr;
+    }
+    // Walk the entries once to check their bounds before building anything
+    std::vector<std::string_view> entries;
+    entries.reserve(static_cast<size_t>(count));
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t length = 0;
+        if (!getVarint(bytes, pos, length) || length > bytes.size() - pos) {
+            return nullptr;
+        }
+        entries.emplace_back(bytes.data() + pos, static_cast<size_t>(length));
+        pos += static_cast<size_t>(length);
+    }
+    if (pos != bytes.size()) {
+        return nullptr;
+    }
+
+    switch (static_cast<ValueType>(bytes[0])) {
+        case ValueType::Hash: {
+            if (count % 2 != 0) return nullptr;
+            auto hash = std::make_unique<HashValue>();
+            for (size_t i = 0; i < entries.size(); i += 2) {
+                hash->set(entries[i], entries[i + 1]);
+            }
+            return hash;
+        }
+        case ValueType::List: {
+            auto list = std::make_unique<ListValue>();
+            for (std::string_view element : entries) {
+                list->push(false, element);
+            }
+            return list;
+        }
+        case ValueType::SortedSet: {
+            if (count % 2 != 0) return nullptr;
+            auto set = std::make_unique<SortedSetValue>();
+            for (size_t i = 0; i < entries.size(); i += 2) {
+                if (entries[i + 1].size() != sizeof(double)) return nullptr;
+                set->add(entries[i], decodeScore(entries[i + 1]));
+            }
+            return set;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+const char* Collection::typeName(ValueType type) noexcept {
+    switch (type) {
+        case ValueType::String: return "string";
+        case ValueType::Hash: return "hash";
+        case ValueType::List: return "list";
+        case ValueType::SortedSet: return "zset";
+    }
+    return "none";
+}
+
+// HashValue
+
+HashValue::HashValue() : Collection(ValueType::Hash), entryBytes_(0) {}
+
+HashValue::HashValue(const HashValue& other)
+    : Collection(ValueType::Hash), compact_(other.compact_),
+      table_(other.table_ ? std::make_unique<FlatHashMap<Value>>(*other.table_) : nullptr),
+      entryBytes_(other.entryBytes_) {}
+
+size_t HashValue::size() const noexcept {
+    return table_ ? table_->size() : compact_.size() / 2;
+}
+
+size_t HashValue::memoryUsage() const noexcept {
+    size_t bytes = allocationSize(sizeof(HashValue));
+    if (table_) {
+        return bytes + allocationSize(sizeof(FlatHashMap<Value>)) + table_->allocatedBytes() + entryBytes_;
+    }
+    return bytes + compact_.memoryUsage();
+}
+
+std::unique_ptr<Collection> HashValue::clone() const {
+    return std::make_unique<HashValue>(*this);
+}
+
+void HashValue::encode(std::string& out) const {
+    out += static_cast<char>(ValueType::Hash);
+    putVarint(out, size() * 2);
+    if (!table_) {
+        out.append(compact_.bytes().data(), compact_.bytes().size());
+        return;
+    }
+    for (const auto& entry : *table_) {
+        Listpack::encodeEntry(out, entry.first);
+        Listpack::encodeEntry(out, entry.second.view());
+    }
+}
+
+size_t HashValue::findCompact(std::string_view field) const noexcept {
+    for (size_t pos = compact_.begin(); pos != compact_.end(); pos = compact_.next(compact_.next(pos))) {
+        if (compact_.at(pos) == field) {
+            return pos;
+        }
+    }
+    return compact_.end();
+}
+
+void HashValue::convert() {
+    auto table = std::make_unique<FlatHashMap<Value>>();
+    table->reserve(compact_.size() / 2 + 1);
+    size_t bytes = 0;
+    for (size_t pos = compact_.begin(); pos != compact_.end();) {
+        size_t valuePos = compact_.next(pos);
+        auto it = table->emplace(compact_.at(pos), Value::copyOf(compact_.at(valuePos))).first;
+        bytes += (it->first.heapBytes() != 0 ? allocationSize(it->first.heapBytes()) : 0) + valueBytes(it->second);
+        pos = compact_.next(valuePos);
+    }
+    table_ = std::move(table);
+    entryBytes_ = bytes;
+    compact_ = Listpack();
+}
+
+bool HashValue::set(std::string_view field, std::string_view value) {
+    if (!table_) {
+        size_t pos = findCompact(field);
+        if (pos != compact_.end() && fitsCompact(value)) {
+            compact_.replace(compact_.next(pos), value);
+            return false;
+        }
+        if (pos == compact_.end() && fitsCompact(field) && fitsCompact(value) &&
+            compact_.size() / 2 < COMPACT_MAX_ENTRIES) {
+            compact_.insert(compact_.end(), field);
+            compact_.insert(compact_.end(), value);
+            return true;
+        }
+        convert();
+    }
+    auto it = table_->find(field);
+    if (it != table_->end()) {
+        entryBytes_ -= valueBytes(it->second);
+        it->second = Value::copyOf(value);
+        entryBytes_ += valueBytes(it->second);
+        return false;
+    }
+    it = table_->emplace(field, Value::copyOf(value)).first;
+    entryBytes_ += (it->first.heapBytes() != 0 ? allocationSize(it->first.heapBytes()) : 0) + valueBytes(it->second);
+    return true;
+}
+
+Value HashValue::get(std::string_view field) const {
+    if (table_) {
+        auto it = table_->find(field);
+        return it != table_->end() ? it->second : Value();
+    }
+    size_t pos = findCompact(field);
+    return pos != compact_.end() ? Value::copyOf(compact_.at(compact_.next(pos))) : Value();
+}
+
+bool HashValue::erase(std::string_view field) {
+    if (table_) {
+        auto it = table_->find(field);
+        if (it == table_->end()) {
+            return false;
+        }
+        entryBytes_ -= (it->first.heapBytes() != 0 ? allocationSize(it->first.heapBytes()) : 0) +
+                       valueBytes(it->second);
+        table_->erase(it);
+        return true;
+    }
+    size_t pos = findCompact(field);
+    if (pos == compact_.end()) {
+        return false;
+    }
+    compact_.erase(pos, 2);
+    return true;
+}
+
+void HashValue::forEach(const std::function<void(std::string_view, const Value&)>& visit) const {
+    if (table_) {
+        for (const auto& entry : *table_) {
+            visit(entry.first, entry.second);
+        }
+        return;
+    }
+    for (size_t pos = compact_.begin(); pos != compact_.end();) {
+        size_t valuePos = compact_.next(pos);
+        visit(compact_.at(pos), Value::copyOf(compact_.at(valuePos)));
+        pos = compact_.next(valuePos);
+    }
+}
+
+// ListValue
+
+ListValue::ListValue() : Collection(ValueType::List), elementBytes_(0) {}
+
+ListValue::ListValue(const ListValue& other)
+    : Collection(ValueType::List), compact_(other.compact_),
+      elements_(other.elements_ ? std::make_unique<std::deque<Value>>(*other.elements_) : nullptr),
+      elementBytes_(other.elementBytes_) {}
+
+size_t ListValue::size() const noexcept {
+    return elements_ ? elements_->size() : compact_.size();
+}
+
+size_t ListValue::memoryUsage() const noexcept {
+    size_t bytes = allocationSize(sizeof(ListValue));
+    if (elements_) {
+        return bytes + allocationSize(sizeof(std::deque<Value>)) + elements_->size() * sizeof(Value) +
+               elementBytes_;
+    }
+    return bytes + compact_.memoryUsage();
+}
+
+std::unique_ptr<Collection> ListValue::clone() const {
+    return std::make_unique<ListValue>(*this);
+}
+
+void ListValue::encode(std::string& out) const {
+    out += static_cast<char>(ValueType::List);
+    putVarint(out, size());
+    if (!elements_) {
+        out.append(compact_.bytes().data(), compact_.bytes().size());
+        return;
+    }
+    for (const Value& element : *elements_) {
+        Listpack::encodeEntry(out, element.view());
+    }
+}
+
+void ListValue::convert() {
+    auto elements = std::make_unique<std::deque<Value>>();
+    size_t bytes = 0;
+    for (size_t pos = compact_.begin(); pos != compact_.end(); pos = compact_.next(pos)) {
+        elements->push_back(Value::copyOf(compact_.at(pos)));
+        bytes += valueBytes(elements->back());
+    }
+    elements_ = std::move(elements);
+    elementBytes_ = bytes;
+    compact_ = Listpack();
+}
+
+void ListValue::push(bool front, std::string_view element) {
+    if (!elements_) {
+        if (fitsCompact(element) && compact_.size() < COMPACT_MAX_ENTRIES) {
+            compact_.insert(front ? compact_.begin() : compact_.end(), element);
+            return;
+        }
+        convert();
+    }
+    Value value = Value::copyOf(element);
+    elementBytes_ += valueBytes(value);
+    if (front) {
+        elements_->push_front(std::move(value));
+    } else {
+        elements_->push_back(std::move(value));
+    }
+}
+
+Value ListValue::pop(bool front) {
+    if (elements_) {
+        if (elements_->empty()) {
+            return Value();
+        }
+        Value value = front ? std::move(elements_->front()) : std::move(elements_->back());
+        if (front) {
+            elements_->pop_front();
+        } else {
+            elements_->pop_back();
+        }
+        elementBytes_ -= valueBytes(value);
+        return value;
+    }
+    if (compact_.size() == 0) {
+        return Value();
+    }
+    size_t pos = compact_.begin();
+    if (!front) {
+        for (size_t next = compact_.next(pos); next != compact_.end(); next = compact_.next(next)) {
+            pos = next;
+        }
+    }
+    Value value = Value::copyOf(compact_.at(pos));
+    compact_.erase(pos);
+    return value;
+}
+
+void ListValue::range(size_t start, size_t stop, const std::function<void(const Value&)>& visit) const {
+    if (elements_) {
+        for (size_t i = start; i <= stop; ++i) {
+            visit((*elements_)[i]);
+        }
+        return;
+    }
+    size_t pos = compact_.begin();
+    for (size_t i = 0; i < start; ++i) {
+        pos = compact_.next(pos);
+    }
+    for (size_t i = start; i <= stop; ++i, pos = compact_.next(pos)) {
+        visit(Value::copyOf(compact_.at(pos)));
+    }
+}
+
+// SortedSetValue
+
+SortedSetValue::SortedSetValue() : Collection(ValueType::SortedSet), memberBytes_(0) {}
+
+SortedSetValue::SortedSetValue(const SortedSetValue& other)
+    : Collection(ValueType::SortedSet), compact_(other.compact_),
+      scores_(other.scores_ ? std::make_unique<FlatHashMap<double>>(*other.scores_) : nullptr),
+      order_(other.order_ ? std::make_unique<std::set<std::pair<double, std::string>, ScoreOrder>>(*other.order_)
+                          : nullptr),
+      memberBytes_(other.memberBytes_) {}
+
+size_t SortedSetValue::size() const noexcept {
+    return scores_ ? scores_->size() : compact_.size() / 2;
+}
+
+size_t SortedSetValue::memoryUsage() const noexcept {
+    size_t bytes = allocationSize(sizeof(SortedSetValue));
+    if (scores_) {
+        return bytes + allocationSize(sizeof(FlatHashMap<double>)) + scores_->allocatedBytes() +
+               allocationSize(sizeof(*order_)) + memberBytes_;
+    }
+    return bytes + compact_.memoryUsage();
+}
+
+std::unique_ptr<Collection> SortedSetValue::clone() const {
+    return std::make_unique<SortedSetValue>(*this);
+}
+
+void SortedSetValue::encode(std::string& out) const {
+    out += static_cast<char>(ValueType::SortedSet);
+    putVarint(out, size() * 2);
+    if (!scores_) {
+        out.append(compact_.bytes().data(), compact_.bytes().size());
+        return;
+    }
+    for (const auto& member : *order_) {
+        Listpack::encodeEntry(out, member.second);
+        Listpack::encodeEntry(out, encodeScore(member.first));
+    }
+}
+
+size_t SortedSetValue::findCompact(std::string_view member) const noexcept {
+    for (size_t pos = compact_.begin(); pos != compact_.end(); pos = compact_.next(compact_.next(pos))) {
+        if (compact_.at(pos) == member) {
+            return pos;
+        }
+    }
+    return compact_.end();
+}
+
+void SortedSetValue::insertCompact(std::string_view member, double score) {
+    // Before the first member that sorts after this one
+    ScoreOrder less;
+    size_t pos = compact_.begin();
+    while (pos != compact_.end()) {
+        size_t scorePos = compact_.next(pos);
+        if (less(std::make_pair(score, member), std::make_pair(decodeScore(compact_.at(scorePos)), compact_.at(pos)))) {
+            break;
+        }
+        pos = compact_.next(scorePos);
+    }
+    compact_.insert(pos, member);
+    compact_.insert(compact_.next(pos), encodeScore(score));
+}
+
+void SortedSetValue::convert() {
+    auto scores = std::make_unique<FlatHashMap<double>>();
+    auto order = std::make_unique<std::set<std::pair<double, std::string>, ScoreOrder>>();
+    scores->reserve(compact_.size() / 2 + 1);
+    size_t bytes = 0;
+    for (size_t pos = compact_.begin(); pos != compact_.end();) {
+        size_t scorePos = compact_.next(pos);
+        std::string_view member = compact_.at(pos);
+        double score = decodeScore(compact_.at(scorePos));
+        auto it = scores->emplace(member, score).first;
+        auto node = order->emplace_hint(order->end(), score, std::string(member));
+        bytes += (it->first.heapBytes() != 0 ? allocationSize(it->first.heapBytes()) : 0) +
+                 allocationSize(SET_NODE_OVERHEAD + sizeof(*node)) + stringBytes(node->second);
+        pos = compact_.next(scorePos);
+    }
+    scores_ = std::move(scores);
+    order_ = std::move(order);
+    memberBytes_ = bytes;
+    compact_ = Listpack();
+}
+
+bool SortedSetValue::add(std::string_view member, double score) {
+    if (!scores_) {
+        size_t pos = findCompact(member);
+        if (pos != compact_.end()) {
+            if (decodeScore(compact_.at(compact_.next(pos))) != score) {
+                compact_.erase(pos, 2);
+                insertCompact(member, score);
+            }
+            return false;
+        }
+        if (fitsCompact(member) && compact_.size() / 2 < COMPACT_MAX_ENTRIES) {
+            insertCompact(member, score);
+            return true;
+        }
+        convert();
+    }
+    auto it = scores_->find(member);
+    if (it != scores_->end()) {
+        if (it->second != score) {
+            auto node = order_->extract(order_->find(std::make_pair(it->second, member)));
+            node.value().first = score;
+            order_->insert(std::move(node));
+            it->second = score;
+        }
+        return false;
+    }
+    it = scores_->emplace(member, score).first;
+    auto node = order_->emplace(score, std::string(member)).first;
+    memberBytes_ += (it->first.heapBytes() != 0 ? allocationSize(it->first.heapBytes()) : 0) +
+                    allocationSize(SET_NODE_OVERHEAD + sizeof(*node)) + stringBytes(node->second);
+    return true;
+}
+
+bool SortedSetValue::erase(std::string_view member) {
+    if (!scores_) {
+        size_t pos = findCompact(member);
+        if (pos == compact_.end()) {
+            return false;
+        }
+        compact_.erase(pos, 2);
+        return true;
+    }
+    auto it = scores_->find(member);
+    if (it == scores_->end()) {
+        return false;
+    }
+    auto node = order_->find(std::make_pair(it->second, member));
+    memberBytes_ -= (it->first.heapBytes() != 0 ? allocationSize(it->first.heapBytes()) : 0) +
+                    allocationSize(SET_NODE_OVERHEAD + sizeof(*node)) + stringBytes(node->second);
+    order_->erase(node);
+    scores_->erase(it);
+    return true;
+}
+
+bool SortedSetValue::score(std::string_view member, double& score) const {
+    if (scores_) {
+        auto it = scores_->find(member);
+        if (it == scores_->end()) {
+            return false;
+        }
+        score = it->second;
+        return true;
+    }
+    size_t pos = findCompact(member);
+    if (pos == compact_.end()) {
+        return false;
+    }
+    score = decodeScore(compact_.at(compact_.next(pos)));
+    return true;
+}
+
+void SortedSetValue::range(size_t start, size_t stop,
+                           const std::function<void(std::string_view, double)>& visit) const {
+    if (scores_) {
+        size_t count = order_->size();
+        auto it = start <= count - 1 - stop ? std::next(order_->begin(), static_cast<std::ptrdiff_t>(start))
+                                            : std::prev(order_->end(), static_cast<std::ptrdiff_t>(count - start));
+        for (size_t i = start; i <= stop; ++i, ++it) {
+            visit(it->second, it->first);
+        }
+        return;
+    }
+    size_t pos = compact_.begin();
+    for (size_t i = 0; i < start; ++i) {
+        pos = compact_.next(compact_.next(pos));
+    }
+    for (size_t i = start; i <= stop; ++i) {
+        size_t scorePos = compact_.next(pos);
+        visit(compact_.at(pos), decodeScore(compact_.at(scorePos)));
+        pos = compact_.next(scorePos);
+    }
+}
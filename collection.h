@@ -0,0 +1,326 @@
+#pragma once
+
+#include "flat_hash_map.h"
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/**
+ * Kind of value stored under a key
+ */
+enum class ValueType : uint8_t {
+    String,
+    Hash,
+    List,
+    SortedSet
+};
+
+/**
+ * Compact encoding of a small collection, after Redis's listpack
+ * Entries sit back to back in one buffer, each a varint length followed by
+ * its bytes, so a small collection is one allocation with two or so bytes
+ * of overhead per entry. Entries are addressed by byte offset; finding one
+ * walks the buffer, which collections keep cheap by switching to a full
+ * structure past Collection::COMPACT_MAX_ENTRIES entries
+ */
+class Listpack {
+private:
+    std::string data_;
+    size_t count_ = 0;
+
+public:
+    /**
+     * Get the number of entries
+     */
+    size_t size() const noexcept { return count_; }
+
+    /**
+     * Get the offset of the first entry, or end() if there is none
+     */
+    size_t begin() const noexcept { return 0; }
+
+    /**
+     * Get the offset just past the last entry
+     */
+    size_t end() const noexcept { return data_.size(); }
+
+    /**
+     * Get the entry at an offset
+     * @param offset Offset of an entry, from begin() or next()
+     */
+    std::string_view at(size_t offset) const noexcept;
+
+    /**
+     * Get the offset of the entry after the one at offset, end() after the last
+     */
+    size_t next(size_t offset) const noexcept;
+
+    /**
+     * Insert an entry before the one at offset, or append it at end()
+     */
+    void insert(size_t offset, std::string_view entry);
+
+    /**
+     * Remove entries starting at an offset
+     * @param offset Offset of the first entry to remove
+     * @param count Number of entries to remove
+     */
+    void erase(size_t offset, size_t count = 1);
+
+    /**
+     * Replace the entry at an offset
+     */
+    void replace(size_t offset, std::string_view entry);
+
+    /**
+     * Get the encoded entries, as encode() writes them
+     */
+    std::string_view bytes() const noexcept { return data_; }
+
+    /**
+     * Replace the contents with encoded entries
+     * @param bytes count entries in the listpack entry format
+     * @param count The number of entries
+     * @return false if the bytes don't hold exactly count entries
+     */
+    bool assign(std::string_view bytes, size_t count);
+
+    /**
+     * Get the memory the buffer takes
+     */
+    size_t memoryUsage() const noexcept;
+
+    /**
+     * Append one entry in the listpack format to a buffer
+     */
+    static void encodeEntry(std::string& out, std::string_view entry);
+};
+
+/**
+ * A hash, list or sorted set stored under a key, see Value::collection()
+ * Each type starts out in a Listpack and switches to a full structure when
+ * it grows past COMPACT_MAX_ENTRIES entries or is given an element longer
+ * than COMPACT_MAX_VALUE bytes, after which updates cost O(element) instead
+ * of a walk over the listpack. Collections are mutated in place by
+ * DataStore under the shard lock, and cloned first when a snapshot or a
+ * reader still holds the Value they belong to
+ */
+class Collection {
+private:
+    ValueType type_;
+
+protected:
+    explicit Collection(ValueType type) noexcept : type_(type) {}
+
+public:
+    /**
+     * Most entries (hash fields, list elements or sorted set members) a
+     * collection keeps in a Listpack
+     */
+    static constexpr size_t COMPACT_MAX_ENTRIES = 128;
+
+    /**
+     * Longest element a collection keeps in a Listpack
+     */
+    static constexpr size_t COMPACT_MAX_VALUE = 64;
+
+    virtual ~Collection() = default;
+
+    ValueType type() const noexcept { return type_; }
+
+    /**
+     * Get the number of fields, elements or members
+     */
+    virtual size_t size() const noexcept = 0;
+
+    /**
+     * Check whether the collection is still in its Listpack encoding
+     */
+    virtual bool compact() const noexcept = 0;
+
+    /**
+     * Get the memory the collection allocates, kept up to date as it changes
+     */
+    virtual size_t memoryUsage() const noexcept = 0;
+
+    /**
+     * Make an independent copy to modify
+     */
+    virtual std::unique_ptr<Collection> clone() const = 0;
+
+    /**
+     * Serialize the collection: a type byte, a varint entry count and the
+     * entries in the listpack format (hash fields each followed by their
+     * value, list elements in order, sorted set members each followed by
+     * their score as 8 little-endian bytes of a double, in score order)
+     * @param out Buffer to append to
+     */
+    virtual void encode(std::string& out) const = 0;
+
+    /**
+     * Rebuild a collection from encode()'s output
+     * @param bytes The serialized collection
+     * @return The collection, null if the bytes are malformed
+     */
+    static std::unique_ptr<Collection> decode(std::string_view bytes);
+
+    /**
+     * Get the name TYPE reports for a type: "string", "hash", "list" or "zset"
+     */
+    static const char* typeName(ValueType type) noexcept;
+};
+
+/**
+ * Field-value map: a Listpack of alternating fields and values, then a
+ * FlatHashMap
+ */
+class HashValue : public Collection {
+private:
+    Listpack compact_;
+    std::unique_ptr<FlatHashMap<Value>> table_;
+    size_t entryBytes_;  // Heap bytes of the table's fields and values
+
+    size_t findCompact(std::string_view field) const noexcept;
+    void convert();
+
+public:
+    HashValue();
+    HashValue(const HashValue& other);
+
+    size_t size() const noexcept override;
+    bool compact() const noexcept override { return !table_; }
+    size_t memoryUsage() const noexcept override;
+    std::unique_ptr<Collection> clone() const override;
+    void encode(std::string& out) const override;
+
+    /**
+     * Set a field
+     * @return true if the field is new, false if its value was replaced
+     */
+    bool set(std::string_view field, std::string_view value);
+
+    /**
+     * Get a field's value
+     * @return The value, empty if there is no such field
+     */
+    Value get(std::string_view field) const;
+
+    /**
+     * Remove a field
+     * @return true if the field existed
+     */
+    bool erase(std::string_view field);
+
+    /**
+     * Call visit(field, value) for every field, in no particular order
+     */
+    void forEach(const std::function<void(std::string_view, const Value&)>& visit) const;
+};
+
+/**
+ * Sequence of elements pushed and popped at both ends: a Listpack, then a
+ * std::deque
+ */
+class ListValue : public Collection {
+private:
+    Listpack compact_;
+    std::unique_ptr<std::deque<Value>> elements_;
+    size_t elementBytes_;  // Heap bytes of the deque's elements
+
+    void convert();
+
+public:
+    ListValue();
+    ListValue(const ListValue& other);
+
+    size_t size() const noexcept override;
+    bool compact() const noexcept override { return !elements_; }
+    size_t memoryUsage() const noexcept override;
+    std::unique_ptr<Collection> clone() const override;
+    void encode(std::string& out) const override;
+
+    /**
+     * Add an element at the head (front) or the tail
+     */
+    void push(bool front, std::string_view element);
+
+    /**
+     * Remove the element at the head (front) or the tail
+     * @return The element, empty if the list is empty
+     */
+    Value pop(bool front);
+
+    /**
+     * Call visit(element) for the elements from index start to stop, both
+     * included and already clamped to [0, size())
+     */
+    void range(size_t start, size_t stop, const std::function<void(const Value&)>& visit) const;
+};
+
+/**
+ * Members ordered by score, then by member: a Listpack of members each
+ * followed by its score, kept in order, then a FlatHashMap from member to
+ * score next to a std::set of (score, member) pairs
+ */
+class SortedSetValue : public Collection {
+private:
+    struct ScoreOrder {
+        using is_transparent = void;
+        template <typename A, typename B>
+        bool operator()(const A& a, const B& b) const {
+            if (a.first != b.first) return a.first < b.first;
+            return std::string_view(a.second) < std::string_view(b.second);
+        }
+    };
+
+    Listpack compact_;
+    std::unique_ptr<FlatHashMap<double>> scores_;
+    std::unique_ptr<std::set<std::pair<double, std::string>, ScoreOrder>> order_;
+    size_t memberBytes_;  // Heap bytes of the members in scores_ and order_
+
+    size_t findCompact(std::string_view member) const noexcept;
+    void insertCompact(std::string_view member, double score);
+    void convert();
+
+public:
+    SortedSetValue();
+    SortedSetValue(const SortedSetValue& other);
+
+    size_t size() const noexcept override;
+    bool compact() const noexcept override { return !scores_; }
+    size_t memoryUsage() const noexcept override;
+    std::unique_ptr<Collection> clone() const override;
+    void encode(std::string& out) const override;
+
+    /**
+     * Add a member or change its score
+     * @return true if the member is new
+     */
+    bool add(std::string_view member, double score);
+
+    /**
+     * Remove a member
+     * @return true if the member existed
+     */
+    bool erase(std::string_view member);
+
+    /**
+     * Get a member's score
+     * @return false if there is no such member
+     */
+    bool score(std::string_view member, double& score) const;
+
+    /**
+     * Call visit(member, score) for the members ranked start to stop, both
+     * included and already clamped to [0, size()), lowest score first.
+     * Walks in from the nearer end, so ranks near either end are cheap
+     */
+    void range(size_t start, size_t stop, const std::function<void(std::string_view, double)>& visit) const;
+};
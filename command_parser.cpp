@@ -0,0 +1,278 @@
+#include "command_parser.h"
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace {
+
+/**
+ * Read a "<number>\r\n" header starting at pos (just after its type byte)
+ * @param data The unparsed input
+ * @param pos Position of the first digit; advanced past the "\r\n"
+ * @param value Receives the number
+ * @return Ready, Incomplete if the line has not fully arrived, or Error
+ */
+CommandParser::Status readNumberLine(std::string_view data, size_t& pos, long long& value) {
+    constexpr size_t MAX_DIGITS = 19;
+    size_t i = pos;
+    bool negative = i < data.size() && data[i] == '-';
+    if (negative) ++i;
+    value = 0;
+    size_t digits = 0;
+    for (; i < data.size() && data[i] >= '0' && data[i] <= '9'; ++i) {
+        if (++digits > MAX_DIGITS) return CommandParser::Status::Error;
+        value = value * 10 + (data[i] - '0');
+    }
+    if (i + 1 >= data.size()) return CommandParser::Status::Incomplete;
+    if (digits == 0 || data[i] != '\r' || data[i + 1] != '\n') {
+        return CommandParser::Status::Error;
+    }
+    if (negative) value = -value;
+    pos = i + 2;
+    return CommandParser::Status::Ready;
+}
+
+} // namespace
+
+bool protocol::parseInteger(std::string_view text, long long& value) {
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+bool protocol::parseDouble(std::string_view text, double& value) {
+    if (!text.empty() && text.front() == '+') {
+        text.remove_prefix(1);
+    }
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end && !std::isnan(value);
+}
+
+std::string protocol::formatDouble(double value) {
+    if (std::isinf(value)) {
+        return value > 0 ? "inf" : "-inf";
+    }
+    char digits[32];
+    int length = std::snprintf(digits, sizeof(digits), "%.17g", value);
+    return std::string(digits, static_cast<size_t>(length));
+}
+
+bool protocol::parseExpiry(std::string_view option, std::string_view amount, int64_t now, int64_t& expiresAt) {
+    long long number = 0;
+    if (!parseInteger(amount, number) || number <= 0) {
+        return false;
+    }
+    // Reject amounts that would overflow once converted to milliseconds
+    constexpr long long MAX_MILLIS = std::numeric_limits<int64_t>::max() / 2;
+    constexpr long long MAX_SECONDS = MAX_MILLIS / 1000;
+    if (equalsIgnoreCase(option, "EX") && number <= MAX_SECONDS) {
+        expiresAt = now + number * 1000;
+    } else if (equalsIgnoreCase(option, "PX") && number <= MAX_MILLIS) {
+        expiresAt = now + number;
+    } else if (equalsIgnoreCase(option, "EXAT") && number <= MAX_SECONDS) {
+        expiresAt = number * 1000;
+    } else if (equalsIgnoreCase(option, "PXAT") && number <= MAX_MILLIS) {
+        expiresAt = number;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool protocol::splitTrailingExpiry(std::string_view& value, std::string_view& option, std::string_view& amount) {
+    auto trimEnd = [](std::string_view text) {
+        while (!text.empty() && isSpace(text.back())) text.remove_suffix(1);
+        return text;
+    };
+    std::string_view rest = trimEnd(value);
+    size_t amountStart = rest.find_last_of(" \t");
+    if (amountStart == std::string_view::npos) {
+        return false;
+    }
+    std::string_view head = trimEnd(rest.substr(0, amountStart));
+    size_t optionStart = head.find_last_of(" \t");
+    if (optionStart == std::string_view::npos) {
+        return false;  // "SET k EX 10" stores the value "EX 10"
+    }
+    std::string_view candidate = head.substr(optionStart + 1);
+    long long number = 0;
+    if ((!equalsIgnoreCase(candidate, "EX") && !equalsIgnoreCase(candidate, "PX") &&
+         !equalsIgnoreCase(candidate, "EXAT") && !equalsIgnoreCase(candidate, "PXAT")) ||
+        !parseInteger(rest.substr(amountStart + 1), number)) {
+        return false;
+    }
+    option = candidate;
+    amount = rest.substr(amountStart + 1);
+    value = trimEnd(head.substr(0, optionStart));
+    return true;
+}
+
+bool protocol::matchPattern(std::string_view pattern, std::string_view text) {
+    // Iterative matcher: on a mismatch, retry from the last '*' with it
+    // taking one more byte, so no pattern is exponential
+    size_t p = 0;
+    size_t t = 0;
+    size_t starPattern = std::string_view::npos;
+    size_t starText = 0;
+    while (t < text.size()) {
+        bool matched = false;
+        size_t nextPattern = p + 1;
+        if (p < pattern.size()) {
+            char c = pattern[p];
+            if (c == '*') {
+                starPattern = p++;
+                starText = t;
+                continue;
+            }
+            if (c == '?') {
+                matched = true;
+            } else if (c == '[') {
+                size_t i = p + 1;
+                bool negate = i < pattern.size() && pattern[i] == '^';
+                if (negate) ++i;
+                bool inSet = false;
+                for (bool first = true; i < pattern.size() && (first || pattern[i] != ']'); ++i, first = false) {
+                    if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+                        inSet |= pattern[++i] == text[t];
+                    } else if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                        unsigned char low = static_cast<unsigned char>(pattern[i]);
+                        unsigned char high = static_cast<unsigned char>(pattern[i + 2]);
+                        if (low > high) std::swap(low, high);
+                        unsigned char byte = static_cast<unsigned char>(text[t]);
+                        inSet |= byte >= low && byte <= high;
+                        i += 2;
+                    } else {
+                        inSet |= pattern[i] == text[t];
+                    }
+                }
+                matched = inSet != negate;
+                nextPattern = i < pattern.size() ? i + 1 : i;
+            } else if (c == '\\' && p + 1 < pattern.size()) {
+                matched = pattern[p + 1] == text[t];
+                nextPattern = p + 2;
+            } else {
+                matched = c == text[t];
+            }
+        }
+        if (matched) {
+            p = nextPattern;
+            ++t;
+        } else if (starPattern != std::string_view::npos) {
+            p = starPattern + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+std::string protocol::patternPrefix(std::string_view pattern) {
+    std::string prefix;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char c = pattern[i];
+        if (c == '*' || c == '?' || c == '[') {
+            break;
+        }
+        if (c == '\\' && i + 1 < pattern.size()) {
+            c = pattern[++i];
+        }
+        prefix.push_back(c);
+    }
+    return prefix;
+}
+
+CommandParser::Status CommandParser::next(InputBuffer& input, Command& command) {
+    std::string_view data = input.view();
+    if (data.empty()) {
+        return Status::Incomplete;
+    }
+
+    if (protocol_ == Protocol::Detect) {
+        if (data.front() == '*') {
+            protocol_ = Protocol::Resp;
+        } else {
+            size_t newline = data.find('\n');
+            if (newline == std::string_view::npos) {
+                return Status::Incomplete;
+            }
+            protocol_ = (newline > 0 && data[newline - 1] == '\r') ? Protocol::Resp : Protocol::Text;
+        }
+    }
+
+    if (protocol_ == Protocol::Resp && data.front() == '*') {
+        return parseArray(input, command);
+    }
+
+    std::string_view line;
+    if (!input.readLine(line)) {
+        return Status::Incomplete;
+    }
+    command = protocol::parseCommand(line);
+    return Status::Ready;
+}
+
+CommandParser::Status CommandParser::parseArray(InputBuffer& input, Command& command) {
+    std::string_view data = input.view();
+    Status status;
+
+    // Progress is kept as offsets from the front of the unparsed input, so
+    // an array that arrives over many reads is not parsed from the start
+    // again each time, and stays valid when the buffer grows
+    if (arrayLength_ < 0) {
+        size_t pos = 1;
+        long long count;
+        status = readNumberLine(data, pos, count);
+        if (status != Status::Ready || count > MAX_ARGUMENTS) {
+            error_ = "invalid multibulk length";
+            return status == Status::Incomplete ? status : Status::Error;
+        }
+        arrayLength_ = count > 0 ? count : 0;
+        arrayParsed_ = pos;
+        spans_.clear();
+    }
+
+    while (static_cast<long long>(spans_.size()) < arrayLength_) {
+        size_t pos = arrayParsed_;
+        if (pos >= data.size()) return Status::Incomplete;
+        if (data[pos] != '$') {
+            error_ = "expected '$'";
+            return Status::Error;
+        }
+        ++pos;
+        long long length;
+        status = readNumberLine(data, pos, length);
+        if (status == Status::Incomplete) return status;
+        if (status != Status::Ready || length < 0 || length > MAX_BULK_LENGTH) {
+            error_ = "invalid bulk length";
+            return Status::Error;
+        }
+        size_t size = static_cast<size_t>(length);
+        if (data.size() - pos < size + 2) return Status::Incomplete;
+        if (data[pos + size] != '\r' || data[pos + size + 1] != '\n') {
+            error_ = "bulk string not terminated by CRLF";
+            return Status::Error;
+        }
+        spans_.emplace_back(pos, size);
+        arrayParsed_ = pos + size + 2;
+    }
+
+    argv_.clear();
+    for (const auto& span : spans_) {
+        argv_.push_back(data.substr(span.first, span.second));
+    }
+    input.consume(arrayParsed_);
+    arrayLength_ = -1;
+
+    command = Command();
+    if (!argv_.empty()) {
+        command.name = argv_[0];
+        command.type = protocol::lookupCommand(command.name);
+        command.argv = argv_.data() + 1;
+        command.argc = argv_.size() - 1;
+    }
+    return Status::Ready;
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+#include "input_buffer.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Commands understood by the TCP protocol
+ */
+enum class CommandType {
+    Unknown,
+    Set,
+    Get,
+    Delete,
+    Info,
+    Quit,
+    Ping,
+    Echo,
+    Config,
+    MGet,
+    MSet,
+    MDel,
+    Expire,
+    PExpire,
+    PExpireAt,
+    Persist,
+    Ttl,
+    PTtl,
+    Scan,
+    Range,
+    Type,
+    HSet,
+    HGet,
+    HDel,
+    HGetAll,
+    HLen,
+    LPush,
+    RPush,
+    LPop,
+    RPop,
+    LRange,
+    LLen,
+    ZAdd,
+    ZRem,
+    ZScore,
+    ZRange,
+    ZCard,
+    Incr,
+    IncrBy,
+    Decr,
+    DecrBy,
+    Append,
+    GetSet,
+    Cas
+};
+
+/**
+ * Wire protocol spoken by a connection
+ */
+enum class Protocol {
+    Detect,  // Nothing received yet
+    Text,    // Newline-terminated command lines, replies end in "\n"
+    Resp     // RESP2 arrays of bulk strings (or inline lines), replies end in "\r\n"
+};
+
+/**
+ * One parsed command
+ * All views point into the connection's input buffer; nothing is copied.
+ * Text commands keep the unparsed remainder of the line in args, RESP
+ * commands have their arguments already split into argv
+ */
+struct Command {
+    CommandType type = CommandType::Unknown;
+    std::string_view name;                   // Command name as sent by the client
+    std::string_view args;                   // Text: everything after the name, leading separator included
+    const std::string_view* argv = nullptr;  // RESP: arguments after the name
+    size_t argc = 0;
+};
+
+/**
+ * Zero-copy parsing of the line-based text protocol
+ * Commands are recognised by switching on a compile-time hash of the
+ * upper-cased name, so dispatch costs one pass over the name and one
+ * comparison, and a hash collision between two commands fails to compile
+ */
+namespace protocol {
+
+constexpr char toUpper(char c) {
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+/**
+ * Case-insensitive FNV-1a hash of a command name
+ */
+constexpr uint32_t commandHash(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(toUpper(c))) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Compare a name against an upper-case command name, ignoring case
+ */
+constexpr bool equalsIgnoreCase(std::string_view name, std::string_view upper) {
+    if (name.size() != upper.size()) return false;
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (toUpper(name[i]) != upper[i]) return false;
+    }
+    return true;
+}
+
+/**
+ * Resolve a hash match: the name must really be the command it hashed to
+ */
+constexpr CommandType confirm(std::string_view name, std::string_view upper, CommandType type) {
+    return equalsIgnoreCase(name, upper) ? type : CommandType::Unknown;
+}
+
+/**
+ * Map a command name to its type
+ * @param name The name, in any case
+ * @return The command, or CommandType::Unknown
+ */
+constexpr CommandType lookupCommand(std::string_view name) {
+    switch (commandHash(name)) {
+        case commandHash("SET"): return confirm(name, "SET", CommandType::Set);
+        case commandHash("GET"): return confirm(name, "GET", CommandType::Get);
+        case commandHash("DELETE"): return confirm(name, "DELETE", CommandType::Delete);
+        case commandHash("INFO"): return confirm(name, "INFO", CommandType::Info);
+        case commandHash("QUIT"): return confirm(name, "QUIT", CommandType::Quit);
+        case commandHash("DEL"): return confirm(name, "DEL", CommandType::Delete);
+        case commandHash("PING"): return confirm(name, "PING", CommandType::Ping);
+        case commandHash("ECHO"): return confirm(name, "ECHO", CommandType::Echo);
+        case commandHash("CONFIG"): return confirm(name, "CONFIG", CommandType::Config);
+        case commandHash("MGET"): return confirm(name, "MGET", CommandType::MGet);
+        case commandHash("MSET"): return confirm(name, "MSET", CommandType::MSet);
+        case commandHash("MDEL"): return confirm(name, "MDEL", CommandType::MDel);
+        case commandHash("EXPIRE"): return confirm(name, "EXPIRE", CommandType::Expire);
+        case commandHash("PEXPIRE"): return confirm(name, "PEXPIRE", CommandType::PExpire);
+        case commandHash("PEXPIREAT"): return confirm(name, "PEXPIREAT", CommandType::PExpireAt);
+        case commandHash("PERSIST"): return confirm(name, "PERSIST", CommandType::Persist);
+        case commandHash("TTL"): return confirm(name, "TTL", CommandType::Ttl);
+        case commandHash("PTTL"): return confirm(name, "PTTL", CommandType::PTtl);
+        case commandHash("SCAN"): return confirm(name, "SCAN", CommandType::Scan);
+        case commandHash("RANGE"): return confirm(name, "RANGE", CommandType::Range);
+        case commandHash("TYPE"): return confirm(name, "TYPE", CommandType::Type);
+        case commandHash("HSET"): return confirm(name, "HSET", CommandType::HSet);
+        case commandHash("HGET"): return confirm(name, "HGET", CommandType::HGet);
+        case commandHash("HDEL"): return confirm(name, "HDEL", CommandType::HDel);
+        case commandHash("HGETALL"): return confirm(name, "HGETALL", CommandType::HGetAll);
+        case commandHash("HLEN"): return confirm(name, "HLEN", CommandType::HLen);
+        case commandHash("LPUSH"): return confirm(name, "LPUSH", CommandType::LPush);
+        case commandHash("RPUSH"): return confirm(name, "RPUSH", CommandType::RPush);
+        case commandHash("LPOP"): return confirm(name, "LPOP", CommandType::LPop);
+        case commandHash("RPOP"): return confirm(name, "RPOP", CommandType::RPop);
+        case commandHash("LRANGE"): return confirm(name, "LRANGE", CommandType::LRange);
+        case commandHash("LLEN"): return confirm(name, "LLEN", CommandType::LLen);
+        case commandHash("ZADD"): return confirm(name, "ZADD", CommandType::ZAdd);
+        case commandHash("ZREM"): return confirm(name, "ZREM", CommandType::ZRem);
+        case commandHash("ZSCORE"): return confirm(name, "ZSCORE", CommandType::ZScore);
+        case commandHash("ZRANGE"): return confirm(name, "ZRANGE", CommandType::ZRange);
+        case commandHash("ZCARD"): return confirm(name, "ZCARD", CommandType::ZCard);
+        case commandHash("INCR"): return confirm(name, "INCR", CommandType::Incr);
+        case commandHash("INCRBY"): return confirm(name, "INCRBY", CommandType::IncrBy);
+        case commandHash("DECR"): return confirm(name, "DECR", CommandType::Decr);
+        case commandHash("DECRBY"): return confirm(name, "DECRBY", CommandType::DecrBy);
+        case commandHash("APPEND"): return confirm(name, "APPEND", CommandType::Append);
+        case commandHash("GETSET"): return confirm(name, "GETSET", CommandType::GetSet);
+        case commandHash("CAS"): return confirm(name, "CAS", CommandType::Cas);
+        default: return CommandType::Unknown;
+    }
+}
+
+constexpr bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * Strip leading and trailing whitespace
+ */
+constexpr std::string_view trim(std::string_view text) {
+    while (!text.empty() && isSpace(text.front())) text.remove_prefix(1);
+    while (!text.empty() && isSpace(text.back())) text.remove_suffix(1);
+    return text;
+}
+
+/**
+ * Take the next whitespace-separated token
+ * @param rest Remaining text; advanced past the token
+ * @return The token, empty if there are no more tokens
+ */
+constexpr std::string_view nextToken(std::string_view& rest) {
+    size_t start = 0;
+    while (start < rest.size() && isSpace(rest[start])) ++start;
+    size_t end = start;
+    while (end < rest.size() && !isSpace(rest[end])) ++end;
+    std::string_view token = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return token;
+}
+
+/**
+ * Parse a decimal integer argument
+ * @param text Optional '-' followed by digits and nothing else
+ * @param value Receives the number
+ * @return false if text is not such a number or overflows
+ */
+bool parseInteger(std::string_view text, long long& value);
+
+/**
+ * Parse a floating-point argument, such as a sorted set score
+ * @param text A decimal or exponent number, or inf, +inf or -inf
+ * @param value Receives the number
+ * @return false if text is not such a number or is NaN
+ */
+bool parseDouble(std::string_view text, double& value);
+
+/**
+ * Format a floating-point number so that parseDouble() reads back the
+ * same value, e.g. "1.5", "3", "inf"
+ */
+std::string formatDouble(double value);
+
+/**
+ * Turn a SET expiry option into an absolute expiry time
+ * @param option EX or PX (seconds or milliseconds from now), EXAT or PXAT
+ *        (Unix time in seconds or milliseconds), in any case
+ * @param amount The option's argument, a positive integer
+ * @param now Current Unix time in milliseconds
+ * @param expiresAt Receives the expiry time in Unix milliseconds
+ * @return false if the option is unknown or the amount is invalid
+ */
+bool parseExpiry(std::string_view option, std::string_view amount, int64_t now, int64_t& expiresAt);
+
+/**
+ * Split a trailing expiry option off a text protocol SET value
+ * In text mode the value is the rest of the line, so "SET k v EX 10"
+ * arrives as the value "v EX 10"; this turns it into "v"
+ * @param value The value; shortened if it ends in an option
+ * @param option Receives the option name, e.g. "EX"
+ * @param amount Receives the option's argument
+ * @return true if an option was split off
+ */
+bool splitTrailingExpiry(std::string_view& value, std::string_view& option, std::string_view& amount);
+
+/**
+ * Match a key against a glob-style pattern
+ * @param pattern '*' matches any run of bytes, '?' any one byte, "[abc]",
+ *        "[a-z]" and "[^abc]" a set of bytes; '\\' escapes the next byte
+ * @param text The key
+ * @return true if the whole key matches
+ */
+bool matchPattern(std::string_view pattern, std::string_view text);
+
+/**
+ * Get the literal prefix every key matching a glob-style pattern starts with
+ * @param pattern A pattern as matchPattern() takes it
+ * @return The bytes before the first wildcard, escapes resolved
+ */
+std::string patternPrefix(std::string_view pattern);
+
+/**
+ * Parse one command line
+ * @param line The line without its terminator; surrounding whitespace is ignored
+ * @return The parsed command; name is empty for a blank line
+ */
+constexpr Command parseCommand(std::string_view line) {
+    Command command;
+    command.args = trim(line);
+    command.name = nextToken(command.args);
+    command.type = lookupCommand(command.name);
+    return command;
+}
+
+} // namespace protocol
+
+/**
+ * Walks the arguments of a command the same way for both protocols
+ */
+class CommandArgs {
+private:
+    std::string_view line_;
+    const std::string_view* argv_;
+    size_t argc_;
+    size_t index_ = 0;
+
+public:
+    explicit CommandArgs(const Command& command)
+        : line_(command.args), argv_(command.argv), argc_(command.argc) {}
+
+    /**
+     * Take the next argument (a whitespace-separated token in text mode)
+     * @return true if there was one
+     */
+    bool next(std::string_view& arg) {
+        if (argv_) {
+            if (index_ == argc_) return false;
+            arg = argv_[index_++];
+            return true;
+        }
+        arg = protocol::nextToken(line_);
+        return !arg.empty();
+    }
+
+    /**
+     * Take a value argument. In text mode this is the rest of the line
+     * minus one separating space, so values may contain spaces
+     * @return true if there was one (always in text mode, where it may be empty)
+     */
+    bool rest(std::string_view& arg) {
+        if (argv_) return next(arg);
+        if (!line_.empty() && line_.front() == ' ') line_.remove_prefix(1);
+        arg = line_;
+        line_ = std::string_view();
+        return true;
+    }
+
+    /**
+     * Check whether every argument has been taken
+     */
+    bool done() const {
+        return argv_ ? index_ == argc_ : protocol::trim(line_).empty();
+    }
+};
+
+/**
+ * Per-connection command parser
+ * The protocol is picked from the first bytes a client sends: a '*' starts
+ * a RESP2 array, and a first line ending in "\r\n" is a RESP inline
+ * command (what redis-benchmark's *_INLINE tests send). Anything else is
+ * the newline-terminated text protocol. RESP bulk strings are taken from
+ * the input buffer by their length prefix, so payloads are never scanned
+ * and may contain any bytes, including newlines
+ */
+class CommandParser {
+private:
+    Protocol protocol_ = Protocol::Detect;
+    std::vector<std::string_view> argv_;  // Reused for every RESP command
+    const char* error_ = "";
+
+    // State of a RESP array that has only partly arrived
+    long long arrayLength_ = -1;                       // Elements expected, -1 between arrays
+    size_t arrayParsed_ = 0;                           // Input bytes parsed so far
+    std::vector<std::pair<size_t, size_t>> spans_;     // Offset and length of each parsed element
+
+public:
+    enum class Status {
+        Incomplete,  // Need more input
+        Ready,       // A command was parsed (its name is empty for a blank line)
+        Error        // Malformed input; see error()
+    };
+
+    /**
+     * Largest accepted number of elements in a RESP array
+     */
+    static constexpr long long MAX_ARGUMENTS = 1024 * 1024;
+
+    /**
+     * Largest accepted RESP bulk string
+     */
+    static constexpr long long MAX_BULK_LENGTH = 512LL * 1024 * 1024;
+
+    /**
+     * Parse the next command from the front of a connection's input
+     * The command's views stay valid until the buffer's next prepare()
+     * @param input Received bytes; the parsed command is consumed
+     * @param command Receives the command
+     * @return Whether a command was parsed
+     */
+    Status next(InputBuffer& input, Command& command);
+
+    Protocol protocol() const { return protocol_; }
+
+    /**
+     * Describe the last protocol error
+     */
+    const char* error() const { return error_; }
+
+private:
+    /**
+     * Parse a RESP array of bulk strings
+     */
+    Status parseArray(InputBuffer& input, Command& command);
+};
+
+static_assert(protocol::lookupCommand("get") == CommandType::Get, "lookup ignores case");
+static_assert(protocol::lookupCommand("GETX") == CommandType::Unknown, "lookup needs an exact name");
+static_assert(protocol::parseCommand("  set k  v ").args == " k  v", "args keep their separator");
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC-32C (Castagnoli) checksums for on-disk data
+ * Uses the SSE4.2 crc32 instruction when the CPU has it and a
+ * slicing-by-8 table otherwise; both give identical results
+ */
+namespace crc32c {
+
+/**
+ * Extend a checksum over more bytes
+ * @param crc Checksum of the preceding bytes (0 to start)
+ * @param data The bytes
+ * @param size Number of bytes
+ * @return Checksum of the preceding bytes followed by these
+ */
+uint32_t extend(uint32_t crc, const void* data, size_t size);
+
+/**
+ * Checksum a buffer
+ */
+inline uint32_t compute(const void* data, size_t size) {
+    return extend(0, data, size);
+}
+
+} // namespace crc32c
@@ -1,10 +1,349 @@
 #include "datastore.h"
+#include "append_only_log.h"
+#include "command_parser.h"
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
 
-bool DataStore::set(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
+namespace {
+
+/**
+ * Lock every shard in index order
+ * Multi-shard operations must always acquire locks in ascending order so
+ * they cannot deadlock against each other
+ * @tparam Lock std::unique_lock for writers, std::shared_lock for readers
+ */
+template <typename Lock, typename ShardArray>
+std::vector<Lock> lockAllShards(ShardArray& shards, size_t count) {
+    std::vector<Lock> locks;
+    locks.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        locks.emplace_back(shards[i].mutex);
+    }
+    return locks;
+}
+
+/**
+ * Check whether a key has expired, reading the clock only for keys that
+ * have an expiry time
+ */
+bool hasExpired(const StoredValue& entry) {
+    return entry.expiresAt != 0 && entry.expiresAt <= DataStore::unixTimeMillis();
+}
+
+/**
+ * Bytes malloc hands out for a request: glibc adds an 8-byte header and
+ * rounds chunks up to 16 bytes, 32 at least
+ */
+size_t allocationSize(size_t bytes) {
+    return std::max<size_t>((bytes + 8 + 15) & ~static_cast<size_t>(15), 32);
+}
+
+/**
+ * Bytes a buffer takes: its size class if it is a slab arena block, its
+ * malloc chunk otherwise
+ */
+size_t bufferSize(size_t bytes, bool inArena) {
+    return inArena ? SlabArena::blockSize(bytes) : allocationSize(bytes);
+}
+
+/**
+ * Memory one entry allocates beyond its table slot: the key's buffer unless
+ * it is kept inline, and likewise the value's
+ */
+size_t entryBytes(const InlineString& key, const StoredValue& entry) {
+    size_t bytes = 0;
+    if (key.heapBytes() != 0) {
+        bytes += bufferSize(key.heapBytes(), key.inArena());
+    }
+    if (entry.value.footprint() != 0) {
+        bytes += bufferSize(entry.value.footprint(), entry.value.inArena());
+    }
+    return bytes;
+}
+
+/**
+ * Turn LRANGE-style indexes into positions in a collection of the given
+ * size: negative ones count from the end, and both are clamped
+ * @return false if the range holds nothing
+ */
+bool clampRange(long long& start, long long& stop, size_t size) {
+    long long count = static_cast<long long>(size);
+    if (start < 0) start = std::max(start + count, 0LL);
+    if (stop < 0) stop += count;
+    stop = std::min(stop, count - 1);
+    return start <= stop;
+}
+
+/**
+ * Memory a key takes in the ordered index: a tree node holding an
+ * InlineString, plus the key's own buffer if it is too long for that
+ */
+size_t indexBytes(std::string_view key) {
+    constexpr size_t NODE_BYTES = 4 * sizeof(void*) + sizeof(InlineString);
+    return allocationSize(NODE_BYTES) + (key.size() > InlineString::INLINE_CAPACITY ? allocationSize(key.size()) : 0);
+}
+
+/**
+ * Create an empty shard map whose long keys come from the shard's arena
+ */
+std::shared_ptr<KeyValueMap> newShardMap(const std::shared_ptr<SlabArena>& arena) {
+    auto map = std::make_shared<KeyValueMap>();
+    map->setKeyArena(arena);
+    return map;
+}
+
+/**
+ * Per-thread xorshift64 generator for sampling and LFU increments
+ */
+uint64_t randomNumber() {
+    thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(&state);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+bool isLfu(EvictionPolicy policy) {
+    return policy == EvictionPolicy::AllKeysLfu || policy == EvictionPolicy::VolatileLfu;
+}
+
+bool isVolatileOnly(EvictionPolicy policy) {
+    return policy == EvictionPolicy::VolatileLru || policy == EvictionPolicy::VolatileLfu ||
+           policy == EvictionPolicy::VolatileRandom || policy == EvictionPolicy::VolatileTtl;
+}
+
+// LFU counters as in Redis: a new key starts at LFU_INIT_VALUE so it is not
+// evicted before it had a chance to be read, each access increments the
+// counter with probability 1 / ((counter - LFU_INIT_VALUE) * LFU_LOG_FACTOR + 1),
+// so 255 takes about a million accesses, and the counter loses one per
+// LFU_DECAY_MINUTES without access
+constexpr uint32_t LFU_INIT_VALUE = 5;
+constexpr uint32_t LFU_LOG_FACTOR = 10;
+constexpr uint32_t LFU_DECAY_MINUTES = 1;
+
+uint32_t lfuMinutes(uint32_t clock) {
+    return (clock / 60000) & 0xFFFF;
+}
+
+/**
+ * Get an LFU stamp's counter after decaying it to the given minute
+ */
+uint32_t lfuCounter(uint32_t stamp, uint32_t minutes) {
+    uint32_t counter = stamp & 0xFF;
+    uint32_t periods = ((minutes - (stamp >> 8)) & 0xFFFF) / LFU_DECAY_MINUTES;
+    return periods >= counter ? 0 : counter - periods;
+}
+
+uint32_t lfuIncrement(uint32_t counter) {
+    if (counter == 255) {
+        return counter;
+    }
+    uint32_t base = counter > LFU_INIT_VALUE ? counter - LFU_INIT_VALUE : 0;
+    if (randomNumber() % (base * LFU_LOG_FACTOR + 1) == 0) {
+        ++counter;
+    }
+    return counter;
+}
+
+/**
+ * Visit up to count entries of a map, starting at a random slot
+ * @param volatileOnly Only visit keys with an expiry time; such keys may be
+ *        sparse, so the walk gives up after a bounded number of entries
+ * @param visit Called as visit(key, entry)
+ */
+template <typename Visit>
+void sampleEntries(const KeyValueMap& map, size_t count, bool volatileOnly, Visit visit) {
+    if (map.empty()) {
+        return;
+    }
+    size_t limit = std::min(map.size(), count * 64);
+    auto it = map.seek(static_cast<size_t>(randomNumber() % map.capacity()));
+    size_t found = 0;
+    for (size_t walked = 0; walked < limit && found < count; ++walked, ++it) {
+        if (it == map.end()) {
+            it = map.begin();
+        }
+        if (volatileOnly && it->second.expiresAt == 0) {
+            continue;
+        }
+        visit(it->first, it->second);
+        ++found;
+    }
+}
+
+const std::pair<EvictionPolicy, const char*> EVICTION_POLICY_NAMES[] = {
+    {EvictionPolicy::NoEviction, "noeviction"},
+    {EvictionPolicy::AllKeysLru, "allkeys-lru"},
+    {EvictionPolicy::AllKeysLfu, "allkeys-lfu"},
+    {EvictionPolicy::AllKeysRandom, "allkeys-random"},
+    {EvictionPolicy::VolatileLru, "volatile-lru"},
+    {EvictionPolicy::VolatileLfu, "volatile-lfu"},
+    {EvictionPolicy::VolatileRandom, "volatile-random"},
+    {EvictionPolicy::VolatileTtl, "volatile-ttl"},
+};
+
+/**
+ * Rough heap footprint of a map excluding values, which are shared:
+ * the table and the keys too long to keep inline
+ */
+size_t estimateMapBytes(const KeyValueMap& map) {
+    size_t bytes = map.allocatedBytes();
+    for (const auto& entry : map) {
+        bytes += entry.first.heapBytes();
+    }
+    return bytes;
+}
+
+} // namespace
+
+size_t StoreSnapshot::size() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        if (shard) total += shard->size();
+    }
+    return total;
+}
+
+DataStore::DataStore(size_t shardCount)
+    : shardCount_(shardCount > 0 ? shardCount : 1),
+      shards_(std::make_unique<Shard[]>(shardCount_)),
+      appendLog_(nullptr),
+      pendingShards_(0), trackChanges_(false), expiryStop_(false), expiryCursor_(0),
+      maxMemory_(0), evictionPolicy_(EvictionPolicy::NoEviction),
+      evictionSamples_(DEFAULT_EVICTION_SAMPLES), tracksAccess_(false), usedMemory_(0),
+      accessClock_(0), evictionCursor_(0), activeDefrag_(false),
+      defragIgnoreBytes_(DEFAULT_DEFRAG_IGNORE_BYTES), defragThreshold_(DEFAULT_DEFRAG_THRESHOLD),
+      defragRunning_(false), defragShard_(0), defragSlot_(0), orderedIndex_(false) {
+    for (size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].arena = SlabArena::create();
+        shards_[i].data = newShardMap(shards_[i].arena);
+        adjustMemory(shards_[i], 0);
+    }
+}
+
+DataStore::~DataStore() {
+    stopExpiryCycle();
+}
+
+int64_t DataStore::unixTimeMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void DataStore::setAppendLog(AppendOnlyLog* log) {
+    appendLog_ = log;
+}
+
+size_t DataStore::shardIndex(std::string_view key) const {
+    // std::hash<std::string_view> agrees with std::hash<std::string>
+    return std::hash<std::string_view>{}(key) % shardCount_;
+}
+
+DataStore::Shard& DataStore::shardFor(std::string_view key) const {
+    return shards_[shardIndex(key)];
+}
+
+void DataStore::ensureLoaded(Shard& shard) const {
+    if (!shard.pending.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (!shard.pending.load(std::memory_order_relaxed)) {
+        return;  // Another thread loaded it while we waited for the lock
+    }
+    size_t index = static_cast<size_t>(&shard - shards_.get());
+    if (!lazySource_->load(index, *shard.data)) {
+        std::cerr << "Failed to load shard " << index << " from the snapshot; some keys are missing"
+                  << std::endl;
+    }
+    rescanShard(shard);
+    shard.pending.store(false, std::memory_order_release);
+    if (pendingShards_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // Nobody reads the source once no shard is pending
+        lazySource_.reset();
+    }
+}
+
+void DataStore::ensureLoaded(const std::vector<size_t>& shardIndexes) const {
+    if (pendingShards_.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    for (size_t index : shardIndexes) {
+        ensureLoaded(shards_[index]);
+    }
+}
+
+void DataStore::ensureAllLoaded() const {
+    if (pendingShards_.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    for (size_t i = 0; i < shardCount_; ++i) {
+        ensureLoaded(shards_[i]);
+    }
+}
+
+KeyValueMap& DataStore::mutableData(Shard& shard) {
+    // Snapshots only take new references under the shard lock, so with the
+    // lock held exclusively the count can fall but never rise; a stale
+    // count at worst causes one needless copy
+    if (shard.data.use_count() > 1) {
+        shard.data = std::make_shared<KeyValueMap>(*shard.data);
+        metrics::snapshotShardCopies.fetch_add(1, std::memory_order_relaxed);
+        metrics::snapshotBytesCopied.fetch_add(estimateMapBytes(*shard.data), std::memory_order_relaxed);
+    }
+    return *shard.data;
+}
+
+template <typename KeyAt>
+std::vector<size_t> DataStore::groupByShard(size_t count, KeyAt keyAt,
+                                            std::vector<size_t>& shardOf) const {
+    // Counting sort by shard index: linear in the batch size and stable
+    shardOf.resize(count);
+    std::vector<size_t> offsets(shardCount_ + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        shardOf[i] = shardIndex(keyAt(i));
+        ++offsets[shardOf[i] + 1];
+    }
+    for (size_t shard = 0; shard < shardCount_; ++shard) {
+        offsets[shard + 1] += offsets[shard];
+    }
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[offsets[shardOf[i]]++] = i;
+    }
+    return order;
+}
+
+bool DataStore::set(std::string_view key, std::string_view value, int64_t expiresAt) {
+    if (expiresAt != 0 && expiresAt <= unixTimeMillis()) {
+        // Like Redis, setting a key that is already expired deletes it
+        del(key);
+        return true;
+    }
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
     try {
-        data_[key] = value;
+        // Build the buffer before taking the lock to keep the critical section short
+        Value stored = Value::copyOf(value, shard.arena.get());
+        std::string record;
+        if (appendLog_) {
+            // Logged as an absolute time so replaying later expires it on time
+            record = expiresAt != 0
+                ? AppendOnlyLog::encode({"SET", key, value, "PXAT", std::to_string(expiresAt)})
+                : AppendOnlyLog::encode({"SET", key, value});
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        storeEntry(shard, key, std::move(stored), expiresAt);
+        if (appendLog_) {
+            appendLog_->append(std::move(record));
+        }
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Error setting key-value pair: " << e.what() << std::endl;
@@ -12,36 +351,1428 @@ bool DataStore::set(const std::string& key, const std::string& value) {
     }
 }
 
-std::optional<std::string> DataStore::get(const std::string& key) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = data_.find(key);
-    if (it != data_.end()) {
-        return it->second;
+Value DataStore::get(std::string_view key) const {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it != shard.data->end() && !hasExpired(it->second)) {
+        if (tracksAccess_) {
+            touch(it->second);
+        }
+        return it->second.value;
+    }
+    return Value();
+}
+
+bool DataStore::del(std::string_view key) {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::string record;
+    if (appendLog_) {
+        record = AppendOnlyLog::encode({"DEL", key});
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    // Look the key up before copying a shared map; deleting a missing key
+    // changes nothing
+    auto it = shard.data->find(key);
+    if (it == shard.data->end()) {
+        return false;
+    }
+    bool live = !hasExpired(it->second);
+    eraseEntry(shard, key);
+    if (!live) {
+        metrics::expiredKeys.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (appendLog_) {
+        appendLog_->append(std::move(record));
+    }
+    return live;
+}
+
+std::vector<Value> DataStore::mget(const std::vector<std::string_view>& keys) const {
+    std::vector<Value> values(keys.size());
+    std::vector<size_t> shardOf;
+    std::vector<size_t> order = groupByShard(keys.size(), [&keys](size_t i) { return keys[i]; }, shardOf);
+    ensureLoaded(shardOf);
+
+    // Walking the keys in shard order takes each lock once, in ascending
+    // order; earlier locks stay held until the whole batch has been read
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    for (size_t i = 0; i < order.size(); ++i) {
+        size_t index = order[i];
+        const Shard& shard = shards_[shardOf[index]];
+        if (i == 0 || shardOf[index] != shardOf[order[i - 1]]) {
+            locks.emplace_back(shard.mutex);
+        }
+        auto it = shard.data->find(keys[index]);
+        if (it != shard.data->end() && !hasExpired(it->second)) {
+            if (tracksAccess_) {
+                touch(it->second);
+            }
+            values[index] = it->second.value;
+        }
     }
-    return std::nullopt;
+    return values;
 }
 
-bool DataStore::del(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = data_.find(key);
-    if (it != data_.end()) {
-        data_.erase(it);
+bool DataStore::mset(const std::vector<std::pair<std::string_view, std::string_view>>& entries,
+                     const std::vector<int64_t>& expiresAt) {
+    try {
+        std::vector<size_t> shardOf;
+        std::vector<size_t> order =
+            groupByShard(entries.size(), [&entries](size_t i) { return entries[i].first; }, shardOf);
+
+        // Build every buffer before taking any lock
+        std::vector<Value> values;
+        values.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            values.push_back(Value::copyOf(entries[i].second, shards_[shardOf[i]].arena.get()));
+        }
+        std::string record;
+        if (appendLog_) {
+            AppendOnlyLog::beginCommand(record, entries.size() * 2 + 1);
+            AppendOnlyLog::addArgument(record, "MSET");
+            for (const auto& entry : entries) {
+                AppendOnlyLog::addArgument(record, entry.first);
+                AppendOnlyLog::addArgument(record, entry.second);
+            }
+            // Expiry times follow in the same record, so they can't be
+            // separated from the MSET by a torn write
+            for (size_t i = 0; i < expiresAt.size(); ++i) {
+                if (expiresAt[i] != 0) {
+                    record += AppendOnlyLog::encode({"PEXPIREAT", entries[i].first, std::to_string(expiresAt[i])});
+                }
+            }
+        }
+        int64_t now = expiresAt.empty() ? 0 : unixTimeMillis();
+        ensureLoaded(shardOf);
+
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (size_t i = 0; i < order.size(); ++i) {
+            size_t index = order[i];
+            Shard& shard = shards_[shardOf[index]];
+            if (i == 0 || shardOf[index] != shardOf[order[i - 1]]) {
+                locks.emplace_back(shard.mutex);
+            }
+            std::string_view key = entries[index].first;
+            int64_t expiry = expiresAt.empty() ? 0 : expiresAt[index];
+            if (expiry != 0 && expiry <= now) {
+                eraseEntry(shard, key);
+            } else {
+                storeEntry(shard, key, std::move(values[index]), expiry);
+            }
+        }
+        if (appendLog_) {
+            appendLog_->append(std::move(record));
+        }
         return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error setting key-value pairs: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+size_t DataStore::mdel(const std::vector<std::string_view>& keys) {
+    std::vector<size_t> shardOf;
+    std::vector<size_t> order = groupByShard(keys.size(), [&keys](size_t i) { return keys[i]; }, shardOf);
+    ensureLoaded(shardOf);
+    std::string record;
+    if (appendLog_) {
+        AppendOnlyLog::beginCommand(record, keys.size() + 1);
+        AppendOnlyLog::addArgument(record, "DEL");
+        for (std::string_view key : keys) {
+            AppendOnlyLog::addArgument(record, key);
+        }
+    }
+
+    size_t deleted = 0;
+    bool erased = false;
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    for (size_t i = 0; i < order.size(); ++i) {
+        size_t index = order[i];
+        Shard& shard = shards_[shardOf[index]];
+        if (i == 0 || shardOf[index] != shardOf[order[i - 1]]) {
+            locks.emplace_back(shard.mutex);
+        }
+        auto it = shard.data->find(keys[index]);
+        if (it == shard.data->end()) {
+            continue;
+        }
+        if (hasExpired(it->second)) {
+            metrics::expiredKeys.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            ++deleted;
+        }
+        eraseEntry(shard, keys[index]);
+        erased = true;
+    }
+    if (appendLog_ && erased) {
+        appendLog_->append(std::move(record));
+    }
+    return deleted;
+}
+
+void DataStore::storeEntry(Shard& shard, std::string_view key, Value&& value, int64_t expiresAt) {
+    KeyValueMap& data = mutableData(shard);
+    auto it = data.find(key);
+    int64_t delta = 0;
+    if (it != data.end()) {
+        delta -= static_cast<int64_t>(entryBytes(it->first, it->second));
+        it->second.value = std::move(value);
+        if (tracksAccess_) {
+            touch(it->second);
+        }
+    } else {
+        it = data.emplace(key, StoredValue{std::move(value), 0, initialStamp()}).first;
+        if (shard.ordered) {
+            shard.ordered->emplace(key);
+            delta += static_cast<int64_t>(indexBytes(key));
+        }
+    }
+    delta += static_cast<int64_t>(entryBytes(it->first, it->second));
+    adjustMemory(shard, delta);
+    setExpiry(shard, key, it->second, expiresAt);
+    recordChange(shard, key);
+}
+
+bool DataStore::eraseEntry(Shard& shard, std::string_view key) {
+    auto it = shard.data->find(key);
+    if (it == shard.data->end()) {
+        return false;
+    }
+    if (it->second.expiresAt != 0) {
+        --shard.expiring;
+    }
+    int64_t bytes = static_cast<int64_t>(entryBytes(it->first, it->second));
+    if (shard.ordered) {
+        shard.ordered->erase(shard.ordered->find(key));
+        bytes += static_cast<int64_t>(indexBytes(key));
+    }
+    // The wheel may keep an entry for the key; it is dropped when it comes due
+    mutableData(shard).erase(key);
+    adjustMemory(shard, -bytes);
+    recordChange(shard, key);
+    return true;
+}
+
+bool DataStore::eraseIfExpired(Shard& shard, std::string_view key, int64_t now) {
+    auto it = shard.data->find(key);
+    if (it == shard.data->end() || !it->second.expired(now)) {
+        return false;
+    }
+    eraseEntry(shard, key);
+    metrics::expiredKeys.fetch_add(1, std::memory_order_relaxed);
+    if (appendLog_) {
+        appendLog_->append(AppendOnlyLog::encode({"DEL", key}));
+    }
+    return true;
+}
+
+void DataStore::setExpiry(Shard& shard, std::string_view key, StoredValue& entry, int64_t expiresAt) {
+    int64_t previous = entry.expiresAt;
+    entry.expiresAt = expiresAt;
+    if (previous == 0 && expiresAt != 0) {
+        ++shard.expiring;
+    } else if (previous != 0 && expiresAt == 0) {
+        --shard.expiring;
+    }
+    // A key that already had an expiry time has a wheel entry no later than
+    // that time, which refiles the key when it comes due; only an earlier
+    // time needs an entry of its own
+    if (expiresAt != 0 && (previous == 0 || expiresAt < previous)) {
+        if (!shard.expiries) {
+            shard.expiries = std::make_unique<ExpiryWheel>(unixTimeMillis());
+        }
+        shard.expiries->add(key, expiresAt);
+    }
+}
+
+void DataStore::rescanShard(Shard& shard) const {
+    int64_t now = unixTimeMillis();
+    uint32_t stamp = initialStamp();
+    size_t bytes = 0;
+    shard.expiries.reset();
+    shard.expiring = 0;
+    if (shard.ordered) {
+        shard.ordered->clear();
+    }
+    // Only called on maps just filled by a loader, which no snapshot
+    // shares yet, so expired keys can be dropped in place
+    KeyValueMap& data = *shard.data;
+    for (auto it = data.begin(); it != data.end();) {
+        if (it->second.expired(now)) {
+            it = data.erase(it);
+            continue;
+        }
+        bytes += entryBytes(it->first, it->second);
+        if (shard.ordered) {
+            shard.ordered->emplace(it->first.view());
+            bytes += indexBytes(it->first);
+        }
+        if (tracksAccess_) {
+            it->second.access.store(stamp);
+        }
+        if (it->second.expiresAt != 0) {
+            if (!shard.expiries) {
+                shard.expiries = std::make_unique<ExpiryWheel>(now);
+            }
+            shard.expiries->add(it->first, it->second.expiresAt);
+            ++shard.expiring;
+        }
+        ++it;
+    }
+    // Replace whatever the shard accounted for before
+    adjustMemory(shard, static_cast<int64_t>(bytes) - static_cast<int64_t>(shard.memory - shard.tableBytes));
+}
+
+void DataStore::adjustMemory(Shard& shard, int64_t entryDelta) const {
+    size_t table = shard.data->capacity() != 0 ? allocationSize(shard.data->allocatedBytes()) : 0;
+    int64_t delta = entryDelta + static_cast<int64_t>(table) - static_cast<int64_t>(shard.tableBytes);
+    shard.tableBytes = table;
+    shard.memory = static_cast<size_t>(static_cast<int64_t>(shard.memory) + delta);
+    if (delta != 0) {
+        usedMemory_.fetch_add(delta, std::memory_order_relaxed);
+    }
+}
+
+void DataStore::setMemoryLimit(size_t maxMemory, EvictionPolicy policy, size_t samples) {
+    maxMemory_ = maxMemory;
+    evictionPolicy_ = policy;
+    evictionSamples_ = samples > 0 ? samples : 1;
+    tracksAccess_ = policy == EvictionPolicy::AllKeysLru || policy == EvictionPolicy::VolatileLru ||
+                    isLfu(policy);
+    evictionPool_.clear();
+    refreshAccessClock();
+    // Stamps left by another policy mean nothing to this one
+    uint32_t stamp = initialStamp();
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shards_, shardCount_);
+    for (size_t i = 0; i < shardCount_; ++i) {
+        for (const auto& entry : *shards_[i].data) {
+            entry.second.access.store(stamp);
+        }
+    }
+}
+
+size_t DataStore::memoryLimit() const {
+    return maxMemory_;
+}
+
+EvictionPolicy DataStore::evictionPolicy() const {
+    return evictionPolicy_;
+}
+
+size_t DataStore::usedMemory() const {
+    int64_t used = usedMemory_.load(std::memory_order_relaxed);
+    return used > 0 ? static_cast<size_t>(used) : 0;
+}
+
+bool DataStore::parseEvictionPolicy(const std::string& name, EvictionPolicy& policy) {
+    for (const auto& known : EVICTION_POLICY_NAMES) {
+        if (name == known.second) {
+            policy = known.first;
+            return true;
+        }
     }
     return false;
 }
 
-std::unordered_map<std::string, std::string> DataStore::getAllData() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return data_;
+const char* DataStore::evictionPolicyName(EvictionPolicy policy) {
+    for (const auto& known : EVICTION_POLICY_NAMES) {
+        if (policy == known.first) {
+            return known.second;
+        }
+    }
+    return "unknown";
+}
+
+void DataStore::refreshAccessClock() const {
+    if (!tracksAccess_) {
+        return;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - metrics::processStart;
+    uint32_t now = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    // Readers load the clock on every access; only write when it moved
+    if (accessClock_.load(std::memory_order_relaxed) != now) {
+        accessClock_.store(now, std::memory_order_relaxed);
+    }
+}
+
+uint32_t DataStore::initialStamp() const {
+    if (!tracksAccess_) {
+        return 0;
+    }
+    uint32_t clock = accessClock_.load(std::memory_order_relaxed);
+    return isLfu(evictionPolicy_) ? (lfuMinutes(clock) << 8) | LFU_INIT_VALUE : clock;
+}
+
+void DataStore::touch(const StoredValue& entry) const {
+    uint32_t clock = accessClock_.load(std::memory_order_relaxed);
+    uint32_t stamp = entry.access.load();
+    uint32_t updated = clock;
+    if (isLfu(evictionPolicy_)) {
+        uint32_t minutes = lfuMinutes(clock);
+        updated = (minutes << 8) | lfuIncrement(lfuCounter(stamp, minutes));
+    }
+    // A hot key read again within the same tick keeps its cache line clean
+    if (updated != stamp) {
+        entry.access.store(updated);
+    }
+}
+
+uint64_t DataStore::evictionScore(const StoredValue& entry) const {
+    uint32_t clock = accessClock_.load(std::memory_order_relaxed);
+    if (evictionPolicy_ == EvictionPolicy::VolatileTtl) {
+        return UINT64_MAX - static_cast<uint64_t>(entry.expiresAt);
+    }
+    if (isLfu(evictionPolicy_)) {
+        return 255 - lfuCounter(entry.access.load(), lfuMinutes(clock));
+    }
+    return static_cast<uint32_t>(clock - entry.access.load());  // Idle time
+}
+
+bool DataStore::freeMemoryIfNeeded() {
+    if (maxMemory_ == 0) {
+        return true;
+    }
+    refreshAccessClock();
+    if (usedMemory() <= maxMemory_) {
+        return true;
+    }
+    if (evictionPolicy_ == EvictionPolicy::NoEviction) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(evictionMutex_);
+    for (size_t evicted = 0; usedMemory() > maxMemory_; ++evicted) {
+        if (evicted == MAX_EVICTIONS_PER_WRITE) {
+            return true;
+        }
+        if (!evictOne()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DataStore::sampleForEviction(size_t index) {
+    Shard& shard = shards_[index];
+    if (shard.pending.load(std::memory_order_acquire)) {
+        return;
+    }
+    bool volatileOnly = isVolatileOnly(evictionPolicy_);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    if (volatileOnly && shard.expiring == 0) {
+        return;
+    }
+    sampleEntries(*shard.data, evictionSamples_, volatileOnly,
+                  [&](const InlineString& key, const StoredValue& entry) {
+        uint64_t score = evictionScore(entry);
+        if (evictionPool_.size() == EVICTION_POOL_SIZE && score <= evictionPool_.front().score) {
+            return;
+        }
+        for (const EvictionCandidate& candidate : evictionPool_) {
+            if (candidate.shard == index && candidate.key == key.view()) {
+                return;
+            }
+        }
+        auto position = std::upper_bound(evictionPool_.begin(), evictionPool_.end(), score,
+            [](uint64_t value, const EvictionCandidate& candidate) { return value < candidate.score; });
+        evictionPool_.insert(position, EvictionCandidate{score, index, std::string(key.view())});
+        if (evictionPool_.size() > EVICTION_POOL_SIZE) {
+            evictionPool_.erase(evictionPool_.begin());
+        }
+    });
 }
 
-void DataStore::loadData(const std::unordered_map<std::string, std::string>& data) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    data_ = data;
+bool DataStore::evictOne() {
+    bool random = evictionPolicy_ == EvictionPolicy::AllKeysRandom ||
+                  evictionPolicy_ == EvictionPolicy::VolatileRandom;
+    for (size_t tried = 0; tried < shardCount_; ++tried) {
+        size_t index = evictionCursor_;
+        evictionCursor_ = (evictionCursor_ + 1) % shardCount_;
+        if (random) {
+            std::string key;
+            bool found = false;
+            {
+                const Shard& shard = shards_[index];
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                if (isVolatileOnly(evictionPolicy_) && shard.expiring == 0) {
+                    continue;
+                }
+                sampleEntries(*shard.data, 1, isVolatileOnly(evictionPolicy_),
+                              [&](const InlineString& sampled, const StoredValue&) {
+                    key.assign(sampled.data(), sampled.size());
+                    found = true;
+                });
+            }
+            if (found && evictKey(index, key)) {
+                return true;
+            }
+            continue;
+        }
+        // Evict the best candidate of every sample so far; entries whose
+        // key was deleted or lost its expiry meanwhile are dropped
+        sampleForEviction(index);
+        while (!evictionPool_.empty()) {
+            EvictionCandidate best = std::move(evictionPool_.back());
+            evictionPool_.pop_back();
+            if (evictKey(best.shard, best.key)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool DataStore::evictKey(size_t index, const std::string& key) {
+    Shard& shard = shards_[index];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it == shard.data->end() ||
+        (isVolatileOnly(evictionPolicy_) && it->second.expiresAt == 0)) {
+        return false;
+    }
+    eraseEntry(shard, key);
+    metrics::evictedKeys.fetch_add(1, std::memory_order_relaxed);
+    if (appendLog_) {
+        appendLog_->append(AppendOnlyLog::encode({"DEL", key}));
+    }
+    return true;
+}
+
+bool DataStore::expireAt(std::string_view key, int64_t expiresAt) {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    int64_t now = unixTimeMillis();
+    std::string record;
+    if (appendLog_) {
+        record = expiresAt <= now ? AppendOnlyLog::encode({"DEL", key})
+                                  : AppendOnlyLog::encode({"PEXPIREAT", key, std::to_string(expiresAt)});
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it == shard.data->end() || eraseIfExpired(shard, key, now)) {
+        return false;
+    }
+    if (expiresAt <= now) {
+        eraseEntry(shard, key);
+    } else {
+        setExpiry(shard, key, mutableData(shard).find(key)->second, expiresAt);
+        recordChange(shard, key);
+    }
+    if (appendLog_) {
+        appendLog_->append(std::move(record));
+    }
+    return true;
+}
+
+bool DataStore::persist(std::string_view key) {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::string record;
+    if (appendLog_) {
+        record = AppendOnlyLog::encode({"PERSIST", key});
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it == shard.data->end() || it->second.expiresAt == 0 ||
+        eraseIfExpired(shard, key, unixTimeMillis())) {
+        return false;
+    }
+    setExpiry(shard, key, mutableData(shard).find(key)->second, 0);
+    recordChange(shard, key);
+    if (appendLog_) {
+        appendLog_->append(std::move(record));
+    }
+    return true;
+}
+
+int64_t DataStore::timeToLive(std::string_view key) const {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it == shard.data->end()) {
+        return -2;
+    }
+    if (it->second.expiresAt == 0) {
+        return -1;
+    }
+    int64_t remaining = it->second.expiresAt - unixTimeMillis();
+    return remaining > 0 ? remaining : -2;
+}
+
+template <typename T, typename Read>
+TypedStatus DataStore::readCollection(std::string_view key, ValueType type, Read read) const {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it == shard.data->end() || hasExpired(it->second)) {
+        return TypedStatus::Ok;
+    }
+    const Collection* collection = it->second.value.collection();
+    if (!collection || collection->type() != type) {
+        return TypedStatus::WrongType;
+    }
+    if (tracksAccess_) {
+        touch(it->second);
+    }
+    read(static_cast<const T&>(*collection));
+    return TypedStatus::Ok;
+}
+
+template <typename T, typename Write>
+TypedStatus DataStore::writeCollection(std::string_view key, ValueType type, bool create, Write write,
+                                       std::string&& record) {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    try {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        eraseIfExpired(shard, key, unixTimeMillis());
+        auto it = shard.data->find(key);
+        if (it == shard.data->end()) {
+            if (!create) {
+                return TypedStatus::Ok;
+            }
+            storeEntry(shard, key, Value::collection(std::make_unique<T>()), 0);
+        } else if (!it->second.value.collection() || it->second.value.collection()->type() != type) {
+            return TypedStatus::WrongType;
+        }
+
+        KeyValueMap& data = mutableData(shard);
+        it = data.find(key);
+        int64_t before = static_cast<int64_t>(entryBytes(it->first, it->second));
+        Collection* collection = it->second.value.mutableCollection();
+        if (!collection) {
+            // Shared with a snapshot or a reader: they keep the old one
+            it->second.value = Value::collection(it->second.value.collection()->clone());
+            collection = it->second.value.mutableCollection();
+        }
+        bool changed = write(static_cast<T&>(*collection));
+        adjustMemory(shard, static_cast<int64_t>(entryBytes(it->first, it->second)) - before);
+        if (!changed) {
+            return TypedStatus::Ok;
+        }
+        if (tracksAccess_) {
+            touch(it->second);
+        }
+        if (collection->size() == 0) {
+            eraseEntry(shard, key);
+        } else {
+            recordChange(shard, key);
+        }
+        if (appendLog_) {
+            appendLog_->append(std::move(record));
+        }
+        return TypedStatus::Ok;
+    } catch (const std::exception& e) {
+        std::cerr << "Error updating " << Collection::typeName(type) << ": " << e.what() << std::endl;
+        return TypedStatus::Failed;
+    }
+}
+
+template <typename Update>
+TypedStatus DataStore::updateString(std::string_view key, Update update) {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    try {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        int64_t now = unixTimeMillis();
+        auto it = shard.data->find(key);
+        if (it != shard.data->end() && it->second.expired(now)) {
+            eraseIfExpired(shard, key, now);
+            it = shard.data->end();
+        }
+        bool found = it != shard.data->end();
+        if (found && it->second.value.collection()) {
+            return TypedStatus::WrongType;
+        }
+        Value replacement;
+        int64_t expiresAt = found ? it->second.expiresAt : 0;
+        TypedStatus status = update(found ? &it->second.value : nullptr, replacement, expiresAt);
+        if (status != TypedStatus::Ok || !replacement) {
+            return status;
+        }
+        std::string record;
+        if (appendLog_) {
+            // The result rather than the command, so replaying it twice is harmless
+            record = expiresAt != 0
+                ? AppendOnlyLog::encode({"SET", key, replacement.view(), "PXAT", std::to_string(expiresAt)})
+                : AppendOnlyLog::encode({"SET", key, replacement.view()});
+        }
+        if (!found) {
+            storeEntry(shard, key, std::move(replacement), expiresAt);
+        } else {
+            // Swap the value in the entry already found instead of looking it
+            // up again, unless a snapshot made the shard copy its map
+            KeyValueMap* shared = shard.data.get();
+            KeyValueMap& data = mutableData(shard);
+            if (&data != shared) {
+                it = data.find(key);
+            }
+            int64_t delta = -static_cast<int64_t>(entryBytes(it->first, it->second));
+            it->second.value = std::move(replacement);
+            delta += static_cast<int64_t>(entryBytes(it->first, it->second));
+            adjustMemory(shard, delta);
+            setExpiry(shard, key, it->second, expiresAt);
+            if (tracksAccess_) {
+                touch(it->second);
+            }
+            recordChange(shard, key);
+        }
+        if (appendLog_) {
+            appendLog_->append(std::move(record));
+        }
+        return TypedStatus::Ok;
+    } catch (const std::exception& e) {
+        std::cerr << "Error updating string: " << e.what() << std::endl;
+        return TypedStatus::Failed;
+    }
+}
+
+bool DataStore::type(std::string_view key, ValueType& type) const {
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.data->find(key);
+    if (it == shard.data->end() || hasExpired(it->second)) {
+        return false;
+    }
+    const Collection* collection = it->second.value.collection();
+    type = collection ? collection->type() : ValueType::String;
+    return true;
+}
+
+TypedStatus DataStore::length(std::string_view key, ValueType type, size_t& length) const {
+    length = 0;
+    return readCollection<Collection>(key, type, [&](const Collection& collection) { length = collection.size(); });
+}
+
+TypedStatus DataStore::hset(std::string_view key,
+                            const std::vector<std::pair<std::string_view, std::string_view>>& fields,
+                            size_t& added) {
+    added = 0;
+    std::string record;
+    if (appendLog_) {
+        AppendOnlyLog::beginCommand(record, fields.size() * 2 + 2);
+        AppendOnlyLog::addArgument(record, "HSET");
+        AppendOnlyLog::addArgument(record, key);
+        for (const auto& field : fields) {
+            AppendOnlyLog::addArgument(record, field.first);
+            AppendOnlyLog::addArgument(record, field.second);
+        }
+    }
+    return writeCollection<HashValue>(key, ValueType::Hash, !fields.empty(), [&](HashValue& hash) {
+        for (const auto& field : fields) {
+            added += hash.set(field.first, field.second);
+        }
+        return !fields.empty();
+    }, std::move(record));
+}
+
+TypedStatus DataStore::hget(std::string_view key, std::string_view field, Value& value) const {
+    value = Value();
+    return readCollection<HashValue>(key, ValueType::Hash, [&](const HashValue& hash) { value = hash.get(field); });
+}
+
+TypedStatus DataStore::hdel(std::string_view key, const std::vector<std::string_view>& fields, size_t& removed) {
+    removed = 0;
+    std::string record;
+    if (appendLog_) {
+        AppendOnlyLog::beginCommand(record, fields.size() + 2);
+        AppendOnlyLog::addArgument(record, "HDEL");
+        AppendOnlyLog::addArgument(record, key);
+        for (std::string_view field : fields) {
+            AppendOnlyLog::addArgument(record, field);
+        }
+    }
+    return writeCollection<HashValue>(key, ValueType::Hash, false, [&](HashValue& hash) {
+        for (std::string_view field : fields) {
+            removed += hash.erase(field);
+        }
+        return removed > 0;
+    }, std::move(record));
+}
+
+TypedStatus DataStore::hgetAll(std::string_view key, std::vector<std::pair<std::string, Value>>& fields) const {
+    fields.clear();
+    return readCollection<HashValue>(key, ValueType::Hash, [&](const HashValue& hash) {
+        fields.reserve(hash.size());
+        hash.forEach([&](std::string_view field, const Value& value) { fields.emplace_back(field, value); });
+    });
+}
+
+TypedStatus DataStore::push(std::string_view key, bool front, const std::vector<std::string_view>& elements,
+                            size_t& length) {
+    length = 0;
+    std::string record;
+    if (appendLog_) {
+        AppendOnlyLog::beginCommand(record, elements.size() + 2);
+        AppendOnlyLog::addArgument(record, front ? "LPUSH" : "RPUSH");
+        AppendOnlyLog::addArgument(record, key);
+        for (std::string_view element : elements) {
+            AppendOnlyLog::addArgument(record, element);
+        }
+    }
+    return writeCollection<ListValue>(key, ValueType::List, !elements.empty(), [&](ListValue& list) {
+        for (std::string_view element : elements) {
+            list.push(front, element);
+        }
+        length = list.size();
+        return !elements.empty();
+    }, std::move(record));
+}
+
+TypedStatus DataStore::pop(std::string_view key, bool front, size_t count, std::vector<Value>& elements) {
+    elements.clear();
+    // Logged with the number of elements actually removed, known only
+    // under the lock, so the record is completed there
+    std::string record;
+    return writeCollection<ListValue>(key, ValueType::List, false, [&](ListValue& list) {
+        while (elements.size() < count && list.size() > 0) {
+            elements.push_back(list.pop(front));
+        }
+        if (appendLog_ && !elements.empty()) {
+            record = AppendOnlyLog::encode({front ? "LPOP" : "RPOP", key, std::to_string(elements.size())});
+        }
+        return !elements.empty();
+    }, std::move(record));
+}
+
+TypedStatus DataStore::listRange(std::string_view key, long long start, long long stop,
+                                 std::vector<Value>& elements) const {
+    elements.clear();
+    return readCollection<ListValue>(key, ValueType::List, [&](const ListValue& list) {
+        if (clampRange(start, stop, list.size())) {
+            elements.reserve(static_cast<size_t>(stop - start + 1));
+            list.range(static_cast<size_t>(start), static_cast<size_t>(stop),
+                       [&](const Value& element) { elements.push_back(element); });
+        }
+    });
+}
+
+TypedStatus DataStore::zadd(std::string_view key, const std::vector<std::pair<double, std::string_view>>& members,
+                            size_t& added) {
+    added = 0;
+    std::string record;
+    if (appendLog_) {
+        AppendOnlyLog::beginCommand(record, members.size() * 2 + 2);
+        AppendOnlyLog::addArgument(record, "ZADD");
+        AppendOnlyLog::addArgument(record, key);
+        for (const auto& member : members) {
+            AppendOnlyLog::addArgument(record, protocol::formatDouble(member.first));
+            AppendOnlyLog::addArgument(record, member.second);
+        }
+    }
+    return writeCollection<SortedSetValue>(key, ValueType::SortedSet, !members.empty(), [&](SortedSetValue& set) {
+        for (const auto& member : members) {
+            added += set.add(member.second, member.first);
+        }
+        return !members.empty();
+    }, std::move(record));
+}
+
+TypedStatus DataStore::zrem(std::string_view key, const std::vector<std::string_view>& members, size_t& removed) {
+    removed = 0;
+    std::string record;
+    if (appendLog_) {
+        AppendOnlyLog::beginCommand(record, members.size() + 2);
+        AppendOnlyLog::addArgument(record, "ZREM");
+        AppendOnlyLog::addArgument(record, key);
+        for (std::string_view member : members) {
+            AppendOnlyLog::addArgument(record, member);
+        }
+    }
+    return writeCollection<SortedSetValue>(key, ValueType::SortedSet, false, [&](SortedSetValue& set) {
+        for (std::string_view member : members) {
+            removed += set.erase(member);
+        }
+        return removed > 0;
+    }, std::move(record));
+}
+
+TypedStatus DataStore::zscore(std::string_view key, std::string_view member, double& score, bool& found) const {
+    found = false;
+    return readCollection<SortedSetValue>(key, ValueType::SortedSet,
+                                          [&](const SortedSetValue& set) { found = set.score(member, score); });
+}
+
+TypedStatus DataStore::zrange(std::string_view key, long long start, long long stop,
+                              std::vector<std::pair<std::string, double>>& members) const {
+    members.clear();
+    return readCollection<SortedSetValue>(key, ValueType::SortedSet, [&](const SortedSetValue& set) {
+        if (clampRange(start, stop, set.size())) {
+            members.reserve(static_cast<size_t>(stop - start + 1));
+            set.range(static_cast<size_t>(start), static_cast<size_t>(stop),
+                      [&](std::string_view member, double score) { members.emplace_back(member, score); });
+        }
+    });
+}
+
+TypedStatus DataStore::increment(std::string_view key, int64_t delta, int64_t& value) {
+    SlabArena* arena = shardFor(key).arena.get();
+    return updateString(key, [&](const Value* current, Value& replacement, int64_t&) {
+        int64_t number = 0;
+        if (current && !current->toInteger(number)) {
+            return TypedStatus::NotInteger;
+        }
+        if ((delta > 0 && number > std::numeric_limits<int64_t>::max() - delta) ||
+            (delta < 0 && number < std::numeric_limits<int64_t>::min() - delta)) {
+            return TypedStatus::Overflow;
+        }
+        value = number + delta;
+        replacement = Value::integer(value, arena);
+        return TypedStatus::Ok;
+    });
+}
+
+TypedStatus DataStore::append(std::string_view key, std::string_view suffix, size_t& length) {
+    SlabArena* arena = shardFor(key).arena.get();
+    // Logged as a SET of the whole result, like the other updates: an
+    // APPEND record replayed over a snapshot that has it would apply twice
+    return updateString(key, [&](const Value* current, Value& replacement, int64_t&) {
+        std::string joined;
+        if (current) {
+            joined.reserve(current->size() + suffix.size());
+            joined.append(current->view());
+        }
+        joined.append(suffix);
+        replacement = Value::copyOf(joined, arena);
+        length = joined.size();
+        return TypedStatus::Ok;
+    });
+}
+
+TypedStatus DataStore::getSet(std::string_view key, std::string_view value, Value& previous) {
+    SlabArena* arena = shardFor(key).arena.get();
+    previous = Value();
+    return updateString(key, [&](const Value* current, Value& replacement, int64_t& expiresAt) {
+        if (current) {
+            previous = *current;
+        }
+        replacement = Value::copyOf(value, arena);
+        expiresAt = 0;
+        return TypedStatus::Ok;
+    });
+}
+
+TypedStatus DataStore::compareAndSwap(std::string_view key, std::string_view expected, std::string_view desired,
+                                      bool& swapped) {
+    SlabArena* arena = shardFor(key).arena.get();
+    swapped = false;
+    return updateString(key, [&](const Value* current, Value& replacement, int64_t&) {
+        if (current && current->view() == expected) {
+            replacement = Value::copyOf(desired, arena);
+            swapped = true;
+        }
+        return TypedStatus::Ok;
+    });
+}
+
+bool DataStore::restoreCollection(std::string_view key, std::string_view encoded, int64_t expiresAt) {
+    std::unique_ptr<Collection> collection = Collection::decode(encoded);
+    if (!collection) {
+        return false;
+    }
+    Shard& shard = shardFor(key);
+    ensureLoaded(shard);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (expiresAt != 0 && expiresAt <= unixTimeMillis()) {
+        eraseEntry(shard, key);
+    } else {
+        storeEntry(shard, key, Value::collection(std::move(collection)), expiresAt);
+    }
+    return true;
+}
+
+size_t DataStore::expireCycle(size_t budget) {
+    int64_t now = unixTimeMillis();
+    // Split the budget so a backlog in one shard can't starve the others
+    size_t perShard = std::max<size_t>(budget / shardCount_, 16);
+    size_t examined = 0;
+    size_t expired = 0;
+    size_t start = expiryCursor_;
+    size_t visited = 0;
+    for (; visited < shardCount_ && examined < budget; ++visited) {
+        Shard& shard = shards_[(start + visited) % shardCount_];
+        if (shard.pending.load(std::memory_order_acquire)) {
+            continue;  // Its keys are scheduled when it is loaded
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (!shard.expiries) {
+            continue;
+        }
+        ExpiryWheel& wheel = *shard.expiries;
+        examined += wheel.advance(now, std::min(perShard, budget - examined),
+                                  [&](const std::string& key, int64_t) {
+            auto it = shard.data->find(key);
+            if (it == shard.data->end() || it->second.expiresAt == 0) {
+                return;  // Deleted or persisted since it was filed
+            }
+            if (!it->second.expired(now)) {
+                wheel.add(key, it->second.expiresAt);  // Expiry moved later
+                return;
+            }
+            if (eraseIfExpired(shard, key, now)) {
+                ++expired;
+            }
+        });
+    }
+    // Resume after the last shard visited if the budget ran out
+    expiryCursor_ = (start + visited) % shardCount_;
+    return expired;
+}
+
+void DataStore::startExpiryCycle() {
+    if (expiryThread_.joinable()) {
+        return;
+    }
+    expiryStop_ = false;
+    expiryThread_ = std::thread(&DataStore::expiryLoop, this);
+}
+
+void DataStore::stopExpiryCycle() {
+    {
+        std::lock_guard<std::mutex> lock(expiryMutex_);
+        expiryStop_ = true;
+    }
+    expiryCondition_.notify_all();
+    if (expiryThread_.joinable()) {
+        expiryThread_.join();
+    }
+}
+
+void DataStore::expiryLoop() {
+    std::unique_lock<std::mutex> lock(expiryMutex_);
+    while (!expiryStop_) {
+        expiryCondition_.wait_for(lock, std::chrono::milliseconds(EXPIRY_CYCLE_MS),
+                                  [this]() { return expiryStop_; });
+        if (expiryStop_) {
+            break;
+        }
+        lock.unlock();
+        refreshAccessClock();
+        expireCycle(EXPIRY_CYCLE_BUDGET);
+        resizeTables();
+        if (activeDefrag_) {
+            defragCycle(DEFRAG_CYCLE_BUDGET);
+        }
+        lock.lock();
+    }
+}
+
+void DataStore::resizeTables() {
+    for (size_t i = 0; i < shardCount_; ++i) {
+        Shard& shard = shards_[i];
+        if (shard.pending.load(std::memory_order_acquire)) {
+            continue;
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        KeyValueMap& data = *shard.data;
+        if (shard.data.use_count() != 1) {
+            continue;
+        }
+        if (data.rehashing()) {
+            data.rehashStep(REHASH_CYCLE_GROUPS);
+        } else if (data.capacity() > KeyValueMap::GROUP_SIZE &&
+                   data.size() < data.capacity() / SHRINK_FILL_RATIO) {
+            data.shrinkToFit();
+        } else {
+            continue;
+        }
+        adjustMemory(shard, 0);
+    }
+}
+
+void DataStore::setActiveDefrag(bool enabled, size_t ignoreBytes, size_t thresholdPercent) {
+    activeDefrag_ = enabled;
+    defragIgnoreBytes_ = ignoreBytes;
+    defragThreshold_ = thresholdPercent;
+}
+
+bool DataStore::activeDefrag() const {
+    return activeDefrag_;
+}
+
+bool DataStore::defragRunning() const {
+    return defragRunning_.load(std::memory_order_relaxed);
+}
+
+SlabArena::Stats DataStore::allocatorStats() const {
+    SlabArena::Stats total;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        SlabArena::Stats stats = shards_[i].arena->stats();
+        total.allocated += stats.allocated;
+        total.active += stats.active;
+        total.slabs += stats.slabs;
+        total.blocks += stats.blocks;
+        total.reclaimable += stats.reclaimable;
+    }
+    return total;
+}
+
+size_t DataStore::defragCycle(size_t budget) {
+    // Worth it only if the slabs it can free are both many and a good share
+    // of the data; a class holding less than a slab's worth of blocks
+    // wastes the rest of its slab whatever is moved
+    auto worthDefragmenting = [this](const SlabArena::Stats& stats, size_t ignoreBytes) {
+        return stats.reclaimable > ignoreBytes && stats.reclaimable * 100 > stats.allocated * defragThreshold_;
+    };
+    if (!worthDefragmenting(allocatorStats(), defragIgnoreBytes_)) {
+        defragRunning_.store(false, std::memory_order_relaxed);
+        return 0;
+    }
+    defragRunning_.store(true, std::memory_order_relaxed);
+
+    size_t scanned = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    for (size_t visited = 0; visited < shardCount_ && scanned < budget;) {
+        Shard& shard = shards_[defragShard_];
+        bool done = true;
+        if (!shard.pending.load(std::memory_order_acquire) &&
+            worthDefragmenting(shard.arena->stats(), 0)) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            // A shared map must not change; values referenced elsewhere
+            // are skipped by Value::relocate() itself
+            if (shard.data.use_count() == 1) {
+                KeyValueMap& data = *shard.data;
+                size_t batch = std::min(budget - scanned, DEFRAG_LOCK_BATCH);
+                auto it = data.seek(defragSlot_);
+                for (; it != data.end() && batch > 0; ++it, --batch, ++scanned) {
+                    if (it->first.inArena()) {
+                        it->first.relocate() ? ++hits : ++misses;
+                    }
+                    if (it->second.value.inArena()) {
+                        it->second.value.relocate() ? ++hits : ++misses;
+                    }
+                }
+                done = it == data.end();
+                defragSlot_ = done ? 0 : it.slot();
+            }
+        }
+        if (done) {
+            defragShard_ = (defragShard_ + 1) % shardCount_;
+            defragSlot_ = 0;
+            ++visited;
+        }
+    }
+    metrics::activeDefragHits.fetch_add(hits, std::memory_order_relaxed);
+    metrics::activeDefragMisses.fetch_add(misses, std::memory_order_relaxed);
+    return hits;
+}
+
+size_t DataStore::expiringKeys() const {
+    auto locks = lockAllShards<std::shared_lock<std::shared_mutex>>(shards_, shardCount_);
+    size_t total = 0;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        total += shards_[i].expiring;
+    }
+    return total;
+}
+
+size_t DataStore::expiryWheelSize() const {
+    auto locks = lockAllShards<std::shared_lock<std::shared_mutex>>(shards_, shardCount_);
+    size_t total = 0;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        if (shards_[i].expiries) total += shards_[i].expiries->size();
+    }
+    return total;
+}
+
+void DataStore::recordChange(Shard& shard, std::string_view key) {
+    shard.changes.fetch_add(1, std::memory_order_relaxed);
+    if (!trackChanges_.load(std::memory_order_relaxed) || shard.dirtyOverflow) {
+        return;
+    }
+    shard.dirty.emplace(key);
+    // Past half the shard a delta is no smaller than a full save, so stop
+    // paying for the set
+    if (shard.dirty.size() > shard.data->size() / 2 + 1024) {
+        shard.dirty = DirtyKeys();
+        shard.dirtyOverflow = true;
+    }
+}
+
+void DataStore::overflowAllShards() {
+    for (size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].dirty = DirtyKeys();
+        shards_[i].dirtyOverflow = true;
+    }
+}
+
+void DataStore::trackChanges(bool enabled) {
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shards_, shardCount_);
+    trackChanges_ = enabled;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].dirty = DirtyKeys();
+        shards_[i].dirtyOverflow = false;
+    }
+}
+
+uint64_t DataStore::changeCount() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        total += shards_[i].changes.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+StoreSnapshot DataStore::snapshot(uint64_t sequence) const {
+    return capture(nullptr, nullptr, sequence);
+}
+
+StoreSnapshot DataStore::checkpoint(std::vector<DirtyKeys>& changed, bool& complete, uint64_t sequence) const {
+    return capture(&changed, &complete, sequence);
+}
+
+StoreSnapshot DataStore::capture(std::vector<DirtyKeys>* changed, bool* complete, uint64_t sequence) const {
+    ensureAllLoaded();
+    StoreSnapshot snapshot;
+    snapshot.shards_.reserve(shardCount_);
+    if (changed) {
+        changed->assign(shardCount_, DirtyKeys());
+        *complete = trackChanges_.load(std::memory_order_relaxed);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        // Writers need the locks exclusively, so the dirty sets are stable
+        // while every shared lock is held
+        auto locks = lockAllShards<std::shared_lock<std::shared_mutex>>(shards_, shardCount_);
+        for (size_t i = 0; i < shardCount_; ++i) {
+            snapshot.shards_.push_back(shards_[i].data);
+            if (changed) {
+                (*changed)[i].swap(shards_[i].dirty);
+                if (shards_[i].dirtyOverflow) {
+                    *complete = false;
+                    shards_[i].dirtyOverflow = false;
+                }
+            }
+        }
+        // Mutations log their records under the exclusive lock, so none
+        // can fall between the maps taken above and this record
+        if (appendLog_ && sequence != 0) {
+            appendLog_->appendCheckpoint(sequence);
+        }
+    }
+    auto pause = std::chrono::steady_clock::now() - start;
+    metrics::snapshotLastPauseMicros.store(
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(pause).count()),
+        std::memory_order_relaxed);
+    return snapshot;
+}
+
+KeyValueMap DataStore::getAllData() const {
+    StoreSnapshot view = snapshot();
+    KeyValueMap result;
+    result.reserve(view.size());
+    for (size_t i = 0; i < view.shardCount(); ++i) {
+        for (const auto& entry : *view.shard(i)) {
+            result.emplace(entry.first, entry.second);
+        }
+        view.release(i);
+    }
+    return result;
+}
+
+void DataStore::loadData(KeyValueMap data) {
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shards_, shardCount_);
+    for (size_t i = 0; i < shardCount_; ++i) {
+        // Fresh maps, so snapshots still holding the old ones are unaffected
+        shards_[i].data = newShardMap(shards_[i].arena);
+        shards_[i].pending.store(false, std::memory_order_relaxed);
+    }
+    pendingShards_ = 0;
+    lazySource_.reset();
+    overflowAllShards();
+    // Values move over without copying their bytes; only keys too long to
+    // keep inline are copied
+    for (auto& entry : data) {
+        shardFor(entry.first).data->emplace(entry.first, std::move(entry.second));
+    }
+    for (size_t i = 0; i < shardCount_; ++i) {
+        rescanShard(shards_[i]);
+    }
+}
+
+void DataStore::loadLazily(std::shared_ptr<ShardSource> source) {
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shards_, shardCount_);
+    lazySource_ = std::move(source);
+    for (size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].data = newShardMap(shards_[i].arena);
+        shards_[i].pending.store(true, std::memory_order_relaxed);
+        rescanShard(shards_[i]);
+    }
+    pendingShards_ = shardCount_;
+    overflowAllShards();
+}
+
+void DataStore::materializeShard(size_t index) {
+    if (index < shardCount_) {
+        ensureLoaded(shards_[index]);
+    }
+}
+
+size_t DataStore::pendingShards() const {
+    return pendingShards_.load(std::memory_order_relaxed);
+}
+
+void DataStore::reset(size_t expectedEntries) {
+    size_t perShard = expectedEntries / shardCount_;
+    if (perShard > 0) {
+        // Leave room for an uneven spread of keys across shards
+        perShard += perShard / 8 + 16;
+    }
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shards_, shardCount_);
+    for (size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].data = newShardMap(shards_[i].arena);
+        shards_[i].data->reserve(perShard);
+        shards_[i].pending.store(false, std::memory_order_relaxed);
+        rescanShard(shards_[i]);
+    }
+    pendingShards_ = 0;
+    lazySource_.reset();
+    overflowAllShards();
 }
 
 size_t DataStore::size() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return data_.size();
+    auto locks = lockAllShards<std::shared_lock<std::shared_mutex>>(shards_, shardCount_);
+    size_t total = 0;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        // Shards not loaded yet count what their source will insert
+        total += shards_[i].pending.load(std::memory_order_relaxed) ? lazySource_->size(i)
+                                                                     : shards_[i].data->size();
+    }
+    return total;
+}
+
+size_t DataStore::shardCount() const {
+    return shardCount_;
+}
+
+void DataStore::setOrderedIndex(bool enabled) {
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shards_, shardCount_);
+    orderedIndex_ = enabled;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        Shard& shard = shards_[i];
+        if (enabled == (shard.ordered != nullptr)) {
+            continue;
+        }
+        // Shards still pending are indexed by rescanShard() when they load
+        int64_t bytes = 0;
+        if (enabled) {
+            shard.ordered = std::make_unique<OrderedKeys>();
+            for (const auto& entry : *shard.data) {
+                shard.ordered->emplace(entry.first.view());
+                bytes += static_cast<int64_t>(indexBytes(entry.first));
+            }
+        } else {
+            for (const InlineString& key : *shard.ordered) {
+                bytes -= static_cast<int64_t>(indexBytes(key));
+            }
+            shard.ordered.reset();
+        }
+        adjustMemory(shard, bytes);
+    }
+}
+
+bool DataStore::orderedIndex() const {
+    return orderedIndex_;
+}
+
+std::vector<std::pair<std::string, Value>> DataStore::range(const KeyRange& range, size_t limit,
+                                                            bool withValues) const {
+    using Entry = std::pair<std::string, Value>;
+    std::vector<Entry> result;
+    if (!orderedIndex_ || limit == 0) {
+        return result;
+    }
+    ensureAllLoaded();
+
+    // One cursor per shard holding its next few keys; a heap merges them.
+    // Shards are refilled, a batch at a time under their own lock, only
+    // when the merge reaches the end of what was taken from them
+    struct Cursor {
+        size_t shard;
+        std::vector<Entry> batch;
+        size_t next = 0;
+        bool exhausted = false;
+    };
+    size_t batchSize = std::max<size_t>(4, 2 * limit / shardCount_);
+    auto refill = [&](Cursor& cursor) {
+        // Resume after the last key taken, or start at the range's bound
+        std::string last = cursor.batch.empty() ? std::string() : std::move(cursor.batch.back().first);
+        bool resume = !cursor.batch.empty();
+        cursor.batch.clear();
+        cursor.next = 0;
+        const Shard& shard = shards_[cursor.shard];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        if (!shard.ordered) {
+            cursor.exhausted = true;
+            return;
+        }
+        const OrderedKeys& keys = *shard.ordered;
+        auto it = resume ? keys.upper_bound(last)
+                         : range.minExclusive ? keys.upper_bound(range.min) : keys.lower_bound(range.min);
+        int64_t now = shard.expiring != 0 ? unixTimeMillis() : 0;
+        // Expired keys count towards the walk too, bounding the time the
+        // lock is held when many are waiting to be reclaimed
+        for (size_t walked = 0; it != keys.end() && walked < batchSize; ++it, ++walked) {
+            std::string_view key = *it;
+            if (!range.belowMax(key)) {
+                break;
+            }
+            if (!withValues && shard.expiring == 0) {
+                cursor.batch.emplace_back(std::string(key), Value());
+                continue;
+            }
+            auto entry = shard.data->find(key);
+            if (entry->second.expired(now)) {
+                continue;
+            }
+            cursor.batch.emplace_back(std::string(key), withValues ? entry->second.value : Value());
+        }
+        cursor.exhausted = it == keys.end() || !range.belowMax(*it);
+        if (!cursor.exhausted && cursor.batch.empty()) {
+            // Every key of the batch had expired: keep the position
+            cursor.batch.emplace_back(std::string(*std::prev(it)), Value());
+            cursor.next = 1;
+        }
+    };
+
+    std::vector<Cursor> cursors(shardCount_);
+    auto later = [&cursors](size_t a, size_t b) {
+        return cursors[a].batch[cursors[a].next].first > cursors[b].batch[cursors[b].next].first;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+    auto advance = [&](size_t index) {
+        Cursor& cursor = cursors[index];
+        while (cursor.next == cursor.batch.size() && !cursor.exhausted) {
+            refill(cursor);
+        }
+        if (cursor.next < cursor.batch.size()) {
+            heads.push(index);
+        }
+    };
+    for (size_t i = 0; i < shardCount_; ++i) {
+        cursors[i].shard = i;
+        advance(i);
+    }
+    while (!heads.empty() && result.size() < limit) {
+        size_t index = heads.top();
+        heads.pop();
+        Cursor& cursor = cursors[index];
+        Entry& entry = cursor.batch[cursor.next++];
+        if (cursor.next == cursor.batch.size()) {
+            // The last entry stays in the batch to resume the shard from
+            result.emplace_back(entry.first, entry.second);
+        } else {
+            result.push_back(std::move(entry));
+        }
+        advance(index);
+    }
+    return result;
 }
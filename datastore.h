@@ -1,57 +1,1114 @@
 #pragma once
 
-#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <set>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
-#include <optional>
+#include <string_view>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <condition_variable>
+#include <thread>
+#include "collection.h"
+#include "expiry_wheel.h"
+#include "flat_hash_map.h"
+#include "slab_arena.h"
+#include "value.h"
+
+class AppendOnlyLog;
+
+/**
+ * How a DataStore over its memory limit picks the keys to evict, see
+ * DataStore::setMemoryLimit()
+ */
+enum class EvictionPolicy {
+    NoEviction,      // Reject writes instead
+    AllKeysLru,      // Least recently used of the sampled keys
+    AllKeysLfu,      // Least frequently used of the sampled keys
+    AllKeysRandom,
+    VolatileLru,     // The same, but only among keys with an expiry time
+    VolatileLfu,
+    VolatileRandom,
+    VolatileTtl      // The sampled key closest to expiring
+};
+
+/**
+ * Access history of an entry for LRU and LFU eviction
+ * Readers update it while holding only the shared shard lock, so it is a
+ * relaxed atomic; a lost update merely makes eviction slightly less exact.
+ * With an LRU policy it holds the access clock at the last access, with an
+ * LFU policy the minute of the last decay in bits 8-23 and a logarithmic
+ * access counter in bits 0-7
+ */
+class AccessStamp {
+private:
+    mutable std::atomic<uint32_t> bits_;
+
+public:
+    AccessStamp(uint32_t bits = 0) noexcept : bits_(bits) {}
+    AccessStamp(const AccessStamp& other) noexcept : bits_(other.load()) {}
+    AccessStamp& operator=(const AccessStamp& other) noexcept {
+        store(other.load());
+        return *this;
+    }
+
+    uint32_t load() const noexcept { return bits_.load(std::memory_order_relaxed); }
+    void store(uint32_t bits) const noexcept { bits_.store(bits, std::memory_order_relaxed); }
+};
+
+/**
+ * A stored value, when it expires and when it was last used
+ */
+struct StoredValue {
+    Value value;
+    int64_t expiresAt = 0;  // Unix time in milliseconds, 0 if the key never expires
+    AccessStamp access;
+
+    StoredValue() = default;
+    StoredValue(Value value, int64_t expiresAt, uint32_t access = 0)
+        : value(std::move(value)), expiresAt(expiresAt), access(access) {}
+
+    /**
+     * Check whether the key has expired at a given time
+     * @param now Unix time in milliseconds
+     */
+    bool expired(int64_t now) const { return expiresAt != 0 && expiresAt <= now; }
+};
+
+/**
+ * Contents of one shard
+ */
+using KeyValueMap = FlatHashMap<StoredValue>;
+
+/**
+ * Keys of one shard changed since the last checkpoint, see DataStore::checkpoint()
+ */
+using DirtyKeys = std::unordered_set<std::string>;
+
+/**
+ * Byte-wise order of keys, comparable with string views without a copy
+ */
+struct KeyOrder {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const { return a < b; }
+};
+
+/**
+ * Keys of one shard in ascending order, see DataStore::setOrderedIndex()
+ */
+using OrderedKeys = std::set<InlineString, KeyOrder>;
+
+/**
+ * Bounds of an ordered walk over the keys, see DataStore::range()
+ * The default range holds every key
+ */
+struct KeyRange {
+    std::string_view min;       // Lower bound
+    bool minExclusive = false;  // Leave min itself out
+    std::string_view max;       // Upper bound, unless maxUnbounded
+    bool maxExclusive = false;  // Leave max itself out
+    bool maxUnbounded = true;
+
+    /**
+     * Check whether a key at or above the lower bound is also within the upper one
+     */
+    bool belowMax(std::string_view key) const {
+        return maxUnbounded || key < max || (!maxExclusive && key == max);
+    }
+};
+
+/**
+ * Outcome of a DataStore command that expects a certain type of value: a
+ * hash, list or sorted set, or a string for the read-modify-write commands
+ */
+enum class TypedStatus {
+    Ok,          // Done; a missing key reads as an empty collection, or 0 for increment()
+    WrongType,   // The key holds a value of another type; nothing changed
+    NotInteger,  // increment() on a string that is not a 64-bit integer; nothing changed
+    Overflow,    // increment() would leave the 64-bit range; nothing changed
+    Failed       // Out of memory
+};
+
+/**
+ * Contents of shards that are materialized on first use, see
+ * DataStore::loadLazily()
+ */
+class ShardSource {
+public:
+    virtual ~ShardSource() = default;
+
+    /**
+     * Insert one shard's entries into its map
+     * Entries whose expiry time has passed may be left out
+     * @param shard Shard index
+     * @param map The shard's map, empty
+     * @return true if successful; on failure whatever was inserted is kept
+     */
+    virtual bool load(size_t shard, KeyValueMap& map) = 0;
+
+    /**
+     * Get the number of entries load() will insert for a shard
+     */
+    virtual size_t size(size_t shard) const = 0;
+};
+
+/**
+ * Point-in-time view of a DataStore, see DataStore::snapshot()
+ * Holds a reference to every shard's map as it was when the snapshot was
+ * taken. The maps are never modified while referenced here: a writer that
+ * finds its shard shared copies the map first. Release each shard as soon
+ * as it has been written out so later writes to it no longer copy
+ */
+class StoreSnapshot {
+private:
+    friend class DataStore;
+    std::vector<std::shared_ptr<const KeyValueMap>> shards_;
+
+public:
+    /**
+     * Get the number of shards in the snapshot
+     */
+    size_t shardCount() const { return shards_.size(); }
+
+    /**
+     * Get one shard's contents
+     * @param index Shard index in [0, shardCount())
+     * @return The shard's map, or nullptr if it was released
+     */
+    const KeyValueMap* shard(size_t index) const { return shards_[index].get(); }
+
+    /**
+     * Drop the reference to one shard
+     * @param index Shard index in [0, shardCount())
+     */
+    void release(size_t index) { shards_[index].reset(); }
+
+    /**
+     * Get the number of entries in the shards not yet released
+     */
+    size_t size() const;
+};
 
 /**
  * Thread-safe in-memory key-value data store
- * Uses std::unordered_map with mutex protection for concurrent access
+ * Keys are hash-partitioned across a fixed number of shards, each with its
+ * own FlatHashMap and reader-writer lock, so operations on different
+ * shards never contend with each other and readers of the same shard run
+ * concurrently. Values are stored as immutable reference-counted buffers, so
+ * readers share them instead of copying. Each shard's map is itself shared
+ * copy-on-write with snapshots, so saving to disk never copies the store
+ * while clients wait.
+ *
+ * Keys may carry an expiry time. An expired key reads as missing at once;
+ * it is removed by the next write to it, or by the active expiry cycle,
+ * which drains each shard's timing wheel a bounded number of keys at a
+ * time (see startExpiryCycle()).
+ *
+ * The store accounts for the memory of every entry and can be given a
+ * limit, which writers enforce by evicting keys before they write (see
+ * freeMemoryIfNeeded()). Keys and values too long to keep inline are
+ * allocated from a slab arena per shard, whose sparse slabs an optional
+ * active defragmentation pass empties (see setActiveDefrag()).
+ *
+ * An optional ordered index keeps each shard's keys sorted as well, for
+ * prefix and range walks over all keys (see range()).
+ *
+ * Besides strings, a key may hold a hash, list or sorted set (see
+ * collection.h). Commands on them modify the collection in place under the
+ * shard lock, cloning it first only if a snapshot or a reader still shares
+ * it, and log themselves rather than the whole collection. A collection
+ * left empty is deleted
  */
 class DataStore {
 private:
-    std::unordered_map<std::string, std::string> data_;
-    mutable std::mutex mutex_;
+    // Cache-line aligned so readers on neighbouring shards don't bounce the
+    // same line when they update the lock's reader count
+    struct alignas(64) Shard {
+        std::shared_ptr<KeyValueMap> data;
+        mutable std::shared_mutex mutex;
+        std::atomic<bool> pending{false};  // Contents still to be loaded from lazySource_
+        std::atomic<uint64_t> changes{0};   // Mutations ever applied, see changeCount()
+        // Keys changed since the last checkpoint; guarded by the exclusive
+        // lock for writers and read only by checkpoint()
+        mutable DirtyKeys dirty;
+        mutable bool dirtyOverflow = false;  // Too many to track; the next checkpoint is a full one
+        // Both guarded by the lock like data; the wheel is created when the
+        // shard's first key gets an expiry time
+        std::unique_ptr<ExpiryWheel> expiries;
+        size_t expiring = 0;  // Keys in data with an expiry time
+        // Guarded by the lock like data, see usedMemory()
+        size_t memory = 0;      // Bytes of the table and what its entries allocate
+        size_t tableBytes = 0;  // The table's share of memory
+        // Where the shard's keys and values are allocated; the map refers
+        // to it too, for the keys it copies
+        std::shared_ptr<SlabArena> arena;
+        // The keys of data in order, guarded by the lock like data; null
+        // unless the ordered index is enabled
+        std::unique_ptr<OrderedKeys> ordered;
+    };
+
+    /**
+     * A key the next eviction may remove, see evictOne()
+     */
+    struct EvictionCandidate {
+        uint64_t score;  // Higher evicts first
+        size_t shard;
+        std::string key;
+    };
+
+    size_t shardCount_;
+    std::unique_ptr<Shard[]> shards_;
+    AppendOnlyLog* appendLog_;
+    mutable std::shared_ptr<ShardSource> lazySource_;  // Released once every shard is loaded
+    mutable std::atomic<size_t> pendingShards_;
+    std::atomic<bool> trackChanges_;
+
+    // Active expiry thread, see startExpiryCycle()
+    std::thread expiryThread_;
+    std::mutex expiryMutex_;
+    std::condition_variable expiryCondition_;
+    bool expiryStop_;
+    size_t expiryCursor_;  // Shard the next cycle starts at
+
+    // Memory limit and eviction, see setMemoryLimit()
+    size_t maxMemory_;
+    EvictionPolicy evictionPolicy_;
+    size_t evictionSamples_;
+    bool tracksAccess_;  // The policy needs access stamps (LRU or LFU)
+    mutable std::atomic<int64_t> usedMemory_;
+    // Coarse clock in milliseconds for access stamps; advanced by writers
+    // and the expiry thread so readers never have to read the time
+    mutable std::atomic<uint32_t> accessClock_;
+    std::mutex evictionMutex_;
+    // Guarded by evictionMutex_: best candidates sampled so far, ascending
+    // by score, and the shard the next eviction samples
+    std::vector<EvictionCandidate> evictionPool_;
+    size_t evictionCursor_;
+
+    // Active defragmentation, see setActiveDefrag(); the cursor is only
+    // used by the thread running defragCycle()
+    bool activeDefrag_;
+    size_t defragIgnoreBytes_;
+    size_t defragThreshold_;
+    std::atomic<bool> defragRunning_;
+    size_t defragShard_;  // Shard and slot the next cycle resumes at
+    size_t defragSlot_;
+
+    bool orderedIndex_;  // Shards keep OrderedKeys, see setOrderedIndex()
+
+    /**
+     * Store a value under a key, replacing any previous value and expiry
+     * The caller must hold the shard lock exclusively
+     * @param shard The key's shard
+     * @param key The key
+     * @param value The value
+     * @param expiresAt Unix time in milliseconds, 0 for no expiry; must not
+     *        be in the past
+     */
+    void storeEntry(Shard& shard, std::string_view key, Value&& value, int64_t expiresAt);
+
+    /**
+     * Remove a key if present. The caller must hold the shard lock exclusively
+     * @return true if the key was present (expired or not)
+     */
+    bool eraseEntry(Shard& shard, std::string_view key);
+
+    /**
+     * Change the expiry time of an entry in a shard's own map, keeping the
+     * expiry count and wheel up to date. The caller must hold the shard
+     * lock exclusively and records the change
+     * @param entry The key's entry, in the map returned by mutableData()
+     * @param expiresAt Unix time in milliseconds, 0 for no expiry
+     */
+    void setExpiry(Shard& shard, std::string_view key, StoredValue& entry, int64_t expiresAt);
+
+    /**
+     * Remove a key that has expired and log the deletion
+     * The caller must hold the shard lock exclusively
+     * @return true if the key was present but expired, and is now gone
+     */
+    bool eraseIfExpired(Shard& shard, std::string_view key, int64_t now);
+
+    /**
+     * Rebuild a shard's expiry count, wheel and memory accounting after its
+     * map was filled or replaced wholesale, dropping keys that have already
+     * expired. The caller must hold the shard lock exclusively
+     */
+    void rescanShard(Shard& shard) const;
+
+    /**
+     * Add the change in a shard's entry bytes, and in its bucket array, to
+     * the shard's and the store's memory use
+     * The caller must hold the shard lock exclusively
+     * @param entryDelta Bytes of entries added minus bytes of entries removed
+     */
+    void adjustMemory(Shard& shard, int64_t entryDelta) const;
+
+    /**
+     * Update an entry's access stamp for the eviction policy on a read
+     */
+    void touch(const StoredValue& entry) const;
+
+    /**
+     * Access stamp of a key that was just created
+     */
+    uint32_t initialStamp() const;
+
+    /**
+     * Rank an entry for eviction under the current policy; higher evicts first
+     */
+    uint64_t evictionScore(const StoredValue& entry) const;
+
+    /**
+     * Advance the access clock to the current time
+     */
+    void refreshAccessClock() const;
+
+    /**
+     * Sample keys of one shard into the eviction pool
+     * The caller must hold evictionMutex_
+     * @param index Shard index
+     */
+    void sampleForEviction(size_t index);
+
+    /**
+     * Evict one key chosen by the eviction policy
+     * The caller must hold evictionMutex_
+     * @return true if a key was evicted, false if no shard has a candidate
+     */
+    bool evictOne();
+
+    /**
+     * Evict a key if it is still present and eligible under the policy
+     * @return true if it was evicted
+     */
+    bool evictKey(size_t index, const std::string& key);
+
+    /**
+     * Background thread: run expireCycle(), resizeTables() and, if
+     * enabled, defragCycle() EXPIRY_CYCLE_MS apart
+     */
+    void expiryLoop();
+
+    /**
+     * Move on the resizing of shard tables that no writes are driving:
+     * move REHASH_CYCLE_GROUPS more groups of each table still being
+     * resized, and start shrinking tables that fell below
+     * 1/SHRINK_FILL_RATIO full, e.g. after mass expiry or eviction, so their
+     * slots stop counting against the memory limit. Shards still shared
+     * with a snapshot are left for a later cycle
+     */
+    void resizeTables();
+
+    /**
+     * Count a mutation and remember the key for the next checkpoint
+     * The caller must hold the shard lock exclusively
+     * @param shard The shard that was modified
+     * @param key The key that was set or deleted
+     */
+    void recordChange(Shard& shard, std::string_view key);
+
+    /**
+     * Mark every shard as changed beyond key tracking, after its contents
+     * were replaced wholesale. The caller must hold every shard lock
+     */
+    void overflowAllShards();
+
+    /**
+     * Take references to every shard's map, and optionally its dirty keys
+     * @param changed If not null, receives and clears each shard's dirty keys
+     * @param complete Receives false if some shard overflowed its dirty keys
+     * @param sequence Checkpoint sequence to mark in the append-only log, 0 for none
+     * @return The snapshot
+     */
+    StoreSnapshot capture(std::vector<DirtyKeys>* changed, bool* complete, uint64_t sequence) const;
+
+    /**
+     * Find the shard responsible for a key
+     * @param key The key to look up
+     * @return Reference to the owning shard
+     */
+    Shard& shardFor(std::string_view key) const;
+
+    /**
+     * Get a shard's map for writing, first copying it if a snapshot still
+     * shares it. The copy only duplicates keys and value references; value
+     * bytes stay shared. The caller must hold the shard lock exclusively
+     * @param shard The shard about to be modified
+     * @return The map owned by the shard alone
+     */
+    KeyValueMap& mutableData(Shard& shard);
+
+    /**
+     * Load a shard from the lazy source if it has not been loaded yet
+     * Must be called without holding the shard lock; it costs one atomic
+     * load once the shard is loaded
+     * @param shard The shard about to be accessed
+     */
+    void ensureLoaded(Shard& shard) const;
+
+    /**
+     * Load every pending shard among a batch's shards
+     * @param shardIndexes Shard index of every key in the batch
+     */
+    void ensureLoaded(const std::vector<size_t>& shardIndexes) const;
+
+    /**
+     * Load every shard still pending
+     */
+    void ensureAllLoaded() const;
+
+    /**
+     * Plan a batch: work out each key's shard and an order that visits the
+     * keys shard by shard, in ascending shard order
+     * @param count Number of keys
+     * @param keyAt Function returning the i-th key
+     * @param shardOf Receives the shard index of every key
+     * @return Key indices grouped by shard; keys of one shard keep their batch order
+     */
+    template <typename KeyAt>
+    std::vector<size_t> groupByShard(size_t count, KeyAt keyAt, std::vector<size_t>& shardOf) const;
+
+    /**
+     * Run a read on the collection under a key, with the shard locked shared
+     * @param type The type the command expects
+     * @param read Called with the collection as a const T&, unless the key
+     *        is missing
+     * @return Ok, or WrongType if the key holds another type
+     */
+    template <typename T, typename Read>
+    TypedStatus readCollection(std::string_view key, ValueType type, Read read) const;
+
+    /**
+     * Run a write on the collection under a key, with the shard locked
+     * exclusively, and account for the change
+     * @param type The type the command expects
+     * @param create true to create an empty collection if the key is
+     *        missing, false to leave a missing key alone
+     * @param write Called with the collection as a T&, owned by the store
+     *        alone; returns true if it changed the collection
+     * @param record The command to log if the collection changed
+     * @return Ok, WrongType if the key holds another type, or Failed
+     */
+    template <typename T, typename Write>
+    TypedStatus writeCollection(std::string_view key, ValueType type, bool create, Write write,
+                                std::string&& record);
+
+    /**
+     * Run a read-modify-write on the string under a key, with the shard
+     * locked exclusively, then store and log the result in place
+     * @param update Called as update(current, replacement, expiresAt)
+     *        with the current value (null if the key is missing), an empty
+     *        Value to fill with the new one, and the key's expiry time to
+     *        keep or change; returns Ok to store the replacement (if it
+     *        filled one) and log it as a SET of the result; any other
+     *        status leaves the key alone
+     * @return WrongType if the key holds a collection, Failed, or what
+     *         update returned
+     */
+    template <typename Update>
+    TypedStatus updateString(std::string_view key, Update update);
 
 public:
     /**
-     * Store a key-value pair
+     * Default number of shards when none is given on the command line
+     */
+    static constexpr size_t DEFAULT_SHARD_COUNT = 64;
+
+    /**
+     * Constructor
+     * @param shardCount Number of hash partitions (values below 1 are treated as 1)
+     */
+    explicit DataStore(size_t shardCount = DEFAULT_SHARD_COUNT);
+
+    /**
+     * Destructor - stops the active expiry cycle
+     */
+    ~DataStore();
+
+    DataStore(const DataStore&) = delete;
+    DataStore& operator=(const DataStore&) = delete;
+
+    /**
+     * Keys sampled per eviction unless configured otherwise
+     */
+    static constexpr size_t DEFAULT_EVICTION_SAMPLES = 5;
+
+    /**
+     * Candidates kept between evictions, the best of all recent samples
+     */
+    static constexpr size_t EVICTION_POOL_SIZE = 16;
+
+    /**
+     * Most keys one write evicts; a write that reaches it goes ahead even
+     * if the store is still over its limit, so memory drains over several
+     * writes instead of stalling one
+     */
+    static constexpr size_t MAX_EVICTIONS_PER_WRITE = 64;
+
+    /**
+     * Interval between active expiry cycles
+     */
+    static constexpr int EXPIRY_CYCLE_MS = 100;
+
+    /**
+     * Most due wheel entries one active expiry cycle examines
+     */
+    static constexpr size_t EXPIRY_CYCLE_BUDGET = 20000;
+
+    /**
+     * A shard's table is shrunk when fewer than 1 in SHRINK_FILL_RATIO of
+     * its slots hold an entry
+     */
+    static constexpr size_t SHRINK_FILL_RATIO = 8;
+
+    /**
+     * Groups of an old shard table moved per shard by each active expiry
+     * cycle while the table is resized, on top of those every insertion
+     * moves; about 100 microseconds under the shard lock
+     */
+    static constexpr size_t REHASH_CYCLE_GROUPS = 256;
+
+    /**
+     * Reclaimable slab bytes (see SlabArena::Stats) up to which active
+     * defragmentation does nothing, as Redis' active-defrag-ignore-bytes
+     */
+    static constexpr size_t DEFAULT_DEFRAG_IGNORE_BYTES = 100 * 1024 * 1024;
+
+    /**
+     * Percentage of reclaimable over allocated bytes up to which active
+     * defragmentation does nothing, as Redis' active-defrag-threshold-lower
+     */
+    static constexpr size_t DEFAULT_DEFRAG_THRESHOLD = 10;
+
+    /**
+     * Most entries one active defragmentation cycle looks at
+     */
+    static constexpr size_t DEFRAG_CYCLE_BUDGET = 20000;
+
+    /**
+     * Entries looked at per shard lock acquisition while defragmenting
+     */
+    static constexpr size_t DEFRAG_LOCK_BATCH = 1000;
+
+    /**
+     * Current Unix time in milliseconds, the clock of all expiry times
+     */
+    static int64_t unixTimeMillis();
+
+    /**
+     * Record every mutation in an append-only log
+     * Records are queued while the affected shard locks are held, so the
+     * log order of any one key matches the order the changes were applied.
+     * Must be called before the store is shared between threads
+     * @param log The log to append to, or nullptr to stop logging
+     */
+    void setAppendLog(AppendOnlyLog* log);
+
+    /**
+     * Limit the memory the store may use and choose how to enforce it
+     * Must be called before the store is shared between threads
+     * @param maxMemory Limit in bytes, as reported by usedMemory(); 0 for none
+     * @param policy How keys are chosen for eviction
+     * @param samples Keys sampled per eviction; more is closer to exact
+     *        LRU/LFU and slower
+     */
+    void setMemoryLimit(size_t maxMemory, EvictionPolicy policy, size_t samples = DEFAULT_EVICTION_SAMPLES);
+
+    /**
+     * Get the memory limit in bytes, 0 if there is none
+     */
+    size_t memoryLimit() const;
+
+    /**
+     * Get the eviction policy
+     */
+    EvictionPolicy evictionPolicy() const;
+
+    /**
+     * Evict keys until the store is within its memory limit
+     * Called before a command that may add memory; writes themselves
+     * never evict, so loading a snapshot is never cut short. Each eviction
+     * samples a few keys of the next shard into a pool of the best
+     * candidates seen and evicts the best of the pool. Readers only update
+     * the entries' access stamps; nothing here is on the read path
+     * @return false if the store is over its limit and nothing can be
+     *         evicted (always with EvictionPolicy::NoEviction): the command
+     *         should be refused
+     */
+    bool freeMemoryIfNeeded();
+
+    /**
+     * Get the estimated memory held by the stored entries
+     * Counts each entry's node, key and value allocations (rounded up as
+     * malloc or the slab arena does) and every shard's bucket array. Copies a snapshot forces
+     * are not included
+     */
+    size_t usedMemory() const;
+
+    /**
+     * Enable or disable active defragmentation in the background thread
+     * started by startExpiryCycle()
+     * Must be called before the store is shared between threads
+     * @param enabled true to run defragCycle() every EXPIRY_CYCLE_MS
+     * @param ignoreBytes Reclaimable slab bytes up to which nothing is moved
+     * @param thresholdPercent Reclaimable bytes, as a percentage of
+     *        allocated bytes, up to which nothing is moved; also applied
+     *        per shard
+     */
+    void setActiveDefrag(bool enabled, size_t ignoreBytes = DEFAULT_DEFRAG_IGNORE_BYTES,
+                         size_t thresholdPercent = DEFAULT_DEFRAG_THRESHOLD);
+
+    /**
+     * Check whether active defragmentation is enabled
+     */
+    bool activeDefrag() const;
+
+    /**
+     * Check whether the last defragmentation cycle found enough waste to work
+     */
+    bool defragRunning() const;
+
+    /**
+     * Move keys and values out of sparsely used slabs into fuller ones, so
+     * emptied slabs go back to the system, if the arenas could give back
+     * more than setActiveDefrag() tolerates. Starts where the previous call stopped and
+     * skips shards still shared with a snapshot or waiting to be loaded,
+     * and values referenced outside the store. Only one thread may run
+     * cycles at a time
+     * @param budget Most entries to look at
+     * @return Number of keys and values moved
+     */
+    size_t defragCycle(size_t budget);
+
+    /**
+     * Get the combined statistics of every shard's slab arena
+     */
+    SlabArena::Stats allocatorStats() const;
+
+    /**
+     * Parse an eviction policy name as used by Redis, e.g. "allkeys-lru"
+     * @return true if the name is known
+     */
+    static bool parseEvictionPolicy(const std::string& name, EvictionPolicy& policy);
+
+    /**
+     * Get the name of a policy as accepted by parseEvictionPolicy()
+     */
+    static const char* evictionPolicyName(EvictionPolicy policy);
+
+    /**
+     * Store a key-value pair, replacing the key's value and expiry time
      * @param key The key to store
      * @param value The value to associate with the key
+     * @param expiresAt When the key expires, in Unix milliseconds; 0 (the
+     *        default) for never. A time already past deletes the key instead
      * @return true if successful
      */
-    bool set(const std::string& key, const std::string& value);
+    bool set(std::string_view key, std::string_view value, int64_t expiresAt = 0);
 
     /**
      * Retrieve a value by key
+     * Takes the shard lock in shared mode, so concurrent readers never
+     * exclude each other. Only a reference count is taken under the lock;
+     * the value bytes are never copied
      * @param key The key to look up
-     * @return Optional containing the value if found, empty if not found
+     * @return The value if found, an empty Value if not found or expired
      */
-    std::optional<std::string> get(const std::string& key) const;
+    Value get(std::string_view key) const;
 
     /**
      * Delete a key-value pair
      * @param key The key to delete
-     * @return true if key was deleted, false if key didn't exist
+     * @return true if key was deleted, false if key didn't exist (or had expired)
+     */
+    bool del(std::string_view key);
+
+    /**
+     * Retrieve several values at once
+     * Keys are grouped by shard and every involved shard lock is taken
+     * once, in shared mode and ascending order, and held until all keys are
+     * read, so the result is one consistent view (never half of an MSET)
+     * @param keys The keys to look up
+     * @return One entry per key, in order; empty Values for missing or expired keys
+     */
+    std::vector<Value> mget(const std::vector<std::string_view>& keys) const;
+
+    /**
+     * Store several key-value pairs atomically
+     * Values are built before any lock is taken; then every involved shard
+     * is locked once, exclusively and in ascending order, so readers see
+     * either none or all of the pairs. If a key repeats, the last pair wins
+     * @param entries The key-value pairs
+     * @param expiresAt Expiry time of each pair as for set(), or empty if
+     *        none of them expire
+     * @return true if successful
+     */
+    bool mset(const std::vector<std::pair<std::string_view, std::string_view>>& entries,
+              const std::vector<int64_t>& expiresAt = {});
+
+    /**
+     * Delete several keys atomically, locking each involved shard once
+     * @param keys The keys to delete
+     * @return Number of keys that existed, had not expired, and were deleted
+     */
+    size_t mdel(const std::vector<std::string_view>& keys);
+
+    /**
+     * Set when an existing key expires
+     * @param key The key
+     * @param expiresAt Unix time in milliseconds; a time already past
+     *        deletes the key
+     * @return true if the key exists, false otherwise
+     */
+    bool expireAt(std::string_view key, int64_t expiresAt);
+
+    /**
+     * Remove a key's expiry time
+     * @param key The key
+     * @return true if the key exists and had an expiry time
+     */
+    bool persist(std::string_view key);
+
+    /**
+     * Get a key's remaining time to live
+     * @param key The key
+     * @return Milliseconds left, -1 if the key never expires, -2 if it
+     *         does not exist
+     */
+    int64_t timeToLive(std::string_view key) const;
+
+    /**
+     * Get the type of the value under a key
+     * @param key The key
+     * @param type Receives the type
+     * @return false if the key does not exist
+     */
+    bool type(std::string_view key, ValueType& type) const;
+
+    /**
+     * Get the number of entries of a hash, list or sorted set
+     * @param key The key
+     * @param type The type expected
+     * @param length Receives the number of fields, elements or members, 0
+     *        for a missing key
+     */
+    TypedStatus length(std::string_view key, ValueType type, size_t& length) const;
+
+    /**
+     * Set fields of a hash, creating it if needed
+     * @param key The key
+     * @param fields Field-value pairs, applied in order
+     * @param added Receives the number of fields that were new
+     */
+    TypedStatus hset(std::string_view key, const std::vector<std::pair<std::string_view, std::string_view>>& fields,
+                     size_t& added);
+
+    /**
+     * Get a field of a hash
+     * @param key The key
+     * @param field The field
+     * @param value Receives the value, empty if the key or field is missing
+     */
+    TypedStatus hget(std::string_view key, std::string_view field, Value& value) const;
+
+    /**
+     * Remove fields of a hash
+     * @param key The key
+     * @param fields The fields
+     * @param removed Receives the number of fields that existed
      */
-    bool del(const std::string& key);
+    TypedStatus hdel(std::string_view key, const std::vector<std::string_view>& fields, size_t& removed);
 
     /**
-     * Get all key-value pairs (for persistence)
-     * @return Copy of the entire data map
+     * Get every field of a hash, in no particular order
+     * @param key The key
+     * @param fields Receives the field-value pairs
      */
-    std::unordered_map<std::string, std::string> getAllData() const;
+    TypedStatus hgetAll(std::string_view key, std::vector<std::pair<std::string, Value>>& fields) const;
 
     /**
-     * Load data from a map (for persistence)
+     * Add elements at the head or the tail of a list, creating it if needed
+     * @param key The key
+     * @param front true to push at the head (LPUSH), false at the tail
+     * @param elements The elements, pushed one after the other
+     * @param length Receives the length of the list afterwards
+     */
+    TypedStatus push(std::string_view key, bool front, const std::vector<std::string_view>& elements,
+                     size_t& length);
+
+    /**
+     * Remove elements from the head or the tail of a list
+     * @param key The key
+     * @param front true to pop from the head (LPOP), false from the tail
+     * @param count Most elements to remove
+     * @param elements Receives the removed elements, in the order removed
+     */
+    TypedStatus pop(std::string_view key, bool front, size_t count, std::vector<Value>& elements);
+
+    /**
+     * Get elements of a list by index, as LRANGE counts them: from 0 at
+     * the head, negative indexes counting back from -1 at the tail, both
+     * ends included and clamped to the list
+     * @param key The key
+     * @param elements Receives the elements
+     */
+    TypedStatus listRange(std::string_view key, long long start, long long stop, std::vector<Value>& elements) const;
+
+    /**
+     * Add members to a sorted set or update their scores, creating it if needed
+     * @param key The key
+     * @param members Score-member pairs, applied in order
+     * @param added Receives the number of members that were new
+     */
+    TypedStatus zadd(std::string_view key, const std::vector<std::pair<double, std::string_view>>& members,
+                     size_t& added);
+
+    /**
+     * Remove members of a sorted set
+     * @param key The key
+     * @param members The members
+     * @param removed Receives the number of members that existed
+     */
+    TypedStatus zrem(std::string_view key, const std::vector<std::string_view>& members, size_t& removed);
+
+    /**
+     * Get a member's score in a sorted set
+     * @param key The key
+     * @param member The member
+     * @param score Receives the score
+     * @param found Receives false if the key or member is missing
+     */
+    TypedStatus zscore(std::string_view key, std::string_view member, double& score, bool& found) const;
+
+    /**
+     * Get members of a sorted set by rank, lowest score first, with ranks
+     * counted as listRange() counts indexes
+     * @param key The key
+     * @param members Receives the members and their scores
+     */
+    TypedStatus zrange(std::string_view key, long long start, long long stop,
+                       std::vector<std::pair<std::string, double>>& members) const;
+
+    /**
+     * Add to the integer under a key, as INCRBY does; a missing key counts
+     * as 0, and the key keeps its expiry time. The result is stored with
+     * Value::integer(), in the handle itself
+     * @param key The key
+     * @param delta Amount to add, negative to subtract
+     * @param value Receives the new value
+     * @return Ok, WrongType, NotInteger if the string is not an integer, or
+     *         Overflow if the result leaves the 64-bit range
+     */
+    TypedStatus increment(std::string_view key, int64_t delta, int64_t& value);
+
+    /**
+     * Append bytes to the string under a key, creating it if needed; the
+     * key keeps its expiry time
+     * @param key The key
+     * @param suffix The bytes to append
+     * @param length Receives the length of the string afterwards
+     */
+    TypedStatus append(std::string_view key, std::string_view suffix, size_t& length);
+
+    /**
+     * Store a string and return the one it replaced, as one step; like
+     * set(), clears the key's expiry time
+     * @param key The key
+     * @param value The new value
+     * @param previous Receives the old value, empty if the key was missing
+     */
+    TypedStatus getSet(std::string_view key, std::string_view value, Value& previous);
+
+    /**
+     * Replace the string under a key only if it still equals an expected
+     * value; the key keeps its expiry time
+     * @param key The key
+     * @param expected The value the key must hold
+     * @param desired The value to store in its place
+     * @param swapped Receives true if the value was replaced, false if the
+     *        key is missing or holds something else
+     */
+    TypedStatus compareAndSwap(std::string_view key, std::string_view expected, std::string_view desired,
+                               bool& swapped);
+
+    /**
+     * Store a hash, list or sorted set as Collection::encode() serialized
+     * it, replacing any value under the key; for loading snapshots, so the
+     * change is not logged
+     * @param key The key
+     * @param encoded The serialized collection
+     * @param expiresAt Unix time in milliseconds, 0 for no expiry
+     * @return false if the bytes don't decode
+     */
+    bool restoreCollection(std::string_view key, std::string_view encoded, int64_t expiresAt);
+
+    /**
+     * Remove keys whose expiry time has passed, found through the shards'
+     * timing wheels, starting after the shard the previous call ended at
+     * Shards still waiting to be lazily loaded are skipped. Only one thread
+     * may run cycles at a time
+     * @param budget Most wheel entries to examine, stale ones included
+     * @return Number of keys removed
+     */
+    size_t expireCycle(size_t budget);
+
+    /**
+     * Run expireCycle() in a background thread every EXPIRY_CYCLE_MS
+     * The thread also advances the access clock of the eviction policy and
+     * shrinks tables left mostly empty
+     */
+    void startExpiryCycle();
+
+    /**
+     * Stop the background expiry thread, if running
+     */
+    void stopExpiryCycle();
+
+    /**
+     * Get the number of keys with an expiry time
+     */
+    size_t expiringKeys() const;
+
+    /**
+     * Get the number of entries in the expiry wheels, including stale ones
+     */
+    size_t expiryWheelSize() const;
+
+    /**
+     * Take a consistent point-in-time view of the whole store
+     * All shards are locked together only long enough to take a reference
+     * to each shard's map, independent of the number of keys. Writers keep
+     * going while the snapshot is read; the first write to a shard the
+     * snapshot still references copies that shard's map
+     * @param sequence If not 0, the snapshot's checkpoint sequence, logged
+     *        at the exact point of the snapshot in the append-only log
+     *        (see AppendOnlyLog::checkpointRecord())
+     * @return The snapshot
+     */
+    StoreSnapshot snapshot(uint64_t sequence = 0) const;
+
+    /**
+     * Start or stop remembering which keys change, for incremental saves
+     * Clears whatever was remembered. Keys are tracked per shard until a
+     * shard's set grows past half its size; beyond that the shard is only
+     * flagged and the next checkpoint reports itself incomplete
+     * @param enabled true to track changed keys
+     */
+    void trackChanges(bool enabled);
+
+    /**
+     * Take a snapshot together with the keys changed since the previous
+     * checkpoint, and start tracking afresh
+     * The changed keys are the ones whose state in the snapshot differs
+     * from the previous checkpoint: present keys were set, missing ones
+     * deleted. Only one thread may take checkpoints
+     * @param changed Receives one set of changed keys per shard
+     * @param complete Receives false if the changes could not all be
+     *        tracked (or tracking is off), so only a full save captures them
+     * @param sequence As for snapshot()
+     * @return The snapshot
+     */
+    StoreSnapshot checkpoint(std::vector<DirtyKeys>& changed, bool& complete, uint64_t sequence = 0) const;
+
+    /**
+     * Get the number of mutations applied since the store was created
+     * Take the difference between two calls to count changes in between
+     */
+    uint64_t changeCount() const;
+
+    /**
+     * Get all key-value pairs as one map
+     * Built from a snapshot, so writers are not blocked while it is copied
+     * @return Copy of the entire data map (values are shared, not copied)
+     */
+    KeyValueMap getAllData() const;
+
+    /**
+     * Load data from a map (for persistence), moving its nodes into the shards
+     * Replaces the current contents of every shard; not recorded in the
+     * append-only log
      * @param data The data to load
      */
-    void loadData(const std::unordered_map<std::string, std::string>& data);
+    void loadData(KeyValueMap data);
+
+    /**
+     * Remove every key and size the shards for a bulk load
+     * @param expectedEntries Number of keys about to be inserted; each
+     *        shard reserves room for its share so the load never rehashes
+     */
+    void reset(size_t expectedEntries = 0);
+
+    /**
+     * Replace the contents of every shard with a source that is read on
+     * demand: the first operation touching a shard loads it, and
+     * materializeShard() lets a background thread load the rest. Must be
+     * called before the store is shared between threads
+     * @param source Provides each shard's entries; must use this store's
+     *        shard count and key-to-shard mapping
+     */
+    void loadLazily(std::shared_ptr<ShardSource> source);
+
+    /**
+     * Load one shard from the lazy source if it is still pending
+     * @param index Shard index
+     */
+    void materializeShard(size_t index);
+
+    /**
+     * Get the number of shards not yet loaded from the lazy source
+     */
+    size_t pendingShards() const;
 
     /**
      * Get the number of stored key-value pairs
      * @return Number of entries
      */
     size_t size() const;
+
+    /**
+     * Find the index of the shard responsible for a key
+     * @param key The key to look up
+     * @return Shard index in [0, shardCount())
+     */
+    size_t shardIndex(std::string_view key) const;
+
+    /**
+     * Get the number of shards the key space is partitioned into
+     * @return Number of shards
+     */
+    size_t shardCount() const;
+
+    /**
+     * Keep or drop an ordered index of every shard's keys, which range()
+     * needs. Writers maintain it under the shard lock they already hold;
+     * it costs a tree insertion per new key and about 64 bytes per key,
+     * counted in usedMemory(). Must be called before the store is shared
+     * between threads
+     * @param enabled true to build the index, false to drop it
+     */
+    void setOrderedIndex(bool enabled);
+
+    /**
+     * Check whether the ordered index is enabled
+     */
+    bool orderedIndex() const;
+
+    /**
+     * Get keys in ascending byte order, optionally with their values
+     * The shards' indexes are merged: each shard is read in batches, under
+     * its own shared lock, one shard at a time, so a walk never holds more
+     * than one lock and a long one doesn't stall writers. Each call is
+     * therefore not one point-in-time view; a walk resumed from its last
+     * key sees every key that existed throughout exactly once. Expired keys
+     * are left out. Requires the ordered index (empty result otherwise)
+     * @param range Bounds of the keys
+     * @param limit Most keys to return
+     * @param withValues true to also return each key's value
+     * @return Keys in order, each with its value or an empty Value
+     */
+    std::vector<std::pair<std::string, Value>> range(const KeyRange& range, size_t limit, bool withValues) const;
 };
@@ -0,0 +1,349 @@
+#include "event_loop.h"
+
+#ifdef BOLTDB_HAS_EPOLL
+
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+EventLoop::EventLoop(ConnectionCallbacks callbacks)
+    : callbacks_(std::move(callbacks)), running_(false), epollFd_(-1), wakeFd_(-1),
+      listenSocket_(INVALID_SOCKET_VALUE), connectionCount_(0) {
+}
+
+EventLoop::~EventLoop() {
+    stop();
+}
+
+void EventLoop::setListener(socket_t listenSocket) {
+    listenSocket_ = listenSocket;
+}
+
+bool EventLoop::start(int cpu) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        std::cerr << "Failed to create epoll instance" << std::endl;
+        return false;
+    }
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        std::cerr << "Failed to create eventfd" << std::endl;
+        close(epollFd_);
+        epollFd_ = -1;
+        return false;
+    }
+
+    // The wakeup descriptor is registered with a null pointer so it can be
+    // told apart from connections
+    struct epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event);
+
+    if (listenSocket_ != INVALID_SOCKET_VALUE) {
+        int flags = fcntl(listenSocket_, F_GETFL, 0);
+        fcntl(listenSocket_, F_SETFL, flags | O_NONBLOCK);
+        event.events = EPOLLIN;
+        event.data.ptr = &listenSocket_;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenSocket_, &event);
+    }
+
+    running_ = true;
+    thread_ = std::thread(&EventLoop::run, this);
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(thread_.native_handle(), sizeof(cpus), &cpus) != 0) {
+            std::cerr << "Failed to pin event loop to CPU " << cpu << std::endl;
+        }
+    }
+    return true;
+}
+
+void EventLoop::stop() {
+    if (!running_) {
+        return;
+    }
+
+    running_ = false;
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) {
+        std::cerr << "Failed to wake event loop" << std::endl;
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    // Sockets handed over after the loop exited were never adopted
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        for (const auto& entry : pending_) {
+            close(entry.first);
+        }
+        pending_.clear();
+    }
+
+    close(wakeFd_);
+    close(epollFd_);
+    wakeFd_ = -1;
+    epollFd_ = -1;
+}
+
+void EventLoop::addConnection(socket_t socket, int clientId) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        if (!running_) {
+            close(socket);
+            return;
+        }
+        pending_.emplace_back(socket, clientId);
+    }
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) {
+        std::cerr << "Failed to wake event loop" << std::endl;
+    }
+}
+
+size_t EventLoop::connectionCount() const {
+    return connectionCount_.load(std::memory_order_relaxed);
+}
+
+void EventLoop::adoptPending() {
+    uint64_t count;
+    while (read(wakeFd_, &count, sizeof(count)) > 0) {
+    }
+
+    std::vector<std::pair<socket_t, int>> adopted;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        adopted.swap(pending_);
+    }
+
+    for (const auto& entry : adopted) {
+        registerConnection(entry.first, entry.second);
+    }
+}
+
+void EventLoop::acceptConnections() {
+    for (int accepted = 0; accepted < MAX_ACCEPT_PER_EVENT; ++accepted) {
+        socket_t socket = accept4(listenSocket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && running_) {
+                std::cerr << "Failed to accept client connection" << std::endl;
+            }
+            return;
+        }
+        setNoDelay(socket);
+        registerConnection(socket, callbacks_.nextClientId ? callbacks_.nextClientId() : 0);
+    }
+}
+
+void EventLoop::registerConnection(socket_t socket, int clientId) {
+    auto connection = std::make_unique<Connection>();
+    connection->socket = socket;
+    connection->id = clientId;
+
+    struct epoll_event event {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = connection.get();
+    connection->registeredEvents = event.events;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, socket, &event) < 0) {
+        std::cerr << "Failed to register client socket" << std::endl;
+        close(socket);
+        return;
+    }
+
+    Connection& registered = *connection;
+    connections_[socket] = std::move(connection);
+    connectionCount_.fetch_add(1, std::memory_order_relaxed);
+    if (callbacks_.onOpen) callbacks_.onOpen(registered);
+}
+
+void EventLoop::run() {
+    struct epoll_event events[256];
+
+    while (running_) {
+        int ready = epoll_wait(epollFd_, events, 256, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed" << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                adoptPending();
+                continue;
+            }
+            if (events[i].data.ptr == &listenSocket_) {
+                acceptConnections();
+                continue;
+            }
+
+            Connection& connection = *static_cast<Connection*>(events[i].data.ptr);
+            uint32_t flags = events[i].events;
+            // A dead peer can't drain replies we are holding back for it
+            if ((flags & (EPOLLHUP | EPOLLERR)) &&
+                (connection.closeAfterWrite || connection.readPaused)) {
+                closeConnection(connection);
+                continue;
+            }
+            if (!connection.closeAfterWrite && !connection.readPaused &&
+                (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                handleReadable(connection);
+            }
+            if ((flags & EPOLLOUT) && !connection.flushQueued) {
+                handleWritable(connection);
+            }
+        }
+        flushQueued();
+    }
+
+    while (!connections_.empty()) {
+        closeConnection(*connections_.begin()->second);
+    }
+}
+
+void EventLoop::handleReadable(Connection& connection) {
+    size_t total = 0;
+    bool peerClosed = false;
+
+    while (total < MAX_READ_PER_EVENT) {
+        char* space = connection.input.prepare();
+        ssize_t received = recv(connection.socket, space, connection.input.writable(), 0);
+        if (received > 0) {
+            connection.input.commit(static_cast<size_t>(received));
+            total += static_cast<size_t>(received);
+            continue;
+        }
+        if (received == 0) {
+            peerClosed = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            peerClosed = true;
+        }
+        break;
+    }
+
+    bool keepOpen = true;
+    if (total > 0) {
+        keepOpen = callbacks_.onInput(connection);
+        connection.readPaused = connection.output.size() >= OutputBuffer::HIGH_WATERMARK;
+    }
+
+    if (peerClosed || !keepOpen) {
+        connection.closeAfterWrite = true;
+    }
+    if (!connection.flushQueued) {
+        connection.flushQueued = true;
+        flushQueue_.push_back(connection.socket);
+    }
+}
+
+void EventLoop::flushQueued() {
+    if (flushQueue_.empty()) {
+        return;
+    }
+    // One hook call covers every connection of this iteration, e.g. a
+    // single wait for the append-only log's group commit. When it fails the
+    // replies are dropped with their connections, so no client is told that
+    // a write it made was stored
+    bool flush = !callbacks_.beforeFlush || callbacks_.beforeFlush();
+
+    for (socket_t socket : flushQueue_) {
+        auto it = connections_.find(socket);
+        if (it == connections_.end() || !it->second->flushQueued) continue;
+        it->second->flushQueued = false;
+        if (flush) {
+            handleWritable(*it->second);
+        } else {
+            closeConnection(*it->second);
+        }
+    }
+    flushQueue_.clear();
+}
+
+bool EventLoop::handleWritable(Connection& connection) {
+    while (true) {
+        while (!connection.output.empty()) {
+            long written = connection.output.writeTo(connection.socket);
+            if (written < 0) {
+                closeConnection(connection);
+                return false;
+            }
+            if (written == 0) {
+                break;
+            }
+        }
+
+        if (connection.output.empty() && connection.closeAfterWrite) {
+            closeConnection(connection);
+            return false;
+        }
+
+        // Once the client has caught up, resume with the commands that were
+        // left in the input buffer when the high watermark was hit
+        if (connection.readPaused && !connection.closeAfterWrite &&
+            connection.output.size() < OutputBuffer::LOW_WATERMARK) {
+            connection.readPaused = false;
+            if (!connection.input.empty()) {
+                if (!callbacks_.onInput(connection)) {
+                    connection.closeAfterWrite = true;
+                }
+                if (callbacks_.beforeFlush && !callbacks_.beforeFlush()) {
+                    closeConnection(connection);
+                    return false;
+                }
+                connection.readPaused = connection.output.size() >= OutputBuffer::HIGH_WATERMARK;
+                continue;
+            }
+        }
+        break;
+    }
+
+    updateInterest(connection);
+    return true;
+}
+
+void EventLoop::updateInterest(Connection& connection) {
+    // A connection that is only draining replies, or is paused for
+    // backpressure, stops listening for input
+    uint32_t events = 0;
+    if (!connection.closeAfterWrite && !connection.readPaused) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (!connection.output.empty()) {
+        events |= EPOLLOUT;
+    }
+
+    if (events != connection.registeredEvents) {
+        struct epoll_event event {};
+        event.events = events;
+        event.data.ptr = &connection;
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, connection.socket, &event);
+        connection.registeredEvents = events;
+    }
+}
+
+void EventLoop::closeConnection(Connection& connection) {
+    socket_t socket = connection.socket;
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, socket, nullptr);
+    if (callbacks_.onClose) callbacks_.onClose(connection);
+    close(socket);
+    connections_.erase(socket);
+    connectionCount_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+#endif // BOLTDB_HAS_EPOLL
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "net.h"
+#include "output_buffer.h"
+#include "input_buffer.h"
+#include "command_parser.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+    #define BOLTDB_HAS_EPOLL 1
+#endif
+
+/**
+ * State of one client connection owned by an event loop
+ */
+struct Connection {
+    socket_t socket;
+    int id;
+    InputBuffer input;       // Bytes received but not yet parsed
+    CommandParser parser;    // Protocol state of the connection
+    OutputBuffer output;     // Replies waiting to be written
+    uint32_t registeredEvents = 0; // epoll interest currently registered
+    bool readPaused = false;       // Output passed the high watermark; not reading input
+    bool closeAfterWrite = false;  // Peer finished sending; close once output drains
+    bool flushQueued = false;      // Replies are written at the end of the loop iteration
+};
+
+/**
+ * Callbacks an event loop uses to hand connection events to the server
+ */
+struct ConnectionCallbacks {
+    /** Allocates client ids for connections the loop accepts itself */
+    std::function<int()> nextClientId;
+    std::function<void(Connection&)> onOpen;
+    /** Called after new input arrived; return false to close the connection */
+    std::function<bool(Connection&)> onInput;
+    /**
+     * Called once per loop iteration before the replies produced by onInput
+     * are written; return false to close those connections without them
+     */
+    std::function<bool()> beforeFlush;
+    std::function<void(Connection&)> onClose;
+};
+
+/**
+ * Single-threaded epoll reactor
+ * Owns a set of non-blocking client sockets, reads whatever is available,
+ * lets the server turn complete commands into replies and writes the replies
+ * back without ever blocking the thread. Connections either arrive from the
+ * server's accept thread or are accepted by the loop from its own listening
+ * socket. Only available on Linux.
+ */
+class EventLoop {
+private:
+    ConnectionCallbacks callbacks_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+    int epollFd_;
+    int wakeFd_;
+    socket_t listenSocket_;
+    std::unordered_map<socket_t, std::unique_ptr<Connection>> connections_;
+    std::atomic<size_t> connectionCount_;
+
+    std::mutex pendingMutex_;
+    std::vector<std::pair<socket_t, int>> pending_;
+
+    // Connections with new replies, written together after all events of
+    // one epoll_wait() have been processed
+    std::vector<socket_t> flushQueue_;
+
+    /**
+     * Event loop thread body
+     */
+    void run();
+
+    /**
+     * Register sockets handed over by addConnection()
+     */
+    void adoptPending();
+
+    /**
+     * Accept pending connections from this loop's own listening socket
+     */
+    void acceptConnections();
+
+    /**
+     * Start watching a connected, non-blocking client socket
+     */
+    void registerConnection(socket_t socket, int clientId);
+
+    /**
+     * Read available input, process it and queue the connection for the
+     * flush at the end of the loop iteration
+     */
+    void handleReadable(Connection& connection);
+
+    /**
+     * Write the replies of every queued connection
+     */
+    void flushQueued();
+
+    /**
+     * Write as much queued output as the socket accepts, resume a paused
+     * connection once its output drains below the low watermark, and update
+     * the epoll interest accordingly
+     * @return false if the connection was closed
+     */
+    bool handleWritable(Connection& connection);
+
+    /**
+     * Register the epoll events matching the connection's current state
+     */
+    void updateInterest(Connection& connection);
+
+    /**
+     * Unregister, close and forget a connection
+     */
+    void closeConnection(Connection& connection);
+
+public:
+    /**
+     * Upper bound on bytes read from one connection per wakeup, so one busy
+     * client can't starve the others on the same loop
+     */
+    static constexpr size_t MAX_READ_PER_EVENT = 256 * 1024;
+
+    /**
+     * Upper bound on connections accepted per listener wakeup
+     */
+    static constexpr int MAX_ACCEPT_PER_EVENT = 64;
+
+    /**
+     * Constructor
+     * @param callbacks Connection event callbacks
+     */
+    explicit EventLoop(ConnectionCallbacks callbacks);
+
+    /**
+     * Destructor - stops the loop and closes its connections
+     */
+    ~EventLoop();
+
+    /**
+     * Give this loop its own listening socket (e.g. one of several
+     * SO_REUSEPORT listeners); must be called before start()
+     * @param listenSocket A bound, listening socket; it stays owned by the caller
+     */
+    void setListener(socket_t listenSocket);
+
+    /**
+     * Create the epoll instance and start the loop thread
+     * @param cpu CPU to pin the loop thread to, or -1 to leave it unpinned
+     * @return true if successful, false otherwise
+     */
+    bool start(int cpu = -1);
+
+    /**
+     * Stop the loop thread and close every connection it owns
+     */
+    void stop();
+
+    /**
+     * Hand a connected socket to this loop (thread-safe)
+     * @param socket The client socket, switched to non-blocking mode here
+     * @param clientId Unique identifier for this client
+     */
+    void addConnection(socket_t socket, int clientId);
+
+    /**
+     * Get the number of connections currently owned by this loop
+     */
+    size_t connectionCount() const;
+};
@@ -0,0 +1,49 @@
+#include "expiry_wheel.h"
+
+ExpiryWheel::ExpiryWheel(int64_t now)
+    : current_(now / RESOLUTION_MS), size_(0) {
+}
+
+int64_t ExpiryWheel::tickOf(int64_t expiresAt) {
+    return expiresAt / RESOLUTION_MS + (expiresAt % RESOLUTION_MS != 0 ? 1 : 0);
+}
+
+void ExpiryWheel::add(std::string_view key, int64_t expiresAt) {
+    place(Entry{expiresAt, std::string(key)});
+    ++size_;
+}
+
+void ExpiryWheel::place(Entry&& entry) {
+    int64_t tick = tickOf(entry.expiresAt);
+    if (tick < current_) {
+        tick = current_;
+    }
+    for (size_t level = 0; level < LEVELS; ++level) {
+        unsigned shift = static_cast<unsigned>(level) * SLOT_BITS;
+        if (tick - current_ < (int64_t(1) << (shift + SLOT_BITS))) {
+            slots_[level][static_cast<size_t>(tick >> shift) & (SLOTS - 1)].push_back(std::move(entry));
+            return;
+        }
+    }
+    // Beyond the wheel: park in the furthest top-level slot; the entry is
+    // refiled by its real time when that slot comes round
+    unsigned top = static_cast<unsigned>(LEVELS - 1) * SLOT_BITS;
+    int64_t furthest = current_ + (int64_t(1) << (top + SLOT_BITS)) - 1;
+    slots_[LEVELS - 1][static_cast<size_t>(furthest >> top) & (SLOTS - 1)].push_back(std::move(entry));
+}
+
+void ExpiryWheel::cascade() {
+    // Level L's slot for the current tick starts here when every level
+    // below it has just wrapped to slot 0
+    for (size_t level = 1; level < LEVELS; ++level) {
+        unsigned shift = static_cast<unsigned>(level) * SLOT_BITS;
+        if ((current_ & ((int64_t(1) << shift) - 1)) != 0) {
+            break;
+        }
+        std::vector<Entry> entries;
+        entries.swap(slots_[level][static_cast<size_t>(current_ >> shift) & (SLOTS - 1)]);
+        for (Entry& entry : entries) {
+            place(std::move(entry));
+        }
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Hierarchical timing wheel of key expiry times
+ * LEVELS rings of SLOTS slots each; a slot of level L spans
+ * RESOLUTION_MS * SLOTS^L milliseconds. An entry is filed in the lowest
+ * level whose range covers its distance from the wheel's current tick and
+ * moves down a level whenever the level below wraps around, so each entry
+ * is touched at most LEVELS times and advancing only ever looks at slots
+ * that came due, never at the whole keyspace. Slots are plain vectors, so
+ * draining one walks contiguous memory.
+ *
+ * Entries are hints: whoever drains the wheel checks the key's current
+ * expiry time, and simply drops entries of keys that were deleted or
+ * refiles those whose expiry moved later. Not thread-safe; DataStore keeps
+ * one per shard under the shard lock
+ */
+class ExpiryWheel {
+public:
+    static constexpr int64_t RESOLUTION_MS = 10;
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+
+    /**
+     * Number of levels; together they cover SLOTS^LEVELS ticks (about
+     * 46 hours). Later expiry times wait in the top level and are refiled
+     * each time it comes round
+     */
+    static constexpr size_t LEVELS = 4;
+
+    struct Entry {
+        int64_t expiresAt;  // Unix time in milliseconds
+        std::string key;
+    };
+
+    /**
+     * Constructor
+     * @param now Current Unix time in milliseconds
+     */
+    explicit ExpiryWheel(int64_t now);
+
+    /**
+     * File a key to come due at its expiry time
+     * @param key The key
+     * @param expiresAt Unix time in milliseconds; times already past come
+     *        due on the next advance()
+     */
+    void add(std::string_view key, int64_t expiresAt);
+
+    /**
+     * Hand out entries that have come due, oldest tick first
+     * Stops after budget entries; the rest stay filed for the next call.
+     * due may add() entries for later times
+     * @param now Current Unix time in milliseconds
+     * @param budget Most entries to hand out
+     * @param due Called as due(key, expiresAt) for each due entry
+     * @return Number of entries handed out
+     */
+    template <typename Due>
+    size_t advance(int64_t now, size_t budget, Due due);
+
+    /**
+     * Get the number of filed entries, stale ones included
+     */
+    size_t size() const { return size_; }
+
+private:
+    std::vector<Entry> slots_[LEVELS][SLOTS];
+    int64_t current_;  // Tick whose level-0 slot is drained next
+    size_t size_;
+
+    /**
+     * Expiry time to tick, rounded up so a slot only holds entries that
+     * are due once its tick has been reached
+     */
+    static int64_t tickOf(int64_t expiresAt);
+
+    void place(Entry&& entry);
+
+    /**
+     * Refile the higher-level slots that start at the current tick
+     */
+    void cascade();
+};
+
+template <typename Due>
+size_t ExpiryWheel::advance(int64_t now, size_t budget, Due due) {
+    int64_t target = now / RESOLUTION_MS;
+    if (size_ == 0) {
+        // Nothing filed: jump instead of stepping through every tick
+        if (target > current_) current_ = target;
+        return 0;
+    }
+    size_t handed = 0;
+    while (current_ <= target) {
+        std::vector<Entry>& slot = slots_[0][static_cast<size_t>(current_) & (SLOTS - 1)];
+        while (!slot.empty()) {
+            if (handed == budget) {
+                return handed;
+            }
+            Entry entry = std::move(slot.back());
+            slot.pop_back();
+            --size_;
+            ++handed;
+            due(entry.key, entry.expiresAt);
+        }
+        // Give back the memory of a burst of expiries
+        if (slot.capacity() > 1024) {
+            std::vector<Entry>().swap(slot);
+        }
+        if (current_ == target) {
+            break;
+        }
+        ++current_;
+        cascade();
+    }
+    return handed;
+}
@@ -0,0 +1,679 @@
+#pragma once
+
+#include "inline_string.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BOLTDB_FLAT_MAP_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Open-addressing hash map from string keys to T, laid out like a Swiss table
+ *
+ * Entries (an InlineString key next to its value) sit in one flat array,
+ * beside an array of one control byte per slot: EMPTY (0), DELETED, or the
+ * high bit plus 7 bits of the key's hash for a full slot. Slots form groups of
+ * GROUP_SIZE. A lookup hashes the key to a group, compares the 7-bit tag
+ * with all of the group's control bytes at once (one SSE2 compare where
+ * available) and only looks at entries whose tag matches; it moves on to
+ * the next group of a triangular probe sequence only if the group has no
+ * EMPTY byte, so a miss usually costs a single 16-byte load.
+ *
+ * The table stays at most 7/8 full. Erasing marks the slot DELETED unless
+ * its group still has an EMPTY slot, in which case no probe can have passed
+ * the group and the slot becomes EMPTY again.
+ *
+ * Resizing is incremental, as in Redis: when the table runs out of room a
+ * new one is allocated (twice the size, or the same size if DELETED markers
+ * took up the room) and the old one is kept. Every insertion then moves the
+ * entries of REHASH_STEP_GROUPS old groups over, so no single operation
+ * pays for moving the whole table; lookups and erasures look in both
+ * tables until the old one is empty and freed. rehashStep() lets an idle
+ * map finish the move, and shrinkToFit() starts one into a smaller table.
+ *
+ * Any insertion may move entries, invalidating iterators and references;
+ * erasure only invalidates the erased entry. Keys are looked up by
+ * std::string_view, so a key parsed out of a network buffer is never
+ * copied; entry keys must not be modified. Keys too long to keep in place
+ * take their bytes from the key arena if one is set
+ */
+template <typename T>
+class FlatHashMap {
+public:
+    struct Entry {
+        InlineString first;  // The key
+        T second;
+    };
+
+    using value_type = Entry;
+
+    static constexpr size_t GROUP_SIZE = 16;
+
+    /**
+     * Old groups moved to the new table by each insertion while resizing
+     * Moving a table of capacity slots this way takes capacity / 16
+     * insertions, and the new table has room for more: at least
+     * 7 * capacity / 8 after doubling, 3 * capacity / 32 after cleaning
+     * up DELETED markers at the same size (done only when at most 25/32 full)
+     */
+    static constexpr size_t REHASH_STEP_GROUPS = 1;
+
+    /**
+     * Smallest entry array whose pages are given back while it is moved
+     * from, see releaseMoved(); malloc maps allocations this large on
+     * their own (glibc's largest mmap threshold)
+     */
+    static constexpr size_t RELEASE_MIN_BYTES = 32 * 1024 * 1024;
+
+private:
+    // Full slots have the high bit set. EMPTY is 0 so that a new table's
+    // control bytes can come zeroed from calloc(), which for a large table
+    // gets fresh pages from the system and doesn't touch them: growing a
+    // big table then doesn't stall on faulting in and filling its control
+    // bytes, which the move spreads over many insertions instead
+    static constexpr int8_t EMPTY = 0;
+    static constexpr int8_t DELETED = 1;
+
+    struct Table {
+        int8_t* control = nullptr;  // capacity bytes
+        Entry* entries = nullptr;   // capacity entries, constructed where control is full
+        size_t capacity = 0;        // Slots: 0 or a power of two no smaller than GROUP_SIZE
+    };
+
+    Table table_;
+    Table old_;           // The table being moved into table_, empty if none
+    size_t migrated_ = 0; // Slots of old_ already moved
+    size_t size_ = 0;     // Entries in both tables
+    // EMPTY slots of table_ that may still be filled before resizing, net of
+    // those the entries still in old_ will take
+    size_t growthLeft_ = 0;
+    size_t deleted_ = 0;  // DELETED slots in table_
+    std::shared_ptr<SlabArena> keyArena_;
+
+    static size_t maxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+    static size_t hashOf(std::string_view key) {
+        // DataStore picks shards by the low bits of the same hash, so mix
+        // it before taking the tag and the group from it
+        uint64_t hash = std::hash<std::string_view>{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        return static_cast<size_t>(hash);
+    }
+
+    static int8_t tagOf(size_t hash) { return static_cast<int8_t>(static_cast<uint8_t>(0x80 | (hash & 0x7F))); }
+
+    static bool isFull(int8_t control) { return control < 0; }
+
+    static unsigned lowestBit(uint32_t mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    /**
+     * Bit i set where control byte i of the group equals byte
+     */
+    static uint32_t match(const int8_t* group, int8_t byte) {
+#ifdef BOLTDB_FLAT_MAP_SSE2
+        __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(byte))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; ++i) {
+            mask |= static_cast<uint32_t>(group[i] == byte) << i;
+        }
+        return mask;
+#endif
+    }
+
+    /**
+     * Bit i set where slot i of the group is full
+     */
+    static uint32_t matchFull(const int8_t* group) {
+#ifdef BOLTDB_FLAT_MAP_SSE2
+        return static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; ++i) {
+            mask |= static_cast<uint32_t>(isFull(group[i])) << i;
+        }
+        return mask;
+#endif
+    }
+
+    /**
+     * Bit i set where slot i of the group is EMPTY or DELETED
+     */
+    static uint32_t matchFree(const int8_t* group) { return ~matchFull(group) & 0xFFFF; }
+
+    /**
+     * Slot of a key in one table, or table.capacity if it is not there
+     */
+    static size_t findIn(const Table& table, std::string_view key, size_t hash) {
+        if (table.capacity == 0) {
+            return 0;
+        }
+        size_t groupMask = table.capacity / GROUP_SIZE - 1;
+        size_t group = (hash >> 7) & groupMask;
+        int8_t tag = tagOf(hash);
+        for (size_t step = 1;; ++step) {
+            const int8_t* control = table.control + group * GROUP_SIZE;
+            for (uint32_t mask = match(control, tag); mask != 0; mask &= mask - 1) {
+                size_t index = group * GROUP_SIZE + lowestBit(mask);
+                if (table.entries[index].first == key) {
+                    return index;
+                }
+            }
+            if (match(control, EMPTY) != 0) {
+                return table.capacity;
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    /**
+     * First EMPTY or DELETED slot on a hash's probe sequence
+     * There always is one: a table never fills past maxLoad()
+     */
+    static size_t findFree(const Table& table, size_t hash) {
+        size_t groupMask = table.capacity / GROUP_SIZE - 1;
+        size_t group = (hash >> 7) & groupMask;
+        for (size_t step = 1;; ++step) {
+            uint32_t mask = matchFree(table.control + group * GROUP_SIZE);
+            if (mask != 0) {
+                return group * GROUP_SIZE + lowestBit(mask);
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    static size_t allocationBytes(size_t capacity) {
+        return capacity * (1 + sizeof(Entry));
+    }
+
+    static Table allocate(size_t capacity) {
+        Table table;
+        table.control = static_cast<int8_t*>(std::calloc(capacity, 1));
+        if (!table.control) {
+            throw std::bad_alloc();
+        }
+        try {
+            table.entries = static_cast<Entry*>(::operator new(capacity * sizeof(Entry)));
+        } catch (...) {
+            std::free(table.control);
+            throw;
+        }
+        table.capacity = capacity;
+        return table;
+    }
+
+    /**
+     * Free a table without looking at its slots, which must hold no entries
+     */
+    static void deallocate(Table& table) noexcept {
+        std::free(table.control);
+        ::operator delete(table.entries);
+        table = Table();
+    }
+
+    /**
+     * Destroy a table's entries and free it
+     */
+    static void release(Table& table) noexcept {
+        if (!table.control) {
+            return;
+        }
+        for (size_t i = 0; i < table.capacity; ++i) {
+            if (isFull(table.control[i])) {
+                table.entries[i].~Entry();
+            }
+        }
+        deallocate(table);
+    }
+
+    /**
+     * Copy a table slot for slot: no hashing, just copies of the entries
+     */
+    static Table copy(const Table& other) {
+        if (other.capacity == 0) {
+            return Table();
+        }
+        Table table = allocate(other.capacity);
+        try {
+            for (size_t i = 0; i < table.capacity; ++i) {
+                if (isFull(other.control[i])) {
+                    new (&table.entries[i]) Entry(other.entries[i]);
+                }
+                table.control[i] = other.control[i];
+            }
+        } catch (...) {
+            release(table);
+            throw;
+        }
+        return table;
+    }
+
+    // Slots are numbered across both tables: table_ first, then old_
+
+    size_t endIndex() const { return table_.capacity + old_.capacity; }
+
+    int8_t controlAt(size_t index) const {
+        return index < table_.capacity ? table_.control[index] : old_.control[index - table_.capacity];
+    }
+
+    Entry& entryAt(size_t index) const {
+        return index < table_.capacity ? table_.entries[index] : old_.entries[index - table_.capacity];
+    }
+
+    /**
+     * Slot of a key in either table, or endIndex() if it is not present
+     */
+    size_t findIndex(std::string_view key, size_t hash) const {
+        size_t index = findIn(table_, key, hash);
+        if (index != table_.capacity) {
+            return index;
+        }
+        if (old_.capacity != 0) {
+            index = findIn(old_, key, hash);
+            if (index != old_.capacity) {
+                return table_.capacity + index;
+            }
+        }
+        return endIndex();
+    }
+
+    /**
+     * Start moving the entries into a new table of the given capacity
+     */
+    void beginRehash(size_t capacity) {
+        finishRehash();
+        Table table = allocate(capacity);
+        old_ = table_;
+        table_ = table;
+        migrated_ = 0;
+        growthLeft_ = maxLoad(capacity) - size_;
+        deleted_ = 0;
+        if (size_ == 0) {
+            release(old_);
+        }
+    }
+
+    /**
+     * Move the entries of up to groups old groups to the new table, freeing
+     * the old table once it is empty
+     */
+    void migrate(size_t groups) {
+        size_t start = migrated_;
+        size_t left = (old_.capacity - migrated_) / GROUP_SIZE;
+        size_t end = groups >= left ? old_.capacity : migrated_ + groups * GROUP_SIZE;
+        for (; migrated_ < end; migrated_ += GROUP_SIZE) {
+            int8_t* control = old_.control + migrated_;
+            for (uint32_t full = matchFull(control); full != 0; full &= full - 1) {
+                size_t slot = lowestBit(full);
+                Entry& entry = old_.entries[migrated_ + slot];
+                size_t hash = hashOf(entry.first);
+                size_t index = findFree(table_, hash);
+                if (table_.control[index] == DELETED) {
+                    // The slot set aside for this entry stays EMPTY instead
+                    --deleted_;
+                    ++growthLeft_;
+                }
+                new (&table_.entries[index]) Entry(std::move(entry));
+                table_.control[index] = tagOf(hash);
+                entry.~Entry();
+                // DELETED rather than EMPTY, so lookups still probe past it
+                control[slot] = DELETED;
+            }
+        }
+        if (migrated_ == old_.capacity) {
+            deallocate(old_);
+            migrated_ = 0;
+        } else {
+            releaseMoved(start, migrated_);
+        }
+    }
+
+    /**
+     * Give the pages of old entries in slots [from, to), all moved out, back
+     * to the system as the move goes, so that freeing a large old table at
+     * its end doesn't stall on unmapping all of its pages at once
+     */
+    void releaseMoved(size_t from, size_t to) {
+#ifdef __linux__
+        if (old_.capacity * sizeof(Entry) < RELEASE_MIN_BYTES) {
+            return;
+        }
+        static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t base = reinterpret_cast<uintptr_t>(old_.entries);
+        // Whole pages of the allocation only; a page is released once the
+        // move has passed its end
+        uintptr_t first = (base + page - 1) & ~(page - 1);
+        uintptr_t begin = std::max(first, (base + from * sizeof(Entry)) & ~(page - 1));
+        uintptr_t end = (base + to * sizeof(Entry)) & ~(page - 1);
+        if (end > begin) {
+            madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+        }
+#else
+        (void)from;
+        (void)to;
+#endif
+    }
+
+    void finishRehash() {
+        if (old_.capacity != 0) {
+            migrate(old_.capacity / GROUP_SIZE);
+        }
+    }
+
+    /**
+     * Smallest capacity holding count entries
+     */
+    static size_t capacityFor(size_t count) {
+        size_t capacity = GROUP_SIZE;
+        while (maxLoad(capacity) < count) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    void eraseAt(size_t index) {
+        --size_;
+        if (index >= table_.capacity) {
+            // Not moved yet; it no longer needs the slot set aside for it
+            old_.entries[index - table_.capacity].~Entry();
+            old_.control[index - table_.capacity] = DELETED;
+            ++growthLeft_;
+            return;
+        }
+        table_.entries[index].~Entry();
+        if (match(table_.control + (index & ~(GROUP_SIZE - 1)), EMPTY) != 0) {
+            table_.control[index] = EMPTY;
+            ++growthLeft_;
+        } else {
+            table_.control[index] = DELETED;
+            ++deleted_;
+        }
+    }
+
+    template <bool Const>
+    class Iterator {
+    private:
+        friend class FlatHashMap;
+        using Map = std::conditional_t<Const, const FlatHashMap, FlatHashMap>;
+        Map* map_;
+        size_t index_;
+
+        void skipFree() {
+            size_t end = map_->endIndex();
+            while (index_ < end && !isFull(map_->controlAt(index_))) {
+                ++index_;
+            }
+        }
+
+    public:
+        using Reference = std::conditional_t<Const, const Entry&, Entry&>;
+        using Pointer = std::conditional_t<Const, const Entry*, Entry*>;
+
+        Iterator(Map* map, size_t index) : map_(map), index_(index) {}
+
+        // iterator converts to const_iterator
+        template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+        Iterator(const Iterator<OtherConst>& other) : map_(other.map_), index_(other.index_) {}
+
+        Reference operator*() const { return map_->entryAt(index_); }
+        Pointer operator->() const { return &map_->entryAt(index_); }
+
+        Iterator& operator++() {
+            ++index_;
+            skipFree();
+            return *this;
+        }
+
+        /**
+         * Get the entry's slot, to resume a walk from with seek()
+         */
+        size_t slot() const { return index_; }
+
+        bool operator==(const Iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const Iterator& other) const { return index_ != other.index_; }
+
+        template <bool> friend class Iterator;
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    FlatHashMap() = default;
+
+    FlatHashMap(const FlatHashMap& other)
+        : table_(copy(other.table_)), migrated_(other.migrated_), size_(other.size_),
+          growthLeft_(other.growthLeft_), deleted_(other.deleted_), keyArena_(other.keyArena_) {
+        try {
+            old_ = copy(other.old_);
+        } catch (...) {
+            release(table_);
+            throw;
+        }
+    }
+
+    FlatHashMap(FlatHashMap&& other) noexcept { swap(other); }
+
+    FlatHashMap& operator=(FlatHashMap other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~FlatHashMap() {
+        release(table_);
+        release(old_);
+    }
+
+    void swap(FlatHashMap& other) noexcept {
+        std::swap(table_, other.table_);
+        std::swap(old_, other.old_);
+        std::swap(migrated_, other.migrated_);
+        std::swap(size_, other.size_);
+        std::swap(growthLeft_, other.growthLeft_);
+        std::swap(deleted_, other.deleted_);
+        std::swap(keyArena_, other.keyArena_);
+    }
+
+    /**
+     * Set the arena new keys too long to keep in place are allocated from
+     */
+    void setKeyArena(std::shared_ptr<SlabArena> arena) { keyArena_ = std::move(arena); }
+
+    iterator begin() {
+        iterator it(this, 0);
+        it.skipFree();
+        return it;
+    }
+    const_iterator begin() const {
+        const_iterator it(this, 0);
+        it.skipFree();
+        return it;
+    }
+    iterator end() { return iterator(this, endIndex()); }
+    const_iterator end() const { return const_iterator(this, endIndex()); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /**
+     * Get the number of slots of the current table, not counting one
+     * still being moved from
+     */
+    size_t capacity() const { return table_.capacity; }
+
+    /**
+     * Check whether entries are still being moved from an old table
+     */
+    bool rehashing() const { return old_.capacity != 0; }
+
+    /**
+     * Get the bytes of the tables themselves: control bytes and entries,
+     * but not what keys and values allocate on their own
+     */
+    size_t allocatedBytes() const { return allocationBytes(table_.capacity) + allocationBytes(old_.capacity); }
+
+    /**
+     * Find the first entry in a given slot or after it, e.g. to sample
+     * entries from a random position
+     * @param slot Slot index in [0, capacity())
+     * @return Iterator to the entry, end() if there is none from slot on
+     */
+    const_iterator seek(size_t slot) const {
+        const_iterator it(this, slot < endIndex() ? slot : endIndex());
+        it.skipFree();
+        return it;
+    }
+    iterator seek(size_t slot) {
+        iterator it(this, slot < endIndex() ? slot : endIndex());
+        it.skipFree();
+        return it;
+    }
+
+    iterator find(std::string_view key) { return iterator(this, findIndex(key, hashOf(key))); }
+    const_iterator find(std::string_view key) const { return const_iterator(this, findIndex(key, hashOf(key))); }
+
+    size_t count(std::string_view key) const { return find(key) != end() ? 1 : 0; }
+
+    /**
+     * Insert an entry unless the key is present
+     * @return Iterator to the key's entry, and true if it was inserted
+     */
+    std::pair<iterator, bool> emplace(std::string_view key, T value) {
+        if (old_.capacity != 0) {
+            migrate(REHASH_STEP_GROUPS);
+        }
+        size_t hash = hashOf(key);
+        size_t index = findIndex(key, hash);
+        if (index != endIndex()) {
+            return {iterator(this, index), false};
+        }
+        if (growthLeft_ == 0) {
+            // The new table filled up before the old one was moved, e.g.
+            // after shrinkToFit() left a large old table: finish the move
+            finishRehash();
+        }
+        if (growthLeft_ == 0) {
+            // Out of EMPTY slots: if DELETED markers took up a good part of
+            // them, clearing those out at the same size is enough
+            size_t capacity = table_.capacity;
+            beginRehash(capacity == 0 ? GROUP_SIZE : size_ * 32 <= capacity * 25 ? capacity : capacity * 2);
+        }
+        index = findFree(table_, hash);
+        new (&table_.entries[index]) Entry{InlineString(key, keyArena_.get()), std::move(value)};
+        if (table_.control[index] == DELETED) {
+            --deleted_;
+        } else {
+            --growthLeft_;
+        }
+        table_.control[index] = tagOf(hash);
+        ++size_;
+        return {iterator(this, index), true};
+    }
+
+    /**
+     * Insert an entry or replace the value of an existing key
+     */
+    iterator insert_or_assign(std::string_view key, T value) {
+        auto result = emplace(key, T());
+        result.first->second = std::move(value);
+        return result.first;
+    }
+
+    /**
+     * Erase an entry
+     * @return Iterator to the next entry
+     */
+    iterator erase(const_iterator position) {
+        eraseAt(position.index_);
+        iterator next(this, position.index_);
+        ++next;
+        return next;
+    }
+
+    /**
+     * Erase a key if present
+     * @return Number of entries erased
+     */
+    size_t erase(std::string_view key) {
+        size_t index = findIndex(key, hashOf(key));
+        if (index == endIndex()) {
+            return 0;
+        }
+        eraseAt(index);
+        return 1;
+    }
+
+    /**
+     * Make room for count entries without growing again, moving all
+     * entries at once if needed
+     */
+    void reserve(size_t count) {
+        size_t capacity = capacityFor(count);
+        if (capacity > table_.capacity) {
+            beginRehash(capacity);
+            finishRehash();
+        }
+    }
+
+    /**
+     * Move the entries of some old groups to the new table while resizing,
+     * e.g. from a maintenance task when there are no insertions to do it
+     * @param groups Most old groups to move
+     */
+    void rehashStep(size_t groups) {
+        if (old_.capacity != 0) {
+            migrate(groups);
+        }
+    }
+
+    /**
+     * Start moving the entries into the smallest table that holds twice
+     * as many, giving back the memory left over after many erasures; the
+     * move is incremental like growing
+     */
+    void shrinkToFit() {
+        if (size_ == 0) {
+            clear();
+        } else if (old_.capacity == 0 && capacityFor(size_ * 2) < table_.capacity) {
+            beginRehash(capacityFor(size_ * 2));
+        }
+    }
+
+    void clear() {
+        release(table_);
+        release(old_);
+        migrated_ = size_ = growthLeft_ = deleted_ = 0;
+    }
+};
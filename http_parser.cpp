@@ -0,0 +1,195 @@
+#include "http_parser.h"
+#include "command_parser.h"
+
+namespace {
+
+/**
+ * Strip spaces and tabs from both ends
+ */
+std::string_view trimBlanks(std::string_view text) {
+    size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string_view::npos) return {};
+    return text.substr(begin, text.find_last_not_of(" \t") - begin + 1);
+}
+
+/**
+ * Strip the '\r' of a "\r\n" line ending
+ */
+std::string_view stripReturn(std::string_view line) {
+    return !line.empty() && line.back() == '\r' ? line.substr(0, line.size() - 1) : line;
+}
+
+/**
+ * Check whether a comma-separated header value such as Connection's
+ * contains a token, ignoring case
+ * @param upperToken The token in upper case
+ */
+bool hasToken(std::string_view value, std::string_view upperToken) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        if (protocol::equalsIgnoreCase(trimBlanks(value.substr(0, comma)), upperToken)) return true;
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+} // namespace
+
+std::string_view HttpRequest::header(std::string_view upperName) const {
+    for (const auto& header : headers) {
+        if (protocol::equalsIgnoreCase(header.first, upperName)) return header.second;
+    }
+    return {};
+}
+
+std::string_view HttpRequest::path() const {
+    return target.substr(0, target.find('?'));
+}
+
+std::string_view HttpRequest::query() const {
+    size_t mark = target.find('?');
+    return mark == std::string_view::npos ? std::string_view() : target.substr(mark + 1);
+}
+
+HttpParser::Status HttpParser::next(InputBuffer& input, HttpRequest& request) {
+    std::string_view data = input.view();
+    if (headerBytes_ == 0) {
+        // Line breaks between requests are ignored, as RFC 9112 allows
+        size_t blank = 0;
+        while (blank < data.size() && (data[blank] == '\r' || data[blank] == '\n')) ++blank;
+        if (blank > 0) {
+            input.consume(blank);
+            data = input.view();
+            scanned_ = scanned_ > blank ? scanned_ - blank : 0;
+        }
+
+        // Look for the empty line ending the headers, resuming where the
+        // previous call stopped
+        size_t end = 0;
+        size_t pos = scanned_;
+        while (end == 0) {
+            pos = data.find('\n', pos);
+            if (pos == std::string_view::npos) {
+                scanned_ = data.size();
+                break;
+            }
+            size_t after = pos + 1;
+            if (after < data.size() && data[after] == '\r') ++after;
+            if (after >= data.size()) {
+                scanned_ = pos;  // Can't tell yet whether an empty line follows
+                break;
+            }
+            if (data[after] == '\n') {
+                end = after + 1;
+            } else {
+                ++pos;
+            }
+        }
+        if (end == 0) {
+            return data.size() > MAX_HEADER_BYTES ? fail(431, "request headers too large") : Status::Incomplete;
+        }
+        if (end > MAX_HEADER_BYTES) {
+            return fail(431, "request headers too large");
+        }
+        Status status = parseHead(data.substr(0, end), request);
+        if (status != Status::Ready) {
+            return status;
+        }
+        headerBytes_ = end;
+        scanned_ = 0;
+    } else if (data.size() >= headerBytes_ + bodyBytes_) {
+        // The headers were parsed when they arrived, but the views taken
+        // then may have moved with the buffer since
+        parseHead(data.substr(0, headerBytes_), request);
+    }
+
+    if (data.size() < headerBytes_ + bodyBytes_) {
+        return Status::Incomplete;
+    }
+    request.body = data.substr(headerBytes_, bodyBytes_);
+    input.consume(headerBytes_ + bodyBytes_);
+    headerBytes_ = 0;
+    bodyBytes_ = 0;
+    return Status::Ready;
+}
+
+size_t HttpParser::missing(const InputBuffer& input) const {
+    size_t total = headerBytes_ + bodyBytes_;
+    return headerBytes_ != 0 && total > input.size() ? total - input.size() : 0;
+}
+
+HttpParser::Status HttpParser::parseHead(std::string_view head, HttpRequest& request) {
+    request.headers.clear();
+    request.body = {};
+    bodyBytes_ = 0;
+
+    // Request line: method, target and version separated by single spaces
+    size_t lineEnd = head.find('\n');
+    std::string_view line = stripReturn(head.substr(0, lineEnd));
+    size_t first = line.find(' ');
+    size_t second = first == std::string_view::npos ? first : line.find(' ', first + 1);
+    if (second == std::string_view::npos || first == 0 || second == first + 1) {
+        return fail(400, "malformed request line");
+    }
+    request.method = line.substr(0, first);
+    request.target = line.substr(first + 1, second - first - 1);
+    request.version = line.substr(second + 1);
+    if (request.version.size() != 8 || request.version.substr(0, 7) != "HTTP/1.") {
+        return fail(505, "unsupported HTTP version");
+    }
+
+    size_t pos = lineEnd + 1;
+    while (pos < head.size()) {
+        size_t end = head.find('\n', pos);
+        line = stripReturn(head.substr(pos, end - pos));
+        pos = end + 1;
+        if (line.empty()) {
+            break;
+        }
+        size_t colon = line.find(':');
+        std::string_view name = line.substr(0, colon);
+        // Folded lines and blanks before the colon are rejected, as RFC 9112 asks
+        if (colon == std::string_view::npos || name.empty() || name.find_first_of(" \t") != std::string_view::npos) {
+            return fail(400, "malformed header");
+        }
+        request.headers.emplace_back(name, trimBlanks(line.substr(colon + 1)));
+    }
+
+    // HTTP/1.1 connections persist unless the client says otherwise,
+    // HTTP/1.0 ones only if it asks
+    std::string_view connection = request.header("CONNECTION");
+    request.keepAlive = request.version[7] != '0' ? !hasToken(connection, "CLOSE")
+                                                  : hasToken(connection, "KEEP-ALIVE");
+
+    if (!request.header("TRANSFER-ENCODING").empty()) {
+        return fail(501, "request bodies with Transfer-Encoding are not supported");
+    }
+    bool hasLength = false;
+    for (const auto& header : request.headers) {
+        if (!protocol::equalsIgnoreCase(header.first, "CONTENT-LENGTH")) continue;
+        std::string_view digits = header.second;
+        if (digits.empty() || digits.size() > 10 || digits.find_first_not_of("0123456789") != std::string_view::npos) {
+            return fail(400, "invalid Content-Length");
+        }
+        size_t length = 0;
+        for (char digit : digits) {
+            length = length * 10 + static_cast<size_t>(digit - '0');
+        }
+        if (hasLength && length != bodyBytes_) {
+            return fail(400, "conflicting Content-Length headers");
+        }
+        if (length > MAX_BODY_BYTES) {
+            return fail(413, "request body too large");
+        }
+        bodyBytes_ = length;
+        hasLength = true;
+    }
+    return Status::Ready;
+}
+
+HttpParser::Status HttpParser::fail(int status, const char* error) {
+    errorStatus_ = status;
+    error_ = error;
+    return Status::Error;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "input_buffer.h"
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * One parsed HTTP/1.x request
+ * All views point into the connection's input buffer; nothing is copied
+ */
+struct HttpRequest {
+    std::string_view method;
+    std::string_view target;   // Path and query string, as sent
+    std::string_view version;  // "HTTP/1.1" or "HTTP/1.0"
+    std::string_view body;     // The Content-Length bytes after the headers
+    std::vector<std::pair<std::string_view, std::string_view>> headers;  // Values without surrounding blanks
+    bool keepAlive = true;     // Whether the connection stays open after the response
+
+    /**
+     * Get a header's value
+     * @param upperName The header name in upper case; names match in any case
+     * @return The first value, empty if the header is missing
+     */
+    std::string_view header(std::string_view upperName) const;
+
+    /**
+     * Get the target without its query string
+     */
+    std::string_view path() const;
+
+    /**
+     * Get the query string, after the '?', still URL-encoded
+     */
+    std::string_view query() const;
+};
+
+/**
+ * Incremental parser for HTTP/1.x requests on a keep-alive connection
+ * Requests are taken one after another from the front of the input, so
+ * pipelined requests are answered in order. Bytes already searched for the
+ * end of the headers are not searched again when a request arrives in
+ * several reads, and once the headers are parsed the parser just waits for
+ * Content-Length bytes of body, however many reads they take. Request
+ * bodies sent with Transfer-Encoding are refused with 501
+ */
+class HttpParser {
+private:
+    size_t scanned_ = 0;      // Input bytes known not to hold the end of the headers
+    size_t headerBytes_ = 0;  // Size of the current request's headers once found, else 0
+    size_t bodyBytes_ = 0;    // Its Content-Length
+    int errorStatus_ = 400;
+    const char* error_ = "";
+
+public:
+    enum class Status {
+        Incomplete,  // Need more input
+        Ready,       // A request was parsed
+        Error        // Malformed or unsupported request; see errorStatus() and error()
+    };
+
+    /**
+     * Largest accepted request line plus headers
+     */
+    static constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+
+    /**
+     * Largest accepted request body
+     */
+    static constexpr size_t MAX_BODY_BYTES = 512 * 1024 * 1024;
+
+    /**
+     * Parse the next request from the front of a connection's input
+     * The request's views stay valid until the buffer's next prepare()
+     * @param input Received bytes; the parsed request is consumed
+     * @param request Receives the request; its header list is reused
+     * @return Whether a request was parsed
+     */
+    Status next(InputBuffer& input, HttpRequest& request);
+
+    /**
+     * Get the bytes the current request still needs, 0 if unknown
+     * For sizing the next read of a large body
+     */
+    size_t missing(const InputBuffer& input) const;
+
+    /**
+     * Get the HTTP status to answer the last error with: 400, 413, 431,
+     * 501 or 505
+     */
+    int errorStatus() const { return errorStatus_; }
+
+    /**
+     * Describe the last error
+     */
+    const char* error() const { return error_; }
+
+private:
+    /**
+     * Parse the request line and headers
+     * @param head The bytes before the blank line ending the headers
+     */
+    Status parseHead(std::string_view head, HttpRequest& request);
+
+    /**
+     * Record an error for errorStatus() and error()
+     */
+    Status fail(int status, const char* error);
+};
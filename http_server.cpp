@@ -1,17 +1,72 @@
 #include "http_server.h"
+#include "json.h"
+#include "net.h"
 #include <algorithm>
 #include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
-HttpServer::HttpServer(DataStore &dataStore)
-    : dataStore_(dataStore), running_(false), serverSocket_(HTTP_INVALID_SOCKET) {}
+#ifdef BOLTDB_HTTP_EPOLL
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace {
+
+/**
+ * Most connections one worker accepts before it lets the listener go
+ */
+constexpr int MAX_ACCEPT_PER_EVENT = 64;
+
+/**
+ * Bound how long a send, and a receive if asked, may block on a socket
+ */
+void setSocketTimeouts(http_socket_t s, bool receive) {
+#ifdef _WIN32
+    DWORD timeout = HttpServer::KEEP_ALIVE_TIMEOUT_SECONDS * 1000;
+#else
+    timeval timeout{HttpServer::KEEP_ALIVE_TIMEOUT_SECONDS, 0};
+#endif
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+    if (receive) {
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+    }
+}
+
+void shutdownSocket(http_socket_t s) {
+#ifdef _WIN32
+    shutdown(s, SD_BOTH);
+#else
+    shutdown(s, SHUT_RDWR);
+#endif
+}
+
+#ifdef BOLTDB_HTTP_EPOLL
+int64_t steadyMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+} // namespace
+
+HttpServer::HttpServer(DataStore &dataStore, AppendOnlyLog *appendLog)
+    : dataStore_(dataStore), appendLog_(appendLog), running_(false), serverSocket_(HTTP_INVALID_SOCKET)
+#ifdef BOLTDB_HTTP_EPOLL
+      , epollFd_(-1), wakeFd_(-1), nextSweep_(0)
+#endif
+{}
 
 HttpServer::~HttpServer() { stop(); }
 
-bool HttpServer::start(int port, const std::string &webRoot) {
+bool HttpServer::start(int port, const std::string &webRoot, size_t workers) {
     if (running_) return false;
     webRoot_ = webRoot;
 
@@ -43,23 +98,79 @@ bool HttpServer::start(int port, const std::string &webRoot) {
         return false;
     }
 
-    if (listen(serverSocket_, 16) < 0) {
+    if (listen(serverSocket_, 128) < 0) {
         std::cerr << "HTTP: listen failed" << std::endl;
         closeSocket(serverSocket_);
         return false;
     }
 
+#ifdef BOLTDB_HTTP_EPOLL
+    // Workers accept from the epoll set themselves, so the listener must
+    // not block once another worker has drained it
+    fcntl(serverSocket_, F_SETFL, fcntl(serverSocket_, F_GETFL, 0) | O_NONBLOCK);
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event wake{};
+    wake.events = EPOLLIN;  // Level-triggered, so every worker sees it
+    wake.data.ptr = &wakeFd_;
+    epoll_event listener{};
+    listener.events = EPOLLIN | EPOLLONESHOT;
+    listener.data.ptr = nullptr;
+    if (epollFd_ < 0 || wakeFd_ < 0 || epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &wake) < 0 ||
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, serverSocket_, &listener) < 0) {
+        std::cerr << "HTTP: epoll setup failed" << std::endl;
+        if (epollFd_ >= 0) close(epollFd_);
+        if (wakeFd_ >= 0) close(wakeFd_);
+        epollFd_ = wakeFd_ = -1;
+        closeSocket(serverSocket_);
+        return false;
+    }
+#endif
+
+    if (workers == 0) {
+        workers = std::max(2u, std::thread::hardware_concurrency());
+    }
     running_ = true;
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.emplace_back(&HttpServer::workerLoop, this);
+    }
+#ifndef BOLTDB_HTTP_EPOLL
     acceptThread_ = std::thread(&HttpServer::acceptLoop, this);
-    std::cout << "HTTP server started on http://localhost:" << port << std::endl;
+#endif
+    std::cout << "HTTP server started on http://localhost:" << port << " (" << workers << " workers)" << std::endl;
     return true;
 }
 
 void HttpServer::stop() {
     if (!running_) return;
     running_ = false;
+#ifdef BOLTDB_HTTP_EPOLL
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) {
+        std::cerr << "HTTP: failed to wake workers" << std::endl;
+    }
+    for (auto &worker : workers_) worker.join();
+    closeSocket(serverSocket_);
+    close(epollFd_);
+    close(wakeFd_);
+    epollFd_ = wakeFd_ = -1;
+#else
+    // Shutdown first so the blocked accept() returns; close alone doesn't wake it
+    shutdownSocket(serverSocket_);
     closeSocket(serverSocket_);
     if (acceptThread_.joinable()) acceptThread_.join();
+    {
+        // Wake workers blocked in recv() on idle connections
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        for (auto &entry : connections_) shutdownSocket(entry.first);
+        queue_.clear();
+    }
+    queueReady_.notify_all();
+    for (auto &worker : workers_) worker.join();
+#endif
+    workers_.clear();
+    for (auto &entry : connections_) closeSocket(entry.first);
+    connections_.clear();
 #ifdef _WIN32
     WSACleanup();
 #endif
@@ -67,118 +178,491 @@ void HttpServer::stop() {
 
 bool HttpServer::isRunning() const { return running_; }
 
+void HttpServer::workerLoop() {
+#ifdef BOLTDB_HTTP_EPOLL
+    while (running_) {
+        // One event at a time, so busy connections spread over the workers
+        epoll_event event;
+        int ready = epoll_wait(epollFd_, &event, 1, 1000);
+        closeIdleConnections();
+        if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+        if (ready < 0 || event.data.ptr == &wakeFd_) break;
+        if (event.data.ptr == nullptr) {
+            acceptConnections();
+            continue;
+        }
+        Connection &connection = *static_cast<Connection *>(event.data.ptr);
+        // Never idle while a worker has it, however long a scan streams
+        connection.lastActive.store(INT64_MAX, std::memory_order_relaxed);
+        bool open = serve(connection);
+        connection.lastActive.store(steadyMillis(), std::memory_order_relaxed);
+        if (!open || !rearm(connection)) {
+            closeConnection(connection);
+        }
+    }
+#else
+    while (true) {
+        Connection *connection = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(connectionsMutex_);
+            queueReady_.wait(lock, [this] { return !running_ || !queue_.empty(); });
+            if (!running_) return;
+            connection = queue_.front();
+            queue_.pop_front();
+        }
+        while (running_ && serve(*connection)) {
+        }
+        if (!running_) return;  // stop() closes what is left
+        closeConnection(*connection);
+    }
+#endif
+}
+
+#ifdef BOLTDB_HTTP_EPOLL
+void HttpServer::acceptConnections() {
+    for (int i = 0; i < MAX_ACCEPT_PER_EVENT && running_; ++i) {
+        http_socket_t cs = accept(serverSocket_, nullptr, nullptr);
+        if (cs == HTTP_INVALID_SOCKET) break;  // Drained, or another worker got there first
+        Connection *connection = openConnection(cs);
+        if (!connection) continue;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = connection;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, cs, &event) < 0) {
+            closeConnection(*connection);
+        }
+    }
+    epoll_event listener{};
+    listener.events = EPOLLIN | EPOLLONESHOT;
+    listener.data.ptr = nullptr;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, serverSocket_, &listener);
+}
+
+void HttpServer::closeIdleConnections() {
+    int64_t now = steadyMillis();
+    int64_t due = nextSweep_.load(std::memory_order_relaxed);
+    if (now < due || !nextSweep_.compare_exchange_strong(due, now + 1000)) {
+        return;
+    }
+    int64_t idleSince = now - KEEP_ALIVE_TIMEOUT_SECONDS * 1000;
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    for (auto &entry : connections_) {
+        if (entry.second->lastActive.load(std::memory_order_relaxed) < idleSince) {
+            shutdownSocket(entry.first);
+        }
+    }
+}
+
+bool HttpServer::rearm(Connection &connection) {
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = &connection;
+    return epoll_ctl(epollFd_, EPOLL_CTL_MOD, connection.socket, &event) == 0;
+}
+#else
 void HttpServer::acceptLoop() {
     while (running_) {
         sockaddr_in client{};
         socklen_t len = sizeof(client);
         http_socket_t cs = accept(serverSocket_, (sockaddr *)&client, &len);
         if (cs == HTTP_INVALID_SOCKET) continue;
-        std::thread(&HttpServer::handleClient, this, cs).detach();
+        Connection *connection = openConnection(cs);
+        if (!connection) continue;
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex_);
+            queue_.push_back(connection);
+        }
+        queueReady_.notify_one();
     }
 }
+#endif
 
-static std::string trim(const std::string &s) {
-    size_t b = s.find_first_not_of(" \r\n\t");
-    size_t e = s.find_last_not_of(" \r\n\t");
-    if (b == std::string::npos) return "";
-    return s.substr(b, e - b + 1);
+HttpServer::Connection *HttpServer::openConnection(http_socket_t clientSocket) {
+    setNoDelay(clientSocket);
+#ifdef BOLTDB_HTTP_EPOLL
+    setSocketTimeouts(clientSocket, false);
+#else
+    setSocketTimeouts(clientSocket, true);
+#endif
+    std::unique_lock<std::mutex> lock(connectionsMutex_);
+    if (connections_.size() >= MAX_CONNECTIONS) {
+        lock.unlock();
+        std::string response;
+        appendResponse(response, 503, "application/json", "{\"error\":\"too_many_connections\"}", false);
+        sendAll(clientSocket, response.data(), response.size());
+        closeSocket(clientSocket);
+        return nullptr;
+    }
+    auto connection = std::make_unique<Connection>();
+    connection->socket = clientSocket;
+#ifdef BOLTDB_HTTP_EPOLL
+    connection->lastActive.store(steadyMillis(), std::memory_order_relaxed);
+#endif
+    Connection *opened = connection.get();
+    connections_[clientSocket] = std::move(connection);
+    return opened;
 }
 
-void HttpServer::handleClient(http_socket_t clientSocket) {
-    char buf[4096];
-    int n = recv(clientSocket, buf, sizeof(buf) - 1, 0);
-    if (n <= 0) {
-        closeSocket(clientSocket);
-        return;
+void HttpServer::closeConnection(Connection &connection) {
+    // Forget the socket before closing it: once closed, accept() may hand
+    // out the same descriptor again
+    std::unique_ptr<Connection> closing;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        auto it = connections_.find(connection.socket);
+        if (it == connections_.end()) return;
+        closing = std::move(it->second);
+        connections_.erase(it);
     }
-    buf[n] = '\0';
-    std::string req(buf);
+    closeSocket(closing->socket);
+}
 
-    // Parse request line
-    std::istringstream iss(req);
-    std::string method, path, version;
-    iss >> method >> path >> version;
+bool HttpServer::serve(Connection &connection) {
+    // Read a large body in big pieces, without trusting Content-Length
+    // enough to allocate it all up front
+    size_t wanted = std::min<size_t>(std::max(connection.parser.missing(connection.input), InputBuffer::DEFAULT_CAPACITY),
+                                     1024 * 1024);
+    char *space = connection.input.prepare(wanted);
+#ifdef BOLTDB_HTTP_EPOLL
+    int n = recv(connection.socket, space, (int)connection.input.writable(), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+#else
+    int n = recv(connection.socket, space, (int)connection.input.writable(), 0);
+#endif
+    if (n <= 0) return false;  // Closed by the client, idle too long, or failed
+    connection.input.commit((size_t)n);
+
+    bool keepOpen = true;
+    std::string &out = connection.output;
+    while (keepOpen) {
+        HttpParser::Status status = connection.parser.next(connection.input, connection.request);
+        if (status == HttpParser::Status::Incomplete) break;
+        if (status == HttpParser::Status::Error) {
+            connection.body.clear();
+            json::appendError(connection.body, connection.parser.error());
+            appendResponse(out, connection.parser.errorStatus(), "application/json", connection.body, false);
+            keepOpen = false;
+            break;
+        }
+        keepOpen = handleRequest(connection);
+        if (out.size() >= OUTPUT_FLUSH_BYTES) {
+            bool sent = sendAll(connection.socket, out.data(), out.size());
+            out.clear();
+            if (!sent) return false;
+        }
+    }
+    // Responses to every request that arrived in this read go out in one send
+    if (!out.empty()) {
+        bool sent = sendAll(connection.socket, out.data(), out.size());
+        out.clear();
+        if (!sent) return false;
+    }
+    // Don't keep a large file's or batch's buffers on an idle connection
+    if (out.capacity() > 4 * OUTPUT_FLUSH_BYTES) {
+        std::string().swap(out);
+    }
+    if (connection.body.capacity() > 4 * OUTPUT_FLUSH_BYTES) {
+        std::string().swap(connection.body);
+    }
+    if (connection.scratch.capacity() > 4 * OUTPUT_FLUSH_BYTES) {
+        std::string().swap(connection.scratch);
+    }
+    return keepOpen;
+}
+
+bool HttpServer::handleRequest(Connection &connection) {
+    const HttpRequest &request = connection.request;
+    std::string &out = connection.output;
+    std::string &body = connection.body;
+    bool keepAlive = request.keepAlive;
+    body.clear();
 
     // Basic routing
-    if (method == "GET" && path.rfind("/api/get?key=", 0) == 0) {
-        std::string key = urlDecode(path.substr(std::string("/api/get?key=").size()));
+    if (request.method == "GET" && request.target.rfind("/api/get?key=", 0) == 0) {
+        std::string key = urlDecode(request.target.substr(std::string_view("/api/get?key=").size()));
         auto val = dataStore_.get(key);
-        std::string body;
         int status = 200;
-        if (val.has_value()) {
-            body = std::string("{\"key\":\"") + key + "\",\"value\":\"" + *val + "\"}";
+        if (val && val.collection()) {
+            status = 409;
+            json::appendError(body, "wrong_type");
+        } else if (val) {
+            body.append("{\"key\":");
+            json::appendString(body, key);
+            body.append(",\"value\":");
+            json::appendString(body, val.view());
+            body.push_back('}');
         } else {
             status = 404;
-            body = std::string("{\"error\":\"not_found\"}");
-        }
-        std::ostringstream res;
-        res << "HTTP/1.1 " << status << " OK\r\n";
-        res << "Content-Type: application/json\r\n";
-        res << "Content-Length: " << body.size() << "\r\n\r\n";
-        res << body;
-        auto s = res.str();
-        sendAll(clientSocket, s.c_str(), s.size());
-        closeSocket(clientSocket);
-        return;
+            json::appendError(body, "not_found");
+        }
+        appendResponse(out, status, "application/json", body, keepAlive);
+        return keepAlive;
+    }
+
+    if (request.method == "GET" && request.path() == "/api/scan") {
+        return streamScan(connection);
+    }
+
+    if (request.method == "POST" && request.target == "/api/mget") {
+        handleMget(connection);
+        return keepAlive;
     }
 
-    if (method == "POST" && path == "/api/set") {
-        std::string headers = req.substr(0, req.find("\r\n\r\n"));
-        std::string body = req.substr(req.find("\r\n\r\n") + 4);
+    if (request.method == "POST" && request.target == "/api/mset") {
+        handleMset(connection);
+        return keepAlive;
+    }
+
+    if (request.method == "POST" && request.target == "/api/set") {
         // Expect body as key=value form
-        std::string key, value;
-        size_t kpos = body.find("key=");
-        size_t vpos = body.find("&value=");
-        if (kpos != std::string::npos && vpos != std::string::npos) {
-            key = urlDecode(body.substr(kpos + 4, vpos - (kpos + 4)));
-            value = urlDecode(body.substr(vpos + 7));
-            bool ok = dataStore_.set(key, value);
-            std::string resp = ok ? "{\"ok\":true}" : "{\"ok\":false}";
-            std::ostringstream res;
-            res << "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
-                << resp.size() << "\r\n\r\n" << resp;
-            auto s = res.str();
-            sendAll(clientSocket, s.c_str(), s.size());
-            closeSocket(clientSocket);
-            return;
-        }
-    }
-
-    if (method == "POST" && path == "/api/delete") {
-        std::string body = req.substr(req.find("\r\n\r\n") + 4);
-        std::string key;
-        size_t kpos = body.find("key=");
-        if (kpos != std::string::npos) {
-            key = urlDecode(body.substr(kpos + 4));
+        std::string_view form = request.body;
+        size_t kpos = form.find("key=");
+        size_t vpos = form.find("&value=");
+        if (kpos != std::string_view::npos && vpos != std::string_view::npos) {
+            std::string key = urlDecode(form.substr(kpos + 4, vpos - (kpos + 4)));
+            std::string value = urlDecode(form.substr(vpos + 7));
+            bool ok = dataStore_.freeMemoryIfNeeded() && dataStore_.set(key, value);
+            if (ok && !waitForDurability()) {
+                appendNotLogged(connection);
+                return keepAlive;
+            }
+            appendResponse(out, 200, "application/json", ok ? "{\"ok\":true}" : "{\"ok\":false}", keepAlive);
+            return keepAlive;
+        }
+    }
+
+    if (request.method == "POST" && request.target == "/api/delete") {
+        size_t kpos = request.body.find("key=");
+        if (kpos != std::string_view::npos) {
+            std::string key = urlDecode(request.body.substr(kpos + 4));
             bool deleted = dataStore_.del(key);
-            std::string resp = std::string("{\"deleted\":") + (deleted ? "true" : "false") + "}";
-            std::ostringstream res;
-            res << "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
-                << resp.size() << "\r\n\r\n" << resp;
-            auto s = res.str();
-            sendAll(clientSocket, s.c_str(), s.size());
-            closeSocket(clientSocket);
-            return;
+            if (deleted && !waitForDurability()) {
+                appendNotLogged(connection);
+                return keepAlive;
+            }
+            appendResponse(out, 200, "application/json", deleted ? "{\"deleted\":true}" : "{\"deleted\":false}",
+                           keepAlive);
+            return keepAlive;
         }
     }
 
     // Serve static files
+    std::string path(request.path());
     if (path == "/") path = "/index.html";
     std::string full = webRoot_ + path;
     std::string data = readFileToString(full);
     if (!data.empty()) {
-        std::ostringstream res;
-        std::string mime = getMimeType(full);
-        res << "HTTP/1.1 200 OK\r\nContent-Type: " << mime << "\r\nContent-Length: " << data.size()
-            << "\r\n\r\n";
-        auto head = res.str();
-        sendAll(clientSocket, head.c_str(), head.size());
-        sendAll(clientSocket, data.c_str(), data.size());
+        appendResponse(out, 200, getMimeType(full).c_str(), data, keepAlive);
     } else {
-        const char *notFound = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
-        sendAll(clientSocket, notFound, strlen(notFound));
+        appendResponse(out, 404, "text/plain; charset=utf-8", "", keepAlive);
+    }
+    return keepAlive;
+}
+
+void HttpServer::handleMget(Connection &connection) {
+    std::string &body = connection.body;
+    json::Reader reader(connection.request.body, connection.scratch);
+    std::vector<std::string_view> keys;
+    bool valid = reader.consume('[');
+    if (valid && !reader.consume(']')) {
+        do {
+            std::string_view key;
+            valid = reader.readString(key);
+            keys.push_back(key);
+        } while (valid && reader.consume(','));
+        valid = valid && reader.consume(']');
+    }
+    if (!valid || !reader.atEnd()) {
+        json::appendError(body, "invalid_json", "expected an array of key strings");
+        appendResponse(connection.output, 400, "application/json", body, connection.request.keepAlive);
+        return;
+    }
+
+    // Values come back in key order; missing keys and collections are null
+    std::vector<Value> values = dataStore_.mget(keys);
+    body.append("{\"values\":[");
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) body.push_back(',');
+        if (values[i] && !values[i].collection()) {
+            json::appendString(body, values[i].view());
+        } else {
+            body.append("null");
+        }
+    }
+    body.append("]}");
+    appendResponse(connection.output, 200, "application/json", body, connection.request.keepAlive);
+}
+
+void HttpServer::handleMset(Connection &connection) {
+    std::string &body = connection.body;
+    json::Reader reader(connection.request.body, connection.scratch);
+    std::vector<std::pair<std::string_view, std::string_view>> entries;
+    bool valid = reader.consume('[');
+    if (valid && !reader.consume(']')) {
+        do {
+            // {"key":"k","value":"v"}, members in either order
+            std::string_view key;
+            std::string_view value;
+            bool hasKey = false;
+            bool hasValue = false;
+            valid = reader.consume('{');
+            while (valid) {
+                std::string_view name;
+                valid = reader.readString(name) && reader.consume(':');
+                if (valid && name == "key" && !hasKey) {
+                    valid = hasKey = reader.readString(key);
+                } else if (valid && name == "value" && !hasValue) {
+                    valid = hasValue = reader.readString(value);
+                } else {
+                    valid = false;
+                }
+                if (!valid || !reader.consume(',')) break;
+            }
+            valid = valid && hasKey && hasValue && reader.consume('}');
+            entries.emplace_back(key, value);
+        } while (valid && reader.consume(','));
+        valid = valid && reader.consume(']');
+    }
+    if (!valid || !reader.atEnd()) {
+        json::appendError(body, "invalid_json", "expected an array of {\"key\":string,\"value\":string} objects");
+        appendResponse(connection.output, 400, "application/json", body, connection.request.keepAlive);
+        return;
+    }
+
+    bool ok = entries.empty() || (dataStore_.freeMemoryIfNeeded() && dataStore_.mset(entries));
+    if (ok && !waitForDurability()) {
+        appendNotLogged(connection);
+        return;
     }
-    closeSocket(clientSocket);
+    appendResponse(connection.output, 200, "application/json", ok ? "{\"ok\":true}" : "{\"ok\":false}",
+                   connection.request.keepAlive);
+}
+
+bool HttpServer::waitForDurability() {
+    if (appendLog_ && appendLog_->policy() == FsyncPolicy::Always) {
+        return appendLog_->waitForThreadRecords();
+    }
+    return true;
+}
+
+void HttpServer::appendNotLogged(Connection &connection) {
+    std::string &body = connection.body;
+    body.clear();
+    json::appendError(body, "not_logged", "the change was applied but could not be written to the append-only log");
+    appendResponse(connection.output, 500, "application/json", body, connection.request.keepAlive);
+}
+
+bool HttpServer::streamScan(Connection &connection) {
+    const HttpRequest &request = connection.request;
+    std::string &out = connection.output;
+    std::string &body = connection.body;
+    if (!dataStore_.orderedIndex()) {
+        json::appendError(body, "ordered_index_disabled", "start the server with --ordered-index");
+        appendResponse(out, 501, "application/json", body, request.keepAlive);
+        return request.keepAlive;
+    }
+
+    // ?prefix=p&after=k&limit=n&values=0
+    std::string prefix;
+    std::string after;
+    std::string text;
+    queryParameter(request.query(), "prefix", prefix);
+    queryParameter(request.query(), "after", after);
+    size_t limit = SIZE_MAX;
+    if (queryParameter(request.query(), "limit", text)) {
+        if (text.empty() || text.size() > 18 || text.find_first_not_of("0123456789") != std::string::npos) {
+            json::appendError(body, "invalid_limit");
+            appendResponse(out, 400, "application/json", body, request.keepAlive);
+            return request.keepAlive;
+        }
+        limit = std::stoull(text);
+    }
+    bool withValues = !(queryParameter(request.query(), "values", text) && (text == "0" || text == "false"));
+
+    // Keys with the prefix all lie below the first string past every one of them
+    KeyRange range;
+    std::string prefixEnd = prefix;
+    while (!prefixEnd.empty() && static_cast<unsigned char>(prefixEnd.back()) == 0xff) {
+        prefixEnd.pop_back();
+    }
+    if (!prefixEnd.empty()) {
+        prefixEnd.back() = static_cast<char>(static_cast<unsigned char>(prefixEnd.back()) + 1);
+        range.max = prefixEnd;
+        range.maxExclusive = true;
+        range.maxUnbounded = false;
+    }
+    range.min = prefix;
+    if (after >= prefix) {
+        range.min = after;
+        range.minExclusive = true;
+    }
+
+    // HTTP/1.0 has no chunked encoding: the body ends when the connection closes
+    bool chunked = request.version != "HTTP/1.0";
+    bool keepAlive = chunked && request.keepAlive;
+    out.append("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n");
+    if (chunked) out.append("Transfer-Encoding: chunked\r\n");
+    out.append(keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+
+    auto appendChunk = [&]() {
+        if (body.empty()) return;
+        if (chunked) {
+            char size[20];
+            out.append(size, static_cast<size_t>(snprintf(size, sizeof(size), "%zx\r\n", body.size())));
+        }
+        out.append(body);
+        if (chunked) out.append("\r\n");
+        body.clear();
+    };
+
+    body.push_back('[');
+    size_t sent = 0;
+    std::string lastKey;
+    while (sent < limit) {
+        size_t batch = std::min(SCAN_BATCH_KEYS, limit - sent);
+        auto entries = dataStore_.range(range, batch, withValues);
+        for (const auto &entry : entries) {
+            body.append(sent++ == 0 ? "{\"key\":" : ",{\"key\":");
+            json::appendString(body, entry.first);
+            if (withValues) {
+                body.append(",\"value\":");
+                if (entry.second && !entry.second.collection()) {
+                    json::appendString(body, entry.second.view());
+                } else {
+                    body.append("null");
+                }
+            }
+            body.push_back('}');
+        }
+        if (entries.size() < batch) break;
+        lastKey = std::move(entries.back().first);
+        range.min = lastKey;
+        range.minExclusive = true;
+
+        // Only the current chunk and unsent output are ever held, however
+        // many keys match
+        if (body.size() >= SCAN_CHUNK_BYTES) {
+            appendChunk();
+            if (out.size() >= OUTPUT_FLUSH_BYTES) {
+                bool flushed = sendAll(connection.socket, out.data(), out.size());
+                out.clear();
+                if (!flushed) return false;
+            }
+        }
+    }
+    body.push_back(']');
+    appendChunk();
+    if (chunked) out.append("0\r\n\r\n");
+    return keepAlive;
+}
+
+void HttpServer::appendResponse(std::string &out, int status, const char *contentType, std::string_view body,
+                                bool keepAlive) {
+    out.append("HTTP/1.1 ").append(std::to_string(status)).append(" ").append(statusText(status));
+    out.append("\r\nContent-Type: ").append(contentType);
+    out.append("\r\nContent-Length: ").append(std::to_string(body.size()));
+    out.append(keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+    out.append(body);
 }
 
 void HttpServer::closeSocket(http_socket_t s) {
@@ -199,12 +683,12 @@ bool HttpServer::sendAll(http_socket_t s, const char *data, size_t len) {
     return true;
 }
 
-std::string HttpServer::urlDecode(const std::string &src) {
+std::string HttpServer::urlDecode(std::string_view src) {
     std::string out;
     for (size_t i = 0; i < src.size(); ++i) {
         if (src[i] == '+') out.push_back(' ');
         else if (src[i] == '%' && i + 2 < src.size()) {
-            std::string hex = src.substr(i + 1, 2);
+            std::string hex(src.substr(i + 1, 2));
             char c = (char)strtol(hex.c_str(), nullptr, 16);
             out.push_back(c);
             i += 2;
@@ -213,14 +697,35 @@ std::string HttpServer::urlDecode(const std::string &src) {
     return out;
 }
 
-std::string HttpServer::getHeaderValue(const std::string &headers, const std::string &key) {
-    auto pos = headers.find(key);
-    if (pos == std::string::npos) return "";
-    auto end = headers.find("\r\n", pos);
-    auto line = headers.substr(pos, end - pos);
-    auto colon = line.find(":");
-    if (colon == std::string::npos) return "";
-    return trim(line.substr(colon + 1));
+bool HttpServer::queryParameter(std::string_view query, std::string_view name, std::string &value) {
+    while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == name) {
+            value = eq == std::string_view::npos ? std::string() : urlDecode(pair.substr(eq + 1));
+            return true;
+        }
+        if (amp == std::string_view::npos) break;
+        query.remove_prefix(amp + 1);
+    }
+    return false;
+}
+
+const char *HttpServer::statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Error";
+    }
 }
 
 std::string HttpServer::getMimeType(const std::string &path) {
@@ -239,5 +744,3 @@ std::string HttpServer::readFileToString(const std::string &path) {
     ss << ifs.rdbuf();
     return ss.str();
 }
-
-
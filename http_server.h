@@ -1,9 +1,19 @@
 #pragma once
 
+#include "append_only_log.h"
 #include "datastore.h"
+#include "http_parser.h"
+#include "input_buffer.h"
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -19,32 +29,215 @@ using http_socket_t = int;
 const http_socket_t HTTP_INVALID_SOCKET = -1;
 #endif
 
+#if defined(__linux__)
+#define BOLTDB_HTTP_EPOLL 1
+#endif
+
+/**
+ * Embedded HTTP server for the web UI and the REST API
+ * Connections are kept alive and may pipeline requests, which are parsed
+ * incrementally and answered in order. A fixed pool of worker threads
+ * serves them: on Linux the workers wait on one epoll set with
+ * EPOLLONESHOT, so an idle connection ties up no thread and each readable
+ * connection goes to exactly one worker, and a worker that wakes up
+ * at most once a second shuts down connections idle past the timeout;
+ * elsewhere an accept thread queues connections and each worker serves one
+ * at a time, with a receive timeout. Either way a connection that sends
+ * nothing for KEEP_ALIVE_TIMEOUT_SECONDS is closed
+ */
 class HttpServer {
 public:
-    explicit HttpServer(DataStore &dataStore);
+    /**
+     * Most open connections; further ones are answered 503 and closed
+     */
+    static constexpr size_t MAX_CONNECTIONS = 10000;
+
+    /**
+     * Seconds a connection may stay idle before it is closed, and a slow
+     * client gets to take a response
+     */
+    static constexpr int KEEP_ALIVE_TIMEOUT_SECONDS = 5;
+
+    /**
+     * Responses buffered for a connection before they are sent, even if
+     * more pipelined requests are waiting
+     */
+    static constexpr size_t OUTPUT_FLUSH_BYTES = 64 * 1024;
+
+    /**
+     * Keys /api/scan reads from the store per range() call
+     */
+    static constexpr size_t SCAN_BATCH_KEYS = 256;
+
+    /**
+     * Encoded bytes /api/scan gathers into one chunk of its response
+     */
+    static constexpr size_t SCAN_CHUNK_BYTES = 16 * 1024;
+
+    /**
+     * Constructor
+     * @param dataStore The store the API reads and writes
+     * @param appendLog The store's append-only log, if any; with
+     *        FsyncPolicy::Always writes are answered once they are durable
+     */
+    explicit HttpServer(DataStore &dataStore, AppendOnlyLog *appendLog = nullptr);
     ~HttpServer();
 
-    bool start(int port = 8080, const std::string &webRoot = "web");
+    /**
+     * Start listening and the worker threads
+     * @param port Port to listen on
+     * @param webRoot Directory the static files are served from
+     * @param workers Number of worker threads, 0 for one per hardware thread
+     * @return true if successful
+     */
+    bool start(int port = 8080, const std::string &webRoot = "web", size_t workers = 0);
     void stop();
     bool isRunning() const;
 
 private:
+    /**
+     * State of one client connection, owned by connections_ and used by
+     * one worker at a time
+     */
+    struct Connection {
+        http_socket_t socket;
+        InputBuffer input;    // Bytes received but not yet parsed
+        HttpParser parser;
+        HttpRequest request;  // Reused, so its header list keeps its capacity
+        std::string output;   // Responses waiting to be sent
+        std::string body;     // Response body being encoded, reused across requests
+        std::string scratch;  // Strings decoded from a JSON request body
+#ifdef BOLTDB_HTTP_EPOLL
+        std::atomic<int64_t> lastActive{0};  // Steady clock milliseconds a worker last let it go
+#endif
+    };
+
     DataStore &dataStore_;
+    AppendOnlyLog *appendLog_;
     std::atomic<bool> running_;
     http_socket_t serverSocket_;
-    std::thread acceptThread_;
     std::string webRoot_;
+    std::vector<std::thread> workers_;
+
+    std::mutex connectionsMutex_;
+    std::unordered_map<http_socket_t, std::unique_ptr<Connection>> connections_;
+
+#ifdef BOLTDB_HTTP_EPOLL
+    int epollFd_;
+    int wakeFd_;  // eventfd that stop() signals to release every worker
+    std::atomic<int64_t> nextSweep_;  // When a worker next looks for idle connections
+#else
+    std::thread acceptThread_;
+    std::condition_variable queueReady_;
+    std::deque<Connection *> queue_;  // Accepted connections no worker has taken yet, under connectionsMutex_
+#endif
+
+    /**
+     * Worker thread body
+     */
+    void workerLoop();
+
+#ifdef BOLTDB_HTTP_EPOLL
+    /**
+     * Accept pending connections and add them to the epoll set
+     */
+    void acceptConnections();
 
+    /**
+     * Re-enable a connection's one-shot epoll registration
+     * @return false if that failed
+     */
+    bool rearm(Connection &connection);
+
+    /**
+     * Shut down the sockets of connections idle for longer than
+     * KEEP_ALIVE_TIMEOUT_SECONDS, if no worker did so in the last second
+     * The worker that gets the resulting hang-up closes the connection,
+     * so none is freed under a worker still serving it
+     */
+    void closeIdleConnections();
+#else
+    /**
+     * Accept thread body: queue connections for the workers
+     */
     void acceptLoop();
-    void handleClient(http_socket_t clientSocket);
+#endif
+
+    /**
+     * Adopt an accepted socket, or refuse it with 503 if there are too
+     * many connections
+     * @return The connection, null if it was refused
+     */
+    Connection *openConnection(http_socket_t clientSocket);
+
+    /**
+     * Close a connection and forget it
+     */
+    void closeConnection(Connection &connection);
+
+    /**
+     * Read what has arrived on a connection, answer every complete request
+     * in it and send the responses
+     * @return true to keep the connection open
+     */
+    bool serve(Connection &connection);
+
+    /**
+     * Answer a connection's current request, appending the response to its output
+     * @return true to keep the connection open
+     */
+    bool handleRequest(Connection &connection);
+
+    /**
+     * Block until this worker's mutations are durable, when the log
+     * fsyncs on every commit, as Server does before replying
+     * @return false if the log failed to write them
+     */
+    bool waitForDurability();
+
+    /**
+     * Answer a write that was applied but could not be logged with a 500
+     * instead of its usual response
+     */
+    void appendNotLogged(Connection &connection);
+
+    /**
+     * POST /api/mget: look up a JSON array of keys
+     */
+    void handleMget(Connection &connection);
+
+    /**
+     * POST /api/mset: store a JSON array of {"key":...,"value":...} objects
+     */
+    void handleMset(Connection &connection);
+
+    /**
+     * GET /api/scan: stream keys in order as a chunked JSON array, a batch
+     * of keys at a time, sending each chunk once enough output has built up
+     * @return true to keep the connection open
+     */
+    bool streamScan(Connection &connection);
+
+    /**
+     * Append a complete response with a Content-Length header
+     * @param keepAlive Whether the connection stays open afterwards
+     */
+    static void appendResponse(std::string &out, int status, const char *contentType, std::string_view body,
+                               bool keepAlive);
+
     void closeSocket(http_socket_t s);
     bool sendAll(http_socket_t s, const char *data, size_t len);
 
     // HTTP helpers
-    static std::string urlDecode(const std::string &src);
-    static std::string getHeaderValue(const std::string &headers, const std::string &key);
+    static std::string urlDecode(std::string_view src);
+
+    /**
+     * Find a query string parameter
+     * @param value Receives the URL-decoded value
+     * @return true if the parameter is present
+     */
+    static bool queryParameter(std::string_view query, std::string_view name, std::string &value);
+    static const char *statusText(int status);
     static std::string getMimeType(const std::string &path);
     static std::string readFileToString(const std::string &path);
 };
-
-
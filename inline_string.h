@@ -0,0 +1,149 @@
+#pragma once
+
+#include "slab_arena.h"
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+/**
+ * Immutable string that keeps up to INLINE_CAPACITY bytes in place
+ * FlatHashMap stores its keys as InlineStrings, so the common short key
+ * lives in the table slot itself and costs no allocation; a longer one is
+ * copied to the heap, or to a SlabArena block if given an arena. The
+ * object is 24 bytes either way
+ */
+class InlineString {
+private:
+    static constexpr unsigned char HEAP = 0xFF;
+    static constexpr size_t ARENA_FLAG = 16;
+
+    // Inline: the bytes, then their count in the last byte. On the heap:
+    // the data pointer and the size, then a byte that is 1 if the data is a
+    // SlabArena block, then HEAP in the last byte
+    alignas(char*) unsigned char storage_[24];
+
+    bool onHeap() const noexcept { return storage_[sizeof(storage_) - 1] == HEAP; }
+
+    char* heapData() const noexcept {
+        char* data;
+        std::memcpy(&data, storage_, sizeof(data));
+        return data;
+    }
+
+    void assign(std::string_view text, SlabArena* arena) {
+        if (text.size() <= INLINE_CAPACITY) {
+            std::memset(storage_, 0, sizeof(storage_));
+            if (!text.empty()) {
+                std::memcpy(storage_, text.data(), text.size());
+            }
+            storage_[sizeof(storage_) - 1] = static_cast<unsigned char>(text.size());
+            return;
+        }
+        bool slab = arena && SlabArena::fits(text.size());
+        char* data = slab ? static_cast<char*>(arena->allocate(text.size())) : new char[text.size()];
+        std::memcpy(data, text.data(), text.size());
+        size_t size = text.size();
+        std::memcpy(storage_, &data, sizeof(data));
+        std::memcpy(storage_ + sizeof(data), &size, sizeof(size));
+        storage_[ARENA_FLAG] = slab;
+        storage_[sizeof(storage_) - 1] = HEAP;
+    }
+
+    void destroy() noexcept {
+        if (inArena()) {
+            SlabArena::deallocate(heapData());
+        } else if (onHeap()) {
+            delete[] heapData();
+        }
+    }
+
+public:
+    /**
+     * Longest string kept in place
+     */
+    static constexpr size_t INLINE_CAPACITY = sizeof(storage_) - 1;
+
+    InlineString() noexcept : storage_{} {}
+    /**
+     * Copy a string
+     * @param text The bytes to copy
+     * @param arena Arena to take a block from if the string is too long to
+     *              keep in place, null to use the heap
+     */
+    explicit InlineString(std::string_view text, SlabArena* arena = nullptr) : storage_{} { assign(text, arena); }
+
+    // A copy of an arena string takes its block from the same arena
+    InlineString(const InlineString& other) : storage_{} {
+        assign(other.view(), other.inArena() ? SlabArena::owner(other.heapData()) : nullptr);
+    }
+
+    InlineString(InlineString&& other) noexcept {
+        std::memcpy(storage_, other.storage_, sizeof(storage_));
+        std::memset(other.storage_, 0, sizeof(other.storage_));
+    }
+
+    InlineString& operator=(const InlineString& other) {
+        if (this != &other) {
+            InlineString copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    InlineString& operator=(InlineString&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            std::memcpy(storage_, other.storage_, sizeof(storage_));
+            std::memset(other.storage_, 0, sizeof(other.storage_));
+        }
+        return *this;
+    }
+
+    ~InlineString() { destroy(); }
+
+    const char* data() const noexcept {
+        return onHeap() ? heapData() : reinterpret_cast<const char*>(storage_);
+    }
+
+    size_t size() const noexcept {
+        if (!onHeap()) {
+            return storage_[sizeof(storage_) - 1];
+        }
+        size_t size;
+        std::memcpy(&size, storage_ + sizeof(char*), sizeof(size));
+        return size;
+    }
+
+    std::string_view view() const noexcept { return std::string_view(data(), size()); }
+    operator std::string_view() const noexcept { return view(); }
+
+    /**
+     * Get the number of bytes allocated on the heap, 0 if the string is inline
+     */
+    size_t heapBytes() const noexcept { return onHeap() ? size() : 0; }
+
+    /**
+     * Check whether the bytes are a SlabArena block
+     */
+    bool inArena() const noexcept { return onHeap() && storage_[ARENA_FLAG] != 0; }
+
+    /**
+     * Move the bytes to another block of their arena if
+     * SlabArena::shouldMove() suggests it, for active defragmentation
+     * @return true if the bytes were moved
+     */
+    bool relocate() {
+        if (!inArena() || !SlabArena::shouldMove(heapData())) {
+            return false;
+        }
+        size_t length = size();
+        char* moved = static_cast<char*>(SlabArena::owner(heapData())->allocate(length));
+        std::memcpy(moved, heapData(), length);
+        SlabArena::deallocate(heapData());
+        std::memcpy(storage_, &moved, sizeof(moved));
+        return true;
+    }
+
+    bool operator==(std::string_view other) const noexcept { return view() == other; }
+    bool operator!=(std::string_view other) const noexcept { return view() != other; }
+};
@@ -0,0 +1,78 @@
+#include "input_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+void InputBuffer::reserveTail(size_t minSpace) {
+    size_t pending = writePos_ - readPos_;
+    // Give back storage a huge value left behind once it has been parsed
+    if (pending == 0 && capacity_ > MAX_IDLE_CAPACITY && minSpace <= DEFAULT_CAPACITY) {
+        data_.reset();
+        capacity_ = 0;
+    }
+    if (capacity_ - writePos_ >= minSpace) {
+        return;
+    }
+
+    // Sliding the unread bytes to the front is enough, and cheap because
+    // at least as many bytes were consumed as are moved
+    if (readPos_ >= pending && capacity_ - pending >= minSpace) {
+        std::memmove(data_.get(), data_.get() + readPos_, pending);
+        scanPos_ = std::max(scanPos_, readPos_) - readPos_;
+        readPos_ = 0;
+        writePos_ = pending;
+        return;
+    }
+
+    size_t capacity = std::max(capacity_ * 2, DEFAULT_CAPACITY);
+    while (capacity - pending < minSpace) {
+        capacity *= 2;
+    }
+    std::unique_ptr<char[]> data(new char[capacity]);
+    if (pending > 0) {
+        std::memcpy(data.get(), data_.get() + readPos_, pending);
+    }
+    data_ = std::move(data);
+    capacity_ = capacity;
+    scanPos_ = std::max(scanPos_, readPos_) - readPos_;
+    readPos_ = 0;
+    writePos_ = pending;
+}
+
+char* InputBuffer::prepare(size_t minSpace) {
+    reserveTail(minSpace);
+    return data_.get() + writePos_;
+}
+
+void InputBuffer::commit(size_t count) {
+    writePos_ = std::min(writePos_ + count, capacity_);
+}
+
+void InputBuffer::append(std::string_view bytes) {
+    std::memcpy(prepare(bytes.size()), bytes.data(), bytes.size());
+    commit(bytes.size());
+}
+
+bool InputBuffer::readLine(std::string_view& line) {
+    const char* begin = data_.get() + readPos_;
+    const char* from = data_.get() + std::max(scanPos_, readPos_);
+    size_t remaining = writePos_ - std::max(scanPos_, readPos_);
+    const void* newline = remaining > 0 ? std::memchr(from, '\n', remaining) : nullptr;
+    if (newline == nullptr) {
+        scanPos_ = writePos_;
+        return false;
+    }
+
+    const char* end = static_cast<const char*>(newline);
+    line = std::string_view(begin, static_cast<size_t>(end - begin));
+    consume(line.size() + 1);
+    return true;
+}
+
+void InputBuffer::consume(size_t count) {
+    readPos_ += std::min(count, writePos_ - readPos_);
+    if (readPos_ == writePos_) {
+        // Empty: start over at the front. The bytes stay in place, so views
+        // handed out by readLine() remain valid until the next prepare()
+        readPos_ = writePos_ = scanPos_ = 0;
+    }
+}
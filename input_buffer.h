@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+/**
+ * Per-connection buffer of received bytes waiting to be parsed
+ * Bytes are received straight into the buffer's free tail, and parsed
+ * commands are dropped by advancing a read offset, so consuming a command
+ * never moves the rest of the buffer. Unread bytes are moved back to the
+ * front only when that is cheaper than growing, and the buffer doubles
+ * when a single command does not fit, so a large pipelined batch or a
+ * large value is copied O(n) times in total rather than once per command
+ */
+class InputBuffer {
+private:
+    std::unique_ptr<char[]> data_;
+    size_t capacity_ = 0;
+    size_t readPos_ = 0;   // Start of unparsed bytes
+    size_t writePos_ = 0;  // End of received bytes
+    size_t scanPos_ = 0;   // Bytes before this offset are known not to contain '\n'
+
+    /**
+     * Make room for at least minSpace bytes after writePos_
+     */
+    void reserveTail(size_t minSpace);
+
+public:
+    /**
+     * Capacity allocated on first use and used as the minimum read size
+     */
+    static constexpr size_t DEFAULT_CAPACITY = 16384;
+
+    /**
+     * An empty buffer larger than this is released, so a connection that
+     * once sent a huge value does not hold on to the memory
+     */
+    static constexpr size_t MAX_IDLE_CAPACITY = 1024 * 1024;
+
+    /**
+     * Get writable space for the next receive
+     * @param minSpace Minimum number of free bytes wanted
+     * @return Pointer to at least max(minSpace, writable()) free bytes
+     */
+    char* prepare(size_t minSpace = DEFAULT_CAPACITY);
+
+    /**
+     * Number of free bytes after the last prepare()
+     */
+    size_t writable() const { return capacity_ - writePos_; }
+
+    /**
+     * Mark bytes written into the space returned by prepare() as received
+     * @param count Number of bytes received
+     */
+    void commit(size_t count);
+
+    /**
+     * Copy bytes into the buffer
+     * @param bytes The bytes to add
+     */
+    void append(std::string_view bytes);
+
+    /**
+     * Take the next complete line, without its '\n'
+     * The view points into the buffer and stays valid until the next
+     * prepare() or append(). Bytes already searched are not searched again
+     * when a line arrives in several reads
+     * @param line Receives the line
+     * @return true if a complete line was available, false otherwise
+     */
+    bool readLine(std::string_view& line);
+
+    /**
+     * Get the unparsed bytes
+     */
+    std::string_view view() const {
+        return std::string_view(data_.get() + readPos_, writePos_ - readPos_);
+    }
+
+    /**
+     * Drop parsed bytes from the front of the buffer
+     * @param count Number of bytes to drop
+     */
+    void consume(size_t count);
+
+    size_t size() const { return writePos_ - readPos_; }
+
+    bool empty() const { return writePos_ == readPos_; }
+
+    /**
+     * Get the allocated capacity in bytes
+     */
+    size_t capacity() const { return capacity_; }
+};
@@ -0,0 +1,207 @@
+#include "json.h"
+
+namespace {
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+/**
+ * Length of the valid UTF-8 sequence starting at text[pos], 0 if there is none
+ * Overlong forms, surrogates and code points past U+10FFFF are invalid
+ */
+size_t utf8SequenceLength(std::string_view text, size_t pos) {
+    auto byte = [&](size_t i) { return static_cast<unsigned char>(text[pos + i]); };
+    auto continuation = [&](size_t i) { return pos + i < text.size() && (byte(i) & 0xC0) == 0x80; };
+    unsigned char lead = byte(0);
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        return continuation(1) ? 2 : 0;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        if (!continuation(1) || !continuation(2)) return 0;
+        if (lead == 0xE0 && byte(1) < 0xA0) return 0;  // Overlong
+        if (lead == 0xED && byte(1) > 0x9F) return 0;  // Surrogate
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        if (!continuation(1) || !continuation(2) || !continuation(3)) return 0;
+        if (lead == 0xF0 && byte(1) < 0x90) return 0;  // Overlong
+        if (lead == 0xF4 && byte(1) > 0x8F) return 0;  // Past U+10FFFF
+        return 4;
+    }
+    return 0;
+}
+
+void appendUtf8(std::string& out, unsigned code) {
+    if (code < 0x80) {
+        out.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+}
+
+} // namespace
+
+namespace json {
+
+void appendString(std::string& out, std::string_view text) {
+    out.push_back('"');
+    size_t copied = 0;  // Start of the run not yet appended
+    size_t pos = 0;
+    while (pos < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[pos]);
+        if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80) {
+            ++pos;
+            continue;
+        }
+        if (c >= 0x80) {
+            size_t length = utf8SequenceLength(text, pos);
+            if (length != 0) {
+                pos += length;
+                continue;
+            }
+        }
+        out.append(text.data() + copied, pos - copied);
+        switch (c) {
+            case '"': out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            case '\b': out.append("\\b"); break;
+            case '\f': out.append("\\f"); break;
+            default:
+                if (c < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(HEX_DIGITS[c >> 4]);
+                    out.push_back(HEX_DIGITS[c & 0x0F]);
+                } else {
+                    out.append("\\ufffd");  // Not UTF-8
+                }
+        }
+        copied = ++pos;
+    }
+    out.append(text.data() + copied, text.size() - copied);
+    out.push_back('"');
+}
+
+void appendError(std::string& out, std::string_view code, std::string_view message) {
+    out.append("{\"error\":");
+    appendString(out, code);
+    if (!message.empty()) {
+        out.append(",\"message\":");
+        appendString(out, message);
+    }
+    out.push_back('}');
+}
+
+Reader::Reader(std::string_view text, std::string& scratch) : text_(text), scratch_(scratch) {
+    scratch_.clear();
+    scratch_.reserve(text.size());
+}
+
+void Reader::skipWhitespace() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+        ++pos_;
+    }
+}
+
+bool Reader::consume(char c) {
+    skipWhitespace();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+        ++pos_;
+        return true;
+    }
+    return false;
+}
+
+bool Reader::atEnd() {
+    skipWhitespace();
+    return pos_ == text_.size();
+}
+
+bool Reader::readHex4(unsigned& code) {
+    if (text_.size() - pos_ < 4) return false;
+    code = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = text_[pos_++];
+        code <<= 4;
+        if (c >= '0' && c <= '9') code |= static_cast<unsigned>(c - '0');
+        else if (c >= 'a' && c <= 'f') code |= static_cast<unsigned>(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') code |= static_cast<unsigned>(c - 'A' + 10);
+        else return false;
+    }
+    return true;
+}
+
+bool Reader::readString(std::string_view& value) {
+    if (!consume('"')) return false;
+    size_t start = pos_;
+    while (pos_ < text_.size() && text_[pos_] != '"' && text_[pos_] != '\\' &&
+           static_cast<unsigned char>(text_[pos_]) >= 0x20) {
+        ++pos_;
+    }
+    if (pos_ < text_.size() && text_[pos_] == '"') {
+        value = text_.substr(start, pos_++ - start);  // Nothing to decode
+        return true;
+    }
+
+    // Decode into the scratch buffer, after the strings decoded before
+    size_t begin = scratch_.size();
+    scratch_.append(text_.data() + start, pos_ - start);
+    while (pos_ < text_.size()) {
+        char c = text_[pos_++];
+        if (c == '"') {
+            value = std::string_view(scratch_.data() + begin, scratch_.size() - begin);
+            return true;
+        }
+        if (static_cast<unsigned char>(c) < 0x20) {
+            return false;  // Control characters must be escaped
+        }
+        if (c != '\\') {
+            scratch_.push_back(c);
+            continue;
+        }
+        if (pos_ == text_.size()) break;
+        switch (text_[pos_++]) {
+            case '"': scratch_.push_back('"'); break;
+            case '\\': scratch_.push_back('\\'); break;
+            case '/': scratch_.push_back('/'); break;
+            case 'b': scratch_.push_back('\b'); break;
+            case 'f': scratch_.push_back('\f'); break;
+            case 'n': scratch_.push_back('\n'); break;
+            case 'r': scratch_.push_back('\r'); break;
+            case 't': scratch_.push_back('\t'); break;
+            case 'u': {
+                unsigned code = 0;
+                if (!readHex4(code) || (code >= 0xDC00 && code <= 0xDFFF)) {
+                    return false;
+                }
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    // A high surrogate must be followed by its low half
+                    unsigned low = 0;
+                    if (text_.substr(pos_, 2) != "\\u") return false;
+                    pos_ += 2;
+                    if (!readHex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(scratch_, code);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+} // namespace json
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * The bits of JSON the HTTP API needs: escaping strings into a response
+ * buffer, and reading the arrays, objects and strings of request bodies
+ */
+namespace json {
+
+/**
+ * Append text as a quoted JSON string
+ * Quotes, backslashes and control characters are escaped. Keys and values
+ * are arbitrary bytes but JSON text must be UTF-8, so bytes that are not
+ * part of a valid UTF-8 sequence become U+FFFD. Runs that need no escaping
+ * are copied in one go
+ * @param out Buffer to append to; reused across responses, so it keeps its capacity
+ * @param text The bytes to encode
+ */
+void appendString(std::string& out, std::string_view text);
+
+/**
+ * Append an error body, {"error":"code"} or {"error":"code","message":"..."}
+ */
+void appendError(std::string& out, std::string_view code, std::string_view message = std::string_view());
+
+/**
+ * Pull reader over one JSON document
+ * The caller walks the structure it expects with consume() and
+ * readString(), and checks atEnd() once done. Strings without escapes are
+ * returned as views into the document; escaped ones are decoded into a
+ * scratch buffer reserved up front to the document's size, which a
+ * decoded string can never outgrow, so every view stays valid until the
+ * scratch buffer is next used. Numbers, true, false and null are not
+ * needed by the API and are treated as errors
+ */
+class Reader {
+private:
+    std::string_view text_;
+    size_t pos_ = 0;
+    std::string& scratch_;
+
+public:
+    /**
+     * Constructor
+     * @param text The document
+     * @param scratch Buffer for decoded strings; cleared
+     */
+    Reader(std::string_view text, std::string& scratch);
+
+    /**
+     * Take a punctuation character such as '[' or ',' after optional whitespace
+     * @return true if it was next; otherwise nothing is consumed
+     */
+    bool consume(char c);
+
+    /**
+     * Read a string, decoding its escapes
+     * @param value Receives the string
+     * @return false if the next value is not a well-formed string
+     */
+    bool readString(std::string_view& value);
+
+    /**
+     * Check that only whitespace is left
+     */
+    bool atEnd();
+
+private:
+    void skipWhitespace();
+
+    /**
+     * Read the four hex digits of a \u escape
+     */
+    bool readHex4(unsigned& code);
+};
+
+} // namespace json
@@ -6,6 +6,11 @@
 #include <signal.h>
 #include <memory>
 #include <filesystem>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 
 // Global variables for signal handling
 std::unique_ptr<Server> g_server;
@@ -26,9 +31,15 @@ void signalHandler(int signal) {
         g_httpServer->stop();
     }
     
+    if (g_dataStore) {
+        g_dataStore->stopExpiryCycle();
+    }
+    
     if (g_persistenceManager) {
+        // Final save before exit, while the append-only log is still open
+        // to take its checkpoint record
+        g_persistenceManager->forceSave();
         g_persistenceManager->stopPersistence();
-        g_persistenceManager->forceSave(); // Final save before exit
     }
     
     std::cout << "BoltDB server shutdown complete." << std::endl;
@@ -39,18 +50,122 @@ void signalHandler(int signal) {
  * Print usage information
  */
 void printUsage(const char* programName) {
-    std::cout << "Usage: " << programName << " [port] [dump_file]" << std::endl;
+    std::cout << "Usage: " << programName << " [port] [dump_file] [options]" << std::endl;
     std::cout << "  port      - Port number to listen on (default: 7379)" << std::endl;
     std::cout << "  dump_file - Database dump file (default: dump.bdb)" << std::endl;
     std::cout << "  HTTP UI   - Available at http://localhost:8080" << std::endl;
     std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --shards N       - Number of data store shards (default: "
+              << DataStore::DEFAULT_SHARD_COUNT << ")" << std::endl;
+    std::cout << "  --io-model M     - threads (one thread per client, default) or reactor (epoll)" << std::endl;
+    std::cout << "  --io-threads N   - Event loop threads in reactor mode (default: 4)" << std::endl;
+    std::cout << "  --reuseport      - Reactor mode: each event loop accepts on its own SO_REUSEPORT socket" << std::endl;
+    std::cout << "  --pin-cpus       - Reactor mode: pin event loop N to CPU N" << std::endl;
+    std::cout << "  --backlog N      - listen() backlog per listening socket (default: 511)" << std::endl;
+    std::cout << "  --snapshot-format F - binary (default) or csv; existing files of either format are loaded" << std::endl;
+    std::cout << "  --save \"S C ...\" - Save after S seconds if at least C keys changed, per rule pair"
+              << " (default: \"60 1 10 10000\"; \"\" saves only at shutdown)" << std::endl;
+    std::cout << "  --max-deltas N   - Delta files written before a full snapshot; 0 always saves in full (default: 16)"
+              << std::endl;
+    std::cout << "  --lazy-load      - Serve a binary snapshot from its memory mapping while it loads" << std::endl;
+    std::cout << "  --ordered-index  - Keep keys sorted too, for SCAN and RANGE" << std::endl;
+    std::cout << "  --maxmemory SIZE - Memory limit for keys and values, e.g. 512mb; 0 for none (default)" << std::endl;
+    std::cout << "  --maxmemory-policy P - noeviction (default), allkeys-lru, allkeys-lfu, allkeys-random," << std::endl;
+    std::cout << "                     volatile-lru, volatile-lfu, volatile-random or volatile-ttl" << std::endl;
+    std::cout << "  --maxmemory-samples N - Keys sampled per eviction (default: "
+              << DataStore::DEFAULT_EVICTION_SAMPLES << ")" << std::endl;
+    std::cout << "  --activedefrag yes|no - Move keys and values out of sparse allocator slabs (default: no)"
+              << std::endl;
+    std::cout << "  --active-defrag-ignore-bytes SIZE - Reclaimable allocator memory tolerated (default: 100mb)"
+              << std::endl;
+    std::cout << "  --active-defrag-threshold N - Reclaimable memory tolerated, percent of allocated (default: "
+              << DataStore::DEFAULT_DEFRAG_THRESHOLD << ")" << std::endl;
+    std::cout << "  --aof FILE       - Also record every mutation in an append-only log" << std::endl;
+    std::cout << "  --aof-fsync P    - Append-only log fsync policy: always, everysec (default) or no" << std::endl;
+    std::cout << "  --http-workers N - HTTP worker threads (default: one per hardware thread, at least 2)" << std::endl;
+    std::cout << std::endl;
     std::cout << "Commands:" << std::endl;
-    std::cout << "  SET key value    - Store a key-value pair" << std::endl;
+    std::cout << "  SET key value [EX s|PX ms|EXAT s|PXAT ms] - Store a key-value pair, optionally expiring" << std::endl;
     std::cout << "  GET key          - Retrieve a value by key" << std::endl;
     std::cout << "  DELETE key       - Delete a key-value pair" << std::endl;
+    std::cout << "  EXPIRE key s     - Expire a key after s seconds (also PEXPIRE, PEXPIREAT)" << std::endl;
+    std::cout << "  TTL key          - Seconds until a key expires (also PTTL); PERSIST removes it" << std::endl;
+    std::cout << "  HSET key f v ... - Set hash fields (also HGET, HDEL, HGETALL, HLEN)" << std::endl;
+    std::cout << "  LPUSH key e ...  - Push onto a list (also RPUSH, LPOP, RPOP, LRANGE, LLEN)" << std::endl;
+    std::cout << "  ZADD key s m ... - Add sorted set members (also ZREM, ZSCORE, ZRANGE, ZCARD)" << std::endl;
+    std::cout << "  TYPE key         - Type of a key's value" << std::endl;
+    std::cout << "  INCR key         - Add 1 to an integer (also INCRBY, DECR, DECRBY)" << std::endl;
+    std::cout << "  APPEND key value - Append to a string; GETSET key value swaps in a new one" << std::endl;
+    std::cout << "  CAS key old new  - Store new only if the key holds old" << std::endl;
+    std::cout << "  INFO             - Show server statistics" << std::endl;
     std::cout << "  QUIT             - Disconnect from server" << std::endl;
 }
 
+/**
+ * Parse an integer command line argument within a range
+ * @param name Argument name used in error messages
+ * @param text Argument text
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param out Receives the parsed value
+ * @return true if the value was valid, false otherwise
+ */
+bool parseIntArg(const std::string& name, const char* text, long min, long max, long& out) {
+    try {
+        size_t consumed = 0;
+        long value = std::stol(text, &consumed);
+        if (consumed != std::string(text).size() || value < min || value > max) {
+            std::cerr << "Error: " << name << " must be between " << min << " and " << max << std::endl;
+            return false;
+        }
+        out = value;
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid " << name << ": " << text << std::endl;
+        return false;
+    }
+}
+
+/**
+ * Parse a memory size such as 100mb, 2gb or 1048576
+ * Units as in Redis: k, m and g are powers of 1000, kb, mb and gb powers of 1024
+ * @param text Argument text
+ * @param out Receives the size in bytes
+ * @return true if the size was valid, false otherwise
+ */
+bool parseMemoryArg(const char* text, size_t& out) {
+    std::string size(text);
+    std::transform(size.begin(), size.end(), size.begin(), ::tolower);
+    static const std::pair<const char*, unsigned long long> units[] = {
+        {"gb", 1ull << 30}, {"mb", 1ull << 20}, {"kb", 1ull << 10},
+        {"g", 1000000000ull}, {"m", 1000000ull}, {"k", 1000ull}, {"b", 1ull}};
+    unsigned long long multiplier = 1;
+    for (const auto& unit : units) {
+        size_t length = std::strlen(unit.first);
+        if (size.size() > length && size.compare(size.size() - length, length, unit.first) == 0) {
+            size.resize(size.size() - length);
+            multiplier = unit.second;
+            break;
+        }
+    }
+    if (size.empty() || size.find_first_not_of("0123456789") != std::string::npos) {
+        std::cerr << "Error: Invalid memory size: " << text << std::endl;
+        return false;
+    }
+    try {
+        unsigned long long value = std::stoull(size);
+        if (value > std::numeric_limits<size_t>::max() / multiplier) {
+            throw std::out_of_range(text);
+        }
+        out = static_cast<size_t>(value * multiplier);
+        return true;
+    } catch (const std::exception&) {
+        std::cerr << "Error: Invalid memory size: " << text << std::endl;
+        return false;
+    }
+}
+
 int main(int argc, char* argv[]) {
     std::cout << "=== BoltDB - In-Memory Key-Value Database ===" << std::endl;
     std::cout << "Version: 1.0.0" << std::endl;
@@ -60,27 +175,143 @@ int main(int argc, char* argv[]) {
     // Parse command line arguments
     int port = 7379;
     std::string dumpFile = "dump.bdb";
-    
-    if (argc > 1) {
-        if (std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+    size_t shardCount = DataStore::DEFAULT_SHARD_COUNT;
+    ServerConfig serverConfig;
+    SnapshotFormat snapshotFormat = SnapshotFormat::Binary;
+    std::string aofFile;
+    FsyncPolicy fsyncPolicy = FsyncPolicy::EverySecond;
+    bool lazyLoad = false;
+    bool orderedIndex = false;
+    std::vector<SaveRule> saveRules;
+    bool saveRulesSet = false;
+    long maxDeltas = 16;
+    size_t httpWorkers = 0;
+    size_t maxMemory = 0;
+    EvictionPolicy evictionPolicy = EvictionPolicy::NoEviction;
+    long evictionSamples = static_cast<long>(DataStore::DEFAULT_EVICTION_SAMPLES);
+    bool activeDefrag = false;
+    size_t defragIgnoreBytes = DataStore::DEFAULT_DEFRAG_IGNORE_BYTES;
+    long defragThreshold = static_cast<long>(DataStore::DEFAULT_DEFRAG_THRESHOLD);
+    int positional = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
             printUsage(argv[0]);
             return 0;
         }
-        
-        try {
-            port = std::stoi(argv[1]);
-            if (port < 1 || port > 65535) {
-                std::cerr << "Error: Port must be between 1 and 65535" << std::endl;
+
+        if (arg == "--reuseport") {
+            serverConfig.reusePort = true;
+            continue;
+        }
+        if (arg == "--pin-cpus") {
+            serverConfig.pinThreads = true;
+            continue;
+        }
+        if (arg == "--lazy-load") {
+            lazyLoad = true;
+            continue;
+        }
+        if (arg == "--ordered-index") {
+            orderedIndex = true;
+            continue;
+        }
+
+        if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a value" << std::endl;
                 return 1;
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error: Invalid port number: " << argv[1] << std::endl;
+            long value = 0;
+            if (arg == "--shards") {
+                if (!parseIntArg("shard count", argv[++i], 1, 65536, value)) return 1;
+                shardCount = static_cast<size_t>(value);
+            } else if (arg == "--io-model") {
+                std::string model = argv[++i];
+                if (model == "threads") {
+                    serverConfig.ioModel = IoModel::Threads;
+                } else if (model == "reactor") {
+                    serverConfig.ioModel = IoModel::Reactor;
+                } else {
+                    std::cerr << "Error: Unknown I/O model: " << model << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--io-threads") {
+                if (!parseIntArg("I/O thread count", argv[++i], 1, 1024, value)) return 1;
+                serverConfig.ioThreads = static_cast<int>(value);
+            } else if (arg == "--http-workers") {
+                if (!parseIntArg("HTTP worker count", argv[++i], 1, 1024, value)) return 1;
+                httpWorkers = static_cast<size_t>(value);
+            } else if (arg == "--backlog") {
+                if (!parseIntArg("backlog", argv[++i], 1, 65535, value)) return 1;
+                serverConfig.backlog = static_cast<int>(value);
+            } else if (arg == "--snapshot-format") {
+                std::string format = argv[++i];
+                if (format == "binary") {
+                    snapshotFormat = SnapshotFormat::Binary;
+                } else if (format == "csv") {
+                    snapshotFormat = SnapshotFormat::Csv;
+                } else {
+                    std::cerr << "Error: Unknown snapshot format: " << format << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--save") {
+                if (!PersistenceManager::parseSaveRules(argv[++i], saveRules)) {
+                    std::cerr << "Error: Invalid save rules: " << argv[i]
+                              << " (expected \"seconds changes [seconds changes ...]\")" << std::endl;
+                    return 1;
+                }
+                saveRulesSet = true;
+            } else if (arg == "--max-deltas") {
+                if (!parseIntArg("delta limit", argv[++i], 0, 100000, maxDeltas)) return 1;
+            } else if (arg == "--maxmemory") {
+                if (!parseMemoryArg(argv[++i], maxMemory)) return 1;
+            } else if (arg == "--maxmemory-policy") {
+                std::string policy = argv[++i];
+                if (!DataStore::parseEvictionPolicy(policy, evictionPolicy)) {
+                    std::cerr << "Error: Unknown eviction policy: " << policy << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--maxmemory-samples") {
+                if (!parseIntArg("eviction sample count", argv[++i], 1, 64, evictionSamples)) return 1;
+            } else if (arg == "--activedefrag") {
+                std::string enabled = argv[++i];
+                if (enabled != "yes" && enabled != "no") {
+                    std::cerr << "Error: --activedefrag takes yes or no" << std::endl;
+                    return 1;
+                }
+                activeDefrag = enabled == "yes";
+            } else if (arg == "--active-defrag-ignore-bytes") {
+                if (!parseMemoryArg(argv[++i], defragIgnoreBytes)) return 1;
+            } else if (arg == "--active-defrag-threshold") {
+                if (!parseIntArg("defragmentation threshold", argv[++i], 0, 1000, defragThreshold)) return 1;
+            } else if (arg == "--aof") {
+                aofFile = argv[++i];
+            } else if (arg == "--aof-fsync") {
+                std::string policy = argv[++i];
+                if (!AppendOnlyLog::parsePolicy(policy, fsyncPolicy)) {
+                    std::cerr << "Error: Unknown fsync policy: " << policy << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Unknown option: " << arg << std::endl;
+                return 1;
+            }
+            continue;
+        }
+
+        if (positional == 0) {
+            long value = 0;
+            if (!parseIntArg("port", argv[i], 1, 65535, value)) return 1;
+            port = static_cast<int>(value);
+        } else if (positional == 1) {
+            dumpFile = arg;
+        } else {
+            std::cerr << "Error: Unexpected argument: " << arg << std::endl;
             return 1;
         }
-    }
-    
-    if (argc > 2) {
-        dumpFile = argv[2];
+        ++positional;
     }
 
     // Set up signal handlers for graceful shutdown
@@ -94,23 +325,48 @@ int main(int argc, char* argv[]) {
 
     try {
         // Create data store
-        g_dataStore = std::make_unique<DataStore>();
-        std::cout << "Data store initialized" << std::endl;
+        g_dataStore = std::make_unique<DataStore>(shardCount);
+        std::cout << "Data store initialized (" << g_dataStore->shardCount() << " shards)" << std::endl;
+        g_dataStore->setMemoryLimit(maxMemory, evictionPolicy, static_cast<size_t>(evictionSamples));
+        if (maxMemory > 0) {
+            std::cout << "Memory limit " << maxMemory << " bytes, eviction policy "
+                      << DataStore::evictionPolicyName(evictionPolicy) << std::endl;
+        }
+        g_dataStore->setActiveDefrag(activeDefrag, defragIgnoreBytes, static_cast<size_t>(defragThreshold));
+        g_dataStore->setOrderedIndex(orderedIndex);
 
         // Create persistence manager
         g_persistenceManager = std::make_unique<PersistenceManager>(*g_dataStore, dumpFile);
-        
+        g_persistenceManager->setSnapshotFormat(snapshotFormat);
+        g_persistenceManager->setLazyLoad(lazyLoad);
+        g_persistenceManager->setMaxDeltas(static_cast<size_t>(maxDeltas));
+        if (saveRulesSet) {
+            g_persistenceManager->setSaveRules(saveRules);
+        }
+        if (!aofFile.empty()) {
+            g_persistenceManager->enableAppendOnly(aofFile, fsyncPolicy);
+        }
+
         // Initialize persistence (load existing data)
         if (!g_persistenceManager->initialize()) {
-            std::cerr << "Warning: Failed to initialize persistence. Starting with empty database." << std::endl;
+            // Without the log, acknowledged writes would not survive a crash
+            if (!aofFile.empty()) {
+                std::cerr << "Error: Failed to load " << dumpFile << " and the append-only log " << aofFile
+                          << "; not starting" << std::endl;
+                return 1;
+            }
+            std::cerr << "Warning: Failed to load " << dumpFile << "; starting with only the data that could be read"
+                      << std::endl;
         }
 
         // Start persistence thread
-        g_persistenceManager->startPersistence(60); // Save every 60 seconds
+        g_persistenceManager->startPersistence();
         std::cout << "Persistence manager started" << std::endl;
 
+        g_dataStore->startExpiryCycle();
+
         // Create and start server
-        g_server = std::make_unique<Server>(*g_dataStore, *g_persistenceManager);
+        g_server = std::make_unique<Server>(*g_dataStore, *g_persistenceManager, serverConfig);
         
         // Start embedded HTTP UI server
         std::string webRoot = "web";
@@ -118,8 +374,8 @@ int main(int argc, char* argv[]) {
             if (std::filesystem::exists("../web")) webRoot = "../web";
             else if (std::filesystem::exists("../../web")) webRoot = "../../web";
         }
-        g_httpServer = std::make_unique<HttpServer>(*g_dataStore);
-        if (!g_httpServer->start(8080, webRoot)) {
+        g_httpServer = std::make_unique<HttpServer>(*g_dataStore, g_persistenceManager->appendLog());
+        if (!g_httpServer->start(8080, webRoot, httpWorkers)) {
             std::cerr << "Warning: Failed to start HTTP UI server" << std::endl;
         }
 
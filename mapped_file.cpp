@@ -0,0 +1,75 @@
+#include "mapped_file.h"
+#include <iostream>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : data_(nullptr), size_(0)
+#ifdef _WIN32
+      , fileHandle_(INVALID_HANDLE_VALUE), mappingHandle_(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mappingHandle_) CloseHandle(mappingHandle_);
+    if (fileHandle_ != INVALID_HANDLE_VALUE) CloseHandle(fileHandle_);
+#else
+    if (data_ && size_ > 0) munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& filename) {
+    std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+    file->fileHandle_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                    nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file->fileHandle_ == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->fileHandle_, &size) || size.QuadPart == 0) {
+        return nullptr;
+    }
+    file->size_ = static_cast<size_t>(size.QuadPart);
+    file->mappingHandle_ = CreateFileMappingA(file->fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file->mappingHandle_) {
+        std::cerr << "Failed to map " << filename << std::endl;
+        return nullptr;
+    }
+    file->data_ = static_cast<const char*>(MapViewOfFile(file->mappingHandle_, FILE_MAP_READ, 0, 0, 0));
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    file->size_ = static_cast<size_t>(status.st_size);
+    void* address = mmap(nullptr, file->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        std::cerr << "Failed to map " << filename << std::endl;
+        file->size_ = 0;
+        return nullptr;
+    }
+    file->data_ = static_cast<const char*>(address);
+#endif
+    if (!file->data_) {
+        return nullptr;
+    }
+    return file;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * A whole file mapped read-only into memory
+ * The mapping stays valid even if the file is replaced by rename() or
+ * unlinked, so values can keep pointing into an old snapshot
+ */
+class MappedFile {
+private:
+    const char* data_;
+    size_t size_;
+#ifdef _WIN32
+    void* fileHandle_;
+    void* mappingHandle_;
+#endif
+
+    MappedFile();
+
+public:
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Map a file
+     * @param filename Path of the file
+     * @return The mapping, or nullptr if the file could not be opened or mapped
+     */
+    static std::shared_ptr<MappedFile> open(const std::string& filename);
+
+    const char* data() const { return data_; }
+
+    size_t size() const { return size_; }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+/**
+ * Process-wide counters reported by the INFO command
+ */
+namespace metrics {
+
+/** Value bytes copied in user space, both into the store and out of it */
+inline std::atomic<uint64_t> valueBytesCopied{0};
+
+/** Commands executed by the TCP server */
+inline std::atomic<uint64_t> commandsProcessed{0};
+
+/** Send system calls made for replies */
+inline std::atomic<uint64_t> socketWrites{0};
+
+/** Currently connected TCP clients */
+inline std::atomic<int64_t> connectedClients{0};
+
+/** Snapshots written to disk */
+inline std::atomic<uint64_t> snapshotsTaken{0};
+
+/** Wall time of the last snapshot save, capture to file closed */
+inline std::atomic<uint64_t> snapshotLastMicros{0};
+
+/** Size of the last snapshot file */
+inline std::atomic<uint64_t> snapshotLastBytes{0};
+
+/** Time the last snapshot save spent in fsync (file and directory) */
+inline std::atomic<uint64_t> snapshotLastFsyncMicros{0};
+
+/** Checkpoints written as deltas rather than full snapshots */
+inline std::atomic<uint64_t> snapshotDeltasWritten{0};
+
+/** Full snapshots written to fold accumulated deltas back in */
+inline std::atomic<uint64_t> snapshotCompactions{0};
+
+/** Time writers were blocked while the last snapshot was captured */
+inline std::atomic<uint64_t> snapshotLastPauseMicros{0};
+
+/** Estimated bytes copied for writes during the last snapshot save */
+inline std::atomic<uint64_t> snapshotLastExtraBytes{0};
+
+/** Shard maps copied because a write hit a shard shared with a snapshot */
+inline std::atomic<uint64_t> snapshotShardCopies{0};
+
+/** Estimated bytes of all such copies (keys and nodes; values stay shared) */
+inline std::atomic<uint64_t> snapshotBytesCopied{0};
+
+/** Keys removed because their expiry time had passed */
+inline std::atomic<uint64_t> expiredKeys{0};
+
+/** Keys removed to stay within the memory limit */
+inline std::atomic<uint64_t> evictedKeys{0};
+
+/** Keys and values active defragmentation moved to another slab */
+inline std::atomic<uint64_t> activeDefragHits{0};
+
+/** Keys and values active defragmentation looked at but left in place */
+inline std::atomic<uint64_t> activeDefragMisses{0};
+
+/** When the process started, the origin of the startup_* timings */
+inline const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+/** Time spent loading the snapshot and replaying the append-only log */
+inline std::atomic<uint64_t> startupLoadMicros{0};
+
+/** Time from process start until the server was accepting connections */
+inline std::atomic<uint64_t> startupReadyMicros{0};
+
+/** Time from process start until the first command was executed */
+inline std::atomic<uint64_t> startupFirstCommandMicros{0};
+
+/** Time from process start until a lazily loaded snapshot was fully in memory */
+inline std::atomic<uint64_t> startupMaterializedMicros{0};
+
+/**
+ * Microseconds elapsed since processStart
+ */
+inline uint64_t sinceStartMicros() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - processStart).count());
+}
+
+/**
+ * Resident set size of the process in bytes, 0 where it is not known
+ */
+inline uint64_t residentBytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages = 0;
+    uint64_t resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+} // namespace metrics
@@ -0,0 +1,33 @@
+#pragma once
+
+/**
+ * Platform socket definitions shared by the TCP server and its helpers
+ */
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib")
+    using socket_t = SOCKET;
+    const socket_t INVALID_SOCKET_VALUE = INVALID_SOCKET;
+#else
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+    using socket_t = int;
+    const socket_t INVALID_SOCKET_VALUE = -1;
+#endif
+
+/**
+ * Disable Nagle's algorithm on a client socket
+ * Replies are already batched per read, so holding small writes back
+ * waiting for an ACK only adds latency to pipelined clients
+ * @param socket The connected socket
+ */
+inline void setNoDelay(socket_t socket) {
+    int flag = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag));
+}
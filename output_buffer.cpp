@@ -0,0 +1,110 @@
+#include "output_buffer.h"
+#include "metrics.h"
+#include <cerrno>
+#include <charconv>
+
+void OutputBuffer::append(std::string_view bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    // Coalesce with a trailing owned segment to keep the iovec count low
+    if (segments_.empty() || segments_.back().value) {
+        segments_.emplace_back();
+    }
+    segments_.back().bytes.append(bytes.data(), bytes.size());
+    size_ += bytes.size();
+}
+
+void OutputBuffer::appendNumber(char prefix, long long number, std::string_view eol) {
+    char line[24];
+    line[0] = prefix;
+    char* end = std::to_chars(line + 1, line + sizeof(line), number).ptr;
+    append(std::string_view(line, static_cast<size_t>(end - line)));
+    append(eol);
+}
+
+void OutputBuffer::appendValue(const Value& value) {
+    if (value.size() <= INLINE_VALUE_LIMIT) {
+        metrics::valueBytesCopied.fetch_add(value.size(), std::memory_order_relaxed);
+        append(value.view());
+        return;
+    }
+    Segment segment;
+    segment.value = value;
+    segments_.push_back(std::move(segment));
+    size_ += value.size();
+}
+
+void OutputBuffer::consume(size_t count) {
+    size_ -= count;
+    while (count > 0 && !segments_.empty()) {
+        size_t remaining = segments_.front().view().size() - headOffset_;
+        if (count < remaining) {
+            headOffset_ += count;
+            return;
+        }
+        count -= remaining;
+        headOffset_ = 0;
+        segments_.pop_front();
+    }
+}
+
+long OutputBuffer::writeTo(socket_t socket) {
+    if (segments_.empty()) {
+        return 0;
+    }
+
+#ifdef _WIN32
+    WSABUF buffers[MAX_IOVECS];
+    DWORD count = 0;
+    for (const auto& segment : segments_) {
+        if (count == MAX_IOVECS) break;
+        std::string_view view = segment.view();
+        if (count == 0) view.remove_prefix(headOffset_);
+        buffers[count].buf = const_cast<char*>(view.data());
+        buffers[count].len = static_cast<ULONG>(view.size());
+        ++count;
+    }
+    DWORD sent = 0;
+    if (WSASend(socket, buffers, count, &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+        return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+    }
+#else
+    struct iovec buffers[MAX_IOVECS];
+    int count = 0;
+    for (const auto& segment : segments_) {
+        if (count == MAX_IOVECS) break;
+        std::string_view view = segment.view();
+        if (count == 0) view.remove_prefix(headOffset_);
+        buffers[count].iov_base = const_cast<char*>(view.data());
+        buffers[count].iov_len = view.size();
+        ++count;
+    }
+    struct msghdr message {};
+    message.msg_iov = buffers;
+    message.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+    ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+#else
+    ssize_t sent = sendmsg(socket, &message, 0);
+#endif
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINTR) return 0;
+        return -1;
+    }
+#endif
+
+    metrics::socketWrites.fetch_add(1, std::memory_order_relaxed);
+    consume(static_cast<size_t>(sent));
+    return static_cast<long>(sent);
+}
+
+bool OutputBuffer::flush(socket_t socket) {
+    while (!empty()) {
+        if (writeTo(socket) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
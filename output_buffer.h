@@ -0,0 +1,99 @@
+#pragma once
+
+#include "net.h"
+#include "value.h"
+#include <deque>
+#include <string>
+#include <string_view>
+
+/**
+ * Per-connection queue of response bytes waiting to be sent
+ * Small protocol framing is copied into owned segments, while large values
+ * are queued by reference and handed to the kernel directly with one
+ * scatter-gather send, so a GET never copies the value in user space
+ */
+class OutputBuffer {
+private:
+    struct Segment {
+        std::string bytes;   // Owned bytes, used when value is empty
+        Value value;         // Referenced value bytes
+        std::string_view view() const {
+            return value ? value.view() : std::string_view(bytes);
+        }
+    };
+
+    std::deque<Segment> segments_;
+    size_t headOffset_ = 0;  // Bytes of the front segment already sent
+    size_t size_ = 0;        // Total unsent bytes
+
+    /**
+     * Drop bytes that have been handed to the kernel
+     * @param count Number of bytes sent
+     */
+    void consume(size_t count);
+
+public:
+    /**
+     * Values up to this size are copied next to their framing instead of
+     * being referenced, which keeps pipelined small replies in one iovec
+     */
+    static constexpr size_t INLINE_VALUE_LIMIT = 128;
+
+    /**
+     * Maximum number of segments handed to one sendmsg/WSASend call
+     */
+    static constexpr int MAX_IOVECS = 64;
+
+    /**
+     * Pending output at which a connection stops processing (and, in
+     * reactor mode, reading) further commands until the client catches up
+     */
+    static constexpr size_t HIGH_WATERMARK = 1024 * 1024;
+
+    /**
+     * Pending output below which a paused connection resumes reading
+     */
+    static constexpr size_t LOW_WATERMARK = 256 * 1024;
+
+    /**
+     * Queue a copy of some bytes
+     * @param bytes The bytes to send
+     */
+    void append(std::string_view bytes);
+
+    /**
+     * Queue a protocol number line such as "$5\r\n" or ":1\n" without
+     * building a temporary string
+     * @param prefix Type marker written before the digits
+     * @param number The number
+     * @param eol Line terminator
+     */
+    void appendNumber(char prefix, long long number, std::string_view eol);
+
+    /**
+     * Queue a value, by reference unless it is small
+     * @param value The value to send
+     */
+    void appendValue(const Value& value);
+
+    /**
+     * Get the number of bytes still waiting to be sent
+     */
+    size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    /**
+     * Send as much pending data as one scatter-gather call accepts
+     * @param socket The destination socket
+     * @return Bytes sent, 0 if the socket would block, -1 on error
+     */
+    long writeTo(socket_t socket);
+
+    /**
+     * Send all pending data, blocking until it has been written
+     * @param socket The destination socket
+     * @return true if successful, false otherwise
+     */
+    bool flush(socket_t socket);
+};
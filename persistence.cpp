@@ -1,62 +1,289 @@
 #include "persistence.h"
+#include "binary_snapshot.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <sstream>
 
+namespace {
+
+/**
+ * First line of a CSV snapshot: the checkpoint sequence it was taken at,
+ * so the append-only log is replayed from that checkpoint
+ */
+const char* const CSV_CHECKPOINT_PREFIX = "#checkpoint ";
+
+/**
+ * Append text with commas escaped as \c and newlines as \n
+ */
+void appendEscaped(std::string& out, std::string_view text) {
+    for (char c : text) {
+        if (c == ',') {
+            out += "\\c";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+}
+
+/**
+ * Append bytes as lower-case hex digits
+ */
+void appendHex(std::string& out, std::string_view bytes) {
+    static const char DIGITS[] = "0123456789abcdef";
+    for (char c : bytes) {
+        out += DIGITS[static_cast<unsigned char>(c) >> 4];
+        out += DIGITS[static_cast<unsigned char>(c) & 15];
+    }
+}
+
+/**
+ * Decode appendHex() output
+ * @return false if text is not an even number of hex digits
+ */
+bool decodeHex(std::string_view text, std::string& bytes) {
+    if (text.size() % 2 != 0) {
+        return false;
+    }
+    auto digit = [](char c) {
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    };
+    bytes.clear();
+    bytes.reserve(text.size() / 2);
+    for (size_t i = 0; i < text.size(); i += 2) {
+        int high = digit(text[i]);
+        int low = digit(text[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes += static_cast<char>(high * 16 + low);
+    }
+    return true;
+}
+
+} // namespace
+
 PersistenceManager::PersistenceManager(DataStore& dataStore, const std::string& filename)
-    : dataStore_(dataStore), filename_(filename), shouldStop_(false) {
+    : dataStore_(dataStore), filename_(filename), shouldStop_(false),
+      format_(SnapshotFormat::Binary), loadThreads_(0), lazyLoad_(false),
+      saveRules_{{60, 1}, {10, 10000}}, maxDeltas_(16), incremental_(false), needFullSave_(false),
+      sequence_(0), baseBytes_(0), deltaBytes_(0), deltaCount_(0), changesAtLastSave_(0),
+      lastSave_(std::chrono::steady_clock::now()) {
 }
 
 PersistenceManager::~PersistenceManager() {
     stopPersistence();
 }
 
+void PersistenceManager::setSnapshotFormat(SnapshotFormat format) {
+    format_ = format;
+}
+
+void PersistenceManager::setLoadThreads(size_t threads) {
+    loadThreads_ = threads;
+}
+
+void PersistenceManager::enableAppendOnly(const std::string& filename, FsyncPolicy policy) {
+    appendLog_ = std::make_unique<AppendOnlyLog>(filename, policy);
+}
+
+void PersistenceManager::setLazyLoad(bool lazy) {
+    lazyLoad_ = lazy;
+}
+
+void PersistenceManager::setSaveRules(const std::vector<SaveRule>& rules) {
+    std::lock_guard<std::mutex> lock(stopMutex_);
+    saveRules_ = rules;
+}
+
+void PersistenceManager::setMaxDeltas(size_t maxDeltas) {
+    maxDeltas_ = maxDeltas;
+}
+
+bool PersistenceManager::parseSaveRules(const std::string& text, std::vector<SaveRule>& rules) {
+    rules.clear();
+    std::istringstream input(text);
+    long long seconds = 0;
+    long long changes = 0;
+    while (input >> seconds) {
+        if (!(input >> changes) || seconds < 1 || seconds > 1000000000 || changes < 0) {
+            return false;
+        }
+        rules.push_back({static_cast<int>(seconds), static_cast<uint64_t>(changes)});
+    }
+    return input.eof();
+}
+
+uint64_t PersistenceManager::changesSinceSave() const {
+    return dataStore_.changeCount() - changesAtLastSave_.load(std::memory_order_relaxed);
+}
+
+size_t PersistenceManager::deltaCount() const {
+    return deltaCount_.load(std::memory_order_relaxed);
+}
+
+AppendOnlyLog* PersistenceManager::appendLog() const {
+    return appendLog_.get();
+}
+
 bool PersistenceManager::initialize() {
     std::cout << "Initializing persistence manager..." << std::endl;
-    return loadFromDisk();
+    auto start = std::chrono::steady_clock::now();
+    if (!loadFromDisk()) {
+        return false;
+    }
+    // Track changes from here on, so whatever the log replays goes into
+    // the next checkpoint along with new writes
+    incremental_ = format_ == SnapshotFormat::Binary && maxDeltas_ > 0;
+    dataStore_.trackChanges(incremental_);
+    changesAtLastSave_ = dataStore_.changeCount();
+    if (appendLog_) {
+        // Only what the log holds past the snapshot's checkpoint is new.
+        // Without one (no snapshot, or a CSV file from before checkpoints)
+        // the whole log is replayed
+        size_t applied = 0;
+        if (!appendLog_->replay(dataStore_, sequence_, applied) || !appendLog_->open()) {
+            return false;
+        }
+        dataStore_.setAppendLog(appendLog_.get());
+    }
+    metrics::startupLoadMicros.store(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+
+    if (dataStore_.pendingShards() > 0 && !materializeThread_.joinable()) {
+        shouldStop_ = false;
+        materializeThread_ = std::thread(&PersistenceManager::materializeLoop, this);
+    }
+    return true;
+}
+
+void PersistenceManager::materializeLoop() {
+    // Requests load the shards they touch first; this only fills in the rest
+    for (size_t i = 0; i < dataStore_.shardCount() && !shouldStop_; ++i) {
+        dataStore_.materializeShard(i);
+    }
+    if (dataStore_.pendingShards() == 0) {
+        metrics::startupMaterializedMicros.store(metrics::sinceStartMicros(), std::memory_order_relaxed);
+        std::cout << "Snapshot fully loaded " << metrics::sinceStartMicros() / 1000 << " ms after start"
+                  << std::endl;
+    }
 }
 
 bool PersistenceManager::saveToDisk() {
     try {
-        std::ofstream file(filename_);
-        if (!file.is_open()) {
-            std::cerr << "Failed to open file for writing: " << filename_ << std::endl;
-            return false;
+        std::lock_guard<std::mutex> saveLock(saveMutex_);
+        // Writers only pause while the snapshot takes a reference to each
+        // shard; any shard they modify before it is written out gets copied
+        auto start = std::chrono::steady_clock::now();
+        uint64_t copiedBefore = metrics::snapshotBytesCopied.load(std::memory_order_relaxed);
+        uint64_t changes = dataStore_.changeCount();
+
+        // A full snapshot gets a sequence above every delta on disk, so a
+        // crash before the old deltas are removed can't apply them to it.
+        // The sequence is fixed before the snapshot is taken, which marks
+        // it in the append-only log; stray deltas force a full save
+        uint64_t sequence = sequence_ + 1;
+        for (const auto& existing : listDeltas()) {
+            sequence = std::max(sequence, existing.first + 1);
         }
 
-        auto data = dataStore_.getAllData();
-        for (const auto& pair : data) {
-            // Escape commas and newlines in the data
-            std::string escapedKey = pair.first;
-            std::string escapedValue = pair.second;
-            
-            // Simple escaping: replace commas with \c and newlines with \n
-            size_t pos = 0;
-            while ((pos = escapedKey.find(",", pos)) != std::string::npos) {
-                escapedKey.replace(pos, 1, "\\c");
-                pos += 2;
+        std::vector<DirtyKeys> changed;
+        bool complete = false;
+        StoreSnapshot snapshot = incremental_ ? dataStore_.checkpoint(changed, complete, sequence)
+                                              : dataStore_.snapshot(sequence);
+        size_t changedKeys = 0;
+        for (const DirtyKeys& keys : changed) {
+            changedKeys += keys.size();
+        }
+
+        // Compact into a full snapshot once a delta would not save much
+        bool delta = incremental_ && complete && !needFullSave_ && baseBytes_ > 0 &&
+                     deltaCount_ < maxDeltas_ && deltaBytes_ <= baseBytes_ / 2 &&
+                     changedKeys <= snapshot.size() / 4 && sequence == sequence_ + 1;
+        if (delta && changedKeys == 0) {
+            lastSave_ = std::chrono::steady_clock::now();
+            changesAtLastSave_ = changes;
+            return true;
+        }
+
+        // The live file is only ever replaced by a complete, fsynced one:
+        // a crash mid-save leaves the previous snapshot loadable, and a
+        // lazily loaded store may still have the old file mapped
+        AtomicFileWriter file(delta ? deltaFilename(sequence) : filename_);
+        size_t entries = 0;
+        bool saved = file.open();
+        if (saved) {
+            if (delta) {
+                BinarySnapshot::saveDelta(file, snapshot, changed, sequence, entries);
+            } else if (format_ == SnapshotFormat::Binary) {
+                BinarySnapshot::save(file, snapshot, sequence, entries);
+            } else {
+                saveCsv(file, snapshot, sequence, entries);
             }
-            pos = 0;
-            while ((pos = escapedKey.find("\n", pos)) != std::string::npos) {
-                escapedKey.replace(pos, 1, "\\n");
-                pos += 2;
+        }
+        // The snapshot names the CHECKPOINT record it left in the log, and
+        // a restart replays the log from there; commit it only once that
+        // record is sure to survive a crash
+        if (saved && appendLog_ && !appendLog_->syncThreadRecords()) {
+            std::cerr << "Failed to sync the checkpoint into the append-only log" << std::endl;
+            file.discard();
+            saved = false;
+        }
+        uint64_t bytes = file.size();
+        if (!saved || !file.commit()) {
+            // The changed keys taken by the checkpoint are gone; only a
+            // full snapshot is sure to include them now
+            needFullSave_ = incremental_;
+            lastFailedSave_ = std::chrono::steady_clock::now();
+            return false;
+        }
+
+        sequence_ = sequence;
+        if (delta) {
+            ++deltaCount_;
+            deltaBytes_ += bytes;
+            metrics::snapshotDeltasWritten.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            // Every delta is part of the new snapshot now
+            for (const auto& existing : listDeltas()) {
+                std::remove(existing.second.c_str());
             }
-            
-            pos = 0;
-            while ((pos = escapedValue.find(",", pos)) != std::string::npos) {
-                escapedValue.replace(pos, 1, "\\c");
-                pos += 2;
+            if (deltaCount_ > 0) {
+                metrics::snapshotCompactions.fetch_add(1, std::memory_order_relaxed);
             }
-            pos = 0;
-            while ((pos = escapedValue.find("\n", pos)) != std::string::npos) {
-                escapedValue.replace(pos, 1, "\\n");
-                pos += 2;
+            deltaCount_ = 0;
+            deltaBytes_ = 0;
+            baseBytes_ = format_ == SnapshotFormat::Binary ? bytes : 0;
+            needFullSave_ = false;
+
+            // Nothing before the checkpoint is needed once the snapshot is,
+            // so the log only ever holds what came after the last one
+            if (appendLog_ && !appendLog_->compact(sequence)) {
+                std::cerr << "Append-only log " << appendLog_->filename() << " was not rewritten; it keeps"
+                          << " the records before checkpoint " << sequence << std::endl;
             }
-            
-            file << escapedKey << "," << escapedValue << "\n";
         }
+        lastSave_ = std::chrono::steady_clock::now();
+        changesAtLastSave_ = changes;
 
-        file.close();
-        std::cout << "Data saved to " << filename_ << " (" << data.size() << " entries)" << std::endl;
+        uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            lastSave_ - start).count());
+        metrics::snapshotsTaken.fetch_add(1, std::memory_order_relaxed);
+        metrics::snapshotLastMicros.store(micros, std::memory_order_relaxed);
+        metrics::snapshotLastBytes.store(bytes, std::memory_order_relaxed);
+        metrics::snapshotLastFsyncMicros.store(file.syncMicros(), std::memory_order_relaxed);
+        metrics::snapshotLastExtraBytes.store(
+            metrics::snapshotBytesCopied.load(std::memory_order_relaxed) - copiedBefore, std::memory_order_relaxed);
+        std::cout << (delta ? "Delta " + std::to_string(sequence) + " saved to " + deltaFilename(sequence)
+                            : "Data saved to " + filename_)
+                  << " (" << entries << " entries, " << bytes / (1024 * 1024) << " MB at "
+                  << (micros ? bytes / micros : 0) << " MB/s)" << std::endl;
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Error saving to disk: " << e.what() << std::endl;
@@ -64,7 +291,154 @@ bool PersistenceManager::saveToDisk() {
     }
 }
 
+bool PersistenceManager::saveDue() {
+    std::lock_guard<std::mutex> saveLock(saveMutex_);
+    uint64_t changes = changesSinceSave();
+    if (changes == 0) {
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    // Like Redis, back off for a few seconds after a failed save instead
+    // of retrying every second
+    if (lastFailedSave_ > lastSave_ && now - lastFailedSave_ < std::chrono::seconds(5)) {
+        return false;
+    }
+    auto elapsed = now - lastSave_;
+    for (const SaveRule& rule : saveRules_) {
+        if (elapsed >= std::chrono::seconds(rule.seconds) && changes >= rule.changes) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string PersistenceManager::deltaFilename(uint64_t sequence) const {
+    return filename_ + ".delta." + std::to_string(sequence);
+}
+
+std::vector<std::pair<uint64_t, std::string>> PersistenceManager::listDeltas() const {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<uint64_t, std::string>> deltas;
+    fs::path base(filename_);
+    fs::path directory = base.parent_path().empty() ? fs::path(".") : base.parent_path();
+    std::string prefix = base.filename().string() + ".delta.";
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.find_first_not_of("0123456789", prefix.size()) != std::string::npos) {
+            continue;
+        }
+        deltas.emplace_back(std::stoull(name.substr(prefix.size())), entry.path().string());
+    }
+    std::sort(deltas.begin(), deltas.end());
+    return deltas;
+}
+
+void PersistenceManager::loadDeltas() {
+    uint64_t sequence = 0;
+    if (!BinarySnapshot::readSequence(filename_, sequence)) {
+        return;  // Older formats have no checkpoints; the next save starts them
+    }
+    std::error_code error;
+    sequence_ = sequence;
+    baseBytes_ = std::filesystem::file_size(filename_, error);
+    for (const auto& delta : listDeltas()) {
+        if (delta.first <= sequence_) {
+            std::remove(delta.second.c_str());  // Already part of the snapshot
+            continue;
+        }
+        uint64_t deltaSequence = 0;
+        size_t entries = 0;
+        if (delta.first != sequence_ + 1 ||
+            !BinarySnapshot::applyDelta(delta.second, dataStore_, deltaSequence, entries) ||
+            deltaSequence != delta.first) {
+            std::cerr << "Delta " << delta.second << " can't be applied after checkpoint " << sequence_
+                      << "; later changes are missing" << std::endl;
+            needFullSave_ = true;
+            break;
+        }
+        sequence_ = deltaSequence;
+        ++deltaCount_;
+        deltaBytes_ += std::filesystem::file_size(delta.second, error);
+        std::cout << "Applied " << entries << " changes from " << delta.second << std::endl;
+    }
+}
+
+void PersistenceManager::saveCsv(AtomicFileWriter& file, StoreSnapshot& snapshot, uint64_t sequence,
+                                 size_t& entries) {
+    // Lines are escaped into one reusable buffer and handed to the writer
+    // in large chunks rather than streamed field by field
+    std::string chunk;
+    chunk.reserve(AtomicFileWriter::BUFFER_SIZE / 4);
+    // Every entry line has a comma, so this one can't be mistaken for a key
+    chunk += CSV_CHECKPOINT_PREFIX;
+    chunk += std::to_string(sequence);
+    chunk += '\n';
+    std::string encoded;
+    entries = 0;
+    int64_t now = DataStore::unixTimeMillis();
+    for (size_t shard = 0; shard < snapshot.shardCount(); ++shard) {
+        for (const auto& pair : *snapshot.shard(shard)) {
+            if (pair.second.expired(now)) {
+                continue;
+            }
+            appendEscaped(chunk, pair.first);
+            chunk += ',';
+            const Collection* collection = pair.second.value.collection();
+            if (collection) {
+                // Hashes, lists and sorted sets are written serialized, in
+                // hex, with their type in a fourth field
+                encoded.clear();
+                collection->encode(encoded);
+                appendHex(chunk, encoded);
+            } else {
+                appendEscaped(chunk, pair.second.value.view());
+            }
+            if (pair.second.expiresAt != 0 || collection) {
+                // Commas in values are escaped, so a third field is unambiguous
+                chunk += ',';
+                chunk += std::to_string(pair.second.expiresAt);
+            }
+            if (collection) {
+                chunk += ',';
+                chunk += Collection::typeName(collection->type());
+            }
+            chunk += '\n';
+            ++entries;
+            if (chunk.size() >= AtomicFileWriter::BUFFER_SIZE / 4) {
+                file.write(chunk);
+                chunk.clear();
+            }
+        }
+        snapshot.release(shard);
+    }
+    file.write(chunk);
+}
+
 bool PersistenceManager::loadFromDisk() {
+    if (!BinarySnapshot::isBinary(filename_)) {
+        return loadCsv();
+    }
+    try {
+        size_t entries = 0;
+        if (lazyLoad_ && BinarySnapshot::openLazy(filename_, dataStore_, entries)) {
+            std::cout << "Serving " << entries << " entries from " << filename_ << " while it loads"
+                      << std::endl;
+        } else if (BinarySnapshot::load(filename_, dataStore_, loadThreads_, entries)) {
+            std::cout << "Loaded " << entries << " entries from " << filename_ << std::endl;
+        } else {
+            return false;
+        }
+        loadDeltas();
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading from disk: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool PersistenceManager::loadCsv() {
     try {
         std::ifstream file(filename_);
         if (!file.is_open()) {
@@ -72,14 +446,19 @@ bool PersistenceManager::loadFromDisk() {
             return true; // Not an error if file doesn't exist
         }
 
-        std::unordered_map<std::string, std::string> loadedData;
+        KeyValueMap loadedData;
         std::string line;
         int loadedCount = 0;
+        int64_t now = DataStore::unixTimeMillis();
 
         while (std::getline(file, line)) {
             if (line.empty()) continue;
 
             size_t commaPos = line.find(',');
+            if (commaPos == std::string::npos && line.rfind(CSV_CHECKPOINT_PREFIX, 0) == 0) {
+                sequence_ = std::strtoull(line.c_str() + std::strlen(CSV_CHECKPOINT_PREFIX), nullptr, 10);
+                continue;
+            }
             if (commaPos == std::string::npos) {
                 std::cerr << "Invalid line format: " << line << std::endl;
                 continue;
@@ -87,6 +466,19 @@ bool PersistenceManager::loadFromDisk() {
 
             std::string key = line.substr(0, commaPos);
             std::string value = line.substr(commaPos + 1);
+            // An optional third field holds the expiry time, and a fourth
+            // the type of a hex-encoded collection
+            int64_t expiresAt = 0;
+            bool typed = false;
+            size_t expiryPos = value.find(',');
+            if (expiryPos != std::string::npos) {
+                expiresAt = std::strtoll(value.c_str() + expiryPos + 1, nullptr, 10);
+                typed = value.find(',', expiryPos + 1) != std::string::npos;
+                value.resize(expiryPos);
+                if (expiresAt != 0 && expiresAt <= now) {
+                    continue;
+                }
+            }
 
             // Unescape the data
             size_t pos = 0;
@@ -99,7 +491,19 @@ bool PersistenceManager::loadFromDisk() {
                 key.replace(pos, 2, "\n");
                 pos += 1;
             }
-            
+
+            if (typed) {
+                std::string encoded;
+                std::unique_ptr<Collection> collection;
+                if (!decodeHex(value, encoded) || !(collection = Collection::decode(encoded))) {
+                    std::cerr << "Invalid collection for key: " << key << std::endl;
+                    continue;
+                }
+                loadedData.insert_or_assign(key, StoredValue{Value::collection(std::move(collection)), expiresAt});
+                loadedCount++;
+                continue;
+            }
+
             pos = 0;
             while ((pos = value.find("\\c", pos)) != std::string::npos) {
                 value.replace(pos, 2, ",");
@@ -111,12 +515,12 @@ bool PersistenceManager::loadFromDisk() {
                 pos += 1;
             }
 
-            loadedData[key] = value;
+            loadedData.insert_or_assign(key, StoredValue{Value::copyOf(value), expiresAt});
             loadedCount++;
         }
 
         file.close();
-        dataStore_.loadData(loadedData);
+        dataStore_.loadData(std::move(loadedData));
         std::cout << "Loaded " << loadedCount << " entries from " << filename_ << std::endl;
         return true;
     } catch (const std::exception& e) {
@@ -126,39 +530,52 @@ bool PersistenceManager::loadFromDisk() {
 }
 
 void PersistenceManager::persistenceLoop() {
+    std::unique_lock<std::mutex> lock(stopMutex_);
     while (!shouldStop_) {
-        std::this_thread::sleep_for(std::chrono::seconds(60));
-        if (!shouldStop_) {
+        // Check the rules once a second; stopPersistence() wakes us at once
+        stopCondition_.wait_for(lock, std::chrono::seconds(1), [this]() { return shouldStop_.load(); });
+        if (!shouldStop_ && saveDue()) {
+            lock.unlock();
             saveToDisk();
+            lock.lock();
         }
     }
 }
 
-void PersistenceManager::startPersistence(int intervalSeconds) {
+void PersistenceManager::startPersistence() {
     if (persistenceThread_.joinable()) {
         std::cerr << "Persistence thread already running" << std::endl;
         return;
     }
 
     shouldStop_ = false;
-    persistenceThread_ = std::thread([this, intervalSeconds]() {
-        while (!shouldStop_) {
-            std::this_thread::sleep_for(std::chrono::seconds(intervalSeconds));
-            if (!shouldStop_) {
-                saveToDisk();
-            }
-        }
-    });
-    
-    std::cout << "Persistence thread started (interval: " << intervalSeconds << "s)" << std::endl;
+    persistenceThread_ = std::thread(&PersistenceManager::persistenceLoop, this);
+
+    std::ostringstream rules;
+    for (const SaveRule& rule : saveRules_) {
+        rules << (rules.tellp() > 0 ? " " : "") << rule.seconds << " " << rule.changes;
+    }
+    std::cout << "Persistence thread started (save rules: "
+              << (saveRules_.empty() ? std::string("none") : rules.str()) << ")" << std::endl;
 }
 
 void PersistenceManager::stopPersistence() {
-    if (persistenceThread_.joinable()) {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex_);
         shouldStop_ = true;
+    }
+    stopCondition_.notify_all();
+    if (persistenceThread_.joinable()) {
         persistenceThread_.join();
         std::cout << "Persistence thread stopped" << std::endl;
     }
+    if (materializeThread_.joinable()) {
+        materializeThread_.join();
+    }
+    if (appendLog_) {
+        dataStore_.setAppendLog(nullptr);
+        appendLog_->close();
+    }
 }
 
 bool PersistenceManager::forceSave() {
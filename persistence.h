@@ -1,40 +1,136 @@
 #pragma once
 
 #include "datastore.h"
+#include "append_only_log.h"
+#include "atomic_file.h"
+#include <memory>
 #include <string>
 #include <fstream>
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * On-disk encoding of snapshots
+ */
+enum class SnapshotFormat {
+    Binary,  // Checksummed blocks with an index, see BinarySnapshot
+    Csv      // The original escaped "key,value" lines
+};
+
+/**
+ * Save automatically once at least `changes` mutations happened and
+ * `seconds` have passed since the last save, like Redis' save directive
+ */
+struct SaveRule {
+    int seconds;
+    uint64_t changes;
+};
 
 /**
  * Handles persistence operations for the database
  * Manages saving data to disk and loading data on startup
+ *
+ * With the binary format, saves after the first one are checkpoints: only
+ * the keys changed since the previous checkpoint are written, to a delta
+ * file "<filename>.delta.<sequence>". Once the deltas add up to half the
+ * snapshot, or there are too many of them, the next checkpoint compacts
+ * them by writing a full snapshot in the background (copy-on-write, like
+ * every save) and removing the deltas
  */
 class PersistenceManager {
 private:
     DataStore& dataStore_;
     std::string filename_;
     std::atomic<bool> shouldStop_;
+    std::mutex stopMutex_;
+    std::condition_variable stopCondition_;
     std::thread persistenceThread_;
+    std::unique_ptr<AppendOnlyLog> appendLog_;
+    SnapshotFormat format_;
+    size_t loadThreads_;
+    bool lazyLoad_;
+    std::thread materializeThread_;
+    std::vector<SaveRule> saveRules_;
+    size_t maxDeltas_;
+
+    // Checkpoint state, guarded by saveMutex_ (one save at a time)
+    std::mutex saveMutex_;
+    bool incremental_;       // Changes are tracked, deltas may be written
+    bool needFullSave_;      // Tracked changes were lost; the next save must be full
+    uint64_t sequence_;      // Checkpoint the files on disk add up to
+    uint64_t baseBytes_;     // Size of the snapshot deltas apply to, 0 if there is none
+    uint64_t deltaBytes_;
+    std::atomic<size_t> deltaCount_;
+    std::atomic<uint64_t> changesAtLastSave_;
+    std::chrono::steady_clock::time_point lastSave_;
+    std::chrono::steady_clock::time_point lastFailedSave_;
 
     /**
-     * Save data to disk in CSV format
+     * Write a checkpoint: a delta when possible, otherwise a full snapshot
+     * in the configured format
      * @return true if successful, false otherwise
      */
     bool saveToDisk();
 
     /**
-     * Load data from disk
+     * Check the save rules against the changes since the last save
+     * @return true if a save is due
+     */
+    bool saveDue();
+
+    /**
+     * Get the path of the delta with a checkpoint sequence
+     */
+    std::string deltaFilename(uint64_t sequence) const;
+
+    /**
+     * Find the deltas of the snapshot file on disk
+     * @return (sequence, path) pairs in ascending sequence order
+     */
+    std::vector<std::pair<uint64_t, std::string>> listDeltas() const;
+
+    /**
+     * Bring the freshly loaded snapshot up to date with its deltas and
+     * remove deltas the snapshot already includes
+     */
+    void loadDeltas();
+
+    /**
+     * Write a snapshot in CSV format, releasing each shard once written
+     * @param file An open writer; the caller commits it
+     * @param snapshot The snapshot to write
+     * @param sequence Its checkpoint sequence, written on the first line
+     * @param entries Receives the number of entries written
+     */
+    void saveCsv(AtomicFileWriter& file, StoreSnapshot& snapshot, uint64_t sequence, size_t& entries);
+
+    /**
+     * Load data from disk, detecting the file's format
      * @return true if successful, false otherwise
      */
     bool loadFromDisk();
 
+    /**
+     * Load data from a CSV file, and its checkpoint sequence if it has one
+     * @return true if successful, false otherwise
+     */
+    bool loadCsv();
+
     /**
      * Background thread function for periodic saving
      */
     void persistenceLoop();
 
+    /**
+     * Background thread: load every shard still pending after a lazy load
+     */
+    void materializeLoop();
+
 public:
     /**
      * Constructor
@@ -48,20 +144,91 @@ public:
      */
     ~PersistenceManager();
 
+    /**
+     * Choose the format of snapshots written from now on; loading always
+     * detects the format of the existing file
+     * @param format The format
+     */
+    void setSnapshotFormat(SnapshotFormat format);
+
+    /**
+     * Set the number of threads loading a binary snapshot
+     * @param threads Thread count, 0 for one per hardware thread (default)
+     */
+    void setLoadThreads(size_t threads);
+
+    /**
+     * Serve a binary snapshot straight from its memory mapping instead of
+     * loading it before initialize() returns (see BinarySnapshot::openLazy())
+     * Shards are loaded on first use and by a background thread; files that
+     * can't be served lazily are loaded as usual
+     * @param lazy true to load lazily
+     */
+    void setLazyLoad(bool lazy);
+
+    /**
+     * Record every mutation in an append-only log as well as in snapshots
+     * Must be called before initialize(), which replays the log on top of
+     * the snapshot and then attaches it to the data store
+     * @param filename Path of the log file
+     * @param policy When the log is fsynced
+     */
+    void enableAppendOnly(const std::string& filename, FsyncPolicy policy);
+
+    /**
+     * Get the append-only log
+     * @return The log, or nullptr if it is not enabled
+     */
+    AppendOnlyLog* appendLog() const;
+
+    /**
+     * Set when the background thread saves (default: "60 1 10 10000")
+     * @param rules Save when any rule is met; empty to only save on demand
+     */
+    void setSaveRules(const std::vector<SaveRule>& rules);
+
+    /**
+     * Set how many deltas may pile up before a full snapshot is written
+     * Must be called before initialize()
+     * @param maxDeltas Delta limit (default: 16); 0 always writes full snapshots
+     */
+    void setMaxDeltas(size_t maxDeltas);
+
+    /**
+     * Parse save rules written as "seconds changes [seconds changes ...]"
+     * @param text The rules; an empty string is a valid empty list
+     * @param rules Receives the rules
+     * @return true if the text was valid, false otherwise
+     */
+    static bool parseSaveRules(const std::string& text, std::vector<SaveRule>& rules);
+
     /**
      * Initialize persistence - load data from disk if available
+     * Loads the snapshot and its deltas, then (binary format) starts
+     * tracking changed keys and replays the append-only log
      * @return true if successful, false otherwise
      */
     bool initialize();
 
     /**
-     * Start the background persistence thread
-     * @param intervalSeconds Interval between saves in seconds (default: 60)
+     * Start the background persistence thread, which checks the save rules
+     * once a second
+     */
+    void startPersistence();
+
+    /**
+     * Get the number of mutations since the last successful save
+     */
+    uint64_t changesSinceSave() const;
+
+    /**
+     * Get the number of deltas written since the last full snapshot
      */
-    void startPersistence(int intervalSeconds = 60);
+    size_t deltaCount() const;
 
     /**
-     * Stop the background persistence thread
+     * Stop the background persistence thread, detach the append-only log
+     * from the data store and close it
      */
     void stopPersistence();
 
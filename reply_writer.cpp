@@ -0,0 +1,39 @@
+#include "reply_writer.h"
+
+void ReplyWriter::status(std::string_view text) {
+    out_.append("+");
+    out_.append(text);
+    out_.append(eol_);
+}
+
+void ReplyWriter::error(std::string_view message) {
+    out_.append("-");
+    out_.append(message);
+    out_.append(eol_);
+}
+
+void ReplyWriter::integer(long long number) {
+    out_.appendNumber(':', number, eol_);
+}
+
+void ReplyWriter::bulk(std::string_view bytes) {
+    out_.appendNumber('$', static_cast<long long>(bytes.size()), eol_);
+    out_.append(bytes);
+    out_.append(eol_);
+}
+
+void ReplyWriter::bulk(const Value& value) {
+    // The value is queued by reference and sent straight from the store's buffer
+    out_.appendNumber('$', static_cast<long long>(value.size()), eol_);
+    out_.appendValue(value);
+    out_.append(eol_);
+}
+
+void ReplyWriter::null() {
+    out_.append("$-1");
+    out_.append(eol_);
+}
+
+void ReplyWriter::arrayHeader(size_t count) {
+    out_.appendNumber('*', static_cast<long long>(count), eol_);
+}
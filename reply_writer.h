@@ -0,0 +1,65 @@
+#pragma once
+
+#include "output_buffer.h"
+#include "value.h"
+#include <string_view>
+
+/**
+ * Formats replies for one connection
+ * The text protocol and RESP2 share the same reply types ("+OK", "-ERR",
+ * ":1", "$5 hello", "*2 ...") and differ only in the line terminator,
+ * "\n" for text clients and "\r\n" for RESP clients
+ */
+class ReplyWriter {
+private:
+    OutputBuffer& out_;
+    std::string_view eol_;
+
+public:
+    /**
+     * Constructor
+     * @param out Buffer the replies are appended to
+     * @param resp Whether the connection speaks RESP
+     */
+    ReplyWriter(OutputBuffer& out, bool resp) : out_(out), eol_(resp ? "\r\n" : "\n") {}
+
+    /**
+     * Status reply, e.g. "+OK"
+     */
+    void status(std::string_view text);
+
+    /**
+     * Error reply; message should start with an error code such as "ERR"
+     */
+    void error(std::string_view message);
+
+    /**
+     * Integer reply, e.g. ":1"
+     */
+    void integer(long long number);
+
+    /**
+     * Bulk string reply, copied into the output
+     */
+    void bulk(std::string_view bytes);
+
+    /**
+     * Bulk string reply from a stored value, sent by reference if large
+     */
+    void bulk(const Value& value);
+
+    /**
+     * Null bulk reply, "$-1", for missing keys
+     */
+    void null();
+
+    /**
+     * Header of an array reply with count elements
+     */
+    void arrayHeader(size_t count);
+
+    /**
+     * Get the underlying output buffer
+     */
+    OutputBuffer& buffer() { return out_; }
+};
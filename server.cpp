@@ -1,12 +1,137 @@
 #include "server.h"
+#include "metrics.h"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cctype>
 #include <cstring>
+#include <iomanip>
+#include <limits>
 
-Server::Server(DataStore& dataStore, PersistenceManager& persistenceManager)
-    : dataStore_(dataStore), persistenceManager_(persistenceManager), 
-      serverSocket_(INVALID_SOCKET_VALUE), running_(false) {
+namespace {
+
+// Redis's reply to a write refused because nothing more can be evicted
+const char* const OUT_OF_MEMORY_ERROR = "OOM command not allowed when used memory > 'maxmemory'";
+
+// Redis's reply to a command on a key holding another type of value
+const char* const WRONG_TYPE_ERROR = "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+/**
+ * Read SET's optional expiry: a trailing "EX seconds" style option on the
+ * value in text mode, or the arguments after the value in RESP mode
+ * @param expiresAt Receives the expiry time, left 0 if there is none
+ * @return false if an option is malformed
+ */
+bool readSetExpiry(const Command& command, CommandArgs& args, std::string_view& value, int64_t& expiresAt) {
+    std::string_view option;
+    std::string_view amount;
+    if (!command.argv) {
+        return !protocol::splitTrailingExpiry(value, option, amount) ||
+               protocol::parseExpiry(option, amount, DataStore::unixTimeMillis(), expiresAt);
+    }
+    while (args.next(option)) {
+        if (!args.next(amount) || !protocol::parseExpiry(option, amount, DataStore::unixTimeMillis(), expiresAt)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// SCAN and RANGE return COUNT keys unless told otherwise, and never more
+// than SCAN_MAX_COUNT, so that one reply stays a bounded amount of work
+constexpr size_t SCAN_DEFAULT_COUNT = 10;
+constexpr size_t RANGE_DEFAULT_COUNT = 1000;
+constexpr long long SCAN_MAX_COUNT = 10000;
+
+/**
+ * Encode a key as a SCAN cursor: its bytes in hex
+ */
+std::string formatCursor(std::string_view key) {
+    static const char DIGITS[] = "0123456789abcdef";
+    std::string cursor;
+    cursor.reserve(key.size() * 2);
+    for (char c : key) {
+        cursor.push_back(DIGITS[static_cast<unsigned char>(c) >> 4]);
+        cursor.push_back(DIGITS[static_cast<unsigned char>(c) & 15]);
+    }
+    return cursor;
+}
+
+/**
+ * Decode a SCAN cursor
+ * @param cursor "0" to start, or a cursor from formatCursor()
+ * @param key Receives the key to resume after, empty to start
+ * @return false if the cursor is malformed
+ */
+bool parseCursor(std::string_view cursor, std::string& key) {
+    key.clear();
+    if (cursor == "0") {
+        return true;
+    }
+    if (cursor.empty() || cursor.size() % 2 != 0) {
+        return false;
+    }
+    auto digit = [](char c) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    };
+    for (size_t i = 0; i < cursor.size(); i += 2) {
+        int high = digit(cursor[i]);
+        int low = digit(cursor[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        key.push_back(static_cast<char>(high * 16 + low));
+    }
+    return true;
+}
+
+/**
+ * Parse a RANGE bound, as ZRANGEBYLEX takes them
+ * @param text "[key" or a bare key (inclusive), "(key" (exclusive), or "-"
+ *        or "+" for the lowest and highest keys
+ * @param isMax true for the upper bound
+ * @param key Receives the key
+ * @param exclusive Receives whether the key itself is out of the range
+ * @return false if the bound is "+" as a lower bound or "-" as an upper one
+ */
+bool parseRangeBound(std::string_view text, bool isMax, std::string_view& key, bool& exclusive) {
+    exclusive = false;
+    if (text == "-" || text == "+") {
+        key = std::string_view();
+        return (text == "+") == isMax;
+    }
+    if (!text.empty() && (text.front() == '[' || text.front() == '(')) {
+        exclusive = text.front() == '(';
+        text.remove_prefix(1);
+    }
+    key = text;
+    return true;
+}
+
+/**
+ * Reply with the error for a typed command that did not succeed
+ * @return true if status is Ok and the caller should reply with the result
+ */
+bool checkTyped(TypedStatus status, ReplyWriter& reply) {
+    if (status == TypedStatus::WrongType) {
+        reply.error(WRONG_TYPE_ERROR);
+    } else if (status == TypedStatus::NotInteger) {
+        reply.error("ERR value is not an integer or out of range");
+    } else if (status == TypedStatus::Overflow) {
+        reply.error("ERR increment or decrement would overflow");
+    } else if (status == TypedStatus::Failed) {
+        reply.error("ERR Failed to update key");
+    }
+    return status == TypedStatus::Ok;
+}
+
+} // namespace
+
+Server::Server(DataStore& dataStore, PersistenceManager& persistenceManager,
+               const ServerConfig& config)
+    : dataStore_(dataStore), persistenceManager_(persistenceManager), config_(config),
+      serverSocket_(INVALID_SOCKET_VALUE), running_(false), nextClientId_(0) {
 }
 
 Server::~Server() {
@@ -42,46 +167,43 @@ bool Server::start(int port) {
         return false;
     }
 
-    // Create socket
-    serverSocket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket_ == INVALID_SOCKET_VALUE) {
-        std::cerr << "Failed to create socket" << std::endl;
-        return false;
+    if (config_.reusePort && config_.ioModel != IoModel::Reactor) {
+        std::cerr << "SO_REUSEPORT listeners need reactor mode; using a single listener" << std::endl;
+        config_.reusePort = false;
     }
+#if !defined(BOLTDB_HAS_EPOLL) || !defined(SO_REUSEPORT)
+    config_.reusePort = false;
+#endif
 
-    // Set socket options
-    int opt = 1;
-    if (setsockopt(serverSocket_, SOL_SOCKET, SO_REUSEADDR, 
-                   reinterpret_cast<const char*>(&opt), sizeof(opt)) < 0) {
-        std::cerr << "Failed to set socket options" << std::endl;
-        closeSocket(serverSocket_);
-        return false;
-    }
-
-    // Bind socket
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-
-    if (bind(serverSocket_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
-        std::cerr << "Failed to bind socket to port " << port << std::endl;
-        closeSocket(serverSocket_);
+    serverSocket_ = createListener(port, config_.reusePort);
+    if (serverSocket_ == INVALID_SOCKET_VALUE) {
         return false;
     }
 
-    // Listen for connections
-    if (listen(serverSocket_, 10) < 0) {
-        std::cerr << "Failed to listen on socket" << std::endl;
+    if (config_.ioModel == IoModel::Reactor && !startEventLoops(port)) {
         closeSocket(serverSocket_);
+        serverSocket_ = INVALID_SOCKET_VALUE;
         return false;
     }
 
     running_ = true;
-    std::cout << "BoltDB server started on port " << port << std::endl;
+    metrics::startupReadyMicros.store(metrics::sinceStartMicros(), std::memory_order_relaxed);
+    std::cout << "BoltDB server started on port " << port
+              << (config_.ioModel == IoModel::Reactor
+                      ? " (reactor, " + std::to_string(eventLoops_.size()) + " event loops" +
+                            (config_.reusePort ? ", SO_REUSEPORT listeners)" : ")")
+                      : " (thread per connection)")
+              << ", ready " << metrics::startupReadyMicros.load(std::memory_order_relaxed) / 1000
+              << " ms after start" << std::endl;
+
+    if (config_.reusePort) {
+        // The event loops accept for themselves; block until stop()
+        std::unique_lock<std::mutex> lock(stopMutex_);
+        stopCondition_.wait(lock, [this]() { return !running_; });
+        return true;
+    }
 
     // Accept connections in a loop
-    int clientId = 0;
     while (running_) {
         struct sockaddr_in clientAddress;
         socklen_t clientAddressLen = sizeof(clientAddress);
@@ -97,8 +219,16 @@ bool Server::start(int port) {
             continue;
         }
 
+        setNoDelay(clientSocket);
+        int clientId = ++nextClientId_;
+        if (config_.ioModel == IoModel::Reactor) {
+            // Spread connections over the event loops round-robin
+            eventLoops_[clientId % eventLoops_.size()]->addConnection(clientSocket, clientId);
+            continue;
+        }
+
         // Create a new thread for this client
-        std::thread clientThread(&Server::handleClient, this, clientSocket, ++clientId);
+        std::thread clientThread(&Server::handleClient, this, clientSocket, clientId);
         
         {
             std::lock_guard<std::mutex> lock(threadsMutex_);
@@ -109,16 +239,82 @@ bool Server::start(int port) {
     return true;
 }
 
+socket_t Server::createListener(int port, bool reusePort) {
+    // Create socket
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET_VALUE) {
+        std::cerr << "Failed to create socket" << std::endl;
+        return INVALID_SOCKET_VALUE;
+    }
+
+    // Set socket options
+    int opt = 1;
+    if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, 
+                   reinterpret_cast<const char*>(&opt), sizeof(opt)) < 0) {
+        std::cerr << "Failed to set socket options" << std::endl;
+        closeSocket(listener);
+        return INVALID_SOCKET_VALUE;
+    }
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT,
+                                reinterpret_cast<const char*>(&opt), sizeof(opt)) < 0) {
+        std::cerr << "Failed to set SO_REUSEPORT" << std::endl;
+        closeSocket(listener);
+        return INVALID_SOCKET_VALUE;
+    }
+#else
+    (void)reusePort;
+#endif
+
+    // Bind socket
+    struct sockaddr_in address;
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+        std::cerr << "Failed to bind socket to port " << port << std::endl;
+        closeSocket(listener);
+        return INVALID_SOCKET_VALUE;
+    }
+
+    // Listen for connections
+    if (listen(listener, config_.backlog) < 0) {
+        std::cerr << "Failed to listen on socket" << std::endl;
+        closeSocket(listener);
+        return INVALID_SOCKET_VALUE;
+    }
+
+    return listener;
+}
+
 void Server::stop() {
     if (!running_) {
         return;
     }
 
-    running_ = false;
-    
-    // Close server socket
+    {
+        std::lock_guard<std::mutex> lock(stopMutex_);
+        running_ = false;
+    }
+    stopCondition_.notify_all();
+
+    // Stop the event loops first; they close the connections they own and
+    // stop watching their listeners
+    for (auto& loop : eventLoops_) {
+        loop->stop();
+    }
+
+    // Close server socket (shutdown first so a blocked accept() returns)
+#ifndef _WIN32
+    shutdown(serverSocket_, SHUT_RDWR);
+#endif
     closeSocket(serverSocket_);
     serverSocket_ = INVALID_SOCKET_VALUE;
+    for (socket_t listener : loopListeners_) {
+        closeSocket(listener);
+    }
+    loopListeners_.clear();
 
     // Wait for all client threads to finish
     {
@@ -138,108 +334,882 @@ bool Server::isRunning() const {
     return running_;
 }
 
+bool Server::startEventLoops(int port) {
+#ifdef BOLTDB_HAS_EPOLL
+    ConnectionCallbacks callbacks;
+    callbacks.nextClientId = [this]() { return ++nextClientId_; };
+    callbacks.onOpen = [](Connection& connection) {
+        metrics::connectedClients.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "Client " << connection.id << " connected" << std::endl;
+    };
+    callbacks.onInput = [this](Connection& connection) {
+        return processInput(connection.parser, connection.input, connection.output);
+    };
+    callbacks.beforeFlush = [this]() { return waitForDurability(); };
+    callbacks.onClose = [](Connection& connection) {
+        metrics::connectedClients.fetch_sub(1, std::memory_order_relaxed);
+        std::cout << "Client " << connection.id << " disconnected" << std::endl;
+    };
+
+    // Loops from a previous run are kept until here because the accept
+    // thread may still be handing them sockets while stop() runs
+    eventLoops_.clear();
+
+    int count = config_.ioThreads > 0 ? config_.ioThreads : 1;
+    unsigned cpus = std::thread::hardware_concurrency();
+    bool ok = true;
+    for (int i = 0; i < count && ok; ++i) {
+        auto loop = std::make_unique<EventLoop>(callbacks);
+        if (config_.reusePort) {
+            // Loop 0 reuses the first listener; the kernel spreads incoming
+            // connections across all sockets bound to the port
+            socket_t listener = i == 0 ? serverSocket_ : createListener(port, true);
+            if (listener == INVALID_SOCKET_VALUE) {
+                ok = false;
+                break;
+            }
+            if (i > 0) loopListeners_.push_back(listener);
+            loop->setListener(listener);
+        }
+        int cpu = (config_.pinThreads && cpus > 0) ? static_cast<int>(i % cpus) : -1;
+        ok = loop->start(cpu);
+        if (ok) eventLoops_.push_back(std::move(loop));
+    }
+
+    if (!ok) {
+        for (auto& started : eventLoops_) {
+            started->stop();
+        }
+        eventLoops_.clear();
+        for (socket_t listener : loopListeners_) {
+            closeSocket(listener);
+        }
+        loopListeners_.clear();
+    }
+    return ok;
+#else
+    (void)port;
+    std::cerr << "Reactor mode needs epoll; falling back to thread per connection" << std::endl;
+    config_.ioModel = IoModel::Threads;
+    return true;
+#endif
+}
+
 void Server::handleClient(socket_t clientSocket, int clientId) {
+    metrics::connectedClients.fetch_add(1, std::memory_order_relaxed);
     std::cout << "Client " << clientId << " connected" << std::endl;
     
-    char buffer[1024];
-    std::string commandBuffer;
+    CommandParser parser;
+    InputBuffer input;
+    OutputBuffer response;
     
     while (running_) {
-        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
+        // Receive straight into the input buffer's free space
+        char* space = input.prepare();
+        int bytesReceived = recv(clientSocket, space, static_cast<int>(input.writable()), 0);
         
         if (bytesReceived <= 0) {
             break; // Client disconnected or error
         }
+        input.commit(static_cast<size_t>(bytesReceived));
         
-        buffer[bytesReceived] = '\0';
-        commandBuffer += buffer;
-        
-        // Process complete commands (terminated by \n)
-        size_t pos;
-        while ((pos = commandBuffer.find('\n')) != std::string::npos) {
-            std::string command = commandBuffer.substr(0, pos);
-            commandBuffer.erase(0, pos + 1);
-            
-            // Trim whitespace
-            command.erase(command.find_last_not_of(" \t\r\n") + 1);
-            command.erase(0, command.find_first_not_of(" \t\r\n"));
-            
-            if (!command.empty()) {
-                if (!processCommand(command, clientSocket)) {
-                    closeSocket(clientSocket);
-                    std::cout << "Client " << clientId << " disconnected" << std::endl;
-                    return;
-                }
+        // Replies to every command parsed from this read go out in one write.
+        // processInput stops early once the output passes the high watermark,
+        // so flush and carry on with the rest of the batch
+        bool keepOpen = true;
+        size_t pending;
+        do {
+            pending = input.size();
+            keepOpen = processInput(parser, input, response);
+            if (!waitForDurability() || !sendResponse(response, clientSocket)) {
+                keepOpen = false;
             }
+        } while (keepOpen && input.size() < pending && !input.empty());
+
+        if (!keepOpen) {
+            break;
         }
     }
     
     closeSocket(clientSocket);
+    metrics::connectedClients.fetch_sub(1, std::memory_order_relaxed);
     std::cout << "Client " << clientId << " disconnected" << std::endl;
 }
 
-bool Server::processCommand(const std::string& command, socket_t clientSocket) {
-    std::istringstream iss(command);
-    std::string cmd;
-    iss >> cmd;
-    
-    // Convert to uppercase for case-insensitive commands
-    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
-    
-    if (cmd == "SET") {
-        std::string key, value;
-        if (iss >> key) {
-            // Get the rest of the line as the value
-            std::string remaining;
-            std::getline(iss, remaining);
-            if (!remaining.empty() && remaining[0] == ' ') {
-                value = remaining.substr(1); // Remove leading space
-            }
-            
-            if (dataStore_.set(key, value)) {
-                return sendResponse("+OK\n", clientSocket);
+bool Server::processInput(CommandParser& parser, InputBuffer& input, OutputBuffer& response) {
+    Command command;
+    bool keepOpen = true;
+
+    // Process complete commands until the replies pile up past the high watermark
+    while (keepOpen && response.size() < OutputBuffer::HIGH_WATERMARK) {
+        CommandParser::Status status = parser.next(input, command);
+        if (status == CommandParser::Status::Incomplete) {
+            break;
+        }
+        ReplyWriter reply(response, parser.protocol() == Protocol::Resp);
+        if (status == CommandParser::Status::Error) {
+            reply.error(std::string("ERR Protocol error: ") + parser.error());
+            return false;
+        }
+        if (!command.name.empty()) {
+            keepOpen = processCommand(command, reply);
+        }
+    }
+    return keepOpen;
+}
+
+bool Server::processCommand(const Command& command, ReplyWriter& reply) {
+    if (metrics::commandsProcessed.fetch_add(1, std::memory_order_relaxed) == 0) {
+        metrics::startupFirstCommandMicros.store(metrics::sinceStartMicros(), std::memory_order_relaxed);
+    }
+    CommandArgs args(command);
+    std::string_view key;
+    std::string_view value;
+
+    switch (command.type) {
+        case CommandType::Set: {
+            int64_t expiresAt = 0;
+            if (!args.next(key) || !args.rest(value) || !readSetExpiry(command, args, value, expiresAt)) {
+                reply.error("ERR Invalid SET command");
+            } else if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (dataStore_.set(key, value, expiresAt)) {
+                reply.status("OK");
+            } else {
+                reply.error("ERR Failed to set key");
+            }
+            return true;
+        }
+        case CommandType::Get:
+            if (!args.next(key)) {
+                reply.error("ERR Invalid GET command");
+                return true;
+            }
+            if (Value stored = dataStore_.get(key)) {
+                if (stored.collection()) {
+                    reply.error(WRONG_TYPE_ERROR);
+                } else {
+                    reply.bulk(stored);
+                }
+            } else {
+                reply.null();
+            }
+            return true;
+        case CommandType::Delete:
+        case CommandType::MDel: {
+            // DELETE, DEL and MDEL all take one or more keys
+            std::vector<std::string_view> keys;
+            while (args.next(key)) {
+                keys.push_back(key);
+            }
+            if (keys.empty()) {
+                reply.error(command.type == CommandType::MDel ? "ERR Invalid MDEL command"
+                                                              : "ERR Invalid DELETE command");
+            } else if (keys.size() == 1) {
+                reply.integer(dataStore_.del(keys[0]) ? 1 : 0);
+            } else {
+                reply.integer(static_cast<long long>(dataStore_.mdel(keys)));
+            }
+            return true;
+        }
+        case CommandType::MGet: {
+            std::vector<std::string_view> keys;
+            while (args.next(key)) {
+                keys.push_back(key);
+            }
+            if (keys.empty()) {
+                reply.error("ERR Invalid MGET command");
+                return true;
+            }
+            std::vector<Value> values = dataStore_.mget(keys);
+            reply.arrayHeader(values.size());
+            for (const Value& stored : values) {
+                // As in Redis, keys holding another type read as missing
+                if (stored && !stored.collection()) {
+                    reply.bulk(stored);
+                } else {
+                    reply.null();
+                }
+            }
+            return true;
+        }
+        case CommandType::MSet: {
+            // Text mode splits values on whitespace too; use RESP for values with spaces
+            std::vector<std::pair<std::string_view, std::string_view>> entries;
+            while (args.next(key)) {
+                if (!args.next(value)) {
+                    entries.clear();
+                    break;
+                }
+                entries.emplace_back(key, value);
+            }
+            if (entries.empty()) {
+                reply.error("ERR Invalid MSET command");
+            } else if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (dataStore_.mset(entries)) {
+                reply.status("OK");
+            } else {
+                reply.error("ERR Failed to set keys");
+            }
+            return true;
+        }
+        case CommandType::Info:
+            reply.bulk(buildInfo());
+            return true;
+        case CommandType::Ping:
+            if (args.done()) {
+                reply.status("PONG");
+            } else {
+                args.rest(value);
+                reply.bulk(value);
+            }
+            return true;
+        case CommandType::Echo:
+            if (args.done() || !args.rest(value)) {
+                reply.error("ERR Invalid ECHO command");
             } else {
-                return sendResponse("-ERR Failed to set key\n", clientSocket);
+                reply.bulk(value);
             }
+            return true;
+        case CommandType::Config:
+            processConfig(args, reply);
+            return true;
+        case CommandType::Expire:
+        case CommandType::PExpire:
+        case CommandType::PExpireAt:
+        case CommandType::Persist:
+        case CommandType::Ttl:
+        case CommandType::PTtl:
+            processExpiry(command, args, reply);
+            return true;
+        case CommandType::Scan:
+        case CommandType::Range:
+            processScan(command, args, reply);
+            return true;
+        case CommandType::Type:
+        case CommandType::HSet:
+        case CommandType::HGet:
+        case CommandType::HDel:
+        case CommandType::HGetAll:
+        case CommandType::HLen:
+        case CommandType::LPush:
+        case CommandType::RPush:
+        case CommandType::LPop:
+        case CommandType::RPop:
+        case CommandType::LRange:
+        case CommandType::LLen:
+        case CommandType::ZAdd:
+        case CommandType::ZRem:
+        case CommandType::ZScore:
+        case CommandType::ZRange:
+        case CommandType::ZCard:
+            processCollection(command, args, reply);
+            return true;
+        case CommandType::Incr:
+        case CommandType::IncrBy:
+        case CommandType::Decr:
+        case CommandType::DecrBy:
+        case CommandType::Append:
+        case CommandType::GetSet:
+        case CommandType::Cas:
+            processUpdate(command, args, reply);
+            return true;
+        case CommandType::Quit:
+            reply.status("OK");
+            return true;
+        case CommandType::Unknown:
+            break;
+    }
+
+    std::string name(command.name);
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    reply.error("ERR Unknown command: " + name);
+    return true;
+}
+
+void Server::processConfig(CommandArgs& args, ReplyWriter& reply) {
+    std::string_view subcommand;
+    std::string_view parameter;
+    if (!args.next(subcommand) || !protocol::equalsIgnoreCase(subcommand, "GET") ||
+        !args.next(parameter)) {
+        reply.error("ERR Only CONFIG GET <parameter> is supported");
+        return;
+    }
+
+    // Just enough for tools such as redis-benchmark that read the server's
+    // persistence settings at startup; unknown parameters match nothing
+    if (protocol::equalsIgnoreCase(parameter, "SAVE")) {
+        reply.arrayHeader(2);
+        reply.bulk("save");
+        reply.bulk("");
+    } else if (protocol::equalsIgnoreCase(parameter, "APPENDONLY")) {
+        reply.arrayHeader(2);
+        reply.bulk("appendonly");
+        reply.bulk(persistenceManager_.appendLog() ? "yes" : "no");
+    } else if (protocol::equalsIgnoreCase(parameter, "MAXMEMORY")) {
+        reply.arrayHeader(2);
+        reply.bulk("maxmemory");
+        reply.bulk(std::to_string(dataStore_.memoryLimit()));
+    } else if (protocol::equalsIgnoreCase(parameter, "MAXMEMORY-POLICY")) {
+        reply.arrayHeader(2);
+        reply.bulk("maxmemory-policy");
+        reply.bulk(DataStore::evictionPolicyName(dataStore_.evictionPolicy()));
+    } else if (protocol::equalsIgnoreCase(parameter, "ACTIVEDEFRAG")) {
+        reply.arrayHeader(2);
+        reply.bulk("activedefrag");
+        reply.bulk(dataStore_.activeDefrag() ? "yes" : "no");
+    } else {
+        reply.arrayHeader(0);
+    }
+}
+
+void Server::processExpiry(const Command& command, CommandArgs& args, ReplyWriter& reply) {
+    std::string name(command.name);
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    std::string_view key;
+    std::string_view amount;
+    bool takesTime = command.type == CommandType::Expire || command.type == CommandType::PExpire ||
+                     command.type == CommandType::PExpireAt;
+    if (!args.next(key) || (takesTime && !args.next(amount)) || !args.done()) {
+        reply.error("ERR Invalid " + name + " command");
+        return;
+    }
+
+    switch (command.type) {
+        case CommandType::Persist:
+            reply.integer(dataStore_.persist(key) ? 1 : 0);
+            return;
+        case CommandType::Ttl:
+        case CommandType::PTtl: {
+            int64_t ttl = dataStore_.timeToLive(key);
+            if (ttl >= 0 && command.type == CommandType::Ttl) {
+                ttl = (ttl + 500) / 1000;
+            }
+            reply.integer(ttl);
+            return;
+        }
+        default:
+            break;
+    }
+
+    // A time that is not in the future deletes the key, as in Redis
+    constexpr long long LIMIT = std::numeric_limits<int64_t>::max() / 4000;
+    long long number = 0;
+    if (!protocol::parseInteger(amount, number) || number > LIMIT || number < -LIMIT) {
+        reply.error("ERR Invalid expire time in " + name + " command");
+        return;
+    }
+    int64_t expiresAt = number;
+    if (command.type == CommandType::Expire) {
+        expiresAt = DataStore::unixTimeMillis() + number * 1000;
+    } else if (command.type == CommandType::PExpire) {
+        expiresAt = DataStore::unixTimeMillis() + number;
+    }
+    reply.integer(dataStore_.expireAt(key, expiresAt) ? 1 : 0);
+}
+
+void Server::processScan(const Command& command, CommandArgs& args, ReplyWriter& reply) {
+    bool scan = command.type == CommandType::Scan;
+    if (!dataStore_.orderedIndex()) {
+        reply.error(std::string("ERR ") + (scan ? "SCAN" : "RANGE") +
+                    " needs the ordered index: start the server with --ordered-index");
+        return;
+    }
+
+    KeyRange range;
+    std::string cursorKey;
+    std::string prefix;
+    std::string prefixEnd;
+    std::string_view pattern;
+    if (scan) {
+        // SCAN cursor [MATCH pattern] [COUNT n]: the cursor is "0" or the
+        // last key returned, hex-encoded so that any key survives as a token
+        std::string_view cursor;
+        if (!args.next(cursor) || !parseCursor(cursor, cursorKey)) {
+            reply.error("ERR Invalid SCAN cursor");
+            return;
+        }
+    } else {
+        // RANGE min max [COUNT n]: "[key" or a bare key is inclusive, "(key"
+        // exclusive, "-" and "+" the lowest and highest keys
+        std::string_view min;
+        std::string_view max;
+        if (!args.next(min) || !args.next(max) || !parseRangeBound(min, false, range.min, range.minExclusive) ||
+            !parseRangeBound(max, true, range.max, range.maxExclusive)) {
+            reply.error("ERR Invalid RANGE command");
+            return;
+        }
+        range.maxUnbounded = max == "+";
+    }
+
+    size_t count = scan ? SCAN_DEFAULT_COUNT : RANGE_DEFAULT_COUNT;
+    std::string_view option;
+    std::string_view argument;
+    while (args.next(option)) {
+        long long number = 0;
+        if (!args.next(argument)) {
+            option = std::string_view();
+        } else if (protocol::equalsIgnoreCase(option, "COUNT") && protocol::parseInteger(argument, number) &&
+                   number > 0) {
+            count = static_cast<size_t>(std::min<long long>(number, SCAN_MAX_COUNT));
+            continue;
+        } else if (scan && protocol::equalsIgnoreCase(option, "MATCH")) {
+            pattern = argument;
+            continue;
+        }
+        reply.error(std::string("ERR Invalid ") + (scan ? "SCAN" : "RANGE") + " command");
+        return;
+    }
+
+    if (scan) {
+        // Keys matching the pattern all lie between its literal prefix and
+        // the first string past every key with that prefix
+        prefix = protocol::patternPrefix(pattern);
+        prefixEnd = prefix;
+        while (!prefixEnd.empty() && static_cast<unsigned char>(prefixEnd.back()) == 0xff) {
+            prefixEnd.pop_back();
+        }
+        if (!prefixEnd.empty()) {
+            prefixEnd.back() = static_cast<char>(static_cast<unsigned char>(prefixEnd.back()) + 1);
+            range.max = prefixEnd;
+            range.maxExclusive = true;
+            range.maxUnbounded = false;
+        }
+        if (!cursorKey.empty() && cursorKey >= prefix) {
+            range.min = cursorKey;
+            range.minExclusive = true;
         } else {
-            return sendResponse("-ERR Invalid SET command\n", clientSocket);
+            range.min = prefix;
         }
     }
-    else if (cmd == "GET") {
-        std::string key;
-        if (iss >> key) {
-            auto value = dataStore_.get(key);
-            if (value.has_value()) {
-                std::string response = "$" + std::to_string(value->length()) + "\n" + *value + "\n";
-                return sendResponse(response, clientSocket);
+
+    auto entries = dataStore_.range(range, count, !scan);
+    if (!scan) {
+        reply.arrayHeader(entries.size() * 2);
+        for (const auto& entry : entries) {
+            reply.bulk(entry.first);
+            if (entry.second.collection()) {
+                reply.null();
             } else {
-                return sendResponse("$-1\n", clientSocket);
+                reply.bulk(entry.second);
             }
-        } else {
-            return sendResponse("-ERR Invalid GET command\n", clientSocket);
         }
+        return;
     }
-    else if (cmd == "DELETE") {
-        std::string key;
-        if (iss >> key) {
-            bool deleted = dataStore_.del(key);
-            std::string response = ":" + std::to_string(deleted ? 1 : 0) + "\n";
-            return sendResponse(response, clientSocket);
-        } else {
-            return sendResponse("-ERR Invalid DELETE command\n", clientSocket);
+
+    // COUNT bounds the keys visited, as in Redis: a pattern can filter out
+    // all of them, and a full batch means there may be more to come
+    size_t matched = 0;
+    for (const auto& entry : entries) {
+        matched += pattern.empty() || protocol::matchPattern(pattern, entry.first);
+    }
+    reply.arrayHeader(2);
+    reply.bulk(entries.size() == count ? formatCursor(entries.back().first) : std::string("0"));
+    reply.arrayHeader(matched);
+    for (const auto& entry : entries) {
+        if (pattern.empty() || protocol::matchPattern(pattern, entry.first)) {
+            reply.bulk(entry.first);
+        }
+    }
+}
+
+void Server::processCollection(const Command& command, CommandArgs& args, ReplyWriter& reply) {
+    std::string name(command.name);
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    std::string_view key;
+    std::string_view first;
+    std::string_view second;
+    if (!args.next(key)) {
+        reply.error("ERR Invalid " + name + " command");
+        return;
+    }
+    // The rest of the arguments, for commands that take a list of them
+    std::vector<std::string_view> items;
+    auto readItems = [&]() {
+        std::string_view item;
+        while (args.next(item)) {
+            items.push_back(item);
+        }
+    };
+
+    switch (command.type) {
+        case CommandType::Type: {
+            ValueType type = ValueType::String;
+            reply.status(args.done() && dataStore_.type(key, type) ? Collection::typeName(type) : "none");
+            return;
+        }
+        case CommandType::HLen:
+        case CommandType::LLen:
+        case CommandType::ZCard: {
+            ValueType type = command.type == CommandType::HLen   ? ValueType::Hash
+                             : command.type == CommandType::LLen ? ValueType::List
+                                                                 : ValueType::SortedSet;
+            size_t length = 0;
+            if (checkTyped(dataStore_.length(key, type, length), reply)) {
+                reply.integer(static_cast<long long>(length));
+            }
+            return;
+        }
+        case CommandType::HSet: {
+            readItems();
+            if (items.empty() || items.size() % 2 != 0) {
+                break;
+            }
+            std::vector<std::pair<std::string_view, std::string_view>> fields;
+            fields.reserve(items.size() / 2);
+            for (size_t i = 0; i < items.size(); i += 2) {
+                fields.emplace_back(items[i], items[i + 1]);
+            }
+            size_t added = 0;
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.hset(key, fields, added), reply)) {
+                reply.integer(static_cast<long long>(added));
+            }
+            return;
+        }
+        case CommandType::HGet: {
+            if (!args.next(first) || !args.done()) {
+                break;
+            }
+            Value stored;
+            if (checkTyped(dataStore_.hget(key, first, stored), reply)) {
+                if (stored) {
+                    reply.bulk(stored);
+                } else {
+                    reply.null();
+                }
+            }
+            return;
+        }
+        case CommandType::HDel:
+        case CommandType::ZRem: {
+            readItems();
+            if (items.empty()) {
+                break;
+            }
+            size_t removed = 0;
+            TypedStatus status = command.type == CommandType::HDel ? dataStore_.hdel(key, items, removed)
+                                                                   : dataStore_.zrem(key, items, removed);
+            if (checkTyped(status, reply)) {
+                reply.integer(static_cast<long long>(removed));
+            }
+            return;
+        }
+        case CommandType::HGetAll: {
+            std::vector<std::pair<std::string, Value>> fields;
+            if (checkTyped(dataStore_.hgetAll(key, fields), reply)) {
+                reply.arrayHeader(fields.size() * 2);
+                for (const auto& field : fields) {
+                    reply.bulk(field.first);
+                    reply.bulk(field.second);
+                }
+            }
+            return;
+        }
+        case CommandType::LPush:
+        case CommandType::RPush: {
+            readItems();
+            if (items.empty()) {
+                break;
+            }
+            size_t length = 0;
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.push(key, command.type == CommandType::LPush, items, length), reply)) {
+                reply.integer(static_cast<long long>(length));
+            }
+            return;
+        }
+        case CommandType::LPop:
+        case CommandType::RPop: {
+            // Without a count the reply is one element, with one an array
+            long long count = 1;
+            bool counted = args.next(first);
+            if ((counted && (!protocol::parseInteger(first, count) || count < 0)) || !args.done()) {
+                break;
+            }
+            std::vector<Value> elements;
+            if (!checkTyped(dataStore_.pop(key, command.type == CommandType::LPop, static_cast<size_t>(count),
+                                           elements),
+                            reply)) {
+                return;
+            }
+            if (!counted) {
+                if (elements.empty()) {
+                    reply.null();
+                } else {
+                    reply.bulk(elements.front());
+                }
+            } else {
+                reply.arrayHeader(elements.size());
+                for (const Value& element : elements) {
+                    reply.bulk(element);
+                }
+            }
+            return;
         }
+        case CommandType::LRange:
+        case CommandType::ZRange: {
+            long long start = 0;
+            long long stop = 0;
+            if (!args.next(first) || !args.next(second) || !protocol::parseInteger(first, start) ||
+                !protocol::parseInteger(second, stop)) {
+                break;
+            }
+            std::string_view option;
+            bool withScores = false;
+            if (args.next(option)) {
+                if (command.type != CommandType::ZRange || !protocol::equalsIgnoreCase(option, "WITHSCORES") ||
+                    !args.done()) {
+                    break;
+                }
+                withScores = true;
+            }
+            if (command.type == CommandType::LRange) {
+                std::vector<Value> elements;
+                if (checkTyped(dataStore_.listRange(key, start, stop, elements), reply)) {
+                    reply.arrayHeader(elements.size());
+                    for (const Value& element : elements) {
+                        reply.bulk(element);
+                    }
+                }
+                return;
+            }
+            std::vector<std::pair<std::string, double>> members;
+            if (checkTyped(dataStore_.zrange(key, start, stop, members), reply)) {
+                reply.arrayHeader(members.size() * (withScores ? 2 : 1));
+                for (const auto& member : members) {
+                    reply.bulk(member.first);
+                    if (withScores) {
+                        reply.bulk(protocol::formatDouble(member.second));
+                    }
+                }
+            }
+            return;
+        }
+        case CommandType::ZAdd: {
+            readItems();
+            if (items.empty() || items.size() % 2 != 0) {
+                break;
+            }
+            std::vector<std::pair<double, std::string_view>> members;
+            members.reserve(items.size() / 2);
+            for (size_t i = 0; i < items.size(); i += 2) {
+                double score = 0;
+                if (!protocol::parseDouble(items[i], score)) {
+                    reply.error("ERR value is not a valid float");
+                    return;
+                }
+                members.emplace_back(score, items[i + 1]);
+            }
+            size_t added = 0;
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.zadd(key, members, added), reply)) {
+                reply.integer(static_cast<long long>(added));
+            }
+            return;
+        }
+        case CommandType::ZScore: {
+            if (!args.next(first) || !args.done()) {
+                break;
+            }
+            double score = 0;
+            bool found = false;
+            if (checkTyped(dataStore_.zscore(key, first, score, found), reply)) {
+                if (found) {
+                    reply.bulk(protocol::formatDouble(score));
+                } else {
+                    reply.null();
+                }
+            }
+            return;
+        }
+        default:
+            break;
+    }
+    reply.error("ERR Invalid " + name + " command");
+}
+
+void Server::processUpdate(const Command& command, CommandArgs& args, ReplyWriter& reply) {
+    std::string name(command.name);
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    std::string_view key;
+    std::string_view first;
+    std::string_view second;
+    if (!args.next(key)) {
+        reply.error("ERR Invalid " + name + " command");
+        return;
+    }
+
+    switch (command.type) {
+        case CommandType::Incr:
+        case CommandType::IncrBy:
+        case CommandType::Decr:
+        case CommandType::DecrBy: {
+            long long delta = 1;
+            if (command.type == CommandType::IncrBy || command.type == CommandType::DecrBy) {
+                if (!args.next(first)) {
+                    break;
+                }
+                if (!protocol::parseInteger(first, delta)) {
+                    reply.error("ERR value is not an integer or out of range");
+                    return;
+                }
+            }
+            if (!args.done()) {
+                break;
+            }
+            if (command.type == CommandType::Decr || command.type == CommandType::DecrBy) {
+                if (delta == std::numeric_limits<long long>::min()) {
+                    reply.error("ERR decrement would overflow");
+                    return;
+                }
+                delta = -delta;
+            }
+            int64_t result = 0;
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.increment(key, delta, result), reply)) {
+                reply.integer(result);
+            }
+            return;
+        }
+        case CommandType::Append: {
+            size_t length = 0;
+            if (!args.rest(first) || !args.done()) {
+                break;
+            }
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.append(key, first, length), reply)) {
+                reply.integer(static_cast<long long>(length));
+            }
+            return;
+        }
+        case CommandType::GetSet: {
+            Value previous;
+            if (!args.rest(first) || !args.done()) {
+                break;
+            }
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.getSet(key, first, previous), reply)) {
+                if (previous) {
+                    reply.bulk(previous);
+                } else {
+                    reply.null();
+                }
+            }
+            return;
+        }
+        case CommandType::Cas: {
+            // Text mode takes the expected value as one token, the new one
+            // as the rest of the line
+            bool swapped = false;
+            if (!args.next(first) || !args.rest(second) || !args.done()) {
+                break;
+            }
+            if (!dataStore_.freeMemoryIfNeeded()) {
+                reply.error(OUT_OF_MEMORY_ERROR);
+            } else if (checkTyped(dataStore_.compareAndSwap(key, first, second, swapped), reply)) {
+                reply.integer(swapped ? 1 : 0);
+            }
+            return;
+        }
+        default:
+            break;
     }
-    else if (cmd == "QUIT") {
-        return sendResponse("+OK\n", clientSocket);
+    reply.error("ERR Invalid " + name + " command");
+}
+
+bool Server::waitForDurability() {
+    AppendOnlyLog* log = persistenceManager_.appendLog();
+    if (log && log->policy() == FsyncPolicy::Always) {
+        return log->waitForThreadRecords();
     }
-    else {
-        return sendResponse("-ERR Unknown command: " + cmd + "\n", clientSocket);
+    return true;
+}
+
+std::string Server::buildInfo() const {
+    uint64_t commands = metrics::commandsProcessed.load(std::memory_order_relaxed);
+    uint64_t copied = metrics::valueBytesCopied.load(std::memory_order_relaxed);
+    uint64_t writes = metrics::socketWrites.load(std::memory_order_relaxed);
+
+    std::ostringstream info;
+    info << "keys:" << dataStore_.size() << "\n";
+    info << "shards:" << dataStore_.shardCount() << "\n";
+    info << "ordered_index:" << (dataStore_.orderedIndex() ? 1 : 0) << "\n";
+    info << "io_model:" << (config_.ioModel == IoModel::Reactor ? "reactor" : "threads") << "\n";
+    info << "connected_clients:" << metrics::connectedClients.load(std::memory_order_relaxed) << "\n";
+    info << "commands_processed:" << commands << "\n";
+    info << "value_bytes_copied:" << copied << "\n";
+    info << "value_bytes_copied_per_command:" << (commands ? copied / commands : 0) << "\n";
+    info << "socket_writes:" << writes << "\n";
+    info << "commands_per_write:" << std::fixed << std::setprecision(2)
+         << (writes ? static_cast<double>(commands) / writes : 0.0);
+    info << "\nsnapshots:" << metrics::snapshotsTaken.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_last_us:" << metrics::snapshotLastMicros.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_last_bytes:" << metrics::snapshotLastBytes.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_last_fsync_us:" << metrics::snapshotLastFsyncMicros.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_last_pause_us:" << metrics::snapshotLastPauseMicros.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_last_extra_bytes:" << metrics::snapshotLastExtraBytes.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_shard_copies:" << metrics::snapshotShardCopies.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_deltas_written:" << metrics::snapshotDeltasWritten.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_compactions:" << metrics::snapshotCompactions.load(std::memory_order_relaxed) << "\n";
+    info << "snapshot_pending_deltas:" << persistenceManager_.deltaCount() << "\n";
+    info << "changes_since_last_save:" << persistenceManager_.changesSinceSave();
+    info << "\nstartup_load_us:" << metrics::startupLoadMicros.load(std::memory_order_relaxed) << "\n";
+    info << "startup_ready_us:" << metrics::startupReadyMicros.load(std::memory_order_relaxed) << "\n";
+    info << "startup_first_command_us:" << metrics::startupFirstCommandMicros.load(std::memory_order_relaxed) << "\n";
+    info << "startup_materialized_us:" << metrics::startupMaterializedMicros.load(std::memory_order_relaxed) << "\n";
+    info << "lazy_pending_shards:" << dataStore_.pendingShards();
+    info << "\nkeys_with_expiry:" << dataStore_.expiringKeys() << "\n";
+    info << "expired_keys:" << metrics::expiredKeys.load(std::memory_order_relaxed) << "\n";
+    info << "expiry_wheel_entries:" << dataStore_.expiryWheelSize();
+    info << "\nused_memory:" << dataStore_.usedMemory() << "\n";
+    info << "maxmemory:" << dataStore_.memoryLimit() << "\n";
+    info << "maxmemory_policy:" << DataStore::evictionPolicyName(dataStore_.evictionPolicy()) << "\n";
+    info << "evicted_keys:" << metrics::evictedKeys.load(std::memory_order_relaxed);
+    SlabArena::Stats allocator = dataStore_.allocatorStats();
+    uint64_t rss = metrics::residentBytes();
+    size_t used = dataStore_.usedMemory();
+    info << "\nallocator_allocated:" << allocator.allocated << "\n";
+    info << "allocator_active:" << allocator.active << "\n";
+    info << "allocator_slabs:" << allocator.slabs << "\n";
+    info << "allocator_frag_ratio:"
+         << (allocator.allocated ? static_cast<double>(allocator.active) / allocator.allocated : 1.0) << "\n";
+    info << "allocator_frag_bytes:" << allocator.active - allocator.allocated << "\n";
+    info << "allocator_reclaimable:" << allocator.reclaimable << "\n";
+    info << "used_memory_rss:" << rss << "\n";
+    info << "mem_fragmentation_ratio:" << (used ? static_cast<double>(rss) / used : 0.0) << "\n";
+    info << "active_defrag_enabled:" << (dataStore_.activeDefrag() ? 1 : 0) << "\n";
+    info << "active_defrag_running:" << (dataStore_.defragRunning() ? 1 : 0) << "\n";
+    info << "active_defrag_hits:" << metrics::activeDefragHits.load(std::memory_order_relaxed) << "\n";
+    info << "active_defrag_misses:" << metrics::activeDefragMisses.load(std::memory_order_relaxed);
+
+    if (const AppendOnlyLog* log = persistenceManager_.appendLog()) {
+        AppendLogStats stats = log->stats();
+        info << "\naof_fsync_policy:" << AppendOnlyLog::policyName(log->policy()) << "\n";
+        info << "aof_records:" << stats.records << "\n";
+        info << "aof_bytes:" << stats.bytes << "\n";
+        info << "aof_pending_records:" << stats.pendingRecords << "\n";
+        info << "aof_group_commits:" << stats.writes << "\n";
+        info << "aof_records_per_commit:"
+             << (stats.writes ? static_cast<double>(stats.records) / stats.writes : 0.0) << "\n";
+        info << "aof_max_records_per_commit:" << stats.maxBatchRecords << "\n";
+        info << "aof_fsyncs:" << stats.fsyncs << "\n";
+        info << "aof_fsync_avg_us:"
+             << (stats.fsyncs ? static_cast<double>(stats.fsyncMicros) / stats.fsyncs : 0.0) << "\n";
+        info << "aof_fsync_max_us:" << stats.fsyncMaxMicros;
     }
+    return info.str();
 }
 
-bool Server::sendResponse(const std::string& response, socket_t clientSocket) {
-    int bytesSent = send(clientSocket, response.c_str(), response.length(), 0);
-    return bytesSent > 0;
+bool Server::sendResponse(OutputBuffer& response, socket_t clientSocket) {
+    return response.flush(clientSocket);
 }
 
 void Server::closeSocket(socket_t socket) {
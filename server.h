@@ -2,27 +2,38 @@
 
 #include "datastore.h"
 #include "persistence.h"
+#include "net.h"
+#include "output_buffer.h"
+#include "input_buffer.h"
+#include "command_parser.h"
+#include "reply_writer.h"
+#include "event_loop.h"
 #include <string>
 #include <thread>
 #include <vector>
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 
-#ifdef _WIN32
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment(lib, "ws2_32.lib")
-    using socket_t = SOCKET;
-    const socket_t INVALID_SOCKET_VALUE = INVALID_SOCKET;
-#else
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <unistd.h>
-    using socket_t = int;
-    const socket_t INVALID_SOCKET_VALUE = -1;
-#endif
+/**
+ * How the server maps client connections onto threads
+ */
+enum class IoModel {
+    Threads,   // One blocking thread per client connection
+    Reactor    // A fixed pool of epoll event loops with non-blocking sockets
+};
+
+/**
+ * Server tuning options chosen at startup
+ */
+struct ServerConfig {
+    IoModel ioModel = IoModel::Threads;
+    int ioThreads = 4;        // Event loops in reactor mode
+    int backlog = 511;        // listen() backlog of each listening socket
+    bool reusePort = false;   // Reactor mode: every event loop accepts from its own SO_REUSEPORT listener
+    bool pinThreads = false;  // Reactor mode: pin event loop N to CPU N
+};
 
 /**
  * Multi-threaded TCP server for BoltDB
@@ -32,10 +43,16 @@ class Server {
 private:
     DataStore& dataStore_;
     PersistenceManager& persistenceManager_;
+    ServerConfig config_;
     socket_t serverSocket_;
     std::atomic<bool> running_;
     std::vector<std::thread> clientThreads_;
     std::mutex threadsMutex_;
+    std::vector<std::unique_ptr<EventLoop>> eventLoops_;
+    std::vector<socket_t> loopListeners_;
+    std::atomic<int> nextClientId_;
+    std::mutex stopMutex_;
+    std::condition_variable stopCondition_;
 
     /**
      * Initialize networking (Windows-specific)
@@ -55,21 +72,104 @@ private:
      */
     void handleClient(socket_t clientSocket, int clientId);
 
+    /**
+     * Create a bound, listening socket
+     * @param port Port number to listen on
+     * @param reusePort Set SO_REUSEPORT so several sockets can share the port
+     * @return The socket, or INVALID_SOCKET_VALUE on failure
+     */
+    socket_t createListener(int port, bool reusePort);
+
+    /**
+     * Start the reactor event loops
+     * @param port Port for the per-loop listeners when reusePort is set
+     * @return true if successful, false otherwise
+     */
+    bool startEventLoops(int port);
+
+    /**
+     * Process every complete command in a connection's input buffer
+     * Consumed bytes are removed from the buffer; a trailing partial command
+     * is left for the next read. Stops early, leaving complete commands in
+     * the buffer, once the pending output reaches OutputBuffer::HIGH_WATERMARK
+     * A protocol error is answered with an error reply and closes the connection
+     * @param parser The connection's parser, which tracks its protocol
+     * @param input Received bytes
+     * @param response Buffer the replies are appended to
+     * @return true if connection should continue, false to disconnect
+     */
+    bool processInput(CommandParser& parser, InputBuffer& input, OutputBuffer& response);
+
     /**
      * Process a command from the client
-     * @param command The command string
-     * @param clientSocket The client socket for response
+     * @param command The parsed command, viewing the connection's input buffer
+     * @param reply Writer for the reply, in the connection's protocol
      * @return true if connection should continue, false to disconnect
      */
-    bool processCommand(const std::string& command, socket_t clientSocket);
+    bool processCommand(const Command& command, ReplyWriter& reply);
+
+    /**
+     * Answer CONFIG GET for the few parameters clients commonly ask for
+     * @param args The arguments after CONFIG
+     * @param reply Writer for the reply
+     */
+    void processConfig(CommandArgs& args, ReplyWriter& reply);
+
+    /**
+     * Answer EXPIRE, PEXPIRE, PEXPIREAT, PERSIST, TTL and PTTL
+     * @param command The command
+     * @param args The arguments after the command name
+     * @param reply Writer for the reply
+     */
+    void processExpiry(const Command& command, CommandArgs& args, ReplyWriter& reply);
+
+    /**
+     * Answer SCAN and RANGE from the store's ordered index
+     * @param command The command
+     * @param args The arguments after the command name
+     * @param reply Writer for the reply
+     */
+    void processScan(const Command& command, CommandArgs& args, ReplyWriter& reply);
+
+    /**
+     * Answer TYPE and the hash, list and sorted set commands
+     * @param command The command
+     * @param args The arguments after the command name
+     * @param reply Writer for the reply
+     */
+    void processCollection(const Command& command, CommandArgs& args, ReplyWriter& reply);
+
+    /**
+     * Answer INCR, INCRBY, DECR, DECRBY, APPEND, GETSET and CAS, which read
+     * and rewrite a string in one step under the shard lock
+     * @param command The command
+     * @param args The arguments after the command name
+     * @param reply Writer for the reply
+     */
+    void processUpdate(const Command& command, CommandArgs& args, ReplyWriter& reply);
+
+    /**
+     * Block until the mutations made by this thread are durable, when the
+     * append-only log fsyncs on every commit; replies must not acknowledge
+     * writes that a crash could still lose
+     * @return false if the log is failing to write them; the connection
+     *         is then closed without its replies
+     */
+    bool waitForDurability();
+
+    /**
+     * Build the INFO reply body
+     * @return One "name:value" line per statistic
+     */
+    std::string buildInfo() const;
 
     /**
      * Send a response to the client
-     * @param response The response string
+     * @param response The queued response, drained on success
      * @param clientSocket The client socket
      * @return true if successful, false otherwise
      */
-    bool sendResponse(const std::string& response, socket_t clientSocket);
+    bool sendResponse(OutputBuffer& response, socket_t clientSocket);
 
     /**
      * Close a socket
@@ -82,8 +182,10 @@ public:
      * Constructor
      * @param dataStore Reference to the data store
      * @param persistenceManager Reference to the persistence manager
+     * @param config Threading and networking options
      */
-    Server(DataStore& dataStore, PersistenceManager& persistenceManager);
+    Server(DataStore& dataStore, PersistenceManager& persistenceManager,
+           const ServerConfig& config = ServerConfig());
 
     /**
      * Destructor
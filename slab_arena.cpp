@@ -0,0 +1,289 @@
+#include "slab_arena.h"
+#include <new>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+struct SlabArena::Slab {
+    SlabArena* arena;
+    std::shared_ptr<SlabArena> keepAlive;  // Set while the slab has blocks out
+    Slab* prev;                            // Links in the class's partial list
+    Slab* next;
+    void* freeList;      // Freed blocks, each holding a pointer to the next
+    char* fresh;         // First block never handed out; blocks after it are untouched
+    uint16_t blockSize;
+    uint16_t capacity;   // Blocks
+    uint16_t used;       // Blocks out
+    uint8_t classIndex;
+    bool listed;         // In the partial list
+};
+
+namespace {
+
+/**
+ * Bytes at the start of each slab taken by its header
+ */
+constexpr size_t HEADER_SIZE = 64;
+
+/**
+ * Slabs reserved from the system at once, so that an arena adds one
+ * mapping per REGION_SLABS slabs rather than one per slab
+ */
+constexpr size_t REGION_SLABS = 32;
+
+/**
+ * Fullest-slab search gives up after this many partial slabs, bounding the
+ * cost of switching to a new slab when many are nearly empty
+ */
+constexpr size_t PARTIAL_SCAN_LIMIT = 16;
+
+size_t floorLog2(size_t value) {
+    size_t log = 0;
+    while (value >>= 1) {
+        ++log;
+    }
+    return log;
+}
+
+constexpr size_t classSize(size_t index) {
+    if (index < 8) {
+        return (index + 1) * 16;
+    }
+    size_t step = index - 8;
+    size_t log = 7 + step / 4;
+    return (static_cast<size_t>(1) << log) + (step % 4 + 1) * (static_cast<size_t>(1) << (log - 2));
+}
+
+} // namespace
+
+static_assert(classSize(27) == SlabArena::MAX_BLOCK_SIZE, "Largest size class must be MAX_BLOCK_SIZE");
+
+SlabArena::~SlabArena() {
+    // Only empty slabs are left: each slab with blocks out keeps the arena alive
+    for (ClassSlabs& slabs : classes_) {
+        if (slabs.current) {
+            slabs.current->~Slab();
+#ifdef _WIN32
+            ::operator delete(static_cast<void*>(slabs.current), std::align_val_t(SLAB_SIZE));
+#endif
+        }
+    }
+#ifndef _WIN32
+    for (void* region : regions_) {
+        munmap(region, REGION_SLABS * SLAB_SIZE);
+    }
+#endif
+}
+
+size_t SlabArena::classOf(size_t size) noexcept {
+    if (size <= 128) {
+        return (size + 15) / 16 - 1;
+    }
+    size_t log = floorLog2(size - 1);
+    return 8 + (log - 7) * 4 + (((size - 1) >> (log - 2)) & 3);
+}
+
+size_t SlabArena::blockSize(size_t size) noexcept {
+    return classSize(classOf(size));
+}
+
+SlabArena::Slab* SlabArena::slabOf(const void* block) noexcept {
+    return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(block) & ~static_cast<uintptr_t>(SLAB_SIZE - 1));
+}
+
+SlabArena* SlabArena::owner(const void* block) noexcept {
+    return slabOf(block)->arena;
+}
+
+void SlabArena::link(Slab* slab) noexcept {
+    ClassSlabs& slabs = classes_[slab->classIndex];
+    slab->prev = nullptr;
+    slab->next = slabs.partial;
+    if (slabs.partial) {
+        slabs.partial->prev = slab;
+    }
+    slabs.partial = slab;
+    slab->listed = true;
+}
+
+void SlabArena::unlink(Slab* slab) noexcept {
+    ClassSlabs& slabs = classes_[slab->classIndex];
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        slabs.partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = nullptr;
+    slab->listed = false;
+}
+
+SlabArena::Slab* SlabArena::takeFullestPartial(ClassSlabs& slabs) noexcept {
+    Slab* fullest = nullptr;
+    size_t scanned = 0;
+    for (Slab* slab = slabs.partial; slab && scanned < PARTIAL_SCAN_LIMIT; slab = slab->next, ++scanned) {
+        if (!fullest || slab->used > fullest->used) {
+            fullest = slab;
+        }
+    }
+    if (fullest) {
+        unlink(fullest);
+    }
+    return fullest;
+}
+
+SlabArena::Slab* SlabArena::newSlab(size_t classIndex) {
+    static_assert(sizeof(Slab) <= HEADER_SIZE, "Slab header must fit before the first block");
+    void* memory;
+    if (!freeSlabs_.empty()) {
+        memory = freeSlabs_.back();
+        freeSlabs_.pop_back();
+    } else {
+#ifdef _WIN32
+        memory = ::operator new(SLAB_SIZE, std::align_val_t(SLAB_SIZE));
+#else
+        // Map a region with room to align it, then trim the ends; pages
+        // are only touched as blocks are handed out
+        size_t length = REGION_SLABS * SLAB_SIZE;
+        freeSlabs_.reserve((regions_.size() + 1) * REGION_SLABS);
+        regions_.reserve(regions_.size() + 1);
+        void* mapped = mmap(nullptr, length + SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapped);
+        uintptr_t aligned = (start + SLAB_SIZE - 1) & ~static_cast<uintptr_t>(SLAB_SIZE - 1);
+        if (aligned != start) {
+            munmap(mapped, aligned - start);
+        }
+        munmap(reinterpret_cast<void*>(aligned + length), start + SLAB_SIZE - aligned);
+        regions_.push_back(reinterpret_cast<void*>(aligned));
+        for (size_t i = REGION_SLABS; i-- > 1;) {
+            freeSlabs_.push_back(reinterpret_cast<void*>(aligned + i * SLAB_SIZE));
+        }
+        memory = reinterpret_cast<void*>(aligned);
+#endif
+    }
+
+    Slab* slab = new (memory) Slab{};
+    slab->arena = this;
+    slab->classIndex = static_cast<uint8_t>(classIndex);
+    slab->blockSize = static_cast<uint16_t>(classSize(classIndex));
+    slab->capacity = static_cast<uint16_t>((SLAB_SIZE - HEADER_SIZE) / slab->blockSize);
+    slab->fresh = static_cast<char*>(memory) + HEADER_SIZE;
+    ++classes_[classIndex].slabs;
+    ++stats_.slabs;
+    stats_.active += HEADER_SIZE;
+    return slab;
+}
+
+void SlabArena::releaseSlab(Slab* slab) noexcept {
+    --classes_[slab->classIndex].slabs;
+    --stats_.slabs;
+    stats_.active -= static_cast<size_t>(slab->fresh - reinterpret_cast<char*>(slab));
+    slab->~Slab();
+#ifdef _WIN32
+    ::operator delete(static_cast<void*>(slab), std::align_val_t(SLAB_SIZE));
+#else
+    // Keep the address range for the next slab but give the pages back;
+    // freeSlabs_ has room for every slab of every region
+    madvise(slab, SLAB_SIZE, MADV_DONTNEED);
+    freeSlabs_.push_back(slab);
+#endif
+}
+
+void* SlabArena::allocate(size_t size) {
+    size_t index = classOf(size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ClassSlabs& slabs = classes_[index];
+    Slab* slab = slabs.current;
+    if (!slab || slab->used == slab->capacity) {
+        // A full slab drops out of sight until a block in it is freed
+        slab = takeFullestPartial(slabs);
+        if (!slab) {
+            slab = newSlab(index);
+        }
+        slabs.current = slab;
+    }
+
+    void* block;
+    if (slab->freeList) {
+        block = slab->freeList;
+        slab->freeList = *static_cast<void**>(block);
+    } else {
+        block = slab->fresh;
+        slab->fresh += slab->blockSize;
+        stats_.active += slab->blockSize;
+    }
+    if (slab->used++ == 0) {
+        slab->keepAlive = shared_from_this();
+    }
+    ++slabs.used;
+    stats_.allocated += slab->blockSize;
+    ++stats_.blocks;
+    return block;
+}
+
+void SlabArena::deallocate(void* block) noexcept {
+    Slab* slab = slabOf(block);
+    SlabArena* arena = slab->arena;
+    // Dropped after unlocking: the last block of the last slab may be what
+    // keeps the arena alive
+    std::shared_ptr<SlabArena> keepAlive;
+    {
+        std::lock_guard<std::mutex> lock(arena->mutex_);
+        *static_cast<void**>(block) = slab->freeList;
+        slab->freeList = block;
+        arena->stats_.allocated -= slab->blockSize;
+        --arena->stats_.blocks;
+        --arena->classes_[slab->classIndex].used;
+        bool wasFull = slab->used == slab->capacity;
+        if (--slab->used == 0) {
+            keepAlive = std::move(slab->keepAlive);
+        }
+        if (slab == arena->classes_[slab->classIndex].current) {
+            // Kept even when empty, so one block allocated and freed over
+            // and over doesn't map and unmap a slab each time
+        } else if (slab->used == 0) {
+            if (slab->listed) {
+                arena->unlink(slab);
+            }
+            arena->releaseSlab(slab);
+        } else if (wasFull) {
+            arena->link(slab);
+        }
+    }
+}
+
+bool SlabArena::shouldMove(const void* block) noexcept {
+    Slab* slab = slabOf(block);
+    std::lock_guard<std::mutex> lock(slab->arena->mutex_);
+    const ClassSlabs& slabs = slab->arena->classes_[slab->classIndex];
+    if (slab == slabs.current || slab->used == slab->capacity) {
+        return false;
+    }
+    size_t others = slabs.slabs;
+    size_t used = slabs.used;
+    if (slabs.current) {
+        --others;
+        used -= slabs.current->used;
+    }
+    // Blocks leave the emptier half of the slabs for the current one, and
+    // the fullest slab with room is the next current one, so slabs drain
+    return slab->used * others <= used;
+}
+
+SlabArena::Stats SlabArena::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        size_t capacity = (SLAB_SIZE - HEADER_SIZE) / classSize(i);
+        size_t needed = (classes_[i].used + capacity - 1) / capacity;
+        stats.reclaimable += (classes_[i].slabs - needed) * SLAB_SIZE;
+    }
+    return stats;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Slab allocator for the keys and values of one DataStore shard
+ * Blocks come in size classes (16-byte steps up to 128, then four classes
+ * per doubling up to MAX_BLOCK_SIZE) carved out of SLAB_SIZE slabs, each
+ * slab holding blocks of a single class. Slabs are aligned to their size,
+ * so a block is freed through its address alone, from any thread, and the
+ * arena stays alive while it still has blocks out. Allocation prefers the
+ * fullest slab with room, which lets an emptied slab go back to the system;
+ * shouldMove() tells the active defragmenter which blocks to relocate so
+ * that sparse slabs drain
+ */
+class SlabArena : public std::enable_shared_from_this<SlabArena> {
+public:
+    /**
+     * Size and alignment of a slab
+     */
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+    /**
+     * Largest block handed out; bigger requests belong to the system allocator
+     */
+    static constexpr size_t MAX_BLOCK_SIZE = 4096;
+
+    /**
+     * Allocator statistics, in bytes unless noted
+     */
+    struct Stats {
+        size_t allocated = 0;  // Blocks in use, at their size class
+        size_t active = 0;     // Slabs held, SLAB_SIZE each
+        size_t slabs = 0;      // Number of slabs held
+        size_t blocks = 0;     // Number of blocks in use
+        // Slabs packing every class's blocks tightly would free, SLAB_SIZE
+        // each: what defragmentation can win back
+        size_t reclaimable = 0;
+    };
+
+    SlabArena() = default;
+    SlabArena(const SlabArena&) = delete;
+    SlabArena& operator=(const SlabArena&) = delete;
+    ~SlabArena();
+
+    /**
+     * Create an arena; arenas must be owned by a shared_ptr
+     */
+    static std::shared_ptr<SlabArena> create() { return std::make_shared<SlabArena>(); }
+
+    /**
+     * Check whether a request of the given size is served from slabs
+     */
+    static bool fits(size_t size) noexcept { return size > 0 && size <= MAX_BLOCK_SIZE; }
+
+    /**
+     * Get the size class a request is rounded up to
+     * @param size Requested bytes, at most MAX_BLOCK_SIZE
+     * @return Bytes of the block that would be handed out
+     */
+    static size_t blockSize(size_t size) noexcept;
+
+    /**
+     * Allocate a block of at least size bytes, aligned to 16
+     * @param size Requested bytes, 1 to MAX_BLOCK_SIZE
+     * @return The block; throws std::bad_alloc when out of memory
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Free a block from any arena
+     * @param block A block returned by allocate()
+     */
+    static void deallocate(void* block) noexcept;
+
+    /**
+     * Get the arena a block was allocated from
+     */
+    static SlabArena* owner(const void* block) noexcept;
+
+    /**
+     * Check whether relocating a block would help its arena give slabs
+     * back: true if the block sits in a slab, other than the one new blocks
+     * of its class are taken from, that is no fuller than the class's other
+     * slabs on average (jemalloc's defragmentation hint)
+     * @param block A block returned by allocate()
+     */
+    static bool shouldMove(const void* block) noexcept;
+
+    /**
+     * Get the arena's statistics
+     */
+    Stats stats() const;
+
+private:
+    struct Slab;
+
+    // Slabs of one size class: the one being filled, and the others that
+    // have a free block in a doubly linked list; counts cover all of them
+    struct ClassSlabs {
+        Slab* current = nullptr;
+        Slab* partial = nullptr;
+        size_t slabs = 0;
+        size_t used = 0;  // Blocks out
+    };
+
+    static constexpr size_t CLASS_COUNT = 8 + 20;
+
+    static Slab* slabOf(const void* block) noexcept;
+    static size_t classOf(size_t size) noexcept;
+
+    Slab* newSlab(size_t classIndex);
+    void link(Slab* slab) noexcept;
+    void unlink(Slab* slab) noexcept;
+    Slab* takeFullestPartial(ClassSlabs& slabs) noexcept;
+    void releaseSlab(Slab* slab) noexcept;
+
+    mutable std::mutex mutex_;
+    std::array<ClassSlabs, CLASS_COUNT> classes_;
+    std::vector<void*> regions_;    // Address ranges reserved for slabs
+    std::vector<void*> freeSlabs_;  // Slabs of those ranges not in use, pages given back
+    Stats stats_;
+};
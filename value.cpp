@@ -0,0 +1,162 @@
+#include "value.h"
+#include "collection.h"
+#include "metrics.h"
+#include <charconv>
+#include <cstring>
+#include <new>
+
+Value::Value(const Value& other) noexcept {
+    std::memcpy(storage_, other.storage_, sizeof(storage_));
+    if (Rep* shared = rep()) {
+        shared->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Value::Value(Value&& other) noexcept {
+    std::memcpy(storage_, other.storage_, sizeof(storage_));
+    std::memset(other.storage_, 0, sizeof(other.storage_));
+}
+
+Value& Value::operator=(const Value& other) noexcept {
+    if (this != &other) {
+        Value copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Value& Value::operator=(Value&& other) noexcept {
+    if (this != &other) {
+        release();
+        std::memcpy(storage_, other.storage_, sizeof(storage_));
+        std::memset(other.storage_, 0, sizeof(other.storage_));
+    }
+    return *this;
+}
+
+Value::~Value() {
+    release();
+}
+
+void Value::release() noexcept {
+    Rep* shared = rep();
+    if (shared && shared->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (shared->size & EXTERNAL) {
+            reinterpret_cast<External*>(shared + 1)->~External();
+        } else if (shared->size & OBJECT) {
+            delete *reinterpret_cast<Collection**>(shared + 1);
+        }
+        bool arena = (shared->size & ARENA) != 0;
+        shared->~Rep();
+        if (arena) {
+            SlabArena::deallocate(shared);
+        } else {
+            ::operator delete(shared);
+        }
+    }
+    std::memset(storage_, 0, sizeof(storage_));
+}
+
+Value Value::copyOf(std::string_view bytes, SlabArena* arena) {
+    metrics::valueBytesCopied.fetch_add(bytes.size(), std::memory_order_relaxed);
+    if (bytes.size() <= INLINE_CAPACITY) {
+        Value value;
+        if (!bytes.empty()) {
+            std::memcpy(value.storage_, bytes.data(), bytes.size());
+        }
+        value.storage_[sizeof(storage_) - 1] = static_cast<unsigned char>(INLINE | bytes.size());
+        return value;
+    }
+    bool slab = arena && SlabArena::fits(sizeof(Rep) + bytes.size());
+    void* memory = slab ? arena->allocate(sizeof(Rep) + bytes.size()) : ::operator new(sizeof(Rep) + bytes.size());
+    Rep* rep = new (memory) Rep{{1}, bytes.size() | (slab ? ARENA : 0)};
+    std::memcpy(reinterpret_cast<char*>(rep + 1), bytes.data(), bytes.size());
+    return Value(rep);
+}
+
+bool Value::relocate() {
+    Rep* shared = rep();
+    if (!shared || !(shared->size & ARENA) || shared->refs.load(std::memory_order_acquire) != 1 ||
+        !SlabArena::shouldMove(shared)) {
+        return false;
+    }
+    size_t bytes = sizeof(Rep) + (shared->size & SIZE_MASK);
+    void* memory = SlabArena::owner(shared)->allocate(bytes);
+    Rep* moved = new (memory) Rep{{1}, shared->size};
+    std::memcpy(reinterpret_cast<char*>(moved + 1), shared + 1, bytes - sizeof(Rep));
+    shared->~Rep();
+    SlabArena::deallocate(shared);
+    std::memcpy(storage_, &moved, sizeof(moved));
+    return true;
+}
+
+Value Value::external(std::string_view bytes, std::shared_ptr<const void> owner) {
+    static_assert(sizeof(Rep) % alignof(External) == 0, "External must follow Rep aligned");
+    void* memory = ::operator new(sizeof(Rep) + sizeof(External));
+    Rep* rep = new (memory) Rep{{1}, bytes.size() | EXTERNAL};
+    new (rep + 1) External{bytes.data(), std::move(owner)};
+    return Value(rep);
+}
+
+Value Value::collection(std::unique_ptr<Collection> collection) {
+    static_assert(sizeof(Rep) % alignof(Collection*) == 0, "Collection* must follow Rep aligned");
+    void* memory = ::operator new(sizeof(Rep) + sizeof(Collection*));
+    Rep* rep = new (memory) Rep{{1}, OBJECT};
+    *reinterpret_cast<Collection**>(rep + 1) = collection.release();
+    return Value(rep);
+}
+
+Value Value::integer(int64_t number, SlabArena* arena) {
+    char digits[24];
+    char* end = std::to_chars(digits, digits + sizeof(digits), number).ptr;
+    size_t length = static_cast<size_t>(end - digits);
+    if (length > INLINE_CAPACITY) {
+        return copyOf(std::string_view(digits, length), arena);
+    }
+    Value value;
+    std::memcpy(value.storage_, digits, length);
+    value.storage_[sizeof(storage_) - 1] = static_cast<unsigned char>(INLINE | INTEGER | length);
+    return value;
+}
+
+bool Value::toInteger(int64_t& number) const noexcept {
+    unsigned char tag = storage_[sizeof(storage_) - 1];
+    if ((tag & (INLINE | INTEGER)) == (INLINE | INTEGER)) {
+        // At most 15 characters of known-good digits: no overflow possible
+        const unsigned char* digit = storage_;
+        const unsigned char* end = storage_ + (tag & INLINE_SIZE);
+        bool negative = *digit == '-';
+        int64_t magnitude = 0;
+        for (digit += negative; digit != end; ++digit) {
+            magnitude = magnitude * 10 + (*digit - '0');
+        }
+        number = negative ? -magnitude : magnitude;
+        return true;
+    }
+    std::string_view text = view();
+    if (text.empty()) {
+        return false;
+    }
+    // from_chars already rejects '+' and whitespace; leading zeros and "-0"
+    // would make the text differ from the number's own formatting
+    size_t first = text[0] == '-' ? 1 : 0;
+    if (first == text.size() || (text[first] == '0' && text.size() > 1)) {
+        return false;
+    }
+    auto result = std::from_chars(text.data(), text.data() + text.size(), number);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+size_t Value::footprint() const noexcept {
+    Rep* shared = rep();
+    if (!shared) return 0;
+    if (shared->size & OBJECT) {
+        return sizeof(Rep) + sizeof(Collection*) + (*reinterpret_cast<Collection**>(shared + 1))->memoryUsage();
+    }
+    return sizeof(Rep) + ((shared->size & EXTERNAL) ? sizeof(External) : 0) + size();
+}
+
+std::string Value::str() const {
+    metrics::valueBytesCopied.fetch_add(size(), std::memory_order_relaxed);
+    return std::string(data(), size());
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "slab_arena.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class Collection;
+
+/**
+ * Immutable, reference-counted byte buffer holding a stored value
+ * Copying a Value only bumps a reference count, so the data store, pending
+ * socket writes and persistence can all share one allocation instead of
+ * copying the bytes. A value may also refer to bytes owned elsewhere, such
+ * as a memory-mapped snapshot, which it keeps alive. Values of up to
+ * INLINE_CAPACITY bytes have no buffer at all: the bytes live in the handle
+ * itself, so storing one allocates nothing and copying one copies 16 bytes
+ * without touching a shared reference count. A value may instead hold a
+ * Collection (a hash, list or sorted set), shared the same way; it then
+ * has no bytes. Integers written by integer() are tagged as such, so
+ * INCR reads them back without validating the digits
+ */
+class Value {
+private:
+    struct Rep {
+        std::atomic<size_t> refs;
+        size_t size;  // Byte count, with EXTERNAL set when an External follows instead of the bytes,
+                      // ARENA when the Rep is a SlabArena block and OBJECT when a Collection* follows
+    };
+
+    struct External {
+        const char* data;
+        std::shared_ptr<const void> owner;
+    };
+
+    static constexpr size_t EXTERNAL = static_cast<size_t>(1) << (sizeof(size_t) * 8 - 1);
+    static constexpr size_t ARENA = EXTERNAL >> 1;
+    static constexpr size_t OBJECT = ARENA >> 1;
+    static constexpr size_t SIZE_MASK = OBJECT - 1;
+    static constexpr unsigned char INLINE = 0x80;
+    static constexpr unsigned char INTEGER = 0x40;
+    static constexpr unsigned char INLINE_SIZE = 0x0F;
+
+    // Either a Rep pointer (null for an empty handle) followed by zeros, or
+    // the bytes themselves with INLINE | size in the last byte, plus INTEGER
+    // if they are an integer in canonical decimal form
+    alignas(Rep*) unsigned char storage_[16];
+
+    explicit Value(Rep* rep) noexcept : storage_{} { std::memcpy(storage_, &rep, sizeof(rep)); }
+
+    bool isInline() const noexcept { return (storage_[sizeof(storage_) - 1] & INLINE) != 0; }
+
+    /**
+     * Get the shared buffer, null if the handle is empty or inline
+     */
+    Rep* rep() const noexcept {
+        Rep* rep = nullptr;
+        if (!isInline()) std::memcpy(&rep, storage_, sizeof(rep));
+        return rep;
+    }
+
+    /**
+     * Drop this handle's reference, freeing the buffer on the last one
+     */
+    void release() noexcept;
+
+public:
+    /**
+     * Longest value held inside the handle instead of a shared buffer
+     */
+    static constexpr size_t INLINE_CAPACITY = sizeof(storage_) - 1;
+
+    Value() noexcept : storage_{} {}
+    Value(const Value& other) noexcept;
+    Value(Value&& other) noexcept;
+    Value& operator=(const Value& other) noexcept;
+    Value& operator=(Value&& other) noexcept;
+    ~Value();
+
+    /**
+     * Create a value holding a copy of the given bytes
+     * @param bytes The bytes to copy
+     * @param arena Arena to take the buffer from if it fits a slab block,
+     *              null to allocate it from the heap
+     * @return New value with a reference count of one
+     */
+    static Value copyOf(std::string_view bytes, SlabArena* arena = nullptr);
+
+    /**
+     * Create a value referring to bytes it does not own, without copying
+     * @param bytes The bytes; they must stay valid while owner is alive
+     * @param owner Kept alive until the last handle to the value is gone
+     * @return New value with a reference count of one
+     */
+    static Value external(std::string_view bytes, std::shared_ptr<const void> owner);
+
+    /**
+     * Create a value holding an integer as decimal text, the way INCR
+     * stores counters: written straight into the handle, so it allocates
+     * nothing for numbers of up to INLINE_CAPACITY digits (sign included)
+     * and is tagged so toInteger() can skip validating it
+     * @param number The integer
+     * @param arena Arena for the buffer of a longer number, as for copyOf()
+     * @return New value, inline unless the number is longer than that
+     */
+    static Value integer(int64_t number, SlabArena* arena = nullptr);
+
+    /**
+     * Read the value as a 64-bit integer in canonical decimal form, as
+     * integer() writes it: an optional minus sign and digits without
+     * leading zeros, and nothing else
+     * @param number Receives the integer
+     * @return false if the value is not such an integer or is out of range
+     */
+    bool toInteger(int64_t& number) const noexcept;
+
+    /**
+     * Create a value holding a collection
+     * @param collection The collection, owned by the value from now on
+     * @return New value with a reference count of one
+     */
+    static Value collection(std::unique_ptr<Collection> collection);
+
+    /**
+     * Get the collection the value holds
+     * @return The collection, null for a byte value
+     */
+    const Collection* collection() const noexcept {
+        Rep* shared = rep();
+        return shared && (shared->size & OBJECT) ? *reinterpret_cast<Collection* const*>(shared + 1) : nullptr;
+    }
+
+    /**
+     * Get the collection the value holds for modification, which is only
+     * safe while this handle alone refers to it: the caller must keep the
+     * handle from being copied meanwhile (e.g. hold the lock of the map it
+     * is in) and clone the collection into a new value if this returns null
+     * @return The collection, null for a byte value or a shared collection
+     */
+    Collection* mutableCollection() noexcept {
+        Rep* shared = rep();
+        if (!shared || !(shared->size & OBJECT) || shared->refs.load(std::memory_order_acquire) != 1) {
+            return nullptr;
+        }
+        return *reinterpret_cast<Collection**>(shared + 1);
+    }
+
+    /**
+     * Check whether this handle refers to a value (empty handles mean "not found")
+     */
+    explicit operator bool() const noexcept { return isInline() || rep() != nullptr; }
+
+    const char* data() const noexcept {
+        if (isInline()) return reinterpret_cast<const char*>(storage_);
+        Rep* shared = rep();
+        if (!shared) return "";
+        if (shared->size & EXTERNAL) return reinterpret_cast<const External*>(shared + 1)->data;
+        return reinterpret_cast<const char*>(shared + 1);
+    }
+
+    size_t size() const noexcept {
+        if (isInline()) return storage_[sizeof(storage_) - 1] & INLINE_SIZE;
+        Rep* shared = rep();
+        return shared ? shared->size & SIZE_MASK : 0;
+    }
+
+    /**
+     * Check whether the bytes live outside the value's own allocation
+     */
+    bool isExternal() const noexcept {
+        Rep* shared = rep();
+        return shared && (shared->size & EXTERNAL);
+    }
+
+    /**
+     * Check whether the buffer is a SlabArena block
+     */
+    bool inArena() const noexcept {
+        Rep* shared = rep();
+        return shared && (shared->size & ARENA);
+    }
+
+    std::string_view view() const noexcept { return std::string_view(data(), size()); }
+
+    /**
+     * Move the buffer to another block of its arena if SlabArena::shouldMove()
+     * suggests it, for active defragmentation. Only a buffer this handle
+     * alone refers to is moved, so the caller must keep the handle from
+     * being copied meanwhile (e.g. hold the lock of the map it is in)
+     * @return true if the buffer was moved
+     */
+    bool relocate();
+
+    /**
+     * Get the memory the value occupies beyond the handle: its own
+     * allocation plus any external bytes or collection it refers to, 0 for
+     * an empty or inline value
+     */
+    size_t footprint() const noexcept;
+
+    /**
+     * Copy the bytes into a new std::string
+     * Counted in metrics::valueBytesCopied, prefer view() where possible
+     */
+    std::string str() const;
+};